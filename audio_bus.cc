@@ -0,0 +1,510 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** audio_bus.cc
+** Exports the interleaved capture ring over shared memory
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "audio_bus.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+
+static size_t AudioBusSize(int channels, int capacity_frames) {
+  return sizeof(AudioBusHeader) +
+         (size_t)capacity_frames * channels * sizeof(int16_t);
+}
+
+AudioBusWriter::AudioBusWriter()
+    : header_(nullptr), samples_(nullptr), size_(0) {}
+
+AudioBusWriter::~AudioBusWriter() { Close(); }
+
+bool AudioBusWriter::Create(const char *name, int channels, int sample_rate,
+                            int capacity_frames, mode_t mode) {
+  if (header_) {
+    std::cout << "Audio bus already created." << std::endl;
+    return false;
+  }
+
+  // A segment that is there already gets the mode as well
+  int fd = shm_open(name, O_RDWR | O_CREAT, mode);
+  if (fd < 0) {
+    std::cout << "Failed to create audio bus " << name << " ("
+              << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+  fchmod(fd, mode);
+
+  size_t size = AudioBusSize(channels, capacity_frames);
+  if (ftruncate(fd, size) < 0) {
+    std::cout << "Failed to size audio bus " << name << " ("
+              << strerror(errno) << ")" << std::endl;
+    close(fd);
+    return false;
+  }
+
+  // Populated right away, so the writer never faults on a fresh page
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    std::cout << "Failed to map audio bus " << name << " ("
+              << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+
+  // Start over. Readers of an older bus see the generation change and
+  // start over with us, in the slots they hold; a segment of another
+  // layout is cleared completely
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  header_ = static_cast<AudioBusHeader *>(memory);
+  bool known = header_->magic == AUDIO_BUS_MAGIC &&
+               header_->version == AUDIO_BUS_VERSION;
+  header_->magic = 0;
+  std::atomic_thread_fence(std::memory_order_release);
+  if (known)
+    memset(static_cast<char *>(memory) + sizeof(AudioBusHeader), 0,
+           size - sizeof(AudioBusHeader));
+  else
+    memset(memory, 0, size);
+  header_->version = AUDIO_BUS_VERSION;
+  header_->channels = channels;
+  header_->sample_rate = sample_rate;
+  header_->capacity_frames = capacity_frames;
+  header_->write_frames.store(0, std::memory_order_relaxed);
+  header_->reserved_frames.store(0, std::memory_order_relaxed);
+  header_->generation = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = AUDIO_BUS_MAGIC;
+
+  // Fault the whole ring in now, not in the capture loop
+  mlock(memory, size);
+
+  samples_ = reinterpret_cast<int16_t *>(header_ + 1);
+  name_ = name;
+  size_ = size;
+  return true;
+}
+
+void AudioBusWriter::Close() {
+  if (header_) {
+    munmap(header_, size_);
+    header_ = nullptr;
+    samples_ = nullptr;
+    size_ = 0;
+  }
+}
+
+int16_t *AudioBusWriter::AcquireWrite(int frames) {
+  if (!header_) return nullptr;
+
+  uint64_t write_frames = header_->write_frames.load(std::memory_order_relaxed);
+  uint64_t position = write_frames % header_->capacity_frames;
+  if (position + frames > header_->capacity_frames) return nullptr;
+
+  // Tell the readers which frames we are about to overwrite
+  header_->reserved_frames.store(write_frames + frames,
+                                 std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return samples_ + position * header_->channels;
+}
+
+void AudioBusWriter::CommitWrite(int frames) {
+  if (!header_) return;
+  Publish(header_->write_frames.load(std::memory_order_relaxed) + frames);
+}
+
+void AudioBusWriter::Write(const int16_t *interleaved, int frames) {
+  if (!header_) return;
+
+  uint64_t write_frames = header_->write_frames.load(std::memory_order_relaxed);
+  int channels = header_->channels;
+
+  // Tell the readers which frames we are about to overwrite
+  header_->reserved_frames.store(write_frames + frames,
+                                 std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  while (frames > 0) {
+    uint64_t position = write_frames % header_->capacity_frames;
+    int chunk = header_->capacity_frames - position;
+    if (chunk > frames) chunk = frames;
+
+    memcpy(samples_ + position * channels, interleaved,
+           (size_t)chunk * channels * sizeof(int16_t));
+    interleaved += chunk * channels;
+    write_frames += chunk;
+    frames -= chunk;
+  }
+
+  Publish(write_frames);
+}
+
+void AudioBusWriter::Publish(uint64_t write_frames) {
+  header_->reserved_frames.store(write_frames, std::memory_order_relaxed);
+  header_->write_frames.store(write_frames, std::memory_order_release);
+  header_->futex_word.fetch_add(1, std::memory_order_seq_cst);
+
+  // Only pay for the syscall if a reader sleeps
+  if (header_->waiters.load(std::memory_order_seq_cst) > 0)
+    syscall(SYS_futex, &header_->futex_word, FUTEX_WAKE, INT_MAX, nullptr,
+            nullptr, 0);
+}
+
+uint64_t AudioBusWriter::WriteFrames() const {
+  return header_ ? header_->write_frames.load(std::memory_order_relaxed) : 0;
+}
+
+void AudioBusWriter::PrintReaders() const {
+  if (!header_) return;
+
+  uint64_t write_frames = header_->write_frames.load(std::memory_order_relaxed);
+  for (int i = 0; i < AUDIO_BUS_MAX_READERS; i++) {
+    const AudioBusReaderSlot &slot = header_->readers[i];
+    int pid = slot.pid.load(std::memory_order_relaxed);
+    if (pid == 0) continue;
+
+    // A reader still on the last generation is ahead until it looks
+    uint64_t cursor = slot.cursor.load(std::memory_order_relaxed);
+    std::cout << "Audio bus reader " << pid << ": "
+              << (cursor <= write_frames ? write_frames - cursor : 0)
+              << " frames behind, "
+              << slot.overruns.load(std::memory_order_relaxed)
+              << " overruns" << std::endl;
+  }
+}
+
+AudioBusReader::AudioBusReader()
+    : header_(nullptr),
+      samples_(nullptr),
+      size_(0),
+      slot_(nullptr),
+      device_(0),
+      inode_(0),
+      generation_(0),
+      checked_ms_(0) {}
+
+AudioBusReader::~AudioBusReader() { Close(); }
+
+bool AudioBusReader::Open(const char *name) {
+  if (header_) {
+    std::cout << "Audio bus reader already open." << std::endl;
+    return false;
+  }
+
+  name_ = name;
+  if (!Map(false)) return false;
+  slot_->overruns.store(0, std::memory_order_relaxed);
+  slot_->cursor.store(header_->write_frames.load(std::memory_order_acquire),
+                      std::memory_order_relaxed);
+  return true;
+}
+
+// A free slot or one of a process that is gone, nullptr if all are taken
+static AudioBusReaderSlot *ClaimSlot(AudioBusHeader *header, int32_t pid) {
+  for (int i = 0; i < AUDIO_BUS_MAX_READERS; i++) {
+    AudioBusReaderSlot &slot = header->readers[i];
+    int32_t owner = slot.pid.load(std::memory_order_relaxed);
+    if (owner != 0 && (kill(owner, 0) == 0 || errno != ESRCH)) continue;
+    if (slot.pid.compare_exchange_strong(owner, pid)) return &slot;
+  }
+  return nullptr;
+}
+
+bool AudioBusReader::Map(bool quiet) {
+  const char *name = name_.c_str();
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    if (!quiet)
+      std::cout << "Failed to open audio bus " << name << " ("
+                << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(AudioBusHeader)) {
+    if (!quiet)
+      std::cout << "Shared memory " << name << " is not an audio bus"
+                << std::endl;
+    close(fd);
+    return false;
+  }
+
+  // The samples are mapped read-only for us, only the header is shared
+  // both ways, but one mapping keeps this simple
+  void *memory = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    if (!quiet)
+      std::cout << "Failed to map audio bus " << name << " ("
+                << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+
+  AudioBusHeader *header = static_cast<AudioBusHeader *>(memory);
+  if (header->magic != AUDIO_BUS_MAGIC ||
+      header->version != AUDIO_BUS_VERSION ||
+      AudioBusSize(header->channels, header->capacity_frames) >
+          (size_t)info.st_size) {
+    if (!quiet)
+      std::cout << "Shared memory " << name
+                << " has an unknown layout or is not initialized yet"
+                << std::endl;
+    munmap(memory, info.st_size);
+    return false;
+  }
+
+  // Keep our slot on the same segment, otherwise claim one
+  int32_t pid = getpid();
+  AudioBusReaderSlot *claimed = nullptr;
+  bool same = header_ && info.st_dev == device_ && info.st_ino == inode_;
+  if (same) {
+    claimed = &header->readers[slot_ - header_->readers];
+    if (claimed->pid.load(std::memory_order_relaxed) != pid) claimed = nullptr;
+  }
+  if (!claimed) claimed = ClaimSlot(header, pid);
+  if (!claimed) {
+    if (!quiet)
+      std::cout << "All " << AUDIO_BUS_MAX_READERS
+                << " audio bus reader slots are taken" << std::endl;
+    munmap(memory, info.st_size);
+    return false;
+  }
+
+  // Give the slot of another segment back
+  if (header_ && !same) slot_->pid.store(0, std::memory_order_release);
+  if (header_) munmap(header_, size_);
+  header_ = header;
+  samples_ = reinterpret_cast<const int16_t *>(header_ + 1);
+  size_ = info.st_size;
+  slot_ = claimed;
+  device_ = info.st_dev;
+  inode_ = info.st_ino;
+  generation_ = header_->generation;
+  return true;
+}
+
+void AudioBusReader::Close() {
+  if (header_) {
+    slot_->pid.store(0, std::memory_order_release);
+    munmap(header_, size_);
+    header_ = nullptr;
+    samples_ = nullptr;
+    slot_ = nullptr;
+    size_ = 0;
+  }
+}
+
+bool AudioBusReader::FollowRestart() {
+  // A larger bus than we mapped, on the same segment
+  bool remap = header_->magic == AUDIO_BUS_MAGIC &&
+               AudioBusSize(header_->channels, header_->capacity_frames) >
+                   size_;
+
+  // Or a new segment, the old one was removed
+  struct stat info;
+  int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+  if (fd >= 0) {
+    if (fstat(fd, &info) == 0 &&
+        (info.st_dev != device_ || info.st_ino != inode_))
+      remap = true;
+    close(fd);
+  }
+
+  // Everything in it is new to us
+  if (!remap || !Map(true)) return false;
+  slot_->cursor.store(0, std::memory_order_relaxed);
+  return true;
+}
+
+bool AudioBusReader::CheckGeneration() {
+  // Zero while a writer starts over
+  if (header_->magic != AUDIO_BUS_MAGIC) return false;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (header_->generation == generation_) return true;
+  if (AudioBusSize(header_->channels, header_->capacity_frames) > size_)
+    return false;
+
+  // Our slot survives a restart unless the segment was cleared
+  int32_t pid = getpid();
+  if (slot_->pid.load(std::memory_order_relaxed) != pid) {
+    AudioBusReaderSlot *slot = ClaimSlot(header_, pid);
+    if (!slot) return false;
+    slot_ = slot;
+    slot_->overruns.store(0, std::memory_order_relaxed);
+  }
+
+  generation_ = header_->generation;
+  slot_->cursor.store(0, std::memory_order_relaxed);
+  return true;
+}
+
+int AudioBusReader::Channels() const {
+  return header_ ? header_->channels : 0;
+}
+
+int AudioBusReader::SampleRate() const {
+  return header_ ? header_->sample_rate : 0;
+}
+
+uint64_t AudioBusReader::CheckCursor() {
+  uint64_t reserved = header_->reserved_frames.load(std::memory_order_acquire);
+  uint64_t cursor = slot_->cursor.load(std::memory_order_relaxed);
+
+  // Ahead of the writer only if it restarted under us; either way, the
+  // oldest frame still there is where to go on
+  if (cursor > reserved) {
+    cursor = reserved > header_->capacity_frames
+                 ? reserved - header_->capacity_frames
+                 : 0;
+    slot_->cursor.store(cursor, std::memory_order_relaxed);
+    slot_->overruns.fetch_add(1, std::memory_order_relaxed);
+  } else if (reserved - cursor > header_->capacity_frames) {
+    cursor = reserved - header_->capacity_frames;
+    slot_->cursor.store(cursor, std::memory_order_relaxed);
+    slot_->overruns.fetch_add(1, std::memory_order_relaxed);
+  }
+  return cursor;
+}
+
+int AudioBusReader::Peek(const int16_t **data, int max_frames,
+                         uint64_t *frame_index) {
+  if (!header_ || !CheckGeneration()) return 0;
+
+  uint64_t cursor = CheckCursor();
+  uint64_t write_frames = header_->write_frames.load(std::memory_order_acquire);
+  if (write_frames < cursor) return 0;
+  uint64_t available = write_frames - cursor;
+  uint64_t position = cursor % header_->capacity_frames;
+
+  // Stop at the end of the ring
+  uint64_t frames = header_->capacity_frames - position;
+  if (frames > available) frames = available;
+  if (frames > (uint64_t)max_frames) frames = max_frames;
+
+  *data = samples_ + position * header_->channels;
+  if (frame_index) *frame_index = cursor;
+  return (int)frames;
+}
+
+bool AudioBusReader::Release(int frames) {
+  if (!header_) return false;
+
+  // If the writer started to overwrite what we used, it may have changed
+  // under our feet. If it restarted, the cursor starts over in Peek
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header_->magic != AUDIO_BUS_MAGIC ||
+      header_->generation != generation_) {
+    slot_->overruns.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  uint64_t cursor = slot_->cursor.load(std::memory_order_relaxed);
+  uint64_t reserved = header_->reserved_frames.load(std::memory_order_relaxed);
+  slot_->cursor.store(cursor + frames, std::memory_order_release);
+  if (reserved - cursor > header_->capacity_frames) {
+    slot_->overruns.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  return true;
+}
+
+int AudioBusReader::Read(int16_t *interleaved, int max_frames,
+                         uint64_t *frame_index) {
+  int total = 0;
+  bool first = true;
+  while (total < max_frames) {
+    const int16_t *data;
+    uint64_t index;
+    int frames = Peek(&data, max_frames - total, &index);
+    if (frames == 0) break;
+
+    if (first && frame_index) *frame_index = index;
+    first = false;
+
+    memcpy(interleaved + (size_t)total * header_->channels, data,
+           (size_t)frames * header_->channels * sizeof(int16_t));
+
+    // Overwritten while copying: drop it and start over at the oldest
+    if (!Release(frames)) {
+      total = 0;
+      first = true;
+      continue;
+    }
+    total += frames;
+  }
+
+  return total;
+}
+
+static uint64_t MonotonicMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+bool AudioBusReader::Wait(int timeout_ms) {
+  if (!header_) return false;
+
+  // In slices, so a bus that was replaced under us is noticed
+  uint64_t start_ms = MonotonicMs();
+  for (;;) {
+    // A bus we cannot read (it grew) is followed right away
+    bool readable = CheckGeneration();
+    uint64_t now_ms = MonotonicMs();
+    if (!readable || now_ms - checked_ms_ >= (uint64_t)AUDIO_BUS_CHECK_MS) {
+      checked_ms_ = now_ms;
+      if (FollowRestart()) {
+        readable = true;
+        if (header_->write_frames.load(std::memory_order_acquire) > 0)
+          return true;
+      }
+    }
+    int slice_ms = AUDIO_BUS_CHECK_MS - (int)(now_ms - checked_ms_);
+    if (timeout_ms >= 0 && timeout_ms - (int)(now_ms - start_ms) < slice_ms)
+      slice_ms = timeout_ms - (int)(now_ms - start_ms);
+
+    header_->waiters.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t word = header_->futex_word.load(std::memory_order_seq_cst);
+    bool ready = readable &&
+                 header_->write_frames.load(std::memory_order_acquire) >
+                     slot_->cursor.load(std::memory_order_relaxed);
+    if (!ready && slice_ms > 0) {
+      struct timespec timeout;
+      timeout.tv_sec = slice_ms / 1000;
+      timeout.tv_nsec = (slice_ms % 1000) * 1000000L;
+      syscall(SYS_futex, &header_->futex_word, FUTEX_WAIT, word, &timeout,
+              nullptr, 0);
+      ready = readable &&
+              header_->write_frames.load(std::memory_order_acquire) >
+                  slot_->cursor.load(std::memory_order_relaxed);
+    }
+    header_->waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+    if (ready) return true;
+    if (timeout_ms >= 0 && MonotonicMs() - start_ms >= (uint64_t)timeout_ms)
+      return false;
+  }
+}
+
+uint64_t AudioBusReader::Overruns() const {
+  return slot_ ? slot_->overruns.load(std::memory_order_relaxed) : 0;
+}
@@ -0,0 +1,192 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** audio_bus.h
+** Exports the interleaved 4-channel capture ring over shared memory, so
+** several processes (recorder, hotword, DoA) can consume the audio of the
+** one process that holds the capture device, without copies and without
+** going through dsnoop.
+**
+** The writer never waits for anybody. Every reader has its own cursor in
+** the shared header; a reader that falls more than the ring size behind
+** (or whose data was overwritten while it used it) sees an overrun and
+** continues with the oldest audio still there.
+**
+** The writer leaves the segment in place when it closes. One that creates
+** the bus again starts a new generation on it, and its readers start over
+** at its first frame, in the slots they hold. A segment that was removed
+** and created anew is noticed by waiting readers within
+** AUDIO_BUS_CHECK_MS, and they move over to it.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef AUDIO_BUS_H
+#define AUDIO_BUS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <string>
+
+static const char *const AUDIO_BUS_DEFAULT_NAME = "/doa_audio";
+static const uint32_t AUDIO_BUS_MAGIC = 0x41425553;  // "ABUS"
+static const uint32_t AUDIO_BUS_VERSION = 2;
+static const int AUDIO_BUS_MAX_READERS = 8;
+static const int AUDIO_BUS_CHECK_MS = 1000;
+
+// Readers write their cursor, so they need write access: the owner and
+// its group
+static const mode_t AUDIO_BUS_DEFAULT_MODE = 0660;
+
+struct AudioBusReaderSlot {
+  // Process that owns the slot, 0 if free
+  std::atomic<int32_t> pid;
+  uint32_t padding;
+
+  // Next frame the reader wants and how often it lost audio
+  std::atomic<uint64_t> cursor;
+  std::atomic<uint64_t> overruns;
+};
+
+struct AudioBusHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t channels;
+  uint32_t sample_rate;
+  uint32_t capacity_frames;
+  uint32_t padding;
+
+  // Frames written since the bus was created, the ring holds the frames
+  // [write_frames - capacity_frames, write_frames)
+  std::atomic<uint64_t> write_frames;
+
+  // write_frames plus what the writer is writing right now, readers must
+  // not trust anything older than reserved_frames - capacity_frames
+  std::atomic<uint64_t> reserved_frames;
+
+  // Bumped on every commit, readers sleep on it; the writer only wakes
+  // them if somebody sleeps
+  std::atomic<uint32_t> futex_word;
+  std::atomic<uint32_t> waiters;
+
+  // CLOCK_REALTIME the writer created the bus, new on every restart
+  uint64_t generation;
+
+  AudioBusReaderSlot readers[AUDIO_BUS_MAX_READERS];
+
+  // Followed by capacity_frames * channels int16_t samples
+};
+
+// The capture side
+class AudioBusWriter {
+ public:
+  AudioBusWriter();
+  ~AudioBusWriter();
+
+  // Creates (or takes over) the segment, readable and writable for mode.
+  // capacity_frames should be a multiple of the period, so AcquireWrite
+  // never has to wrap
+  bool Create(const char *name, int channels, int sample_rate,
+              int capacity_frames, mode_t mode = AUDIO_BUS_DEFAULT_MODE);
+
+  // Unmaps the bus. The segment stays, so the readers follow the next
+  // Create on it
+  void Close();
+
+  // Zero-copy write: returns where the next frames go, or nullptr if they
+  // would wrap around the end of the ring. Commit makes them visible
+  int16_t *AcquireWrite(int frames);
+  void CommitWrite(int frames);
+
+  // Copies interleaved frames in, wrapping as needed
+  void Write(const int16_t *interleaved, int frames);
+
+  // Frames written so far, i.e. the absolute index of the next frame
+  uint64_t WriteFrames() const;
+
+  // Readers that still exist and how far behind they are
+  void PrintReaders() const;
+
+ private:
+  void Publish(uint64_t write_frames);
+
+ private:
+  std::string name_;
+  AudioBusHeader *header_;
+  int16_t *samples_;
+  size_t size_;
+};
+
+// A consumer, in any process
+class AudioBusReader {
+ public:
+  AudioBusReader();
+  ~AudioBusReader();
+
+  // Maps the segment and claims a reader slot. The reader starts with the
+  // newest audio, and at the first frame of a writer that restarted. Wait
+  // maps the bus again if the writer restarted with a larger one, or on a
+  // new segment under the name
+  bool Open(const char *name = AUDIO_BUS_DEFAULT_NAME);
+  void Close();
+
+  int Channels() const;
+  int SampleRate() const;
+
+  // Gives the next unread frames without copying, at most max_frames and
+  // never across the end of the ring (so a second call may follow).
+  // frame_index receives the absolute index of the first frame. Returns 0
+  // if nothing new is there
+  int Peek(const int16_t **data, int max_frames, uint64_t *frame_index);
+
+  // Done with frames from the last Peek. Returns false if the writer
+  // overwrote them meanwhile, i.e. what was read is garbage
+  bool Release(int frames);
+
+  // Copies the next frames, handling the wrap. Returns the frames copied
+  int Read(int16_t *interleaved, int max_frames, uint64_t *frame_index);
+
+  // Sleeps until new frames are there or the timeout (ms, -1 forever)
+  // passed. Returns whether there is something new. It looks for a new
+  // bus every AUDIO_BUS_CHECK_MS while nothing comes
+  bool Wait(int timeout_ms);
+
+  // How often this reader lost audio
+  uint64_t Overruns() const;
+
+ private:
+  // Maps the bus of name_ and claims a slot in it (keeps the one we hold
+  // on the same segment), quietly if it is a remap
+  bool Map(bool quiet);
+
+  // Maps the bus again if it no longer fits or the name is another
+  // segment now, true if it did
+  bool FollowRestart();
+
+  // Whether the bus can be read. After a restart the cursor starts over
+  // at its first frame
+  bool CheckGeneration();
+
+  // Moves the cursor to the oldest frame still in the ring if we fell
+  // behind
+  uint64_t CheckCursor();
+
+ private:
+  std::string name_;
+  AudioBusHeader *header_;
+  const int16_t *samples_;
+  size_t size_;
+  AudioBusReaderSlot *slot_;
+  dev_t device_;
+  ino_t inode_;
+  uint64_t generation_;
+
+  // CLOCK_MONOTONIC ms Wait last looked for a new bus
+  uint64_t checked_ms_;
+};
+
+#endif  // AUDIO_BUS_H
@@ -0,0 +1,252 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** audio_bus_sample.cc
+** A sample showing how another process consumes the audio the
+** doa_detection_sample shares (run that one with --audio-bus). Once a
+** second it prints where its cursor is, the peak of every channel and the
+** overruns.
+**
+** --simulate needs no sample: a writer thread fills a bus of its own with
+** a counting pattern through AcquireWrite/CommitWrite, as the capture
+** does. A fast reader follows with Peek/Release and a slow one with Read,
+** and both check that every frame holds what its index says. The fast one
+** must not lose anything, the slow one falls more than the ring behind and
+** must see overruns. Then the writer restarts while a reader holds frames
+** (as after a crash), closes and creates the bus again with a larger ring,
+** and creates it on a new segment; each time the reader has to start over
+** at the new writer's first frame. The exit code is 1 otherwise.
+**
+** Usage: audio_bus_sample [bus name]
+**        audio_bus_sample --simulate
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include "audio_bus.h"
+
+static const char *const SIMULATED_BUS = "/audio_bus_sample";
+static const int SIMULATED_CHANNELS = 4;
+static const int SIMULATED_PERIOD = 256;
+static const int SIMULATED_PERIODS = 8;
+static const int SIMULATED_WRITES = 1000;
+
+// The sample the counting pattern has for a frame and channel
+static int16_t Pattern(uint64_t frame, int channel) {
+  return (int16_t)((frame * SIMULATED_CHANNELS + channel) & 0x7fff);
+}
+
+// Whether frames frames from frame_index hold the pattern
+static bool HasPattern(const int16_t *data, int frames,
+                       uint64_t frame_index) {
+  for (int f = 0; f < frames; f++)
+    for (int c = 0; c < SIMULATED_CHANNELS; c++)
+      if (data[f * SIMULATED_CHANNELS + c] != Pattern(frame_index + f, c))
+        return false;
+  return true;
+}
+
+// Writes periods of the pattern from frame 0
+static void WritePeriods(AudioBusWriter *writer, int periods) {
+  for (int p = 0; p < periods; p++) {
+    int16_t *period = writer->AcquireWrite(SIMULATED_PERIOD);
+    for (int f = 0; f < SIMULATED_PERIOD; f++)
+      for (int c = 0; c < SIMULATED_CHANNELS; c++)
+        period[f * SIMULATED_CHANNELS + c] =
+            Pattern(writer->WriteFrames() + f, c);
+    writer->CommitWrite(SIMULATED_PERIOD);
+  }
+}
+
+// Whether the reader gets the new writer's audio from its first frame
+static bool ReadsFromStart(AudioBusReader *reader, const char *what) {
+  const int16_t *data;
+  uint64_t frame_index = 1;
+  int frames = 0;
+  if (reader->Wait(3 * AUDIO_BUS_CHECK_MS))
+    frames = reader->Peek(&data, SIMULATED_PERIOD, &frame_index);
+  bool right = frames == SIMULATED_PERIOD && frame_index == 0 &&
+               HasPattern(data, frames, frame_index);
+  right &= reader->Release(frames);
+  std::cout << what << ": " << frames << " frames from frame " << frame_index
+            << (right ? "" : " (WRONG)") << std::endl;
+
+  // What is left is read before the next restart
+  while ((frames = reader->Peek(&data, SIMULATED_PERIOD, nullptr)) > 0)
+    reader->Release(frames);
+  return right;
+}
+
+static bool FollowRestarts() {
+  int capacity = SIMULATED_PERIODS * SIMULATED_PERIOD;
+  AudioBusWriter first, second, third, fourth;
+  AudioBusReader reader, other;
+  if (!first.Create(SIMULATED_BUS, SIMULATED_CHANNELS, 16000, capacity) ||
+      !reader.Open(SIMULATED_BUS))
+    return false;
+  WritePeriods(&first, 3);
+
+  // A new writer takes the bus over while the reader holds frames, the
+  // old one is gone without closing
+  const int16_t *data;
+  uint64_t frame_index;
+  int frames = reader.Peek(&data, SIMULATED_PERIOD, &frame_index);
+  second.Create(SIMULATED_BUS, SIMULATED_CHANNELS, 16000, capacity);
+  bool right = !reader.Release(frames);
+  if (!right) std::cout << "Released frames of the last writer" << std::endl;
+
+  // Another reader must not get the slot of ours
+  other.Open(SIMULATED_BUS);
+  WritePeriods(&second, 2);
+  right &= ReadsFromStart(&reader, "Writer restarted");
+  first.Close();
+
+  second.Close();
+  third.Create(SIMULATED_BUS, SIMULATED_CHANNELS, 16000, 2 * capacity);
+  WritePeriods(&third, 2);
+  right &= ReadsFromStart(&reader, "Clean restart, larger ring");
+
+  third.Close();
+  shm_unlink(SIMULATED_BUS);
+  fourth.Create(SIMULATED_BUS, SIMULATED_CHANNELS, 16000, capacity);
+  WritePeriods(&fourth, 2);
+  right &= ReadsFromStart(&reader, "New segment");
+  fourth.PrintReaders();
+  return right;
+}
+
+static int Simulate() {
+  AudioBusWriter writer;
+  if (!writer.Create(SIMULATED_BUS, SIMULATED_CHANNELS, 16000,
+                     SIMULATED_PERIODS * SIMULATED_PERIOD))
+    return 1;
+  AudioBusReader fast, slow;
+  if (!fast.Open(SIMULATED_BUS) || !slow.Open(SIMULATED_BUS)) return 1;
+
+  std::atomic<bool> writing(true);
+  bool fast_right = true, slow_right = true;
+  uint64_t fast_frames = 0, slow_frames = 0, fast_gaps = 0;
+
+  // Peeks in place, every frame in order
+  std::thread fast_thread([&] {
+    uint64_t expected = 0;
+    for (;;) {
+      bool done = !writing;
+      const int16_t *data;
+      uint64_t frame_index;
+      int frames = fast.Peek(&data, SIMULATED_PERIOD, &frame_index);
+      if (frames == 0) {
+        if (done) break;
+        fast.Wait(100);
+        continue;
+      }
+      if (frame_index != expected) fast_gaps++;
+      bool right = HasPattern(data, frames, frame_index);
+      if (fast.Release(frames)) fast_right &= right;
+      expected = frame_index + frames;
+      fast_frames += frames;
+    }
+  });
+
+  // Copies a period now and then, far slower than the writer
+  std::thread slow_thread([&] {
+    int16_t period[SIMULATED_PERIOD * SIMULATED_CHANNELS];
+    while (writing) {
+      uint64_t frame_index;
+      int frames = slow.Read(period, SIMULATED_PERIOD, &frame_index);
+      slow_right &= HasPattern(period, frames, frame_index);
+      slow_frames += frames;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+
+  // Writes in place, a period every 2 ms
+  uint64_t written = 0;
+  for (int w = 0; w < SIMULATED_WRITES; w++) {
+    int16_t *period = writer.AcquireWrite(SIMULATED_PERIOD);
+    for (int f = 0; f < SIMULATED_PERIOD; f++)
+      for (int c = 0; c < SIMULATED_CHANNELS; c++)
+        period[f * SIMULATED_CHANNELS + c] = Pattern(written + f, c);
+    writer.CommitWrite(SIMULATED_PERIOD);
+    written += SIMULATED_PERIOD;
+    if (w == SIMULATED_WRITES / 2) writer.PrintReaders();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  writing = false;
+  fast_thread.join();
+  slow_thread.join();
+  writer.PrintReaders();
+
+  bool right = fast_right && fast_gaps == 0 && fast.Overruns() == 0 &&
+               fast_frames == written && slow_right && slow.Overruns() > 0;
+  std::cout << written << " frames written" << std::endl
+            << "Fast reader: " << fast_frames << " frames, " << fast_gaps
+            << " gaps, " << fast.Overruns() << " overruns"
+            << (fast_right ? "" : ", WRONG data") << std::endl
+            << "Slow reader: " << slow_frames << " frames, "
+            << slow.Overruns() << " overruns"
+            << (slow_right ? "" : ", WRONG data") << std::endl
+            << (right ? "Cursors and overruns work" : "FAILED") << std::endl;
+  writer.Close();
+  fast.Close();
+  slow.Close();
+
+  bool restarts = FollowRestarts();
+  shm_unlink(SIMULATED_BUS);
+  std::cout << (restarts ? "Restarts are followed" : "FAILED") << std::endl;
+  return right && restarts ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--simulate") == 0) return Simulate();
+
+  AudioBusReader reader;
+  if (!reader.Open(argc > 1 ? argv[1] : AUDIO_BUS_DEFAULT_NAME)) return 1;
+  int channels = reader.Channels();
+  std::cout << channels << " channels at " << reader.SampleRate() << " Hz"
+            << std::endl;
+
+  // Peaks per channel over a second of audio
+  int peaks[16];
+  uint64_t counted = 0, last_index = 0;
+  memset(peaks, 0, sizeof(peaks));
+  for (;;) {
+    if (!reader.Wait(1000)) {
+      std::cout << "Nothing new for a second" << std::endl;
+      continue;
+    }
+
+    const int16_t *data;
+    int frames;
+    while ((frames = reader.Peek(&data, 4096, &last_index)) > 0) {
+      for (int f = 0; f < frames; f++)
+        for (int c = 0; c < channels && c < 16; c++)
+          peaks[c] = std::max(peaks[c], abs(data[f * channels + c]));
+      if (!reader.Release(frames)) {
+        std::cout << "Overwritten while reading" << std::endl;
+        continue;
+      }
+      last_index += frames;
+      counted += frames;
+    }
+
+    if (counted < (uint64_t)reader.SampleRate()) continue;
+    std::cout << "Frame " << last_index << ": peaks";
+    for (int c = 0; c < channels && c < 16; c++) std::cout << " " << peaks[c];
+    std::cout << ", " << reader.Overruns() << " overruns" << std::endl;
+    memset(peaks, 0, sizeof(peaks));
+    counted = 0;
+  }
+}
@@ -0,0 +1,176 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** beamformer.cc
+** Frequency-domain delay-and-sum beamformer for the 4mic_hat
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "beamformer.h"
+
+#include <cmath>
+
+// Stage timing
+#include "pipeline_stats.h"
+
+// The defines we need
+static const double SAMPLE_RATE = 16000.0;
+static const double PI = 3.14159265358979323846;
+
+DelayAndSumBeamformer::DelayAndSumBeamformer(double angle_step)
+    : angle_step_(angle_step),
+      frames_(0),
+      bins_(0),
+      fft_backend_(FFT_BACKEND_KISS),
+      fft_(nullptr) {
+  steering_.resize((int)std::ceil(360.0 / angle_step_));
+}
+
+DelayAndSumBeamformer::~DelayAndSumBeamformer() { delete fft_; }
+
+void DelayAndSumBeamformer::Reset() {
+  previous_.assign(DOA_CHANNELS * (frames_ / 2), 0.0);
+  overlap_.assign(frames_ / 2, 0.0);
+}
+
+// Sets up the buffers and the transform, the cached phases only fit one
+// period length. The backend we asked for is kept, the one we got may be
+// kiss_fft instead
+void DelayAndSumBeamformer::Prepare(int frames, FftBackend fft_backend) {
+  if (frames == frames_ && fft_backend == fft_backend_) return;
+
+  delete fft_;
+  fft_backend_ = fft_backend;
+  fft_ = CreateRealFft(fft_backend, frames);
+  if (frames == frames_) return;
+
+  frames_ = frames;
+  bins_ = frames / 2 + 1;
+  for (size_t i = 0; i < steering_.size(); i++) steering_[i].clear();
+  window_.resize(frames);
+  for (int n = 0; n < frames; n++)
+    window_[n] = 0.5 - 0.5 * std::cos(2.0 * PI * n / frames);
+  frame_.resize(DOA_CHANNELS * frames);
+  frame_spectra_.resize(DOA_CHANNELS * bins_);
+  period_spectra_.resize(DOA_CHANNELS * bins_);
+  beam_spectrum_.resize(bins_);
+  beam_.resize(frames);
+  Reset();
+}
+
+// Delays every channel so that a wave from the angle bin lines up. The
+// mic closest to the talker gets the largest delay, the farthest none
+const kiss_fft_cpx *DelayAndSumBeamformer::Steering(int angle_bin) {
+  std::vector<kiss_fft_cpx> &steering = steering_[angle_bin];
+  if (!steering.empty()) return steering.data();
+
+  steering.resize(DOA_CHANNELS * bins_);
+  double direction = angle_bin * angle_step_;
+  for (int channel = 0; channel < DOA_CHANNELS; channel++) {
+    double towards =
+        std::cos((direction - DOA_MIC_ANGLE[channel]) * PI / 180.0);
+    double delay =
+        DOA_MIC_RADIUS / DOA_SOUND_SPEED * (1.0 + towards) * SAMPLE_RATE;
+
+    // exp(-j w d) per bin, with the average over the channels folded in.
+    // The Nyquist bin of a real signal has no imaginary part
+    kiss_fft_cpx *phases = &steering[channel * bins_];
+    for (int k = 0; k < bins_; k++) {
+      double phase = -2.0 * PI * k * delay / frames_;
+      phases[k].r = std::cos(phase) / DOA_CHANNELS;
+      phases[k].i = 2 * k == frames_ ? 0.0 : std::sin(phase) / DOA_CHANNELS;
+    }
+  }
+
+  return steering.data();
+}
+
+void DelayAndSumBeamformer::Steer(const kiss_fft_cpx *spectra,
+                                  const kiss_fft_cpx *steering) {
+  for (int k = 0; k < bins_; k++) {
+    beam_spectrum_[k].r = 0.0;
+    beam_spectrum_[k].i = 0.0;
+  }
+  for (int channel = 0; channel < DOA_CHANNELS; channel++) {
+    const kiss_fft_cpx *spectrum = &spectra[channel * bins_];
+    const kiss_fft_cpx *phases = &steering[channel * bins_];
+    for (int k = 0; k < bins_; k++) {
+      beam_spectrum_[k].r += spectrum[k].r * phases[k].r -
+                             spectrum[k].i * phases[k].i;
+      beam_spectrum_[k].i += spectrum[k].r * phases[k].i +
+                             spectrum[k].i * phases[k].r;
+    }
+  }
+  fft_->Inverse(beam_spectrum_.data(), beam_.data());
+}
+
+static int16_t ToSample(double value) {
+  double sample = std::round(value);
+  if (sample > 32767.0) sample = 32767.0;
+  if (sample < -32768.0) sample = -32768.0;
+  return (int16_t)sample;
+}
+
+void DelayAndSumBeamformer::Process(const DoaEstimator &estimator,
+                                    double direction, int16_t *mono) {
+  ScopedStageTimer stage_timer(STAGE_BEAMFORM);
+  Prepare(estimator.Frames(), estimator.GetFftBackend());
+  int half = frames_ / 2;
+
+  int angle_bin = (int)std::floor(direction / angle_step_ + 0.5);
+  angle_bin %= (int)steering_.size();
+  if (angle_bin < 0) angle_bin += steering_.size();
+  const kiss_fft_cpx *steering = Steering(angle_bin);
+
+  // The frame from the middle of the previous period to the middle of this
+  // one, windowed and transformed here
+  for (int channel = 0; channel < DOA_CHANNELS; channel++) {
+    const double *samples = estimator.Samples(channel);
+    const double *previous = &previous_[channel * half];
+    double *frame = &frame_[channel * frames_];
+    for (int n = 0; n < half; n++) {
+      frame[n] = previous[n] * window_[n];
+      frame[half + n] = samples[n] * window_[half + n];
+    }
+  }
+  fft_->ForwardBatch(DOA_CHANNELS, frame_.data(), frame_spectra_.data());
+  Steer(frame_spectra_.data(), steering);
+
+  // Its first half completes the second half of the previous period
+  for (int n = 0; n < half; n++) mono[n] = ToSample(overlap_[n] + beam_[n]);
+  for (int n = 0; n < half; n++) overlap_[n] = beam_[half + n];
+
+  // This period, windowed in the frequency domain: the Hann window is
+  // 0.5 - 0.25 e^(j w n) - 0.25 e^(-j w n), so each bin takes a quarter of
+  // both neighbours off. Below bin 0 and above Nyquist are the conjugates
+  for (int channel = 0; channel < DOA_CHANNELS; channel++) {
+    const kiss_fft_cpx *spectrum = estimator.Spectrum(channel);
+    kiss_fft_cpx *windowed = &period_spectra_[channel * bins_];
+    for (int k = 0; k < bins_; k++) {
+      kiss_fft_cpx below = spectrum[k == 0 ? 1 : k - 1];
+      kiss_fft_cpx above = spectrum[k == bins_ - 1 ? k - 1 : k + 1];
+      if (k == 0) below.i = -below.i;
+      if (k == bins_ - 1) above.i = -above.i;
+      windowed[k].r = 0.5 * spectrum[k].r - 0.25 * (below.r + above.r);
+      windowed[k].i = 0.5 * spectrum[k].i - 0.25 * (below.i + above.i);
+    }
+  }
+  Steer(period_spectra_.data(), steering);
+
+  // Its first half completes the frame before, its second half waits for
+  // the next one
+  for (int n = 0; n < half; n++)
+    mono[half + n] = ToSample(overlap_[n] + beam_[n]);
+  for (int n = 0; n < half; n++) overlap_[n] = beam_[half + n];
+
+  // Keep the second half of this period for the next frame between
+  for (int channel = 0; channel < DOA_CHANNELS; channel++) {
+    const double *samples = estimator.Samples(channel);
+    for (int n = 0; n < half; n++)
+      previous_[channel * half + n] = samples[half + n];
+  }
+}
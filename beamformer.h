@@ -0,0 +1,88 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** beamformer.h
+** Frequency-domain delay-and-sum beamformer for the 4mic_hat. It steers
+** the channel spectra the DoaEstimator already computed at a direction and
+** turns them into one enhanced mono stream, so the hotword detector (or an
+** ASR) hears the talker instead of mic 1 only.
+**
+** The periods are steered as Hann-windowed frames with a hop of half a
+** period, and the frames are added up (weighted overlap-add). Every period
+** is one frame, windowed in the frequency domain from the estimator's
+** spectra; the frame between two periods is transformed here. That costs
+** four forward and two inverse FFTs per period on top of the estimator's
+** transforms, and the output lags the input by half a period.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef BEAMFORMER_H
+#define BEAMFORMER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "doa_detection.h"
+
+class DelayAndSumBeamformer {
+ public:
+  // The steering phases are cached per angle_step degree
+  explicit DelayAndSumBeamformer(double angle_step = 5.0);
+
+  ~DelayAndSumBeamformer();
+
+  // Steers the period the estimator analyzed last at direction (in degree,
+  // as the estimator reports it) and writes Frames() mono samples, from
+  // half a period before it to its middle. Call it for every period, it
+  // keeps the second half of the previous one
+  void Process(const DoaEstimator &estimator, double direction,
+               int16_t *mono);
+
+  // Forgets the previous period, e.g. after an overrun. The first half
+  // period after it fades in
+  void Reset();
+
+ private:
+  void Prepare(int frames, FftBackend fft_backend);
+  const kiss_fft_cpx *Steering(int angle_bin);
+
+  // Sums the steered spectra of the channels into beam_ (the samples of
+  // one windowed frame)
+  void Steer(const kiss_fft_cpx *spectra, const kiss_fft_cpx *steering);
+
+ private:
+  double angle_step_;
+  int frames_;
+  int bins_;
+
+  // The backend Prepare asked for, and the transform it got
+  FftBackend fft_backend_;
+  RealFft *fft_;
+
+  // Per angle bin the phases for each channel and bin, computed when the
+  // bin is first used
+  std::vector<std::vector<kiss_fft_cpx>> steering_;
+
+  // Periodic Hann window, two of them half a period apart add up to 1
+  std::vector<double> window_;
+
+  // The windowed frame between two periods and its spectra, and the
+  // spectra of the windowed period
+  std::vector<double> frame_;
+  std::vector<kiss_fft_cpx> frame_spectra_;
+  std::vector<kiss_fft_cpx> period_spectra_;
+
+  std::vector<kiss_fft_cpx> beam_spectrum_;
+  std::vector<double> beam_;
+
+  // The second half of each channel of the previous period, and of its
+  // steered frame, which the next frames overlap
+  std::vector<double> previous_;
+  std::vector<double> overlap_;
+};
+
+#endif  // BEAMFORMER_H
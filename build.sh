@@ -1,2 +1,26 @@
 #!/bin/bash
-gcc contrib/kiss_fft/kiss_fft.c contrib/kiss_fft/kiss_fftr.c contrib/led_controller/led_controller.cc doa_detection.cc doa_detection_sample.cc -lasound -lm -lstdc++ -Lcontrib/snowboy/lib/ -lsnowboy-detect -L/usr/lib/atlas-base -lf77blas -lcblas -llapack_atlas -latlas -D_GLIBCXX_USE_CXX11_ABI=0 -pg
+gcc contrib/kiss_fft/kiss_fft.c contrib/kiss_fft/kiss_fftr.c contrib/kiss_fft/kiss_fft_fixed.c contrib/kiss_fft/kiss_fftr_fixed.c contrib/led_controller/led_transport.cc contrib/led_controller/led_controller.cc audio_bus.cc beamformer.cc capture_codec.cc capture_log.cc device_cache.cc doa_arrays.cc doa_simulation.cc doa_async.cc rt_profile.cc doa_config.cc doa_correlation.cc doa_detection.cc doa_detection_fixed.cc doa_direction.cc doa_history.cc fft_backend.cc fft_radix4.cc fft_radix4_avx2.cc doa_publisher.cc doa_subscriber.cc event_loop.cc frame_timing.cc hotword_detector.cc hotword_runner.cc snowboy_hotword_detector.cc pipeline_stats.cc trace_events.cc perf_counters.cc doa_detection_sample.cc -DDOA_ENABLE_PIPELINE_STATS -DDOA_ENABLE_TRACING -DDOA_ENABLE_PERF_COUNTERS -pthread -lrt -lasound -lm -lstdc++ -Lcontrib/snowboy/lib/ -lsnowboy-detect -L/usr/lib/atlas-base -lf77blas -lcblas -llapack_atlas -latlas -D_GLIBCXX_USE_CXX11_ABI=0 -pg
+
+# Benchmarks, these do not need the 4mic_hat, ALSA or snowboy
+gcc -O2 contrib/led_controller/led_transport.cc contrib/led_controller/led_controller.cc led_controller_benchmark.cc -lstdc++ -o led_controller_benchmark
+gcc -O2 contrib/kiss_fft/kiss_fft.c contrib/kiss_fft/kiss_fftr.c contrib/kiss_fft/kiss_fft_fixed.c contrib/kiss_fft/kiss_fftr_fixed.c doa_async.cc rt_profile.cc doa_correlation.cc doa_detection.cc doa_detection_fixed.cc doa_direction.cc fft_backend.cc fft_radix4.cc fft_radix4_avx2.cc trace_events.cc doa_simulation.cc doa_benchmark.cc -pthread -lstdc++ -lm -o doa_benchmark
+gcc -O2 contrib/kiss_fft/kiss_fft.c contrib/kiss_fft/kiss_fftr.c doa_arrays.cc doa_simulation.cc doa_async.cc rt_profile.cc doa_correlation.cc doa_detection.cc doa_direction.cc fft_backend.cc fft_radix4.cc fft_radix4_avx2.cc frame_timing.cc trace_events.cc doa_arrays_benchmark.cc -pthread -lstdc++ -lm -o doa_arrays_benchmark
+gcc -O2 contrib/kiss_fft/kiss_fft.c contrib/kiss_fft/kiss_fftr.c contrib/kiss_fft/kiss_fft_fixed.c contrib/kiss_fft/kiss_fftr_fixed.c doa_arrays.cc doa_simulation.cc doa_async.cc rt_profile.cc doa_config.cc doa_correlation.cc doa_detection.cc doa_detection_fixed.cc doa_direction.cc fft_backend.cc fft_radix4.cc fft_radix4_avx2.cc frame_timing.cc trace_events.cc doa_autotune_benchmark.cc -pthread -lstdc++ -lm -o doa_autotune_benchmark
+gcc -O2 capture_codec.cc capture_codec_benchmark.cc -lstdc++ -lm -o capture_codec_benchmark
+gcc -O2 frame_timing.cc hotword_detector.cc hotword_runner.cc rt_profile.cc trace_events.cc hotword_runner_benchmark.cc -pthread -lstdc++ -lm -o hotword_runner_benchmark
+
+# Client of the published estimates, it only needs the subscriber library
+# (the publisher is for --simulate)
+gcc doa_subscriber.cc doa_publisher.cc pipeline_stats.cc perf_counters.cc doa_subscriber_sample.cc -pthread -lstdc++ -lrt -o doa_subscriber_sample
+
+# Summarizes the file of --history, it only needs the history library
+gcc doa_history.cc doa_history_sample.cc -lstdc++ -o doa_history_sample
+
+# Follows the audio of --audio-bus, it only needs the bus library
+gcc audio_bus.cc audio_bus_sample.cc -pthread -lstdc++ -lrt -o audio_bus_sample
+
+# Reads the logs of --record, it only needs the log library
+gcc capture_codec.cc capture_log.cc capture_log_sample.cc -pthread -lstdc++ -lm -o capture_log_sample
+
+# The fixed-point DoA alone, for boards without a fast FPU (Pi Zero)
+gcc -c -O2 contrib/kiss_fft/kiss_fft_fixed.c contrib/kiss_fft/kiss_fftr_fixed.c doa_direction.cc doa_detection_fixed.cc && ar rcs libdoa_fixed.a kiss_fft_fixed.o kiss_fftr_fixed.o doa_direction.o doa_detection_fixed.o
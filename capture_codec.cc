@@ -0,0 +1,401 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** capture_codec.cc
+** Lossless linear prediction and Rice coding of the capture
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "capture_codec.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// The first channel is padded with this many samples on both sides, so
+// the taps -2 to +2 never leave the buffer
+static const int REF_PADDING = CAPTURE_CODEC_REF_TAPS / 2;
+
+// Quotients from here on are escaped and sent as raw residuals, which
+// never need more than RESIDUAL_BITS (the prediction is clamped to 16 bit)
+static const int RICE_ESCAPE = 32;
+static const int RESIDUAL_BITS = 17;
+static const int MAX_COEFFICIENTS =
+    CAPTURE_CODEC_ORDER + CAPTURE_CODEC_REF_TAPS;
+
+// An order no predictor has: the channel follows as 16 bit samples
+static const int VERBATIM_ORDER = 15;
+
+namespace {
+
+class BitWriter {
+ public:
+  explicit BitWriter(std::vector<uint8_t> *out)
+      : out_(out), bits_(0), count_(0) {}
+
+  // Up to 32 bits
+  void Put(uint32_t value, int count) {
+    bits_ = (bits_ << count) | value;
+    count_ += count;
+    if (count_ >= 32) {
+      count_ -= 32;
+      uint32_t word = bits_ >> count_;
+      out_->push_back(word >> 24);
+      out_->push_back(word >> 16);
+      out_->push_back(word >> 8);
+      out_->push_back(word);
+    }
+  }
+
+  void PutRice(uint32_t value, int k) {
+    uint32_t quotient = value >> k;
+    if (quotient >= RICE_ESCAPE) {
+      Put(0xffffffffu, RICE_ESCAPE);
+      Put(value, RESIDUAL_BITS);
+      return;
+    }
+    // quotient ones and a zero
+    Put(((1ull << quotient) - 1) << 1, quotient + 1);
+    if (k) Put(value & ((1u << k) - 1), k);
+  }
+
+  // The last byte is filled up with zeros
+  void Flush() {
+    while (count_ > 0) {
+      int count = count_ < 8 ? count_ : 8;
+      out_->push_back((bits_ >> (count_ - count)) << (8 - count));
+      count_ -= count;
+    }
+  }
+
+ private:
+  std::vector<uint8_t> *out_;
+  uint64_t bits_;
+  int count_;
+};
+
+class BitReader {
+ public:
+  BitReader(const uint8_t *data, size_t size)
+      : data_(data), size_(size), position_(0), bits_(0), count_(0) {}
+
+  uint32_t Get(int count) {
+    if (!count) return 0;
+    if (count_ < count) Refill();
+    uint32_t value = bits_ >> (64 - count);
+    bits_ <<= count;
+    count_ -= count;
+    return value;
+  }
+
+  uint32_t GetRice(int k) {
+    if (count_ <= RICE_ESCAPE) Refill();
+    int ones = __builtin_clzll(~bits_);
+    if (ones >= RICE_ESCAPE) {
+      bits_ <<= RICE_ESCAPE;
+      count_ -= RICE_ESCAPE;
+      return Get(RESIDUAL_BITS);
+    }
+    bits_ <<= ones + 1;
+    count_ -= ones + 1;
+    return ((uint32_t)ones << k) | Get(k);
+  }
+
+  // Whether we read past the end of the data
+  bool Overrun() const { return position_ * 8 - count_ > size_ * 8; }
+
+ private:
+  // Keeps the bits left-aligned, past the end come zeros
+  void Refill() {
+    while (count_ <= 56) {
+      uint64_t byte = position_ < size_ ? data_[position_] : 0;
+      bits_ |= byte << (56 - count_);
+      position_++;
+      count_ += 8;
+    }
+  }
+
+  const uint8_t *data_;
+  size_t size_;
+  size_t position_;
+  uint64_t bits_;
+  int count_;
+};
+
+// x points at the sample to predict, ref at the first channel at the same
+// instant. Clamped to 16 bit, so the residuals fit RESIDUAL_BITS
+inline int32_t Predict(const int32_t *x, const int32_t *ref,
+                       const int16_t *coefficients, int order, int ref_taps,
+                       int shift) {
+  int64_t sum = 0;
+  for (int i = 0; i < order; i++) sum += coefficients[i] * (int64_t)x[-1 - i];
+  for (int j = 0; j < ref_taps; j++)
+    sum += coefficients[order + j] * (int64_t)ref[j - REF_PADDING];
+  int64_t prediction = sum >> shift;
+  if (prediction > 32767) return 32767;
+  if (prediction < -32768) return -32768;
+  return prediction;
+}
+
+inline uint32_t ZigZag(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline int32_t UnZigZag(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// Bits of the value in the Rice code with parameter k
+inline uint64_t RiceBits(uint32_t value, int k) {
+  uint32_t quotient = value >> k;
+  if (quotient >= RICE_ESCAPE) return RICE_ESCAPE + RESIDUAL_BITS;
+  return quotient + 1 + k;
+}
+
+// The Rice parameter with the fewest bits for the partition, and the bits
+int BestRiceParameter(const uint32_t *values, int count,
+                      uint64_t *best_bits) {
+  uint64_t sum = 0;
+  for (int i = 0; i < count; i++) sum += values[i];
+  int guess = 0;
+  while (guess < RESIDUAL_BITS && ((uint64_t)count << (guess + 1)) <= sum)
+    guess++;
+
+  int best = guess;
+  *best_bits = ~0ull;
+  for (int k = guess > 0 ? guess - 1 : 0;
+       k <= guess + 1 && k <= RESIDUAL_BITS; k++) {
+    uint64_t bits = 0;
+    for (int i = 0; i < count; i++) bits += RiceBits(values[i], k);
+    if (bits < *best_bits) {
+      *best_bits = bits;
+      best = k;
+    }
+  }
+  return best;
+}
+
+// The CRC of every byte value, reflected polynomial
+struct CrcTable {
+  CrcTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t value = i;
+      for (int bit = 0; bit < 8; bit++)
+        value = value & 1 ? (value >> 1) ^ 0xedb88320u : value >> 1;
+      values[i] = value;
+    }
+  }
+  uint32_t values[256];
+};
+
+}  // namespace
+
+uint32_t CaptureCrc32(const int16_t *samples, size_t count) {
+  static const CrcTable table;
+  // Little endian, as the samples are in a raw log
+  uint32_t crc = 0xffffffffu;
+  for (size_t i = 0; i < count; i++) {
+    uint16_t sample = samples[i];
+    crc = table.values[(crc ^ sample) & 0xff] ^ (crc >> 8);
+    crc = table.values[(crc ^ (sample >> 8)) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+CaptureEncoder::CaptureEncoder() {}
+
+size_t CaptureEncoder::Encode(const int16_t *interleaved, int frames,
+                              int channels, std::vector<uint8_t> *out) {
+  size_t start = out->size();
+  samples_.assign(CAPTURE_CODEC_ORDER + frames, 0);
+  ref_.assign(frames + 2 * REF_PADDING, 0);
+  residuals_.resize(frames);
+  int32_t *samples = samples_.data() + CAPTURE_CODEC_ORDER;
+  int32_t *ref = ref_.data() + REF_PADDING;
+
+  BitWriter writer(out);
+  for (int c = 0; c < channels; c++) {
+    for (int n = 0; n < frames; n++) samples[n] = interleaved[n * channels + c];
+
+    // The predictor, if it beats sending the samples as they are
+    int order = CAPTURE_CODEC_ORDER;
+    int ref_taps = c ? CAPTURE_CODEC_REF_TAPS : 0;
+    int16_t coefficients[MAX_COEFFICIENTS];
+    int shift = 0;
+    bool predicted =
+        Fit(samples, ref, frames, order, ref_taps, coefficients, &shift);
+    if (predicted) {
+      uint64_t residual_sum = 0, sample_sum = 0;
+      for (int n = 0; n < frames; n++) {
+        int32_t residual =
+            samples[n] - Predict(samples + n, ref + n, coefficients, order,
+                                 ref_taps, shift);
+        residuals_[n] = ZigZag(residual);
+        residual_sum += abs(residual);
+        sample_sum += abs(samples[n]);
+      }
+      predicted = residual_sum < sample_sum;
+    }
+    if (!predicted) {
+      order = ref_taps = shift = 0;
+      for (int n = 0; n < frames; n++) residuals_[n] = ZigZag(samples[n]);
+    }
+
+    // Rice parameters first, so a channel that does not compress can go
+    // out verbatim
+    int partitions =
+        (frames + CAPTURE_CODEC_PARTITION - 1) / CAPTURE_CODEC_PARTITION;
+    parameters_.resize(partitions);
+    uint64_t bits = 11 + 16 * (order + ref_taps);
+    for (int p = 0; p < partitions; p++) {
+      int first = p * CAPTURE_CODEC_PARTITION;
+      int count = frames - first < CAPTURE_CODEC_PARTITION
+                      ? frames - first
+                      : CAPTURE_CODEC_PARTITION;
+      uint64_t partition_bits;
+      parameters_[p] =
+          BestRiceParameter(&residuals_[first], count, &partition_bits);
+      bits += 5 + partition_bits;
+    }
+
+    if (bits > 16 * (uint64_t)frames) {
+      writer.Put(VERBATIM_ORDER, 4);
+      for (int n = 0; n < frames; n++) writer.Put((uint16_t)samples[n], 16);
+    } else {
+      writer.Put(order, 4);
+      writer.Put(ref_taps, 3);
+      writer.Put(shift, 4);
+      for (int i = 0; i < order + ref_taps; i++)
+        writer.Put((uint16_t)coefficients[i], 16);
+      for (int p = 0; p < partitions; p++) {
+        int first = p * CAPTURE_CODEC_PARTITION;
+        int count = frames - first < CAPTURE_CODEC_PARTITION
+                        ? frames - first
+                        : CAPTURE_CODEC_PARTITION;
+        writer.Put(parameters_[p], 5);
+        for (int n = first; n < first + count; n++)
+          writer.PutRice(residuals_[n], parameters_[p]);
+      }
+    }
+
+    // The other channels are predicted from this one
+    if (c == 0)
+      for (int n = 0; n < frames; n++) ref[n] = samples[n];
+  }
+  writer.Flush();
+  return out->size() - start;
+}
+
+bool CaptureEncoder::Fit(const int32_t *samples, const int32_t *ref,
+                         int frames, int order, int ref_taps,
+                         int16_t *coefficients, int *shift) {
+  // Normal equations of the least-squares fit, lower triangle
+  const int size = order + ref_taps;
+  double matrix[MAX_COEFFICIENTS][MAX_COEFFICIENTS] = {{0}};
+  double vector[MAX_COEFFICIENTS] = {0};
+  double features[MAX_COEFFICIENTS];
+  for (int n = 0; n < frames; n++) {
+    for (int i = 0; i < order; i++) features[i] = samples[n - 1 - i];
+    for (int j = 0; j < ref_taps; j++)
+      features[order + j] = ref[n + j - REF_PADDING];
+    for (int i = 0; i < size; i++) {
+      vector[i] += features[i] * samples[n];
+      for (int j = 0; j <= i; j++) matrix[i][j] += features[i] * features[j];
+    }
+  }
+
+  // A little regularization keeps silence and pure tones solvable
+  for (int i = 0; i < size; i++) matrix[i][i] += matrix[i][i] * 1e-9 + 1.0;
+
+  // Cholesky, in place
+  for (int i = 0; i < size; i++) {
+    for (int j = 0; j <= i; j++) {
+      double sum = matrix[i][j];
+      for (int k = 0; k < j; k++) sum -= matrix[i][k] * matrix[j][k];
+      if (i == j) {
+        if (sum <= 0.0) return false;
+        matrix[i][i] = sqrt(sum);
+      } else {
+        matrix[i][j] = sum / matrix[j][j];
+      }
+    }
+  }
+  double solution[MAX_COEFFICIENTS];
+  for (int i = 0; i < size; i++) {
+    double sum = vector[i];
+    for (int k = 0; k < i; k++) sum -= matrix[i][k] * solution[k];
+    solution[i] = sum / matrix[i][i];
+  }
+  for (int i = size - 1; i >= 0; i--) {
+    double sum = solution[i];
+    for (int k = i + 1; k < size; k++) sum -= matrix[k][i] * solution[k];
+    solution[i] = sum / matrix[i][i];
+  }
+
+  // As many fraction bits as the largest coefficient leaves in 16 bit
+  double largest = 0.0;
+  for (int i = 0; i < size; i++)
+    if (fabs(solution[i]) > largest) largest = fabs(solution[i]);
+  int bits = 15;
+  while (bits > 0 && largest * (1 << bits) > 32767.0) bits--;
+  if (largest * (1 << bits) > 32767.0) return false;
+  for (int i = 0; i < size; i++)
+    coefficients[i] = (int16_t)lrint(solution[i] * (1 << bits));
+  *shift = bits;
+  return true;
+}
+
+CaptureDecoder::CaptureDecoder() {}
+
+bool CaptureDecoder::Decode(const uint8_t *data, size_t size, int frames,
+                            int channels, int16_t *interleaved) {
+  samples_.assign(CAPTURE_CODEC_ORDER + frames, 0);
+  ref_.assign(frames + 2 * REF_PADDING, 0);
+  int32_t *samples = samples_.data() + CAPTURE_CODEC_ORDER;
+  int32_t *ref = ref_.data() + REF_PADDING;
+
+  BitReader reader(data, size);
+  for (int c = 0; c < channels; c++) {
+    int order = reader.Get(4);
+    if (order == VERBATIM_ORDER) {
+      for (int n = 0; n < frames; n++) {
+        samples[n] = (int16_t)reader.Get(16);
+        interleaved[n * channels + c] = samples[n];
+      }
+    } else {
+      int ref_taps = reader.Get(3);
+      int shift = reader.Get(4);
+      if (order > CAPTURE_CODEC_ORDER || (ref_taps && c == 0) ||
+          (ref_taps && ref_taps != CAPTURE_CODEC_REF_TAPS))
+        return false;
+      int16_t coefficients[MAX_COEFFICIENTS];
+      for (int i = 0; i < order + ref_taps; i++)
+        coefficients[i] = (int16_t)reader.Get(16);
+
+      for (int first = 0; first < frames; first += CAPTURE_CODEC_PARTITION) {
+        int count = frames - first < CAPTURE_CODEC_PARTITION
+                        ? frames - first
+                        : CAPTURE_CODEC_PARTITION;
+        int k = reader.Get(5);
+        if (k > RESIDUAL_BITS) return false;
+        for (int n = first; n < first + count; n++) {
+          int32_t sample =
+              Predict(samples + n, ref + n, coefficients, order, ref_taps,
+                      shift) +
+              UnZigZag(reader.GetRice(k));
+          if (sample < -32768 || sample > 32767) return false;
+          samples[n] = sample;
+          interleaved[n * channels + c] = sample;
+        }
+      }
+    }
+    if (reader.Overrun()) return false;
+
+    if (c == 0)
+      for (int n = 0; n < frames; n++) ref[n] = samples[n];
+  }
+  return true;
+}
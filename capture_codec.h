@@ -0,0 +1,80 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** capture_codec.h
+** Lossless compression of the interleaved 4-channel periods for the
+** capture log, in the spirit of Shorten and FLAC. Every block (one period)
+** is coded on its own, so the log can still seek to any chunk.
+**
+** The first channel is predicted from its own last CAPTURE_CODEC_ORDER
+** samples. The other channels are predicted from their own past plus the
+** first channel around the same instant (CAPTURE_CODEC_REF_TAPS samples,
+** -2 to +2): the mics are at most 81 mm apart, which is less than 4
+** samples at 16 kHz, so most of a channel is the first one, slightly
+** shifted. The decoder has the whole first channel before the others, so
+** the prediction may look ahead in it. The coefficients are a least-squares
+** fit over the block, quantized to 16 bit. The residuals are Rice coded,
+** with the parameter chosen per CAPTURE_CODEC_PARTITION samples. A channel
+** the Rice code would make larger than 16 bit per sample (white noise) is
+** sent verbatim instead.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef CAPTURE_CODEC_H
+#define CAPTURE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Own past samples and first-channel samples in the predictor
+static const int CAPTURE_CODEC_ORDER = 8;
+static const int CAPTURE_CODEC_REF_TAPS = 5;
+static const int CAPTURE_CODEC_MAX_CHANNELS = 8;
+
+// Samples per Rice parameter
+static const int CAPTURE_CODEC_PARTITION = 256;
+
+// CRC-32 (IEEE 802.3) of the samples, the capture log keeps it with every
+// period to tell a damaged block from a good one
+uint32_t CaptureCrc32(const int16_t *samples, size_t count);
+
+class CaptureEncoder {
+ public:
+  CaptureEncoder();
+
+  // Appends the coded block to out and returns its size in bytes
+  size_t Encode(const int16_t *interleaved, int frames, int channels,
+                std::vector<uint8_t> *out);
+
+ private:
+  // Fits the predictor of one channel, false if it does not pay off
+  bool Fit(const int32_t *samples, const int32_t *ref, int frames,
+           int order, int ref_taps, int16_t *coefficients, int *shift);
+
+ private:
+  // One channel at a time, and the residuals of the one being coded
+  std::vector<int32_t> samples_;
+  std::vector<int32_t> ref_;
+  std::vector<uint32_t> residuals_;
+  std::vector<int> parameters_;
+};
+
+class CaptureDecoder {
+ public:
+  CaptureDecoder();
+
+  // Decodes a block Encode made, false if it is corrupt
+  bool Decode(const uint8_t *data, size_t size, int frames, int channels,
+              int16_t *interleaved);
+
+ private:
+  std::vector<int32_t> samples_;
+  std::vector<int32_t> ref_;
+};
+
+#endif  // CAPTURE_CODEC_H
@@ -0,0 +1,514 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** capture_log.cc
+** Writes and maps the indexed capture log
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "capture_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// O_DIRECT wants the buffers and the write sizes aligned to the block size
+static const size_t CAPTURE_LOG_ALIGNMENT = 4096;
+
+static uint64_t ClockNs(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static size_t Padded(size_t size) { return (size + 7) & ~(size_t)7; }
+
+static bool IsAudio(uint32_t type) {
+  return type == CAPTURE_LOG_AUDIO || type == CAPTURE_LOG_CODED_AUDIO;
+}
+
+CaptureLogWriter::CaptureLogWriter()
+    : fd_(-1),
+      direct_(false),
+      channels_(0),
+      buffer_bytes_(0),
+      compress_(false),
+      current_(nullptr),
+      fill_(0),
+      offset_(0),
+      dropped_(0),
+      write_failed_(false),
+      stop_(false) {}
+
+CaptureLogWriter::~CaptureLogWriter() { Close(); }
+
+bool CaptureLogWriter::Open(const char *path, uint32_t channels,
+                            uint32_t sample_rate, bool compress,
+                            size_t buffer_bytes,
+                            int buffer_count) {
+  if (fd_ >= 0) {
+    std::cout << "Capture log already open." << std::endl;
+    return false;
+  }
+
+  // Past the page cache if we can, tmpfs and some others refuse O_DIRECT
+  direct_ = true;
+  fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+  if (fd_ < 0 && errno == EINVAL) {
+    direct_ = false;
+    fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+  if (fd_ < 0) {
+    std::cout << "Failed to create capture log " << path << " ("
+              << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+
+  buffer_bytes_ = (buffer_bytes + CAPTURE_LOG_ALIGNMENT - 1) &
+                  ~(CAPTURE_LOG_ALIGNMENT - 1);
+  for (int i = 0; i < std::max(buffer_count, 2); i++) {
+    void *buffer;
+    if (posix_memalign(&buffer, CAPTURE_LOG_ALIGNMENT, buffer_bytes_) != 0)
+      break;
+    buffers_.push_back(static_cast<char *>(buffer));
+    free_.push_back(static_cast<char *>(buffer));
+  }
+  channels_ = channels;
+  compress_ = compress;
+  offset_ = 0;
+  fill_ = 0;
+  current_ = nullptr;
+  dropped_ = 0;
+  write_failed_ = false;
+  index_.clear();
+
+  // The header goes through the buffers like every record
+  CaptureLogHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = CAPTURE_LOG_MAGIC;
+  header.version = CAPTURE_LOG_VERSION;
+  header.channels = channels;
+  header.sample_rate = sample_rate;
+  header.created_realtime_ns = ClockNs(CLOCK_REALTIME);
+  header.created_monotonic_ns = ClockNs(CLOCK_MONOTONIC);
+  CopyIn(&header, sizeof(header));
+  offset_ = sizeof(header);
+
+  stop_ = false;
+  thread_ = std::thread(&CaptureLogWriter::Thread, this);
+  return true;
+}
+
+void CaptureLogWriter::Close() {
+  if (fd_ < 0) return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  filled_.notify_one();
+  thread_.join();
+
+  // The rest is not a whole buffer, it goes through the page cache
+  if (direct_) fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+  if (current_) WriteAll(current_, fill_);
+
+  CaptureLogRecordHeader record;
+  record.type = CAPTURE_LOG_INDEX;
+  record.size = index_.size() * sizeof(CaptureLogIndexEntry);
+  record.timestamp_ns = 0;
+  CaptureLogTrailer trailer;
+  memset(&trailer, 0, sizeof(trailer));
+  trailer.index_offset = offset_;
+  trailer.index_count = index_.size();
+  trailer.magic = CAPTURE_LOG_INDEX_MAGIC;
+  WriteAll(reinterpret_cast<const char *>(&record), sizeof(record));
+  WriteAll(reinterpret_cast<const char *>(index_.data()), record.size);
+  WriteAll(reinterpret_cast<const char *>(&trailer), sizeof(trailer));
+  fdatasync(fd_);
+  close(fd_);
+  fd_ = -1;
+
+  for (char *buffer : buffers_) free(buffer);
+  buffers_.clear();
+  free_.clear();
+  full_.clear();
+  current_ = nullptr;
+  if (dropped_)
+    std::cout << "Capture log dropped " << dropped_
+              << " records, the disk was too slow" << std::endl;
+}
+
+bool CaptureLogWriter::WriteAudio(const int16_t *interleaved, int frames,
+                                  const FrameTag &tag) {
+  CaptureLogAudio audio;
+  memset(&audio, 0, sizeof(audio));
+  audio.frame_index = tag.frame_index;
+  audio.complete_ns = tag.complete_ns;
+  audio.frames = frames;
+  audio.crc = CaptureCrc32(interleaved, (size_t)frames * channels_);
+  if (!compress_)
+    return Append(CAPTURE_LOG_AUDIO, tag.capture_ns, &audio, sizeof(audio),
+                  interleaved, frames * channels_ * sizeof(int16_t));
+
+  // The reader takes no larger coded blocks
+  if ((size_t)frames * channels_ * sizeof(int16_t) > CAPTURE_LOG_BUFFER_BYTES)
+    return false;
+
+  // Coded outside of the buffer lock, the disk thread never waits for it
+  std::lock_guard<std::mutex> lock(encoder_mutex_);
+  coded_.clear();
+  audio.coded_bytes = encoder_.Encode(interleaved, frames, channels_, &coded_);
+  return Append(CAPTURE_LOG_CODED_AUDIO, tag.capture_ns, &audio,
+                sizeof(audio), coded_.data(), coded_.size());
+}
+
+bool CaptureLogWriter::WriteHotword(const FrameTag &tag, int hotword) {
+  CaptureLogHotword marker;
+  memset(&marker, 0, sizeof(marker));
+  marker.frame_index = tag.frame_index;
+  marker.hotword = hotword;
+  return Append(CAPTURE_LOG_HOTWORD, tag.capture_ns, &marker,
+                sizeof(marker));
+}
+
+bool CaptureLogWriter::WriteDoa(const DoaResult &result) {
+  CaptureLogDoa marker;
+  memset(&marker, 0, sizeof(marker));
+  marker.frame_index = result.tag.frame_index;
+  marker.direction = result.direction;
+  marker.confidence = result.confidence;
+  marker.peak_count = std::min(result.peak_count, CAPTURE_LOG_MAX_PEAKS);
+  for (uint32_t i = 0; i < marker.peak_count; i++) {
+    marker.peak_direction[i] = result.peaks[i].direction;
+    marker.peak_strength[i] = result.peaks[i].strength;
+  }
+  return Append(CAPTURE_LOG_DOA, result.tag.capture_ns, &marker,
+                sizeof(marker));
+}
+
+uint64_t CaptureLogWriter::Dropped() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+bool CaptureLogWriter::Append(uint32_t type, uint64_t timestamp_ns,
+                              const void *payload, size_t payload_size,
+                              const void *data, size_t data_size) {
+  static const char PADDING[8] = {0};
+  size_t size = Padded(payload_size + data_size);
+  size_t total = sizeof(CaptureLogRecordHeader) + size;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ < 0 || stop_) return false;
+
+  // All or nothing, a record never waits for a buffer to be written
+  size_t room = (current_ ? buffer_bytes_ - fill_ : 0) +
+                free_.size() * buffer_bytes_;
+  if (room < total) {
+    dropped_++;
+    return false;
+  }
+
+  // Remember where each interval of audio starts
+  if (IsAudio(type) &&
+      (index_.empty() || timestamp_ns >= index_.back().timestamp_ns +
+                                             CAPTURE_LOG_INDEX_INTERVAL_NS)) {
+    CaptureLogIndexEntry entry = {timestamp_ns, offset_};
+    index_.push_back(entry);
+  }
+
+  CaptureLogRecordHeader header;
+  header.type = type;
+  header.size = size;
+  header.timestamp_ns = timestamp_ns;
+  CopyIn(&header, sizeof(header));
+  CopyIn(payload, payload_size);
+  if (data_size) CopyIn(data, data_size);
+  CopyIn(PADDING, size - payload_size - data_size);
+  offset_ += total;
+  return true;
+}
+
+// Called with the lock held and enough room
+void CaptureLogWriter::CopyIn(const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  while (size) {
+    if (!current_) {
+      current_ = free_.front();
+      free_.pop_front();
+      fill_ = 0;
+    }
+
+    size_t count = std::min(size, buffer_bytes_ - fill_);
+    memcpy(current_ + fill_, bytes, count);
+    fill_ += count;
+    bytes += count;
+    size -= count;
+    if (fill_ == buffer_bytes_) {
+      full_.push_back(current_);
+      current_ = nullptr;
+      filled_.notify_one();
+    }
+  }
+}
+
+void CaptureLogWriter::Thread() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    filled_.wait(lock, [this] { return !full_.empty() || stop_; });
+    if (full_.empty()) return;
+
+    char *buffer = full_.front();
+    full_.pop_front();
+    lock.unlock();
+    WriteAll(buffer, buffer_bytes_);
+    lock.lock();
+    free_.push_back(buffer);
+  }
+}
+
+bool CaptureLogWriter::WriteAll(const char *data, size_t size) {
+  while (size) {
+    ssize_t written = write(fd_, data, size);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) {
+      // Reported once, the capture goes on without the log
+      if (!write_failed_)
+        std::cout << "Failed to write the capture log ("
+                  << strerror(written < 0 ? errno : ENOSPC) << ")"
+                  << std::endl;
+      write_failed_ = true;
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+CaptureLogReader::CaptureLogReader()
+    : data_(nullptr),
+      size_(0),
+      header_(nullptr),
+      end_(0),
+      cursor_(0),
+      indexed_(false),
+      index_(nullptr),
+      index_count_(0) {}
+
+CaptureLogReader::~CaptureLogReader() { Close(); }
+
+bool CaptureLogReader::Open(const char *path) {
+  if (data_) {
+    std::cout << "Capture log already open." << std::endl;
+    return false;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::cout << "Failed to open capture log " << path << " ("
+              << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+  struct stat status;
+  if (fstat(fd, &status) < 0 ||
+      (size_t)status.st_size < sizeof(CaptureLogHeader)) {
+    std::cout << "Capture log " << path << " is too short" << std::endl;
+    close(fd);
+    return false;
+  }
+
+  size_t size = status.st_size;
+  void *memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    std::cout << "Failed to map capture log " << path << " ("
+              << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+  data_ = static_cast<const char *>(memory);
+  size_ = size;
+  header_ = reinterpret_cast<const CaptureLogHeader *>(data_);
+  if (header_->magic != CAPTURE_LOG_MAGIC ||
+      header_->version != CAPTURE_LOG_VERSION) {
+    std::cout << "Capture log " << path << " has an unknown format"
+              << std::endl;
+    Close();
+    return false;
+  }
+
+  // A closed log ends with the trailer, its index sits right before
+  index_ = nullptr;
+  index_count_ = 0;
+  indexed_ = false;
+  rebuilt_index_.clear();
+  if (size_ >= sizeof(CaptureLogHeader) + sizeof(CaptureLogRecordHeader) +
+                   sizeof(CaptureLogTrailer)) {
+    const CaptureLogTrailer *trailer =
+        reinterpret_cast<const CaptureLogTrailer *>(
+            data_ + size_ - sizeof(CaptureLogTrailer));
+    // Checked so that nothing overflows, whatever the trailer says
+    uint64_t last = size_ - sizeof(CaptureLogTrailer);
+    uint64_t entries = trailer->index_offset + sizeof(CaptureLogRecordHeader);
+    if (trailer->magic == CAPTURE_LOG_INDEX_MAGIC &&
+        trailer->index_offset >= sizeof(CaptureLogHeader) &&
+        trailer->index_offset % 8 == 0 &&
+        trailer->index_offset <= last - sizeof(CaptureLogRecordHeader) &&
+        trailer->index_count ==
+            (last - entries) / sizeof(CaptureLogIndexEntry) &&
+        (last - entries) % sizeof(CaptureLogIndexEntry) == 0) {
+      index_ = reinterpret_cast<const CaptureLogIndexEntry *>(data_ + entries);
+      index_count_ = trailer->index_count;
+      end_ = trailer->index_offset;
+      indexed_ = true;
+    }
+  }
+
+  // Otherwise the recorder died, find what it wrote completely
+  if (!indexed_) {
+    uint64_t offset = sizeof(CaptureLogHeader);
+    uint64_t next;
+    CaptureLogRecord record;
+    end_ = size_;
+    while (Parse(offset, &record, &next)) {
+      if (IsAudio(record.type) &&
+          (rebuilt_index_.empty() ||
+           record.timestamp_ns >= rebuilt_index_.back().timestamp_ns +
+                                      CAPTURE_LOG_INDEX_INTERVAL_NS)) {
+        CaptureLogIndexEntry entry = {record.timestamp_ns, offset};
+        rebuilt_index_.push_back(entry);
+      }
+      offset = next;
+    }
+    end_ = offset;
+    index_ = rebuilt_index_.data();
+    index_count_ = rebuilt_index_.size();
+  }
+
+  Rewind();
+  return true;
+}
+
+void CaptureLogReader::Close() {
+  if (!data_) return;
+  munmap(const_cast<char *>(data_), size_);
+  data_ = nullptr;
+  header_ = nullptr;
+  size_ = 0;
+  indexed_ = false;
+  index_ = nullptr;
+  index_count_ = 0;
+  rebuilt_index_.clear();
+}
+
+bool CaptureLogReader::Seek(uint64_t time_ns) {
+  // The last interval that starts at or before time_ns
+  const CaptureLogIndexEntry *entry = std::upper_bound(
+      index_, index_ + index_count_, time_ns,
+      [](uint64_t time, const CaptureLogIndexEntry &entry) {
+        return time < entry.timestamp_ns;
+      });
+  cursor_ = entry == index_ ? sizeof(CaptureLogHeader) : (entry - 1)->offset;
+
+  // Walk that interval to the chunk
+  CaptureLogRecord record;
+  uint64_t next;
+  while (Parse(cursor_, &record, &next)) {
+    if (IsAudio(record.type) && record.audio->complete_ns >= time_ns)
+      return true;
+    cursor_ = next;
+  }
+  return false;
+}
+
+void CaptureLogReader::Rewind() { cursor_ = sizeof(CaptureLogHeader); }
+
+bool CaptureLogReader::Next(CaptureLogRecord *record) {
+  uint64_t next;
+  if (!Parse(cursor_, record, &next)) return false;
+  cursor_ = next;
+  return true;
+}
+
+bool CaptureLogReader::ReadAudio(const CaptureLogRecord &record,
+                                 std::vector<int16_t> *samples) {
+  if (!IsAudio(record.type)) return false;
+  size_t count = (size_t)record.audio->frames * header_->channels;
+  if (record.samples) {
+    samples->assign(record.samples, record.samples + count);
+  } else {
+    samples->resize(count);
+    if (!decoder_.Decode(record.coded, record.audio->coded_bytes,
+                         record.audio->frames, header_->channels,
+                         samples->data()))
+      return false;
+  }
+  return CaptureCrc32(samples->data(), count) == record.audio->crc;
+}
+
+bool CaptureLogReader::Parse(uint64_t offset, CaptureLogRecord *record,
+                             uint64_t *next_offset) const {
+  // Records start and end 8-aligned, an offset or a size that is not
+  // comes from a damaged file (or index)
+  if (offset % 8 || offset > end_ ||
+      end_ - offset < sizeof(CaptureLogRecordHeader))
+    return false;
+  const CaptureLogRecordHeader *header =
+      reinterpret_cast<const CaptureLogRecordHeader *>(data_ + offset);
+  const char *payload = data_ + offset + sizeof(CaptureLogRecordHeader);
+  if (header->size % 8 ||
+      header->size > end_ - offset - sizeof(CaptureLogRecordHeader))
+    return false;
+  *next_offset = offset + sizeof(CaptureLogRecordHeader) + header->size;
+
+  memset(record, 0, sizeof(*record));
+  record->type = header->type;
+  record->timestamp_ns = header->timestamp_ns;
+  switch (header->type) {
+    case CAPTURE_LOG_AUDIO:
+      if (header->size < sizeof(CaptureLogAudio)) return false;
+      record->audio = reinterpret_cast<const CaptureLogAudio *>(payload);
+      if (header->size < sizeof(CaptureLogAudio) +
+                             (uint64_t)record->audio->frames *
+                                 header_->channels * sizeof(int16_t))
+        return false;
+      record->samples = reinterpret_cast<const int16_t *>(
+          payload + sizeof(CaptureLogAudio));
+      break;
+    case CAPTURE_LOG_CODED_AUDIO:
+      if (header->size < sizeof(CaptureLogAudio)) return false;
+      record->audio = reinterpret_cast<const CaptureLogAudio *>(payload);
+      // The decoder writes this many samples, bounded as a writer's buffer
+      if (header->size < sizeof(CaptureLogAudio) + record->audio->coded_bytes ||
+          (uint64_t)record->audio->frames * header_->channels *
+                  sizeof(int16_t) >
+              CAPTURE_LOG_BUFFER_BYTES)
+        return false;
+      record->coded =
+          reinterpret_cast<const uint8_t *>(payload + sizeof(CaptureLogAudio));
+      break;
+    case CAPTURE_LOG_HOTWORD:
+      if (header->size < sizeof(CaptureLogHotword)) return false;
+      record->hotword = reinterpret_cast<const CaptureLogHotword *>(payload);
+      break;
+    case CAPTURE_LOG_DOA:
+      if (header->size < sizeof(CaptureLogDoa)) return false;
+      record->doa = reinterpret_cast<const CaptureLogDoa *>(payload);
+      break;
+    default:
+      break;
+  }
+  return true;
+}
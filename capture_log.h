@@ -0,0 +1,255 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** capture_log.h
+** An append-only binary log of the captured 4-channel audio, with the
+** hotwords and DoA results as markers in between, to look at the audio
+** around a misdetection later.
+**
+** The file is a CaptureLogHeader followed by records, each a
+** CaptureLogRecordHeader and its payload, padded to 8 bytes. Audio chunks
+** carry the hardware timestamps of their period. Roughly every second of
+** audio the writer remembers where a chunk starts; on Close these sparse
+** index entries are appended as an index record, and a trailer at the very
+** end points at it. A reader maps the file, binary searches the index and
+** walks at most one interval of records to any timestamp. A log without
+** trailer (the recorder died) is still readable, its index is rebuilt by
+** one scan.
+**
+** With compression the audio chunks are coded losslessly
+** (capture_codec.h) before they are appended, which takes about half of
+** the bytes of speech.
+**
+** The writer only copies into large aligned buffers; a thread of its own
+** writes the full ones (with O_DIRECT where the file system has it), so
+** a slow SD card never blocks the capture. If all buffers are full the
+** record is dropped and counted instead.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef CAPTURE_LOG_H
+#define CAPTURE_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "capture_codec.h"
+#include "doa_detection.h"
+
+static const uint32_t CAPTURE_LOG_MAGIC = 0x474f4c43;        // "CLOG"
+static const uint32_t CAPTURE_LOG_INDEX_MAGIC = 0x58494c43;  // "CLIX"
+static const uint32_t CAPTURE_LOG_VERSION = 2;
+static const int CAPTURE_LOG_MAX_PEAKS = 4;
+
+// Audio between two index entries
+static const uint64_t CAPTURE_LOG_INDEX_INTERVAL_NS = 1000000000ull;
+
+// The writer's buffers, 1 MiB (32 periods of 4096 frames) each
+static const size_t CAPTURE_LOG_BUFFER_BYTES = 1 << 20;
+static const int CAPTURE_LOG_BUFFER_COUNT = 4;
+
+enum CaptureLogRecordType {
+  CAPTURE_LOG_AUDIO = 1,
+  CAPTURE_LOG_HOTWORD = 2,
+  CAPTURE_LOG_DOA = 3,
+  CAPTURE_LOG_INDEX = 4,
+  CAPTURE_LOG_CODED_AUDIO = 5
+};
+
+struct CaptureLogHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t channels;
+  uint32_t sample_rate;
+
+  // CLOCK_REALTIME and CLOCK_MONOTONIC when the log was opened, to map the
+  // record timestamps to wall time
+  uint64_t created_realtime_ns;
+  uint64_t created_monotonic_ns;
+};
+
+struct CaptureLogRecordHeader {
+  uint32_t type;
+
+  // Payload bytes after this header, a multiple of 8
+  uint32_t size;
+
+  // CLOCK_MONOTONIC time the audio was recorded (for markers: the audio
+  // they were found in)
+  uint64_t timestamp_ns;
+};
+
+// Followed by frames * channels interleaved samples, or by coded_bytes of
+// a CaptureEncoder block. crc is the CaptureCrc32 of the samples, which
+// tells a damaged block from a good one
+struct CaptureLogAudio {
+  uint64_t frame_index;
+  uint64_t complete_ns;
+  uint32_t frames;
+  uint32_t coded_bytes;
+  uint32_t crc;
+  uint32_t padding;
+};
+
+struct CaptureLogHotword {
+  uint64_t frame_index;
+  int32_t hotword;
+  uint32_t padding;
+};
+
+struct CaptureLogDoa {
+  uint64_t frame_index;
+  double direction;
+  float confidence;
+  uint32_t peak_count;
+  float peak_direction[CAPTURE_LOG_MAX_PEAKS];
+  float peak_strength[CAPTURE_LOG_MAX_PEAKS];
+};
+
+struct CaptureLogIndexEntry {
+  uint64_t timestamp_ns;
+  uint64_t offset;
+};
+
+// The last bytes of a closed log
+struct CaptureLogTrailer {
+  uint64_t index_offset;
+  uint64_t index_count;
+  uint32_t magic;
+  uint32_t padding;
+};
+
+class CaptureLogWriter {
+ public:
+  CaptureLogWriter();
+  ~CaptureLogWriter();
+
+  // Creates (or truncates) the log and starts the writer thread. With
+  // compress the audio is coded on the thread that writes it
+  bool Open(const char *path, uint32_t channels = 4,
+            uint32_t sample_rate = 16000, bool compress = false,
+            size_t buffer_bytes = CAPTURE_LOG_BUFFER_BYTES,
+            int buffer_count = CAPTURE_LOG_BUFFER_COUNT);
+
+  // Writes what is buffered, the index and the trailer
+  void Close();
+
+  // Append a record, from any thread. They never wait for the disk, false
+  // if the record was dropped because the buffers are full
+  bool WriteAudio(const int16_t *interleaved, int frames,
+                  const FrameTag &tag);
+  bool WriteHotword(const FrameTag &tag, int hotword);
+  bool WriteDoa(const DoaResult &result);
+
+  // Records dropped so far
+  uint64_t Dropped();
+
+ private:
+  bool Append(uint32_t type, uint64_t timestamp_ns, const void *payload,
+              size_t payload_size, const void *data = nullptr,
+              size_t data_size = 0);
+  void CopyIn(const void *data, size_t size);
+  void Thread();
+  bool WriteAll(const char *data, size_t size);
+
+ private:
+  int fd_;
+  bool direct_;
+  uint32_t channels_;
+  size_t buffer_bytes_;
+
+  // Only one block is coded at a time
+  bool compress_;
+  std::mutex encoder_mutex_;
+  CaptureEncoder encoder_;
+  std::vector<uint8_t> coded_;
+
+  std::mutex mutex_;
+  std::condition_variable filled_;
+  std::vector<char *> buffers_;
+  std::deque<char *> free_;
+  std::deque<char *> full_;
+
+  // The buffer being filled, nullptr while none is free
+  char *current_;
+  size_t fill_;
+
+  // File offset of the next record
+  uint64_t offset_;
+  std::vector<CaptureLogIndexEntry> index_;
+  uint64_t dropped_;
+  bool write_failed_;
+  bool stop_;
+  std::thread thread_;
+};
+
+// One record of a mapped log, only the pointers of its type are set. Audio
+// has either samples or a coded block, ReadAudio gets the samples of both
+struct CaptureLogRecord {
+  uint32_t type;
+  uint64_t timestamp_ns;
+  const CaptureLogAudio *audio;
+  const int16_t *samples;
+  const uint8_t *coded;
+  const CaptureLogHotword *hotword;
+  const CaptureLogDoa *doa;
+};
+
+class CaptureLogReader {
+ public:
+  CaptureLogReader();
+  ~CaptureLogReader();
+
+  bool Open(const char *path);
+  void Close();
+
+  const CaptureLogHeader &Header() const { return *header_; }
+
+  // False if the log had no trailer and its index was rebuilt
+  bool Indexed() const { return indexed_; }
+
+  // Index entries, one per interval of audio
+  size_t IndexCount() const { return index_count_; }
+
+  // Continues at the first audio chunk that ends at or after time_ns.
+  // False (and at the end) if there is none
+  bool Seek(uint64_t time_ns);
+  void Rewind();
+
+  // The record at the cursor, false at the end of the log
+  bool Next(CaptureLogRecord *record);
+
+  // The interleaved samples of an audio record, false if it is corrupt
+  // (it does not decode or its CRC does not match)
+  bool ReadAudio(const CaptureLogRecord &record,
+                 std::vector<int16_t> *samples);
+
+ private:
+  bool Parse(uint64_t offset, CaptureLogRecord *record,
+             uint64_t *next_offset) const;
+
+ private:
+  const char *data_;
+  size_t size_;
+  const CaptureLogHeader *header_;
+
+  // Records end here, before the index of a closed log
+  uint64_t end_;
+  uint64_t cursor_;
+  bool indexed_;
+  const CaptureLogIndexEntry *index_;
+  size_t index_count_;
+  std::vector<CaptureLogIndexEntry> rebuilt_index_;
+  CaptureDecoder decoder_;
+};
+
+#endif  // CAPTURE_LOG_H
@@ -0,0 +1,131 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** capture_log_sample.cc
+** Lists the hotwords and directions of a capture log the
+** doa_detection_sample recorded (run that one with --record=FILE), and
+** cuts the 4-channel audio around every hotword into WAV files.
+**
+** Usage: capture_log_sample <log> [seconds around each hotword to extract]
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "capture_log.h"
+
+// Writes the audio of the log from start_ns to end_ns as a WAV file
+bool ExtractWav(CaptureLogReader *log, uint64_t start_ns, uint64_t end_ns,
+                const std::string &filename) {
+  if (!log->Seek(start_ns)) return false;
+
+  std::vector<int16_t> samples, chunk;
+  CaptureLogRecord record;
+  while (log->Next(&record) && record.timestamp_ns <= end_ns) {
+    if (!record.audio) continue;
+    if (!log->ReadAudio(record, &chunk)) {
+      std::cout << "Corrupt audio at frame " << record.audio->frame_index
+                << std::endl;
+      return false;
+    }
+    samples.insert(samples.end(), chunk.begin(), chunk.end());
+  }
+
+  uint32_t channels = log->Header().channels;
+  uint32_t rate = log->Header().sample_rate;
+  uint32_t data_bytes = samples.size() * sizeof(int16_t);
+  uint32_t riff_bytes = 36 + data_bytes;
+  uint32_t format_bytes = 16;
+  uint16_t format = 1;
+  uint16_t wav_channels = channels;
+  uint32_t byte_rate = rate * channels * sizeof(int16_t);
+  uint16_t block_align = channels * sizeof(int16_t);
+  uint16_t bits = 16;
+
+  std::ofstream wav(filename, std::ios::binary);
+  wav.write("RIFF", 4);
+  wav.write(reinterpret_cast<const char *>(&riff_bytes), 4);
+  wav.write("WAVEfmt ", 8);
+  wav.write(reinterpret_cast<const char *>(&format_bytes), 4);
+  wav.write(reinterpret_cast<const char *>(&format), 2);
+  wav.write(reinterpret_cast<const char *>(&wav_channels), 2);
+  wav.write(reinterpret_cast<const char *>(&rate), 4);
+  wav.write(reinterpret_cast<const char *>(&byte_rate), 4);
+  wav.write(reinterpret_cast<const char *>(&block_align), 2);
+  wav.write(reinterpret_cast<const char *>(&bits), 2);
+  wav.write("data", 4);
+  wav.write(reinterpret_cast<const char *>(&data_bytes), 4);
+  wav.write(reinterpret_cast<const char *>(samples.data()), data_bytes);
+  return wav.good();
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <log> [seconds]" << std::endl;
+    return 1;
+  }
+
+  CaptureLogReader log;
+  if (!log.Open(argv[1])) return 1;
+  double seconds = argc > 2 ? atof(argv[2]) : 0.0;
+
+  // Times relative to the first audio
+  const CaptureLogHeader &header = log.Header();
+  std::cout << header.channels << " channels at " << header.sample_rate
+            << " Hz, " << log.IndexCount() << " index entries"
+            << (log.Indexed() ? "" : " (rebuilt, the log was not closed)")
+            << std::endl;
+
+  std::vector<uint64_t> hotwords;
+  uint64_t first_ns = 0, frames = 0, coded_frames = 0, coded_bytes = 0;
+  CaptureLogRecord record;
+  while (log.Next(&record)) {
+    if (!first_ns) first_ns = record.timestamp_ns;
+    double at = (record.timestamp_ns - first_ns) / 1e9;
+    switch (record.type) {
+      case CAPTURE_LOG_AUDIO:
+        frames += record.audio->frames;
+        break;
+      case CAPTURE_LOG_CODED_AUDIO:
+        frames += record.audio->frames;
+        coded_frames += record.audio->frames;
+        coded_bytes += record.audio->coded_bytes;
+        break;
+      case CAPTURE_LOG_HOTWORD:
+        std::cout << at << " s: hotword " << record.hotword->hotword
+                  << std::endl;
+        hotwords.push_back(record.timestamp_ns);
+        break;
+      case CAPTURE_LOG_DOA:
+        std::cout << at << " s: direction " << record.doa->direction
+                  << " confidence " << record.doa->confidence << std::endl;
+        break;
+    }
+  }
+  std::cout << (double)frames / header.sample_rate << " s of audio";
+  if (coded_bytes)
+    std::cout << ", compressed "
+              << (double)coded_frames * header.channels * sizeof(int16_t) /
+                     coded_bytes
+              << ":1";
+  std::cout << std::endl;
+
+  // Each hotword with the audio before and after it
+  uint64_t around_ns = seconds * 1e9;
+  for (size_t i = 0; seconds > 0.0 && i < hotwords.size(); i++) {
+    std::string filename = "hotword_" + std::to_string(i) + ".wav";
+    uint64_t start_ns = hotwords[i] > around_ns ? hotwords[i] - around_ns : 0;
+    if (ExtractWav(&log, start_ns, hotwords[i] + around_ns, filename))
+      std::cout << "Wrote " << filename << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,6 @@
+/*
+ * kiss_fft with 32 bit fixed-point scalars under different names, see
+ * kiss_fftr_fixed.h
+ */
+#include "kiss_fft_fixed_config.h"
+#include "kiss_fft.c"
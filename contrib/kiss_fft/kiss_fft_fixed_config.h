@@ -0,0 +1,15 @@
+/*
+ * Configuration of the fixed-point kiss_fft build, see kiss_fftr_fixed.h.
+ * Only included by kiss_fft_fixed.c and kiss_fftr_fixed.c, in front of the
+ * kiss_fft sources.
+ */
+#define FIXED_POINT 32
+
+#define kiss_fft_alloc kiss_fft_fixed_alloc
+#define kiss_fft kiss_fft_fixed
+#define kiss_fft_stride kiss_fft_fixed_stride
+#define kiss_fft_next_fast_size kiss_fft_fixed_next_fast_size
+#define kiss_fftr_alloc kiss_fftr_fixed_alloc
+#define kiss_fftr kiss_fftr_fixed
+#define kiss_fftri kiss_fftri_fixed
+#define kiss_fftr_state kiss_fftr_fixed_state
@@ -0,0 +1,39 @@
+/*
+ * kiss_fftr built a second time with FIXED_POINT=32 (kiss_fft_fixed.c and
+ * kiss_fftr_fixed.c).
+ * The symbols are renamed, so it links next to the default double build;
+ * kiss_fft_fixed_cpx has the layout of the fixed-point kiss_fft_cpx.
+ *
+ * Note that the forward transform is scaled by 1/nfft to stay in range.
+ * The inverse of this copy of kiss_fft scales a second time and is of no
+ * use in fixed point.
+ */
+#ifndef KISS_FFTR_FIXED_H
+#define KISS_FFTR_FIXED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int32_t r;
+    int32_t i;
+} kiss_fft_fixed_cpx;
+
+typedef struct kiss_fftr_fixed_state *kiss_fftr_fixed_cfg;
+
+kiss_fftr_fixed_cfg kiss_fftr_fixed_alloc(int nfft, int inverse_fft, void *mem,
+                                          size_t *lenmem);
+
+void kiss_fftr_fixed(kiss_fftr_fixed_cfg cfg, const int32_t *timedata,
+                     kiss_fft_fixed_cpx *freqdata);
+
+#define kiss_fftr_fixed_free free
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -12,26 +12,38 @@
 ** -------------------------------------------------------------------------*/
 #include "led_controller.h"
 
-#include <linux/gpio.h>
-#include <linux/spi/spidev.h>
-#include <sys/fcntl.h>
-#include <sys/ioctl.h>
-#include <unistd.h>
 #include <cstring>
 #include <iostream>
 
+// The APA102 start segment is 32 zero bits
+static const int START_SEGMENT_SIZE = 4;
+
+void LedController::SetTransport(LedTransport *transport) {
+  if (powered_up_) {
+    std::cout << "Already powered up. Please call PowerDown first."
+              << std::endl;
+    return;
+  }
+
+  transport_ = transport;
+}
+
 bool LedController::PowerUp(int number_of_leds) {
   if(!powered_up_) {
-    // Power on the LED via GPIO
-    led_gpio_file_descriptor_ = -1;
-    if (!SetGpioPower(true)) return false;
+    // Power on the LEDs and open the device
+    if (!transport_) transport_ = &spidev_transport_;
+    if (!transport_->Open()) return false;
 
-    // Init the SPI device
-    led_spi_file_descriptor_ = -1;
-    if (!InitSpiDevice()) return false;
+    // Allocate the whole frame at once, so Show is one transfer. The end
+    // segment needs half a clock per pixel, but at least one byte
+    int end_segment_size = (number_of_leds + 15) / 16;
+    if (end_segment_size < 1) end_segment_size = 1;
+    frame_size_ = START_SEGMENT_SIZE + number_of_leds * 4 + end_segment_size;
+    frame_ = new uint8_t[frame_size_];
+    memset(frame_, 0, frame_size_);
 
-    // Allocate our pixel map
-    pixel_map_ = new uint8_t[number_of_leds * 4];
+    // Our pixel map lives right behind the start segment
+    pixel_map_ = frame_ + START_SEGMENT_SIZE;
 
     // Set the now known number of leds
     number_of_leds_ = number_of_leds;
@@ -46,80 +58,6 @@ bool LedController::PowerUp(int number_of_leds) {
   }
 }
 
-bool LedController::InitSpiDevice() {
-  // Try to open the SPI device
-  led_spi_file_descriptor_ = open("/dev/spidev0.1", O_RDWR, 0);
-  if (led_spi_file_descriptor_ < 0) {
-    std::cout << "Failed to open LED SPI device" << std::endl;
-    return false;
-  }
-
-  // Try to get the SPI to write mode
-  int ioctl_ret_val = 0;
-  if ((ioctl_ret_val =
-           ioctl(led_spi_file_descriptor_, SPI_IOC_RD_MODE, &spi_mode_)) < 0)
-    std::cout << "Failed to get write mode on the LED SPI device" << std::endl;
-
-  // Get bits per word
-  if ((ioctl_ret_val = ioctl(led_spi_file_descriptor_, SPI_IOC_RD_BITS_PER_WORD,
-                             &bits_per_word_)) < 0)
-    std::cout << "Failed to get bits per word on the LED SPI device"
-              << std::endl;
-
-  // Get the speed
-  if ((ioctl_ret_val = ioctl(led_spi_file_descriptor_, SPI_IOC_RD_MAX_SPEED_HZ,
-                             &speed_in_hz_)) < 0)
-    std::cout << "Failed to get desired speed on the LED SPI device"
-              << std::endl;
-
-  // Try to set it to fast, so we can update the LEDs faster
-  speed_in_hz_ = 8000000;
-  if ((ioctl_ret_val = ioctl(led_spi_file_descriptor_, SPI_IOC_WR_MAX_SPEED_HZ,
-                             &speed_in_hz_)) < 0)
-    std::cout << "Failed to set desired speed on the LED SPI device"
-              << std::endl;
-
-  return true;
-}
-
-bool LedController::SetGpioPower(bool power) {
-  // Set the power state (1 for on 0 for off)
-  struct gpiohandle_data data;
-  data.values[0] = power ? 1 : 0;
-
-  // Open the GPIO device
-  struct gpiohandle_request led_gpio_request;
-
-  // Check if the file descriptor is already open
-  if(led_gpio_file_descriptor_ < 0) {
-    led_gpio_file_descriptor_ = open("/dev/gpiochip0", 0);
-    if (led_gpio_file_descriptor_ < 0) {
-      std::cout << "Failed to open LED GPIO device" << std::endl;
-      return false;
-    }
-  }
-
-  // Set the flags needed in the request
-  led_gpio_request.flags = GPIOHANDLE_REQUEST_OUTPUT;
-  strcpy(led_gpio_request.consumer_label, "LED Controller");
-  led_gpio_request.lineoffsets[0] = 5;  // 5 Controls the LED power
-  led_gpio_request.lines = 1;           // We need one request line
-  memcpy(led_gpio_request.default_values, &data,
-         sizeof(led_gpio_request.default_values));
-
-  // Try to send the power command
-  int ioctl_ret_val = 0;
-  if ((ioctl_ret_val = ioctl(led_gpio_file_descriptor_,
-                             GPIO_GET_LINEHANDLE_IOCTL, 
-                             &led_gpio_request)) < 0) {
-    std::cout << "Failed to send power" << (power ? " on " : " off ")
-              << "signal to the GPIO" << std::endl;
-    return false;
-  }
-
-  return true;
-}
-
 void LedController::SetPixelColor(int pixel, uint8_t r, uint8_t g, uint8_t b,
                                   uint8_t brightness) {
   if (!powered_up_) {
@@ -133,7 +71,7 @@ void LedController::SetPixelColor(int pixel, uint8_t r, uint8_t g, uint8_t b,
   }
 
   // Make sure we do not set the brightness above maximum
-  if (brightness > 31 || brightness < 0) brightness = 31;
+  if (brightness > 31) brightness = 31;
 
   // Set the Pixel
   int start_index = pixel * 4;
@@ -167,52 +105,33 @@ void LedController::Show() {
     return;
   }
 
-  WriteStart();
-  MakeTransfer(pixel_map_, number_of_leds_ * 4, speed_in_hz_, bits_per_word_);
-  WriteEnd();
+  // Start segment, pixels and end segment go out in one transfer
+  transport_->WriteFrame(frame_, frame_size_);
 }
 
-void LedController::WriteStart() {
-  // Write Begin Segment
-  uint8_t start_segment_buffer[4];
-  memset(start_segment_buffer, 0, 4);
-  MakeTransfer(start_segment_buffer, 4, speed_in_hz_, bits_per_word_);
-}
-
-void LedController::WriteEnd() {
-  // Write End Segment
-  uint8_t end_segment_buffer[1];
-  end_segment_buffer[0] = 0x00;
-  MakeTransfer(end_segment_buffer, 1, speed_in_hz_, bits_per_word_);
-}
+void LedController::ShowDirection(double direction) {
+  if (!powered_up_) {
+    std::cout << "Not powered up. Please call PowerUp first." << std::endl;
+    return;
+  }
 
-void LedController::MakeTransfer(uint8_t *data, int len, int speed_in_hz,
-                                 int bits_per_word) {
-  // Initialize receive data. This should not be necessary anymore
-  uint8_t *receive_data = new uint8_t[len];
-
-  // Set the transfer components
-  struct spi_ioc_transfer spi_transfer;
-  memset(&spi_transfer, 0, sizeof(spi_transfer));
-  spi_transfer.tx_buf = (unsigned long)data;
-  spi_transfer.rx_buf = (unsigned long)receive_data;
-  spi_transfer.len = len;
-  spi_transfer.delay_usecs = 0;
-  spi_transfer.speed_hz = speed_in_hz;
-  spi_transfer.bits_per_word = bits_per_word;
-
-  // Transfer the message
-  int ioctl_ret_val =
-      ioctl(led_spi_file_descriptor_, SPI_IOC_MESSAGE(1), &spi_transfer);
-  if (ioctl_ret_val < 0)
-    std::cout << "Failed to make data transfer to the SPI LED device"
-              << std::endl;
+  // Find the pixel the direction points to
+  int best_guess_pixel =
+      ((int)(direction * number_of_leds_ / 360.0)) % number_of_leds_;
+  if (best_guess_pixel < 0) best_guess_pixel += number_of_leds_;
 
-  // UNUSED: Read the received data back
-  if (spi_mode_ & SPI_CS_HIGH)
-    ssize_t ret = read(led_spi_file_descriptor_, &receive_data[0], 0);
+  // Set all Pixel to green
+  for (int i = 0; i < number_of_leds_; i++) {
+    SetPixelColor(i, 0, 24, 0, 1);
+  }
 
-  delete receive_data;
+  // Set the Pixel before and after the computed one to a lower
+  // brightness
+  SetPixelColor((best_guess_pixel + number_of_leds_ - 1) % number_of_leds_, 0,
+                0, 48, 1);
+  SetPixelColor(best_guess_pixel, 0, 0, 48, 31);
+  SetPixelColor((best_guess_pixel + 1) % number_of_leds_, 0, 0, 48, 1);
+  Show();
 }
 
 void LedController::PowerDown() {
@@ -220,35 +139,18 @@ void LedController::PowerDown() {
     // Clear the LEDs
     Clear();
 
-    // Close the SPI connection
-    if (led_spi_file_descriptor_ >= 0) {
-      close(led_spi_file_descriptor_);
-      led_spi_file_descriptor_ = -1;
-    }
-
-    // Power off GPIO and close the connection
-    if (led_gpio_file_descriptor_ >= 0) {
-
-      // Setting the Gpio to power down does not work
-      // currently, as it does not accept the power state off.
-      // Closing the fd seems to accomplish the same thing,
-      // so I am commenting this for now.
-      // SetGpioPower(false);
-
-      close(led_gpio_file_descriptor_);
-      led_gpio_file_descriptor_ = -1;
-    }
+    // Power off and close the device
+    transport_->Close();
 
-    // Cleanup the pixel map
-    if (pixel_map_) {
-      delete pixel_map_;
+    // Cleanup the frame
+    if (frame_) {
+      delete[] frame_;
+      frame_ = nullptr;
       pixel_map_ = nullptr;
     }
 
     // Reset the members
-    spi_mode_ = 0;
-    bits_per_word_ = 0;
-    speed_in_hz_ = 0;
+    frame_size_ = 0;
     number_of_leds_ = 0;
     powered_up_ = false;
   }
@@ -10,8 +10,13 @@
 **
 ** Author: Oliver Pahl
 ** -------------------------------------------------------------------------*/
+#ifndef LED_CONTROLLER_H
+#define LED_CONTROLLER_H
+
 #include <stdint.h>
 
+#include "led_transport.h"
+
 class LedController {
  public:
   // Singleton because we only ever have one
@@ -21,6 +26,11 @@ class LedController {
     return instance;
   }
 
+  // Selects where the frames go. Has to be called before PowerUp, passing
+  // nullptr selects the spidev device of the 4mic_hat again. The transport
+  // is not owned by the controller
+  void SetTransport(LedTransport *transport);
+
   // Powers up the GPIO and SPI connections
   bool PowerUp(int number_of_leds);
 
@@ -37,30 +47,40 @@ class LedController {
   // Display the pixels set with SetColor
   void Show();
 
+  // Paints the ring green and highlights the pixel pointing to the given
+  // direction (0 to 360 degree) in blue, then shows it
+  void ShowDirection(double direction);
+
+  // Size of one frame as it is sent to the transport
+  int FrameSize() const { return frame_size_; }
+
   // Copy constructor and operator removed for Singleton
   LedController(LedController const &) = delete;
   void operator=(LedController const &) = delete;
 
  private:
-  LedController(){};
-  bool SetGpioPower(bool power);
-  bool InitSpiDevice();
-  void WriteStart();
-  void WriteEnd();
-  void MakeTransfer(uint8_t *data, int len, int speed_in_hz, int bits_per_word);
+  LedController()
+      : transport_(nullptr),
+        frame_(nullptr),
+        pixel_map_(nullptr),
+        frame_size_(0),
+        powered_up_(false),
+        number_of_leds_(0){};
 
  private:
-  // LED SPI Control
-  int led_spi_file_descriptor_;
-  uint8_t *pixel_map_;
-  int speed_in_hz_;
-  uint8_t bits_per_word_;
-  uint8_t spi_mode_;
+  // Where the frames go
+  SpidevLedTransport spidev_transport_;
+  LedTransport *transport_;
 
-  // LED GPIO Control
-  int led_gpio_file_descriptor_;
+  // The whole frame (start segment, pixels and end segment) and the
+  // pixels within it
+  uint8_t *frame_;
+  uint8_t *pixel_map_;
+  int frame_size_;
 
   // Other
   bool powered_up_;
   int number_of_leds_;
 };
+
+#endif  // LED_CONTROLLER_H
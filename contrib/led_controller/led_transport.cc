@@ -0,0 +1,235 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** led_transport.cc
+** The output backends the LedController can write its frames to
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "led_transport.h"
+
+#include <errno.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+#include <sys/fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+
+SpidevLedTransport::SpidevLedTransport(const char *spi_device,
+                                       const char *gpio_device)
+    : spi_device_(spi_device),
+      gpio_device_(gpio_device),
+      led_spi_file_descriptor_(-1),
+      speed_in_hz_(0),
+      bits_per_word_(0),
+      spi_mode_(0),
+      led_gpio_file_descriptor_(-1) {}
+
+bool SpidevLedTransport::Open() {
+  // Power on the LED via GPIO
+  if (!SetGpioPower(true)) return false;
+
+  // Init the SPI device
+  if (!InitSpiDevice()) return false;
+
+  return true;
+}
+
+bool SpidevLedTransport::InitSpiDevice() {
+  // Try to open the SPI device
+  led_spi_file_descriptor_ = open(spi_device_.c_str(), O_RDWR, 0);
+  if (led_spi_file_descriptor_ < 0) {
+    std::cout << "Failed to open LED SPI device" << std::endl;
+    return false;
+  }
+
+  // Try to get the SPI to write mode
+  if (ioctl(led_spi_file_descriptor_, SPI_IOC_RD_MODE, &spi_mode_) < 0)
+    std::cout << "Failed to get write mode on the LED SPI device" << std::endl;
+
+  // Get bits per word
+  if (ioctl(led_spi_file_descriptor_, SPI_IOC_RD_BITS_PER_WORD,
+            &bits_per_word_) < 0)
+    std::cout << "Failed to get bits per word on the LED SPI device"
+              << std::endl;
+
+  // Get the speed
+  if (ioctl(led_spi_file_descriptor_, SPI_IOC_RD_MAX_SPEED_HZ, &speed_in_hz_) <
+      0)
+    std::cout << "Failed to get desired speed on the LED SPI device"
+              << std::endl;
+
+  // Try to set it to fast, so we can update the LEDs faster
+  speed_in_hz_ = 8000000;
+  if (ioctl(led_spi_file_descriptor_, SPI_IOC_WR_MAX_SPEED_HZ, &speed_in_hz_) <
+      0)
+    std::cout << "Failed to set desired speed on the LED SPI device"
+              << std::endl;
+
+  return true;
+}
+
+bool SpidevLedTransport::SetGpioPower(bool power) {
+  // Set the power state (1 for on 0 for off)
+  struct gpiohandle_data data;
+  data.values[0] = power ? 1 : 0;
+
+  // Open the GPIO device
+  struct gpiohandle_request led_gpio_request;
+
+  // Check if the file descriptor is already open
+  if (led_gpio_file_descriptor_ < 0) {
+    led_gpio_file_descriptor_ = open(gpio_device_.c_str(), 0);
+    if (led_gpio_file_descriptor_ < 0) {
+      std::cout << "Failed to open LED GPIO device" << std::endl;
+      return false;
+    }
+  }
+
+  // Set the flags needed in the request
+  led_gpio_request.flags = GPIOHANDLE_REQUEST_OUTPUT;
+  strcpy(led_gpio_request.consumer_label, "LED Controller");
+  led_gpio_request.lineoffsets[0] = 5;  // 5 Controls the LED power
+  led_gpio_request.lines = 1;           // We need one request line
+  memcpy(led_gpio_request.default_values, &data,
+         sizeof(led_gpio_request.default_values));
+
+  // Try to send the power command
+  if (ioctl(led_gpio_file_descriptor_, GPIO_GET_LINEHANDLE_IOCTL,
+            &led_gpio_request) < 0) {
+    std::cout << "Failed to send power" << (power ? " on " : " off ")
+              << "signal to the GPIO" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool SpidevLedTransport::WriteFrame(const uint8_t *data, int len) {
+  // Set the transfer components. We never read anything back, so there is
+  // no receive buffer
+  struct spi_ioc_transfer spi_transfer;
+  memset(&spi_transfer, 0, sizeof(spi_transfer));
+  spi_transfer.tx_buf = (unsigned long)data;
+  spi_transfer.rx_buf = 0;
+  spi_transfer.len = len;
+  spi_transfer.delay_usecs = 0;
+  spi_transfer.speed_hz = speed_in_hz_;
+  spi_transfer.bits_per_word = bits_per_word_;
+
+  // Transfer the message
+  if (ioctl(led_spi_file_descriptor_, SPI_IOC_MESSAGE(1), &spi_transfer) < 0) {
+    std::cout << "Failed to make data transfer to the SPI LED device"
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+void SpidevLedTransport::Close() {
+  // Close the SPI connection
+  if (led_spi_file_descriptor_ >= 0) {
+    close(led_spi_file_descriptor_);
+    led_spi_file_descriptor_ = -1;
+  }
+
+  // Power off GPIO and close the connection
+  if (led_gpio_file_descriptor_ >= 0) {
+    // Setting the Gpio to power down does not work
+    // currently, as it does not accept the power state off.
+    // Closing the fd seems to accomplish the same thing,
+    // so I am commenting this for now.
+    // SetGpioPower(false);
+
+    close(led_gpio_file_descriptor_);
+    led_gpio_file_descriptor_ = -1;
+  }
+
+  // Reset the members
+  spi_mode_ = 0;
+  bits_per_word_ = 0;
+  speed_in_hz_ = 0;
+}
+
+MemoryLedTransport::MemoryLedTransport(int frames_to_keep)
+    : frames_(frames_to_keep > 0 ? frames_to_keep : 1),
+      frame_count_(0),
+      byte_count_(0) {}
+
+bool MemoryLedTransport::Open() {
+  for (auto &frame : frames_) frame.clear();
+  frame_count_ = 0;
+  byte_count_ = 0;
+  return true;
+}
+
+void MemoryLedTransport::Close() {}
+
+bool MemoryLedTransport::WriteFrame(const uint8_t *data, int len) {
+  // Reuse the slot of the oldest frame, so we do not allocate once the
+  // ring is warmed up
+  std::vector<uint8_t> &slot = frames_[frame_count_ % frames_.size()];
+  slot.assign(data, data + len);
+
+  frame_count_++;
+  byte_count_ += len;
+  return true;
+}
+
+const std::vector<uint8_t> &MemoryLedTransport::LastFrame() const {
+  return Frame(0);
+}
+
+const std::vector<uint8_t> &MemoryLedTransport::Frame(int n) const {
+  if (frame_count_ == 0) return frames_[0];
+  return frames_[(frame_count_ - 1 - n) % frames_.size()];
+}
+
+int MemoryLedTransport::KeptFrames() const {
+  return frame_count_ < frames_.size() ? (int)frame_count_
+                                       : (int)frames_.size();
+}
+
+FileLedTransport::FileLedTransport(const char *path)
+    : path_(path), file_descriptor_(-1) {}
+
+bool FileLedTransport::Open() {
+  // Opening a FIFO blocks until somebody reads from it
+  file_descriptor_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (file_descriptor_ < 0) {
+    std::cout << "Failed to open LED output file " << path_ << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+void FileLedTransport::Close() {
+  if (file_descriptor_ >= 0) {
+    close(file_descriptor_);
+    file_descriptor_ = -1;
+  }
+}
+
+bool FileLedTransport::WriteFrame(const uint8_t *data, int len) {
+  while (len > 0) {
+    ssize_t written = write(file_descriptor_, data, len);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      std::cout << "Failed to write to LED output file " << path_
+                << std::endl;
+      return false;
+    }
+    data += written;
+    len -= written;
+  }
+
+  return true;
+}
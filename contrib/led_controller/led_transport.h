@@ -0,0 +1,106 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** led_transport.h
+** The output backends the LedController can write its frames to: the
+** spidev/GPIO device of the ReSpeaker 4mic_hat, an in-memory sink and a
+** file/pipe sink for running without the hardware
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef LED_TRANSPORT_H
+#define LED_TRANSPORT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class LedTransport {
+ public:
+  virtual ~LedTransport() {}
+
+  // Opens the device and switches the LED power on
+  virtual bool Open() = 0;
+
+  // Switches the LED power off and closes the device
+  virtual void Close() = 0;
+
+  // Writes one complete frame (start segment, pixels and end segment)
+  virtual bool WriteFrame(const uint8_t *data, int len) = 0;
+};
+
+// The real hardware: LED power on GPIO 5 and the APA102 ring on SPI
+class SpidevLedTransport : public LedTransport {
+ public:
+  SpidevLedTransport(const char *spi_device = "/dev/spidev0.1",
+                     const char *gpio_device = "/dev/gpiochip0");
+
+  bool Open() override;
+  void Close() override;
+  bool WriteFrame(const uint8_t *data, int len) override;
+
+ private:
+  bool SetGpioPower(bool power);
+  bool InitSpiDevice();
+
+ private:
+  std::string spi_device_;
+  std::string gpio_device_;
+
+  // LED SPI Control
+  int led_spi_file_descriptor_;
+  uint32_t speed_in_hz_;
+  uint8_t bits_per_word_;
+  uint8_t spi_mode_;
+
+  // LED GPIO Control
+  int led_gpio_file_descriptor_;
+};
+
+// Keeps the last frames in memory, so the output can be inspected and the
+// controller can be timed without any device
+class MemoryLedTransport : public LedTransport {
+ public:
+  explicit MemoryLedTransport(int frames_to_keep = 64);
+
+  bool Open() override;
+  void Close() override;
+  bool WriteFrame(const uint8_t *data, int len) override;
+
+  // Number of frames and bytes written since Open
+  uint64_t FrameCount() const { return frame_count_; }
+  uint64_t ByteCount() const { return byte_count_; }
+
+  // The most recent frame, empty if nothing was written yet
+  const std::vector<uint8_t> &LastFrame() const;
+
+  // The n-th most recent frame (0 is the last one), n < KeptFrames()
+  const std::vector<uint8_t> &Frame(int n) const;
+  int KeptFrames() const;
+
+ private:
+  std::vector<std::vector<uint8_t>> frames_;
+  uint64_t frame_count_;
+  uint64_t byte_count_;
+};
+
+// Writes the raw frames to a file, a FIFO or /dev/null. All frames of one
+// ring have the same length, so a reader can split the stream by itself
+class FileLedTransport : public LedTransport {
+ public:
+  explicit FileLedTransport(const char *path);
+
+  bool Open() override;
+  void Close() override;
+  bool WriteFrame(const uint8_t *data, int len) override;
+
+ private:
+  std::string path_;
+  int file_descriptor_;
+};
+
+#endif  // LED_TRANSPORT_H
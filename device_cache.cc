@@ -0,0 +1,89 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** device_cache.cc
+** Caches the discovered capture device by sound card identity
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "device_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+
+static const char *const DEVICE_CACHE_FILE = "doa_detection_device";
+
+uint64_t SoundCardIdentity() {
+  std::ifstream cards("/proc/asound/cards");
+  if (!cards) return 0;
+  std::stringstream contents;
+  contents << cards.rdbuf();
+
+  // FNV-1a, never 0 so that stays "unknown"
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : contents.str()) {
+    hash ^= (unsigned char)c;
+    hash *= 1099511628211ull;
+  }
+  return hash ? hash : 1;
+}
+
+std::string DeviceCachePath() {
+  const char *cache_home = getenv("XDG_CACHE_HOME");
+  if (cache_home && *cache_home)
+    return std::string(cache_home) + "/" + DEVICE_CACHE_FILE;
+
+  const char *home = getenv("HOME");
+  if (home && *home) {
+    std::string directory = std::string(home) + "/.cache";
+    mkdir(directory.c_str(), 0700);
+    return directory + "/" + DEVICE_CACHE_FILE;
+  }
+
+  // Not in /tmp, anyone could plant a link there for root to write through
+  return "";
+}
+
+bool LoadCachedDevice(uint64_t identity, std::string *device) {
+  std::string path = DeviceCachePath();
+  if (!identity || path.empty()) return false;
+  std::ifstream cache(path);
+  uint64_t cached_identity;
+  std::string cached_device;
+  if (!(cache >> std::hex >> cached_identity >> cached_device)) return false;
+  if (cached_identity != identity) return false;
+  *device = cached_device;
+  return true;
+}
+
+bool StoreCachedDevice(uint64_t identity, const std::string &device) {
+  std::string path = DeviceCachePath();
+  if (!identity || path.empty()) return false;
+
+  // Write a new file and move it over the old one, a reader never sees half
+  // an entry. The file is our own, never one that was there or a link
+  std::string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+  int fd = open(temporary.c_str(),
+                O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  std::ostringstream entry;
+  entry << std::hex << identity << " " << device << std::endl;
+  std::string contents = entry.str();
+  bool written =
+      write(fd, contents.data(), contents.size()) == (ssize_t)contents.size();
+  if (close(fd) != 0) written = false;
+  if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,37 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** device_cache.h
+** Remembers which capture device the discovery found, so the next start
+** opens it without enumerating every card and PCM first. The entry is keyed
+** by the identity of the sound cards (number, id, driver and name of each,
+** as /proc/asound/cards lists them); plugging, removing or reordering a
+** card changes the key and the discovery runs again.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DEVICE_CACHE_H
+#define DEVICE_CACHE_H
+
+#include <stdint.h>
+#include <string>
+
+// A hash of the installed cards, 0 if they cannot be read
+uint64_t SoundCardIdentity();
+
+// $XDG_CACHE_HOME/doa_detection_device, ~/.cache/... without it and ""
+// without a home, then nothing is cached
+std::string DeviceCachePath();
+
+// The device stored for identity, false if there is none or the cards
+// changed since
+bool LoadCachedDevice(uint64_t identity, std::string *device);
+
+// Replaces the entry, false if the file cannot be written
+bool StoreCachedDevice(uint64_t identity, const std::string &device);
+
+#endif  // DEVICE_CACHE_H
@@ -0,0 +1,438 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_arrays.cc
+** Estimates the directions of several mic arrays in one process
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_arrays.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include "doa_simulation.h"
+#include "pipeline_stats.h"
+#include "trace_events.h"
+
+static const int SAMPLE_RATE = 16000;
+
+// Different periods a synthetic source repeats
+static const int SYNTHETIC_PERIODS = 4;
+
+// Sleeps until the period that ends next_ns is complete, as a device
+// would, and moves next_ns on to the end of the period after it
+static void PacePeriod(int frames, uint64_t *next_ns) {
+  uint64_t now_ns = PipelineClockNs();
+  if (*next_ns == 0) *next_ns = now_ns;
+  *next_ns += (uint64_t)frames * 1000000000ull / SAMPLE_RATE;
+  if (*next_ns <= now_ns) return;
+
+  struct timespec until;
+  until.tv_sec = *next_ns / 1000000000ull;
+  until.tv_nsec = *next_ns % 1000000000ull;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) ==
+         EINTR) {
+  }
+}
+
+SyntheticArraySource::SyntheticArraySource(double direction, double snr_db,
+                                           uint32_t seed, bool realtime)
+    : direction_(direction),
+      snr_db_(snr_db),
+      seed_(seed),
+      realtime_(realtime),
+      periods_(0),
+      frame_index_(0),
+      next_ns_(0),
+      frames_(0) {}
+
+// The periods are made up front, so Read only copies
+void SyntheticArraySource::Simulate(int frames) {
+  std::mt19937 random(seed_);
+  DoaSimulator simulator(frames);
+  frames_ = frames;
+  audio_.resize(SYNTHETIC_PERIODS);
+  for (std::vector<int16_t> &period : audio_)
+    simulator.MakePeriod(direction_, snr_db_, &random, &period);
+}
+
+bool SyntheticArraySource::Read(int16_t *interleaved, int frames,
+                                FrameTag *tag) {
+  uint64_t period = frame_index_ / frames;
+  if (periods_ && period >= periods_) return false;
+  if (frames != frames_) Simulate(frames);
+
+  if (realtime_) PacePeriod(frames, &next_ns_);
+  const std::vector<int16_t> &audio = audio_[period % SYNTHETIC_PERIODS];
+  memcpy(interleaved, audio.data(), audio.size() * sizeof(int16_t));
+  MakeFrameTag(frame_index_, frames, SAMPLE_RATE, realtime_ ? next_ns_ : 0,
+               0, tag);
+  frame_index_ += frames;
+  return true;
+}
+
+FileArraySource::FileArraySource(bool realtime)
+    : file_(nullptr),
+      data_bytes_(0),
+      realtime_(realtime),
+      frame_index_(0),
+      next_ns_(0) {}
+
+FileArraySource::~FileArraySource() {
+  if (file_) fclose(file_);
+}
+
+bool FileArraySource::Open(const char *path) {
+  if (file_) {
+    std::cout << "Array file already open." << std::endl;
+    return false;
+  }
+  file_ = fopen(path, "rb");
+  if (!file_) {
+    std::cout << "Failed to open " << path << " (" << strerror(errno) << ")"
+              << std::endl;
+    return false;
+  }
+
+  // The chunks up to the data, the format has to be ours
+  char riff[12];
+  bool wave = fread(riff, 1, 12, file_) == 12 &&
+              memcmp(riff, "RIFF", 4) == 0 && memcmp(riff + 8, "WAVE", 4) == 0;
+  bool format = false;
+  while (wave) {
+    char id[4];
+    uint32_t size;
+    if (fread(id, 1, 4, file_) != 4 || fread(&size, 4, 1, file_) != 1) break;
+    if (memcmp(id, "data", 4) == 0) {
+      data_bytes_ = size;
+      break;
+    }
+    if (memcmp(id, "fmt ", 4) == 0 && size >= 16) {
+      uint16_t tag, channels, bits;
+      uint32_t rate, byte_rate;
+      uint16_t block_align;
+      format = fread(&tag, 2, 1, file_) == 1 &&
+               fread(&channels, 2, 1, file_) == 1 &&
+               fread(&rate, 4, 1, file_) == 1 &&
+               fread(&byte_rate, 4, 1, file_) == 1 &&
+               fread(&block_align, 2, 1, file_) == 1 &&
+               fread(&bits, 2, 1, file_) == 1 && tag == 1 &&
+               channels == DOA_CHANNELS && bits == 16;
+      if (format && rate != (uint32_t)SAMPLE_RATE)
+        std::cout << path << " has " << rate << " Hz, the directions "
+                  << "assume " << SAMPLE_RATE << std::endl;
+      size -= 16;
+    }
+    if (fseek(file_, size + (size & 1), SEEK_CUR) != 0) break;
+  }
+  if (!wave || !format || !data_bytes_) {
+    std::cout << "Failed to open " << path
+              << " (not a 4-channel 16-bit WAV file)" << std::endl;
+    fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool FileArraySource::Read(int16_t *interleaved, int frames, FrameTag *tag) {
+  size_t bytes = frames * DOA_CHANNELS * sizeof(int16_t);
+  if (!file_ || data_bytes_ < bytes) return false;
+  if (fread(interleaved, 1, bytes, file_) != bytes) return false;
+  data_bytes_ -= bytes;
+
+  if (realtime_) PacePeriod(frames, &next_ns_);
+  MakeFrameTag(frame_index_, frames, SAMPLE_RATE, realtime_ ? next_ns_ : 0,
+               0, tag);
+  frame_index_ += frames;
+  return true;
+}
+
+DoaArraySource *CreateArraySource(const char *spec, bool realtime) {
+  if (strncmp(spec, "synthetic:", 10) == 0) {
+    char *next;
+    double direction = strtod(spec + 10, &next);
+    double snr_db = *next == ':' ? strtod(next + 1, nullptr) : 20.0;
+    return new SyntheticArraySource(direction, snr_db,
+                                    (uint32_t)(direction * 1000), realtime);
+  }
+  if (strncmp(spec, "file:", 5) == 0) {
+    FileArraySource *source = new FileArraySource(realtime);
+    if (source->Open(spec + 5)) return source;
+    delete source;
+  }
+  return nullptr;
+}
+
+MultiArrayDoa::MultiArrayDoa() : batching_(false), stop_(false) {}
+
+MultiArrayDoa::~MultiArrayDoa() {
+  Stop();
+  for (Array *array : arrays_) {
+    delete array->source;
+    delete array;
+  }
+  for (Worker *worker : workers_) delete worker;
+}
+
+int MultiArrayDoa::AddArray(DoaArraySource *source, int frames,
+                            size_t ring_periods) {
+  Array *array = new Array();
+  array->id = arrays_.size();
+  array->name = "capture " + std::to_string(array->id);
+  array->source = source;
+  array->frames = frames;
+  array->hop = frames;
+  array->has_capture_rt_profile = false;
+  array->has_worker_rt_profile = false;
+  array->ring.assign(ring_periods < 1 ? 1 : ring_periods,
+                     std::vector<int16_t>(frames * DOA_CHANNELS));
+  array->tags.resize(array->ring.size());
+  array->written = 0;
+  array->read = 0;
+  array->ended = false;
+  array->captured = 0;
+  array->dropped = 0;
+  array->estimated = 0;
+  array->worker = nullptr;
+  arrays_.push_back(array);
+  return array->id;
+}
+
+void MultiArrayDoa::SetHop(int array, int hop) {
+  int frames = arrays_[array]->frames;
+  arrays_[array]->hop = hop > 0 && frames % hop == 0 ? hop : frames;
+}
+
+void MultiArrayDoa::SetCaptureRtProfile(int array, const RtProfile &profile) {
+  arrays_[array]->capture_rt_profile = profile;
+  arrays_[array]->has_capture_rt_profile = true;
+}
+
+void MultiArrayDoa::SetWorkerRtProfile(int array, const RtProfile &profile) {
+  arrays_[array]->worker_rt_profile = profile;
+  arrays_[array]->has_worker_rt_profile = true;
+}
+
+bool MultiArrayDoa::Start(DoaCallback callback) {
+  if (!workers_.empty()) {
+    std::cout << "Arrays already started." << std::endl;
+    return false;
+  }
+  if (arrays_.empty()) {
+    std::cout << "Failed to start the arrays (there are none)" << std::endl;
+    return false;
+  }
+
+  // A worker per array, or per period length when batching
+  for (Array *array : arrays_) {
+    for (Worker *worker : workers_) {
+      if (batching_ && worker->arrays[0]->frames == array->frames) {
+        array->worker = worker;
+        break;
+      }
+    }
+    if (!array->worker) {
+      array->worker = new Worker();
+      array->worker->name = "doa " + std::to_string(workers_.size());
+      array->worker->finished = false;
+      workers_.push_back(array->worker);
+    }
+    array->worker->arrays.push_back(array);
+  }
+
+  callback_ = std::move(callback);
+  stop_ = false;
+  for (Worker *worker : workers_)
+    worker->thread = std::thread(&MultiArrayDoa::Work, this, worker);
+  for (Array *array : arrays_)
+    array->thread = std::thread(&MultiArrayDoa::Capture, this, array);
+  return true;
+}
+
+void MultiArrayDoa::Stop() {
+  stop_ = true;
+  for (Array *array : arrays_)
+    if (array->thread.joinable()) array->thread.join();
+  for (Worker *worker : workers_)
+    if (worker->thread.joinable()) worker->thread.join();
+}
+
+bool MultiArrayDoa::Finished() const {
+  if (workers_.empty()) return false;
+  for (Worker *worker : workers_) {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->finished) return false;
+  }
+  return true;
+}
+
+uint64_t MultiArrayDoa::Captured(int array) const {
+  return arrays_[array]->captured.load(std::memory_order_relaxed);
+}
+
+uint64_t MultiArrayDoa::Dropped(int array) const {
+  return arrays_[array]->dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t MultiArrayDoa::Estimated(int array) const {
+  return arrays_[array]->estimated.load(std::memory_order_relaxed);
+}
+
+void MultiArrayDoa::Capture(Array *array) {
+  SetTraceThreadName(array->name.c_str());
+  if (array->has_capture_rt_profile)
+    ApplyRtProfile(array->name.c_str(), array->capture_rt_profile);
+
+  Worker *worker = array->worker;
+  size_t size = array->ring.size();
+  std::vector<int16_t> overflow(array->frames * DOA_CHANNELS);
+  std::vector<int16_t> window;
+  FrameTag tag;
+  while (!stop_.load(std::memory_order_relaxed)) {
+    // The next period of the ring if the worker is done with it. Otherwise
+    // the period is still read, into overflow, and dropped
+    int16_t *period = overflow.data();
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      if (array->written - array->read < size)
+        period = array->ring[array->written % size].data();
+    }
+    if (array->hop < array->frames) {
+      if (!ReadWindow(array, &window, period, &tag)) break;
+    } else if (!array->source->Read(period, array->frames, &tag)) {
+      break;
+    }
+    tag.array = array->id;
+    array->captured.fetch_add(1, std::memory_order_relaxed);
+    if (period == overflow.data()) {
+      array->dropped.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      array->tags[array->written % size] = tag;
+      array->written++;
+    }
+    worker->ready.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    array->ended = true;
+  }
+  worker->ready.notify_one();
+}
+
+// The next hop frames behind the ones before them, copied to period as a
+// whole window. The source is always read hop frames at a time, the first
+// window takes as many reads as it needs
+bool MultiArrayDoa::ReadWindow(Array *array, std::vector<int16_t> *window,
+                               int16_t *period, FrameTag *tag) {
+  size_t window_size = array->frames * DOA_CHANNELS;
+  size_t keep = (array->frames - array->hop) * DOA_CHANNELS;
+  int reads = window->empty() ? array->frames / array->hop : 1;
+  window->resize(window_size);
+  for (int i = 0; i < reads; i++) {
+    memmove(window->data(), window->data() + window_size - keep,
+            keep * sizeof(int16_t));
+    if (!array->source->Read(window->data() + keep, array->hop, tag))
+      return false;
+  }
+  memcpy(period, window->data(), window_size * sizeof(int16_t));
+
+  // The window starts with the frames kept from before
+  uint64_t kept = array->frames - array->hop;
+  uint64_t kept_ns = kept * 1000000000ull / 16000;
+  tag->frame_index = tag->frame_index > kept ? tag->frame_index - kept : 0;
+  tag->capture_ns = tag->capture_ns > kept_ns ? tag->capture_ns - kept_ns : 0;
+  return true;
+}
+
+void MultiArrayDoa::Work(Worker *worker) {
+  SetTraceThreadName(worker->name.c_str());
+  Array *first = worker->arrays[0];
+  if (first->has_worker_rt_profile)
+    ApplyRtProfile(worker->name.c_str(), first->worker_rt_profile);
+
+  std::vector<Array *> pending;
+  std::vector<DoaResult> results;
+  std::vector<DoaEstimator *> estimators;
+  std::vector<const int16_t *> periods;
+  std::vector<size_t> batched;
+  for (;;) {
+    // A period of every array that still has a source, so they are
+    // transformed together, or what is left once the sources ended
+    pending.clear();
+    {
+      std::unique_lock<std::mutex> lock(worker->mutex);
+      worker->ready.wait(lock, [worker] {
+        for (Array *array : worker->arrays)
+          if (array->written == array->read && !array->ended) return false;
+        return true;
+      });
+      for (Array *array : worker->arrays)
+        if (array->written > array->read) pending.push_back(array);
+      if (pending.empty()) {
+        worker->finished = true;
+        break;
+      }
+    }
+
+    // The periods stay in the ring while we work on them, the capture
+    // threads only write behind them
+    uint64_t start_ns = PipelineClockNs();
+    results.resize(pending.size());
+    estimators.clear();
+    periods.clear();
+    batched.clear();
+    for (size_t i = 0; i < pending.size(); i++) {
+      Array *array = pending[i];
+      size_t slot = array->read % array->ring.size();
+      const std::vector<int16_t> &period = array->ring[slot];
+      DoaEstimator &estimator = array->estimator;
+
+      // Only the GCC-PHAT works on the spectra
+      if (pending.size() > 1 &&
+          (estimator.Forgetting() > 0.0 ||
+           estimator.ResolvedMethod(period.data(), array->frames) ==
+               DOA_METHOD_GCC_PHAT)) {
+        estimators.push_back(&estimator);
+        periods.push_back(period.data());
+        batched.push_back(i);
+      } else {
+        results[i] = estimator.Estimate(period, array->tags[slot]);
+      }
+    }
+    if (!estimators.empty()) {
+      DoaEstimator::AnalyzeBatch(estimators.size(), estimators.data(),
+                                 periods.data(), pending[batched[0]]->frames);
+      for (size_t b = 0; b < batched.size(); b++) {
+        Array *array = pending[batched[b]];
+        results[batched[b]] =
+            array->estimator.Estimate(array->tags[array->read %
+                                                  array->ring.size()]);
+        results[batched[b]].compute_start_ns = start_ns;
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      for (Array *array : pending) array->read++;
+    }
+    for (size_t i = 0; i < pending.size(); i++) {
+      pending[i]->estimated.fetch_add(1, std::memory_order_relaxed);
+      if (callback_) callback_(results[i]);
+    }
+  }
+}
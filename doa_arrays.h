@@ -0,0 +1,202 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_arrays.h
+** Estimates the directions of several mic arrays (4mic_hats or USB
+** arrays) in one process. Every array has a capture thread that reads its
+** source into a ring of periods, and a DoaEstimator of its own. By default
+** every array also has a worker thread of its own, so each can be pinned
+** to a core. With batching, the arrays of one period length share a worker
+** instead, which transforms their channels together
+** (DoaEstimator::AnalyzeBatch) and so fills the vector lanes of the FFT.
+**
+** A capture thread never waits for the worker: when the ring of its array
+** is full, the period is read (the device keeps running) and dropped. The
+** results carry the ID of their array in tag.array.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_ARRAYS_H
+#define DOA_ARRAYS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "doa_async.h"
+#include "doa_detection.h"
+#include "frame_timing.h"
+#include "rt_profile.h"
+
+// Periods a ring holds by default, 2 s at 4096 frames
+static const size_t DOA_ARRAY_RING_PERIODS = 8;
+
+// Where the periods of an array come from
+class DoaArraySource {
+ public:
+  virtual ~DoaArraySource() {}
+
+  // Reads the next period of frames interleaved 4-channel frames and tags
+  // it (the pipeline sets tag->array), blocking like a capture device.
+  // False at the end of the source or on an error it cannot recover from
+  virtual bool Read(int16_t *interleaved, int frames, FrameTag *tag) = 0;
+};
+
+// Noise from one direction with noise on every mic (DoaSimulator).
+// A few different periods are made up front and repeated. With realtime
+// Read paces them like a 16 kHz device, otherwise it returns at once
+class SyntheticArraySource : public DoaArraySource {
+ public:
+  SyntheticArraySource(double direction, double snr_db, uint32_t seed,
+                       bool realtime);
+
+  // Ends after periods periods, 0 for never
+  void SetPeriods(uint64_t periods) { periods_ = periods; }
+
+  bool Read(int16_t *interleaved, int frames, FrameTag *tag) override;
+
+ private:
+  void Simulate(int frames);
+
+ private:
+  double direction_;
+  double snr_db_;
+  uint32_t seed_;
+  bool realtime_;
+  uint64_t periods_;
+  uint64_t frame_index_;
+  uint64_t next_ns_;
+  int frames_;
+  std::vector<std::vector<int16_t>> audio_;
+};
+
+// A 4-channel 16-bit WAV file, e.g. one capture_log_sample cut from a
+// recording. With realtime Read paces it like a 16 kHz device
+class FileArraySource : public DoaArraySource {
+ public:
+  explicit FileArraySource(bool realtime);
+  ~FileArraySource();
+
+  bool Open(const char *path);
+
+  bool Read(int16_t *interleaved, int frames, FrameTag *tag) override;
+
+ private:
+  FILE *file_;
+  uint64_t data_bytes_;
+  bool realtime_;
+  uint64_t frame_index_;
+  uint64_t next_ns_;
+};
+
+// synthetic:DIRECTION[:SNR] or file:PATH, paced like a device if realtime.
+// nullptr if spec is neither (so the caller may take it as an ALSA
+// device), or if the file does not open
+DoaArraySource *CreateArraySource(const char *spec, bool realtime);
+
+class MultiArrayDoa {
+ public:
+  MultiArrayDoa();
+  ~MultiArrayDoa();
+
+  // Adds an array that reads periods of frames frames from source, which
+  // it then owns. Returns the ID of the array, which is the number of
+  // arrays added before it
+  int AddArray(DoaArraySource *source, int frames,
+               size_t ring_periods = DOA_ARRAY_RING_PERIODS);
+
+  // Configure the estimators and the threads before Start
+  DoaEstimator &Estimator(int array) { return arrays_[array]->estimator; }
+
+  // Estimates every hop frames instead of every period: the source is read
+  // hop frames at a time, and each estimate sees the last frames frames, so
+  // they overlap. hop has to divide frames (otherwise it stays frames). The
+  // tags are those of the whole window
+  void SetHop(int array, int hop);
+  void SetCaptureRtProfile(int array, const RtProfile &profile);
+  void SetWorkerRtProfile(int array, const RtProfile &profile);
+
+  // Arrays of one period length share a worker (with the profile of the
+  // first of them) that transforms their periods together
+  void SetBatching(bool batching) { batching_ = batching; }
+
+  // Starts the threads. callback gets every result on the worker threads,
+  // at the same time for arrays on different workers
+  bool Start(DoaCallback callback);
+
+  // Stops the capture, estimates what is in the rings, stops the workers
+  void Stop();
+
+  // Whether all sources ended and all their periods were estimated
+  bool Finished() const;
+
+  int ArrayCount() const { return arrays_.size(); }
+  int WorkerCount() const { return workers_.size(); }
+
+  // Periods read, dropped because the ring was full, and estimated
+  uint64_t Captured(int array) const;
+  uint64_t Dropped(int array) const;
+  uint64_t Estimated(int array) const;
+
+ private:
+  struct Worker;
+
+  struct Array {
+    int id;
+    std::string name;
+    DoaArraySource *source;
+    int frames;
+    int hop;
+    DoaEstimator estimator;
+    bool has_capture_rt_profile;
+    RtProfile capture_rt_profile;
+    bool has_worker_rt_profile;
+    RtProfile worker_rt_profile;
+
+    // The ring, guarded by the mutex of the worker. The capture thread
+    // fills period written % size and never one that was not read yet
+    std::vector<std::vector<int16_t>> ring;
+    std::vector<FrameTag> tags;
+    uint64_t written;
+    uint64_t read;
+    bool ended;
+
+    std::atomic<uint64_t> captured;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> estimated;
+    Worker *worker;
+    std::thread thread;
+  };
+
+  struct Worker {
+    std::string name;
+    std::vector<Array *> arrays;
+    std::mutex mutex;
+    std::condition_variable ready;
+    bool finished;
+    std::thread thread;
+  };
+
+  void Capture(Array *array);
+  static bool ReadWindow(Array *array, std::vector<int16_t> *window,
+                         int16_t *period, FrameTag *tag);
+  void Work(Worker *worker);
+
+ private:
+  std::vector<Array *> arrays_;
+  std::vector<Worker *> workers_;
+  bool batching_;
+  DoaCallback callback_;
+  std::atomic<bool> stop_;
+};
+
+#endif  // DOA_ARRAYS_H
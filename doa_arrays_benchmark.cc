@@ -0,0 +1,215 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_arrays_benchmark.cc
+** Runs several simulated mic arrays through MultiArrayDoa and prints how
+** much of a core they take with a worker per array and with batching,
+** and how close every array's directions are to its source. The last
+** array of each run reads a WAV file written first, so the file source is
+** covered as well. Before that, the forward FFTs of several arrays are
+** timed one array after the other against DoaEstimator::AnalyzeBatch.
+**
+** The exit code is 1 if an array lost results, got results of another
+** array or is off by more than MAX_MEAN_ERROR on average.
+**
+** Usage: doa_arrays_benchmark [seconds per run]
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "doa_arrays.h"
+#include "doa_simulation.h"
+
+static const int MAX_ARRAYS = 3;
+static const double SOURCE_DIRECTION[MAX_ARRAYS] = {40.0, 150.0, 260.0};
+static const double SNR_DB = 20.0;
+static const double MAX_MEAN_ERROR = 10.0;
+static const int ANALYZE_RUNS = 500;
+static const int ANALYZE_ROUNDS = 7;
+
+// User and system time of the process so far, in seconds
+static double CpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Seconds of periods of frames from direction as a 4-channel WAV file
+static bool WriteWav(const std::string &filename, double direction,
+                     int frames, double seconds) {
+  SyntheticArraySource source(direction, SNR_DB, 7, false);
+  int periods = seconds * 16000 / frames;
+  std::vector<int16_t> period(frames * DOA_CHANNELS);
+  uint32_t data_bytes = periods * period.size() * sizeof(int16_t);
+  uint32_t riff_bytes = 36 + data_bytes, format_bytes = 16;
+  uint32_t rate = 16000, byte_rate = rate * DOA_CHANNELS * 2;
+  uint16_t format = 1, channels = DOA_CHANNELS, block_align = 8, bits = 16;
+
+  std::ofstream wav(filename, std::ios::binary);
+  wav.write("RIFF", 4);
+  wav.write(reinterpret_cast<const char *>(&riff_bytes), 4);
+  wav.write("WAVEfmt ", 8);
+  wav.write(reinterpret_cast<const char *>(&format_bytes), 4);
+  wav.write(reinterpret_cast<const char *>(&format), 2);
+  wav.write(reinterpret_cast<const char *>(&channels), 2);
+  wav.write(reinterpret_cast<const char *>(&rate), 4);
+  wav.write(reinterpret_cast<const char *>(&byte_rate), 4);
+  wav.write(reinterpret_cast<const char *>(&block_align), 2);
+  wav.write(reinterpret_cast<const char *>(&bits), 2);
+  wav.write("data", 4);
+  wav.write(reinterpret_cast<const char *>(&data_bytes), 4);
+  FrameTag tag;
+  for (int p = 0; p < periods; p++) {
+    source.Read(period.data(), frames, &tag);
+    wav.write(reinterpret_cast<const char *>(period.data()),
+              period.size() * sizeof(int16_t));
+  }
+  return wav.good();
+}
+
+// The forward transforms of count arrays, alone and batched
+static void RunAnalyze(int frames, int count) {
+  std::vector<std::vector<int16_t>> audio(count);
+  std::vector<DoaEstimator *> estimators;
+  std::vector<const int16_t *> periods;
+  FrameTag tag;
+  for (int a = 0; a < count; a++) {
+    SyntheticArraySource source(SOURCE_DIRECTION[a % MAX_ARRAYS], SNR_DB, a,
+                                false);
+    audio[a].resize(frames * DOA_CHANNELS);
+    source.Read(audio[a].data(), frames, &tag);
+    estimators.push_back(new DoaEstimator(FastestFftBackend()));
+    periods.push_back(audio[a].data());
+  }
+
+  // The best of a few rounds, alternating, so both see the same load
+  double alone_us = 1e9, batched_us = 1e9;
+  for (int round = 0; round < ANALYZE_ROUNDS; round++) {
+    auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < ANALYZE_RUNS; run++)
+      for (int a = 0; a < count; a++)
+        estimators[a]->Analyze(periods[a], frames);
+    auto alone_at = std::chrono::steady_clock::now();
+    for (int run = 0; run < ANALYZE_RUNS; run++)
+      DoaEstimator::AnalyzeBatch(count, estimators.data(), periods.data(),
+                                 frames);
+    auto batched_at = std::chrono::steady_clock::now();
+    alone_us = std::min(
+        alone_us,
+        std::chrono::duration<double, std::micro>(alone_at - start).count() /
+            ANALYZE_RUNS);
+    batched_us = std::min(
+        batched_us,
+        std::chrono::duration<double, std::micro>(batched_at - alone_at)
+            .count() /
+            ANALYZE_RUNS);
+  }
+  std::cout << "  " << count << " arrays of " << frames
+            << " frames: " << alone_us << " us one by one, " << batched_us
+            << " us with AnalyzeBatch (" << alone_us / batched_us << "x)"
+            << std::endl;
+  for (DoaEstimator *estimator : estimators) delete estimator;
+}
+
+// count arrays at 16 kHz for seconds, the last one from the file if there
+// are more than one. False if an array's results are wrong
+static bool RunArrays(int count, bool batching, int frames, double seconds,
+                      const std::string &wav) {
+  MultiArrayDoa arrays;
+  std::vector<double> truth(count);
+  for (int a = 0; a < count; a++) {
+    DoaArraySource *source;
+    truth[a] = SOURCE_DIRECTION[a];
+    if (count > 1 && a == count - 1) {
+      FileArraySource *file = new FileArraySource(true);
+      file->Open(wav.c_str());
+      source = file;
+      truth[a] = SOURCE_DIRECTION[MAX_ARRAYS - 1];
+    } else {
+      SyntheticArraySource *synthetic =
+          new SyntheticArraySource(SOURCE_DIRECTION[a], SNR_DB, a, true);
+      synthetic->SetPeriods(seconds * 16000 / frames);
+      source = synthetic;
+    }
+    arrays.AddArray(source, frames);
+    arrays.Estimator(a).SetFftBackend(FastestFftBackend());
+    arrays.Estimator(a).SetMethod(DOA_METHOD_GCC_PHAT);
+  }
+  arrays.SetBatching(batching);
+
+  std::mutex mutex;
+  std::vector<uint64_t> results(count, 0);
+  std::vector<double> error(count, 0.0);
+  uint64_t foreign = 0;
+  double cpu_start = CpuSeconds();
+  arrays.Start([&](const DoaResult &result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (result.tag.array >= (uint32_t)count) {
+      foreign++;
+      return;
+    }
+    results[result.tag.array]++;
+    error[result.tag.array] +=
+        DoaAngleError(result.direction, truth[result.tag.array]);
+  });
+  while (!arrays.Finished()) usleep(10000);
+  arrays.Stop();
+  double cpu = (CpuSeconds() - cpu_start) / seconds;
+
+  bool right = foreign == 0;
+  std::cout << "  " << count << " arrays, " << arrays.WorkerCount()
+            << (batching ? " batched worker(s): " : " workers: ") << cpu * 100
+            << " % of a core, mean error";
+  for (int a = 0; a < count; a++) {
+    double mean = results[a] ? error[a] / results[a] : 180.0;
+    std::cout << " " << mean;
+    right &= mean <= MAX_MEAN_ERROR && results[a] == arrays.Estimated(a) &&
+             results[a] + arrays.Dropped(a) == arrays.Captured(a) &&
+             results[a] > 0;
+  }
+  uint64_t dropped = 0;
+  for (int a = 0; a < count; a++) dropped += arrays.Dropped(a);
+  std::cout << " deg, " << dropped << " dropped"
+            << (right ? "" : " (WRONG)") << std::endl;
+  return right;
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  bool right = true;
+
+  std::cout << "Forward FFT with " << FftBackendName(FastestFftBackend())
+            << ":" << std::endl;
+  for (int frames : {256, 512, 4096})
+    for (int count : {1, 2, 4}) RunAnalyze(frames, count);
+
+  std::string wav = "/tmp/doa_arrays_benchmark_" +
+                    std::to_string(getpid()) + ".wav";
+  for (int frames : {512, 4096}) {
+    std::cout << "Periods of " << frames << " frames:" << std::endl;
+    if (!WriteWav(wav, SOURCE_DIRECTION[MAX_ARRAYS - 1], frames, seconds)) {
+      std::cout << "Failed to write " << wav << std::endl;
+      return 1;
+    }
+    for (int count = 1; count <= MAX_ARRAYS; count++)
+      for (bool batching : {false, true})
+        right &= RunArrays(count, batching, frames, seconds, wav);
+  }
+  unlink(wav.c_str());
+  return right ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_async.cc
+** Runs a DoaEstimator on its own thread
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_async.h"
+
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#include "trace_events.h"
+
+static const char *const POLICY_NAMES[] = {"block", "drop-oldest",
+                                           "coalesce"};
+
+const char *DoaOverflowPolicyName(DoaOverflowPolicy policy) {
+  if (policy < DOA_OVERFLOW_BLOCK || policy > DOA_OVERFLOW_COALESCE)
+    return "unknown";
+  return POLICY_NAMES[policy];
+}
+
+bool ParseDoaOverflowPolicy(const char *name, DoaOverflowPolicy *policy) {
+  for (int i = DOA_OVERFLOW_BLOCK; i <= DOA_OVERFLOW_COALESCE; i++) {
+    if (strcmp(name, POLICY_NAMES[i]) == 0) {
+      *policy = (DoaOverflowPolicy)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Hands the waiters of a dropped request to the one that replaces it
+static void MoveWaiters(std::vector<std::promise<DoaResult>> *from_promises,
+                        std::vector<DoaCallback> *from_callbacks,
+                        std::vector<std::promise<DoaResult>> *to_promises,
+                        std::vector<DoaCallback> *to_callbacks) {
+  for (auto &promise : *from_promises)
+    to_promises->push_back(std::move(promise));
+  for (auto &callback : *from_callbacks)
+    to_callbacks->push_back(std::move(callback));
+  from_promises->clear();
+  from_callbacks->clear();
+}
+
+AsyncDoaEstimator::AsyncDoaEstimator()
+    : capacity_(0),
+      policy_(DOA_OVERFLOW_BLOCK),
+      stop_(false),
+      running_(false),
+      dropped_(0),
+      has_rt_profile_(false),
+      latest_(0) {
+  snapshots_[0].seqlock = 0;
+  snapshots_[1].seqlock = 0;
+}
+
+AsyncDoaEstimator::~AsyncDoaEstimator() { Stop(); }
+
+void AsyncDoaEstimator::SetRtProfile(const RtProfile &profile) {
+  rt_profile_ = profile;
+  has_rt_profile_ = true;
+}
+
+bool AsyncDoaEstimator::Start(size_t capacity, DoaOverflowPolicy policy) {
+  if (thread_.joinable()) {
+    std::cout << "Async estimator already started." << std::endl;
+    return false;
+  }
+  if (capacity < 1) capacity = 1;
+
+  capacity_ = capacity;
+  policy_ = policy;
+  stop_ = false;
+  running_ = true;
+  thread_ = std::thread(&AsyncDoaEstimator::Thread, this);
+  return true;
+}
+
+void AsyncDoaEstimator::Stop() {
+  if (!thread_.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  queued_.notify_all();
+  thread_.join();
+}
+
+std::future<DoaResult> AsyncDoaEstimator::Submit(DoaAudio audio,
+                                                 const FrameTag &tag) {
+  Request request;
+  request.audio = std::move(audio);
+  request.tag = tag;
+  request.promises.push_back(std::promise<DoaResult>());
+  std::future<DoaResult> future = request.promises.back().get_future();
+  Enqueue(std::move(request));
+  return future;
+}
+
+void AsyncDoaEstimator::Submit(DoaAudio audio, const FrameTag &tag,
+                               DoaCallback callback) {
+  Request request;
+  request.audio = std::move(audio);
+  request.tag = tag;
+  request.callbacks.push_back(std::move(callback));
+  Enqueue(std::move(request));
+}
+
+void AsyncDoaEstimator::Enqueue(Request request) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  if (running_ && queue_.size() >= capacity_) {
+    switch (policy_) {
+      case DOA_OVERFLOW_BLOCK:
+        taken_.wait(lock,
+                    [this] { return queue_.size() < capacity_ || !running_; });
+        break;
+      case DOA_OVERFLOW_DROP_OLDEST: {
+        // Its waiters get the next period instead
+        Request oldest = std::move(queue_.front());
+        queue_.pop_front();
+        Request &next = queue_.empty() ? request : queue_.front();
+        MoveWaiters(&oldest.promises, &oldest.callbacks, &next.promises,
+                    &next.callbacks);
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        break;
+      }
+      case DOA_OVERFLOW_COALESCE:
+        for (Request &pending : queue_)
+          MoveWaiters(&pending.promises, &pending.callbacks,
+                      &request.promises, &request.callbacks);
+        dropped_.fetch_add(queue_.size(), std::memory_order_relaxed);
+        queue_.clear();
+        break;
+    }
+  }
+
+  // Without the thread the caller estimates it
+  if (!running_) {
+    lock.unlock();
+    Run(&request);
+    return;
+  }
+
+  queue_.push_back(std::move(request));
+  lock.unlock();
+  queued_.notify_one();
+}
+
+void AsyncDoaEstimator::Thread() {
+  SetTraceThreadName("doa");
+  if (has_rt_profile_) ApplyRtProfile("doa", rt_profile_);
+  for (;;) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      queued_.wait(lock, [this] { return !queue_.empty() || stop_; });
+      if (queue_.empty()) {
+        running_ = false;
+        break;
+      }
+      request = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    taken_.notify_one();
+    Run(&request);
+  }
+  taken_.notify_all();
+}
+
+void AsyncDoaEstimator::Run(Request *request) {
+  DoaResult result = estimator_.Estimate(*request->audio, request->tag);
+  StoreLatest(result);
+  for (auto &promise : request->promises) promise.set_value(result);
+  for (auto &callback : request->callbacks) callback(result);
+}
+
+// Only one thread writes at a time: the estimator thread, or the caller
+// while there is none (before Start, or once Stop emptied the queue)
+void AsyncDoaEstimator::StoreLatest(const DoaResult &result) {
+  uint64_t count = latest_.load(std::memory_order_relaxed);
+  Snapshot &snapshot = snapshots_[count & 1];
+
+  // Odd while we write
+  uint32_t lock = snapshot.seqlock.load(std::memory_order_relaxed);
+  snapshot.seqlock.store(lock + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  memcpy(&snapshot.result, &result, sizeof(DoaResult));
+
+  // Even again, then point the readers at it
+  snapshot.seqlock.store(lock + 2, std::memory_order_release);
+  latest_.store(count + 1, std::memory_order_release);
+}
+
+bool AsyncDoaEstimator::Latest(DoaResult *result) const {
+  for (;;) {
+    uint64_t count = latest_.load(std::memory_order_acquire);
+    if (count == 0) return false;
+    const Snapshot &snapshot = snapshots_[(count - 1) & 1];
+
+    uint32_t before = snapshot.seqlock.load(std::memory_order_acquire);
+    if (before & 1) continue;  // Written twice since we looked
+
+    memcpy(result, &snapshot.result, sizeof(DoaResult));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (snapshot.seqlock.load(std::memory_order_relaxed) == before)
+      return true;
+  }
+}
@@ -0,0 +1,128 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_async.h
+** Runs a DoaEstimator on its own thread, so the capture loop only hands
+** over the period instead of waiting for the direction. The periods wait
+** in a bounded queue; when it is full the submitter blocks, the oldest
+** period is dropped, or everything pending is coalesced into the newest.
+** Nobody waits forever: the waiters of a dropped period get the result of
+** the one that replaced it.
+**
+** The last result sits behind a seqlock with two slots, any thread can
+** read it without a lock and without ever waiting for the estimator.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_ASYNC_H
+#define DOA_ASYNC_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "doa_detection.h"
+#include "rt_profile.h"
+
+// What Submit does when the queue is full
+enum DoaOverflowPolicy {
+  DOA_OVERFLOW_BLOCK,        // wait until the estimator took one
+  DOA_OVERFLOW_DROP_OLDEST,  // drop the period that waited longest
+  DOA_OVERFLOW_COALESCE      // only the newest of the pending periods counts
+};
+
+// Short name of a policy, as ParseDoaOverflowPolicy takes it
+const char *DoaOverflowPolicyName(DoaOverflowPolicy policy);
+
+// Policy by name, false if unknown
+bool ParseDoaOverflowPolicy(const char *name, DoaOverflowPolicy *policy);
+
+// Called on the estimator thread with every result
+typedef std::function<void(const DoaResult &result)> DoaCallback;
+
+// An interleaved 4-channel period, kept alive until it is estimated
+typedef std::shared_ptr<const std::vector<int16_t>> DoaAudio;
+
+class AsyncDoaEstimator {
+ public:
+  AsyncDoaEstimator();
+  ~AsyncDoaEstimator();
+
+  // The estimator the thread runs. Configure it before Start
+  DoaEstimator &Estimator() { return estimator_; }
+
+  // Real-time profile the thread applies when it starts (see rt_profile.h)
+  void SetRtProfile(const RtProfile &profile);
+
+  // Starts the thread with a queue of capacity periods
+  bool Start(size_t capacity = 4,
+             DoaOverflowPolicy policy = DOA_OVERFLOW_BLOCK);
+
+  // Estimates what is queued, then stops the thread
+  void Stop();
+
+  // Queues a period. The future (or the callback, on the estimator thread)
+  // gets its direction, or that of the newer period it was dropped for
+  std::future<DoaResult> Submit(DoaAudio audio, const FrameTag &tag);
+  void Submit(DoaAudio audio, const FrameTag &tag, DoaCallback callback);
+
+  // The last result, false if there is none yet. Never blocks
+  bool Latest(DoaResult *result) const;
+
+  // Periods dropped or coalesced because the queue was full
+  uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Request {
+    DoaAudio audio;
+    FrameTag tag;
+    std::vector<std::promise<DoaResult>> promises;
+    std::vector<DoaCallback> callbacks;
+  };
+
+  struct Snapshot {
+    std::atomic<uint32_t> seqlock;
+    DoaResult result;
+  };
+
+  void Enqueue(Request request);
+  void Thread();
+  void Run(Request *request);
+  void StoreLatest(const DoaResult &result);
+
+ private:
+  DoaEstimator estimator_;
+
+  // The queue, guarded by mutex_
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable taken_;
+  std::deque<Request> queue_;
+  size_t capacity_;
+  DoaOverflowPolicy policy_;
+  bool stop_;
+  bool running_;
+  std::atomic<uint64_t> dropped_;
+  std::thread thread_;
+  bool has_rt_profile_;
+  RtProfile rt_profile_;
+
+  // The last result is in snapshots_[(latest_ - 1) & 1]; the estimator
+  // thread writes the other slot, so a reader only retries if two results
+  // came in while it copied
+  Snapshot snapshots_[2];
+  std::atomic<uint64_t> latest_;
+};
+
+#endif  // DOA_ASYNC_H
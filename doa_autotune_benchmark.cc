@@ -0,0 +1,394 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_autotune_benchmark.cc
+** Finds the estimator settings that are worth their CPU on this machine.
+** Every combination of window, hop, band, fusion, precision, method and
+** FFT backend runs over the same audio, an estimate every hop frames, and
+** its thread CPU time per second of audio and its mean error are
+** measured. The hop is the window, unless --array also tries half of it
+** (only doa_detection_sample --array reads overlapping windows). The
+** configurations no other one beats on both are printed, and the most
+** accurate of them within the budget can be written as a file for
+** doa_detection_sample --config (see doa_config.h).
+**
+** The audio is either labeled recordings (4-channel 16-bit 16 kHz WAV
+** files with a talker at a known direction, e.g. cut with
+** capture_log_sample) or a simulation: noise shaped like speech (100 to
+** 7000 Hz, in syllables) from a few directions, with noise on every mic
+** and low-frequency rumble from elsewhere.
+**
+** Usage: doa_autotune_benchmark <CPU ms per second of audio> [options]
+**   --labels=FILE   lines of "WAV DEGREE" instead of the simulation
+**   --snr=DB        simulation: talker to noise on every mic (10)
+**   --rumble=DB     simulation: rumble to talker (0)
+**   --directions=N  simulation: talker positions (8)
+**   --seconds=S     simulation: audio per position (2)
+**   --write=FILE    the configuration to FILE
+**   --array         also a hop of half the window (for --array)
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include <getopt.h>
+#include <time.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "doa_arrays.h"
+#include "doa_config.h"
+#include "doa_correlation.h"
+#include "doa_detection.h"
+#include "doa_detection_fixed.h"
+#include "doa_simulation.h"
+#include "fft_backend.h"
+
+static const double SAMPLE_RATE = 16000.0;
+static const double PI = 3.14159265358979323846;
+
+// The search space. With --array every window also runs with half of it
+// as hop
+static const int WINDOW_FRAMES[] = {256, 512, 1024, 2048, 4096};
+static const double BANDS[][2] = {{0.0, 0.0}, {200.0, 7000.0},
+                                  {300.0, 3400.0}};
+
+// The CPU time of a configuration is the least of this many passes
+static const int TIMING_ROUNDS = 3;
+
+// Frames read from a labeled file at a time
+static const int LOAD_FRAMES = 256;
+
+// An estimate counts as a hit within this many degree
+static const double HIT_DEGREE = 10.0;
+
+// Mean errors closer than this are the same, a configuration has to be
+// more accurate than that to be worth its CPU
+static const double ERROR_RESOLUTION = 0.05;
+
+// Continuous 4-channel audio with the talker at one direction
+struct Clip {
+  double direction;
+  std::vector<int16_t> audio;
+
+  int Frames() const { return audio.size() / DOA_CHANNELS; }
+};
+
+// A configuration and what it costs and gets
+struct Candidate {
+  DoaConfig config;
+  double cpu_ms;
+  double mean_error;
+  double hits;
+};
+
+static double ThreadCpuSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// A talker at direction for seconds: noise in syllables of about 4 per
+// second, rumble below 300 Hz from 135 degree away and noise on every mic
+static void Simulate(double direction, double seconds, double snr_db,
+                     double rumble_db, std::mt19937 *random, Clip *clip) {
+  int frames = (int)(seconds * SAMPLE_RATE) & ~1;
+  DoaSimulator simulator(frames);
+  std::uniform_real_distribution<double> uniform(0.0, 2.0 * PI);
+
+  std::vector<double> syllables(frames);
+  double phase = uniform(*random);
+  for (int n = 0; n < frames; n++) {
+    double s = std::sin(2.0 * PI * 4.0 * n / SAMPLE_RATE + phase);
+    syllables[n] = 0.1 + (s > 0.0 ? s * s : 0.0);
+  }
+
+  std::vector<std::vector<double>> channels(DOA_CHANNELS,
+                                            std::vector<double>(frames));
+  std::vector<kiss_fft_cpx> source;
+  double talker_rms = 3000.0;
+  simulator.MakeSource(100.0, 7000.0, &syllables, random, &source);
+  simulator.AddSource(source, direction, talker_rms, &channels);
+  simulator.MakeSource(20.0, 300.0, nullptr, random, &source);
+  simulator.AddSource(source, std::fmod(direction + 135.0, 360.0),
+                      talker_rms * std::pow(10.0, rumble_db / 20.0),
+                      &channels);
+
+  clip->direction = direction;
+  simulator.Quantize(channels, talker_rms * std::pow(10.0, -snr_db / 20.0),
+                     random, &clip->audio);
+}
+
+// The recordings of the lines "WAV DEGREE" of path
+static bool LoadLabels(const char *path, std::vector<Clip> *clips) {
+  std::ifstream labels(path);
+  if (!labels) {
+    std::cout << "Failed to open " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(labels, line)) {
+    std::istringstream fields(line);
+    std::string wav;
+    Clip clip;
+    if (!(fields >> wav) || wav[0] == '#') continue;
+    if (!(fields >> clip.direction)) {
+      std::cout << "Failed to load " << path << " (" << wav
+                << " has no direction)" << std::endl;
+      return false;
+    }
+
+    FileArraySource file(false);
+    if (!file.Open(wav.c_str())) return false;
+    std::vector<int16_t> chunk(LOAD_FRAMES * DOA_CHANNELS);
+    FrameTag tag;
+    while (file.Read(chunk.data(), LOAD_FRAMES, &tag))
+      clip.audio.insert(clip.audio.end(), chunk.begin(), chunk.end());
+    clips->push_back(clip);
+  }
+  return !clips->empty();
+}
+
+// Every configuration we search, those that need a window longer than the
+// shortest clip left out. Only with overlap a hop shorter than the window
+static std::vector<DoaConfig> SearchSpace(int shortest_clip, bool overlap) {
+  std::vector<DoaConfig> space;
+  for (int frames : WINDOW_FRAMES) {
+    if (frames > shortest_clip) continue;
+    for (int hop : {frames, frames / 2}) {
+      if (hop != frames && !overlap) continue;
+      for (const double *band : BANDS) {
+        for (DoaFusion fusion :
+             {DOA_FUSION_WHOLE_LAGS, DOA_FUSION_INTERPOLATED}) {
+          DoaConfig config = DefaultDoaConfig();
+          config.frames = frames;
+          config.hop = hop;
+          config.band_low_hz = band[0];
+          config.band_high_hz = band[1];
+          config.fusion = fusion;
+          config.method = DOA_METHOD_GCC_PHAT;
+          for (int backend = 0; backend < FFT_BACKEND_COUNT; backend++) {
+            config.fft_backend = (FftBackend)backend;
+            if (FftBackendAvailable(config.fft_backend))
+              space.push_back(config);
+          }
+          config.fft_backend = FFT_BACKEND_KISS;
+          config.fixed_point = true;
+          space.push_back(config);
+
+          // The time domain has no band
+          config.fixed_point = false;
+          config.method = DOA_METHOD_LAG_CORRELATION;
+          if (band[0] == 0.0 && band[1] == 0.0) space.push_back(config);
+        }
+      }
+    }
+  }
+  return space;
+}
+
+// Runs the configuration of candidate over every window of the clips
+static void Evaluate(const std::vector<Clip> &clips, Candidate *candidate) {
+  const DoaConfig &config = candidate->config;
+  DoaEstimator estimator;
+  DoaFixedEstimator fixed_estimator;
+  DoaLagCorrelator correlator;
+  ApplyDoaConfig(config, &estimator);
+  ApplyDoaConfig(config, &fixed_estimator);
+  correlator.SetFusion(config.fusion);
+  auto estimate = [&](const int16_t *window) {
+    if (config.fixed_point)
+      return fixed_estimator.Estimate(window, config.frames, FrameTag());
+    if (config.method == DOA_METHOD_LAG_CORRELATION)
+      return correlator.Estimate(window, config.frames, FrameTag());
+    estimator.Analyze(window, config.frames);
+    return estimator.Estimate(FrameTag());
+  };
+
+  // Once to warm up (plans, tables), then timed
+  estimate(clips[0].audio.data());
+  double best_seconds = 1e9, error = 0.0;
+  uint64_t estimates = 0, hits = 0;
+  for (int round = 0; round < TIMING_ROUNDS; round++) {
+    double start = ThreadCpuSeconds();
+    for (const Clip &clip : clips) {
+      for (int frame = 0; frame + config.frames <= clip.Frames();
+           frame += config.hop) {
+        DoaResult result = estimate(&clip.audio[frame * DOA_CHANNELS]);
+        if (round > 0) continue;
+        double miss = DoaAngleError(result.direction, clip.direction);
+        error += miss;
+        hits += miss <= HIT_DEGREE;
+        estimates++;
+      }
+    }
+    best_seconds = std::min(best_seconds, ThreadCpuSeconds() - start);
+  }
+
+  // Estimates every hop frames, in ms of a second of audio
+  candidate->cpu_ms =
+      best_seconds / estimates * (SAMPLE_RATE / config.hop) * 1000.0;
+  candidate->mean_error = error / estimates;
+  candidate->hits = (double)hits / estimates;
+}
+
+static void PrintUsage(const char *program) {
+  std::cerr << "Usage: " << program
+            << " <CPU ms per second of audio> [options]" << std::endl
+            << "  --labels=FILE   lines of \"WAV DEGREE\" instead of the "
+               "simulation"
+            << std::endl
+            << "  --snr=DB        simulation: talker to noise on every mic "
+               "(10)"
+            << std::endl
+            << "  --rumble=DB     simulation: rumble to talker (0)"
+            << std::endl
+            << "  --directions=N  simulation: talker positions (8)"
+            << std::endl
+            << "  --seconds=S     simulation: audio per position (2)"
+            << std::endl
+            << "  --write=FILE    the configuration to FILE" << std::endl
+            << "  --array         also a hop of half the window, which only "
+               "doa_detection_sample --array honors"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  const char *labels_filename = nullptr;
+  const char *write_filename = nullptr;
+  double snr_db = 10.0, rumble_db = 0.0, seconds = 2.0;
+  int directions = 8;
+  bool overlap = false;
+  static const struct option long_options[] = {
+      {"labels", required_argument, nullptr, 'l'},
+      {"snr", required_argument, nullptr, 's'},
+      {"rumble", required_argument, nullptr, 'r'},
+      {"directions", required_argument, nullptr, 'd'},
+      {"seconds", required_argument, nullptr, 'S'},
+      {"write", required_argument, nullptr, 'w'},
+      {"array", no_argument, nullptr, 'a'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}};
+  int option;
+  while ((option = getopt_long(argc, argv, "h", long_options, nullptr)) !=
+         -1) {
+    switch (option) {
+      case 'l':
+        labels_filename = optarg;
+        break;
+      case 's':
+        snr_db = atof(optarg);
+        break;
+      case 'r':
+        rumble_db = atof(optarg);
+        break;
+      case 'd':
+        directions = std::max(1, atoi(optarg));
+        break;
+      case 'S':
+        seconds = atof(optarg);
+        break;
+      case 'w':
+        write_filename = optarg;
+        break;
+      case 'a':
+        overlap = true;
+        break;
+      default:
+        PrintUsage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+  if (optind >= argc) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  double budget_ms = atof(argv[optind]);
+
+  // The audio every configuration gets
+  std::vector<Clip> clips;
+  std::string audio_name;
+  if (labels_filename) {
+    if (!LoadLabels(labels_filename, &clips)) return 1;
+    audio_name = labels_filename;
+  } else {
+    std::mt19937 random(42);
+    clips.resize(directions);
+    for (int i = 0; i < directions; i++)
+      Simulate(std::fmod(17.0 + i * 360.0 / directions, 360.0), seconds,
+               snr_db, rumble_db, &random, &clips[i]);
+    std::ostringstream name;
+    name << "the simulation (" << directions << " directions of " << seconds
+         << " s, " << snr_db << " dB SNR, " << rumble_db << " dB rumble)";
+    audio_name = name.str();
+  }
+  int shortest_clip = clips[0].Frames();
+  for (const Clip &clip : clips)
+    shortest_clip = std::min(shortest_clip, clip.Frames());
+
+  std::vector<DoaConfig> space = SearchSpace(shortest_clip, overlap);
+  if (space.empty()) {
+    std::cout << "The audio is shorter than the shortest window" << std::endl;
+    return 1;
+  }
+  std::cout << "Trying " << space.size() << " configurations on "
+            << audio_name << std::endl;
+  std::vector<Candidate> candidates(space.size());
+  for (size_t i = 0; i < space.size(); i++) {
+    candidates[i].config = space[i];
+    Evaluate(clips, &candidates[i]);
+  }
+
+  // The Pareto front: from the cheapest up, whatever is more accurate than
+  // everything cheaper (by more than the resolution)
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate &a, const Candidate &b) {
+              return a.cpu_ms != b.cpu_ms ? a.cpu_ms < b.cpu_ms
+                                          : a.mean_error < b.mean_error;
+            });
+  std::vector<const Candidate *> front;
+  for (const Candidate &candidate : candidates)
+    if (front.empty() ||
+        candidate.mean_error < front.back()->mean_error - ERROR_RESOLUTION)
+      front.push_back(&candidate);
+
+  // Along the front the error only falls, so the best within the budget is
+  // the last one that fits
+  const Candidate *chosen = nullptr;
+  std::cout << "CPU ms/s\terror\twithin " << HIT_DEGREE << " deg"
+            << "\tconfiguration (window/hop band fusion engine)" << std::endl;
+  for (const Candidate *candidate : front) {
+    bool fits = candidate->cpu_ms <= budget_ms;
+    if (fits) chosen = candidate;
+    std::cout << candidate->cpu_ms << "\t" << candidate->mean_error << "\t"
+              << candidate->hits * 100.0 << " %\t"
+              << DoaConfigSummary(candidate->config)
+              << (fits ? "" : " (over budget)") << std::endl;
+  }
+  if (!chosen) {
+    std::cout << "Nothing fits into " << budget_ms
+              << " ms of CPU per second of audio" << std::endl;
+    return 1;
+  }
+
+  std::ostringstream comment;
+  comment << "doa_autotune_benchmark, budget " << budget_ms
+          << " ms of CPU per second of audio" << std::endl
+          << chosen->cpu_ms << " ms/s, mean error " << chosen->mean_error
+          << " degree on " << audio_name;
+  std::cout << "Best within " << budget_ms
+            << " ms/s: " << DoaConfigSummary(chosen->config) << std::endl;
+  if (write_filename &&
+      !SaveDoaConfig(write_filename, chosen->config, comment.str()))
+    return 1;
+  return 0;
+}
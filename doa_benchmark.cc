@@ -0,0 +1,475 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_benchmark.cc
+** Runs the DoA estimators on synthetic 4-channel periods (a noise source
+** at a random direction plus independent noise on every mic) and prints
+** how long an estimate takes and how close the results are to the truth
+** and to the double estimator. Needs neither the 4mic_hat nor ALSA.
+**
+** The time-domain lag correlation runs on the same periods, and the
+** method DoaEstimator's auto mode picks for the length is printed. The
+** async estimator gets all periods at once, with every overflow policy.
+**
+** Every FFT backend this CPU runs is checked against kiss_fft as well, the
+** exit code is 2 if one of them is off by more than FFT_TOLERANCE.
+**
+** Usage: doa_benchmark [frames per period] [periods]
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "doa_async.h"
+#include "doa_correlation.h"
+#include "doa_detection.h"
+#include "doa_detection_fixed.h"
+#include "doa_simulation.h"
+#include "fft_backend.h"
+#include "fft_radix4.h"
+
+// Largest difference to kiss_fft a backend may have, relative to the
+// largest bin (forward) or sample (forward and inverse)
+static const double FFT_TOLERANCE = 1e-4;
+
+// Runs of short periods from one direction for the averaged estimator,
+// and its forgetting factor
+static const int AVERAGE_RUN = 8;
+static const double AVERAGE_FORGETTING = 0.8;
+
+// Queue of the async estimator
+static const int ASYNC_QUEUE_PERIODS = 4;
+
+// A synthetic period and where its source is
+struct TestPeriod {
+  double direction;
+  double snr_db;
+  std::vector<int16_t> audio;
+};
+
+// Band-limited noise arriving from direction (see DoaSimulator)
+static void MakePeriod(int frames, double direction, double snr_db,
+                       std::mt19937 *random, TestPeriod *period) {
+  DoaSimulator simulator(frames);
+  period->direction = direction;
+  period->snr_db = snr_db;
+  simulator.MakePeriod(direction, snr_db, random, &period->audio);
+}
+
+// Runs an estimator over all periods and prints its speed and accuracy.
+// reference receives the results if it is empty, otherwise the results
+// are compared with it
+template <typename Estimate>
+void RunCase(const char *name, const std::vector<TestPeriod> &periods,
+             Estimate estimate, std::vector<DoaResult> *reference) {
+  std::vector<DoaResult> results(periods.size());
+
+  // Once to warm up (plans, tables), then timed
+  estimate(periods[0]);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < periods.size(); i++)
+    results[i] = estimate(periods[i]);
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << name << ": " << seconds * 1e6 / periods.size()
+            << " us/estimate" << std::endl;
+
+  // Accuracy per SNR
+  bool compare = !reference->empty();
+  for (size_t first = 0; first < periods.size();) {
+    size_t last = first;
+    double error = 0.0, confidence_difference = 0.0;
+    int same = 0;
+    while (last < periods.size() &&
+           periods[last].snr_db == periods[first].snr_db) {
+      error += DoaAngleError(results[last].direction, periods[last].direction);
+      if (compare) {
+        const DoaResult &other = (*reference)[last];
+        if (results[last].direction == other.direction) same++;
+        confidence_difference =
+            std::max(confidence_difference,
+                     std::abs(results[last].confidence - other.confidence));
+      }
+      last++;
+    }
+
+    std::cout << "  SNR " << periods[first].snr_db
+              << " dB: mean error " << error / (last - first) << " degree";
+    if (compare)
+      std::cout << ", same direction as double " << 100.0 * same / (last - first)
+                << "%, confidence differs by up to " << confidence_difference;
+    std::cout << std::endl;
+    first = last;
+  }
+
+  if (!compare) *reference = results;
+}
+
+// Times forward and inverse transform of one channel of every period and
+// returns the largest difference to kiss_fft
+static double RunFft(RealFft *fft, int frames,
+                     const std::vector<TestPeriod> &periods,
+                     double *microseconds) {
+  RealFft *kiss = CreateRealFft(FFT_BACKEND_KISS, frames);
+  int bins = frames / 2 + 1;
+  std::vector<double> samples(frames * periods.size());
+  for (size_t i = 0; i < periods.size(); i++)
+    for (int n = 0; n < frames; n++)
+      samples[i * frames + n] = periods[i].audio[n * DOA_CHANNELS];
+
+  std::vector<kiss_fft_cpx> spectrum(bins), reference(bins);
+  std::vector<double> roundtrip(frames);
+  fft->Forward(samples.data(), spectrum.data());
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < periods.size(); i++) {
+    fft->Forward(&samples[i * frames], spectrum.data());
+    fft->Inverse(spectrum.data(), roundtrip.data());
+  }
+  auto end = std::chrono::steady_clock::now();
+  *microseconds = std::chrono::duration<double, std::micro>(end - start)
+                      .count() / periods.size();
+
+  double error = 0.0;
+  for (size_t i = 0; i < periods.size(); i++) {
+    const double *period = &samples[i * frames];
+    fft->Forward(period, spectrum.data());
+    kiss->Forward(period, reference.data());
+    double largest = 0.0, difference = 0.0;
+    for (int k = 0; k < bins; k++) {
+      largest = std::max(largest, std::hypot(reference[k].r, reference[k].i));
+      difference = std::max(difference,
+                            std::hypot(spectrum[k].r - reference[k].r,
+                                       spectrum[k].i - reference[k].i));
+    }
+    if (largest > 0.0) error = std::max(error, difference / largest);
+
+    fft->Inverse(reference.data(), roundtrip.data());
+    largest = difference = 0.0;
+    for (int n = 0; n < frames; n++) {
+      largest = std::max(largest, std::abs(period[n]));
+      difference = std::max(difference, std::abs(roundtrip[n] - period[n]));
+    }
+    if (largest > 0.0) error = std::max(error, difference / largest);
+  }
+
+  delete kiss;
+  return error;
+}
+
+// The channels of the periods one after the other, and their spectra
+// from kiss_fftr
+static void SplitChannels(int frames, const std::vector<TestPeriod> &periods,
+                          std::vector<double> *samples,
+                          std::vector<kiss_fft_cpx> *spectra) {
+  int bins = frames / 2 + 1;
+  samples->resize(DOA_CHANNELS * frames * periods.size());
+  spectra->resize(DOA_CHANNELS * bins * periods.size());
+  RealFft *kiss = CreateRealFft(FFT_BACKEND_KISS, frames);
+  for (size_t i = 0; i < periods.size(); i++) {
+    for (int c = 0; c < DOA_CHANNELS; c++) {
+      double *channel = &(*samples)[(i * DOA_CHANNELS + c) * frames];
+      for (int n = 0; n < frames; n++)
+        channel[n] = periods[i].audio[n * DOA_CHANNELS + c];
+      kiss->Forward(channel, &(*spectra)[(i * DOA_CHANNELS + c) * bins]);
+    }
+  }
+  delete kiss;
+}
+
+// Times transform(period samples, period spectra) on the 4 channels of
+// every period and returns the largest difference to kiss_fftr, relative
+// to the largest bin of the period
+template <typename Transform>
+double RunChannels(int frames, const std::vector<double> &samples,
+                   const std::vector<kiss_fft_cpx> &reference,
+                   Transform transform, double *microseconds) {
+  int bins = frames / 2 + 1;
+  size_t periods = samples.size() / (DOA_CHANNELS * frames);
+  std::vector<kiss_fft_cpx> spectra(reference.size());
+  transform(&samples[0], &spectra[0]);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < periods; i++)
+    transform(&samples[i * DOA_CHANNELS * frames],
+              &spectra[i * DOA_CHANNELS * bins]);
+  auto end = std::chrono::steady_clock::now();
+  *microseconds = std::chrono::duration<double, std::micro>(end - start)
+                      .count() / periods;
+
+  double error = 0.0;
+  for (size_t i = 0; i < periods; i++) {
+    double largest = 0.0, difference = 0.0;
+    for (int k = 0; k < DOA_CHANNELS * bins; k++) {
+      const kiss_fft_cpx &a = spectra[i * DOA_CHANNELS * bins + k];
+      const kiss_fft_cpx &b = reference[i * DOA_CHANNELS * bins + k];
+      largest = std::max(largest, std::hypot(b.r, b.i));
+      difference = std::max(difference, std::hypot(a.r - b.r, a.i - b.i));
+    }
+    if (largest > 0.0) error = std::max(error, difference / largest);
+  }
+  return error;
+}
+
+// Runs of AVERAGE_RUN short periods from one direction, each estimated
+// alone and with the cross-spectra averaged since the start of the run
+// (where a hotword would reset it). Prints the errors at the end of the
+// runs, where a detection would read the direction
+static void RunAveraging(int frames, int runs, const double *snr_db,
+                         int snr_count) {
+  std::mt19937 random(5);
+  std::uniform_real_distribution<double> angle(0.0, 360.0);
+  DoaEstimator alone, averaged;
+  averaged.SetForgetting(AVERAGE_FORGETTING);
+
+  std::cout << "Runs of " << AVERAGE_RUN << " periods of " << frames
+            << " frames, averaged with forgetting " << AVERAGE_FORGETTING
+            << ":" << std::endl;
+  for (int s = 0; s < snr_count; s++) {
+    double alone_error = 0.0, averaged_error = 0.0;
+    for (int run = 0; run < runs; run++) {
+      double direction = angle(random);
+      averaged.ResetAverage();
+      for (int i = 0; i < AVERAGE_RUN; i++) {
+        TestPeriod period;
+        MakePeriod(frames, direction, snr_db[s], &random, &period);
+        DoaResult a = alone.Estimate(period.audio, FrameTag());
+        DoaResult b = averaged.Estimate(period.audio, FrameTag());
+        if (i < AVERAGE_RUN - 1) continue;
+        alone_error += DoaAngleError(a.direction, direction);
+        averaged_error += DoaAngleError(b.direction, direction);
+      }
+    }
+    std::cout << "  SNR " << snr_db[s] << " dB: mean error "
+              << alone_error / runs << " degree alone, "
+              << averaged_error / runs << " degree averaged" << std::endl;
+  }
+}
+
+// Submits all periods to the async estimator as fast as possible, once
+// per overflow policy, and prints how long Submit held the caller up and
+// how many periods were dropped. Every future must still get a result
+static void RunAsync(const std::vector<TestPeriod> &periods) {
+  std::vector<DoaAudio> audio;
+  for (const TestPeriod &period : periods)
+    audio.push_back(std::make_shared<const std::vector<int16_t>>(period.audio));
+
+  for (int i = DOA_OVERFLOW_BLOCK; i <= DOA_OVERFLOW_COALESCE; i++) {
+    DoaOverflowPolicy policy = (DoaOverflowPolicy)i;
+    AsyncDoaEstimator async_estimator;
+    async_estimator.Start(ASYNC_QUEUE_PERIODS, policy);
+
+    std::vector<std::future<DoaResult>> futures;
+    double longest = 0.0, total = 0.0;
+    for (size_t p = 0; p < audio.size(); p++) {
+      auto start = std::chrono::steady_clock::now();
+      futures.push_back(async_estimator.Submit(audio[p], FrameTag()));
+      auto end = std::chrono::steady_clock::now();
+      double seconds = std::chrono::duration<double>(end - start).count();
+      longest = std::max(longest, seconds);
+      total += seconds;
+    }
+    for (auto &future : futures) future.get();
+    async_estimator.Stop();
+
+    std::cout << "Async, " << DoaOverflowPolicyName(policy) << ": "
+              << total * 1e6 / audio.size() << " us/submit, up to "
+              << longest * 1e6 << " us, " << async_estimator.Dropped()
+              << " of " << audio.size() << " periods dropped" << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  int frames = argc > 1 ? atoi(argv[1]) : 4096;
+  int count = argc > 2 ? atoi(argv[2]) : 200;
+  if (frames < 64 || frames % 2) {
+    std::cerr << "Usage: " << argv[0] << " [frames per period] [periods]"
+              << std::endl;
+    return 1;
+  }
+  if (count < 1) count = 1;
+
+  // The same periods for every estimator, at a few noise levels
+  std::mt19937 random(4);
+  std::uniform_real_distribution<double> angle(0.0, 360.0);
+  const double snr_db[] = {20.0, 10.0, 0.0, -5.0};
+  std::vector<TestPeriod> periods;
+  for (double snr : snr_db) {
+    for (int i = 0; i < count; i++) {
+      periods.push_back(TestPeriod());
+      MakePeriod(frames, angle(random), snr, &random, &periods.back());
+    }
+  }
+  std::cout << "Periods: " << periods.size() << " of " << frames
+            << " frames" << std::endl;
+
+  std::vector<DoaResult> reference;
+  DoaEstimator estimator;
+  RunCase("double",
+          periods,
+          [&](const TestPeriod &period) {
+            return estimator.Estimate(period.audio, FrameTag());
+          },
+          &reference);
+
+  DoaFixedEstimator fixed_estimator;
+  RunCase("fixed-point",
+          periods,
+          [&](const TestPeriod &period) {
+            return fixed_estimator.Estimate(period.audio, FrameTag());
+          },
+          &reference);
+
+  // The FFT backends against kiss_fft, alone and under the estimator
+  int status = 0;
+  double kiss_microseconds = 0.0;
+  for (int i = 0; i < FFT_BACKEND_COUNT; i++) {
+    FftBackend backend = (FftBackend)i;
+    if (!FftBackendAvailable(backend)) continue;
+
+    // The radix-4 ones with planned stages as well, if the length has a
+    // fixed transform
+    for (int fixed = 1; fixed >= 0; fixed--) {
+      const Radix4Kernels *kernels = Radix4BackendKernels(backend);
+      RealFft *fft = !kernels ? CreateRealFft(backend, frames)
+                              : CreateRadix4Fft(backend, kernels, frames,
+                                                fixed != 0);
+      std::string name = FftBackendName(backend);
+      if (!fixed) name += " (planned stages)";
+
+      double microseconds;
+      double error = RunFft(fft, frames, periods, &microseconds);
+      delete fft;
+      if (backend == FFT_BACKEND_KISS) kiss_microseconds = microseconds;
+      std::cout << "FFT " << name << ": " << microseconds
+                << " us/forward+inverse, " << kiss_microseconds / microseconds
+                << "x kiss, differs by up to " << error;
+      if (error > FFT_TOLERANCE) {
+        std::cout << " (more than " << FFT_TOLERANCE << ")";
+        status = 2;
+      }
+      std::cout << std::endl;
+
+      bool has_fixed = false;
+      for (int j = 0; j < RADIX4_FIXED_COUNT; j++)
+        has_fixed |= frames == RADIX4_FIXED_MIN_LENGTH << j;
+      if (!kernels || !has_fixed) break;
+    }
+  }
+
+  for (int i = 1; i < FFT_BACKEND_COUNT; i++) {
+    FftBackend backend = (FftBackend)i;
+    if (!FftBackendAvailable(backend)) continue;
+
+    DoaEstimator backend_estimator(backend);
+    std::string name = std::string("double, FFT ") + FftBackendName(backend);
+    RunCase(name.c_str(),
+            periods,
+            [&](const TestPeriod &period) {
+              return backend_estimator.Estimate(period.audio, FrameTag());
+            },
+            &reference);
+  }
+
+  // The 4 channels one by one, as the mic pairs packed into one complex
+  // kiss_fft each and, for the radix-4 backends, batched with one channel
+  // per vector lane
+  std::vector<double> channel_samples;
+  std::vector<kiss_fft_cpx> channel_spectra;
+  SplitChannels(frames, periods, &channel_samples, &channel_spectra);
+  int bins = frames / 2 + 1;
+  for (int i = 0; i < FFT_BACKEND_COUNT; i++) {
+    FftBackend backend = (FftBackend)i;
+    if (!FftBackendAvailable(backend)) continue;
+
+    // The scalar one has no lanes to batch
+    if (backend == FFT_BACKEND_RADIX4) continue;
+
+    RealFft *fft = CreateRealFft(backend, frames);
+    double single_microseconds, together_microseconds;
+    RunChannels(frames, channel_samples, channel_spectra,
+                [&](const double *samples, kiss_fft_cpx *spectra) {
+                  for (int c = 0; c < DOA_CHANNELS; c++)
+                    fft->Forward(samples + c * frames, spectra + c * bins);
+                },
+                &single_microseconds);
+    double error;
+    if (backend == FFT_BACKEND_KISS) {
+      error = RunChannels(
+          frames, channel_samples, channel_spectra,
+          [&](const double *samples, kiss_fft_cpx *spectra) {
+            for (int c = 0; c < 2; c++)
+              fft->ForwardPair(samples + c * frames,
+                               samples + (c + 2) * frames, spectra + c * bins,
+                               spectra + (c + 2) * bins);
+          },
+          &together_microseconds);
+    } else {
+      error = RunChannels(
+          frames, channel_samples, channel_spectra,
+          [&](const double *samples, kiss_fft_cpx *spectra) {
+            fft->ForwardBatch(DOA_CHANNELS, samples, spectra);
+          },
+          &together_microseconds);
+    }
+    delete fft;
+
+    std::cout << "FFT " << FftBackendName(backend) << " of 4 channels: "
+              << single_microseconds << " us one by one, "
+              << together_microseconds
+              << (backend == FFT_BACKEND_KISS ? " us as 2 pairs ("
+                                              : " us batched (")
+              << single_microseconds / together_microseconds
+              << "x), differs by up to " << error;
+    if (error > FFT_TOLERANCE) {
+      std::cout << " (more than " << FFT_TOLERANCE << ")";
+      status = 2;
+    }
+    std::cout << std::endl;
+  }
+
+  DoaEstimator paired_estimator;
+  paired_estimator.SetPairedTransform(true);
+  RunCase("double, FFT kiss paired",
+          periods,
+          [&](const TestPeriod &period) {
+            return paired_estimator.Estimate(period.audio, FrameTag());
+          },
+          &reference);
+
+  // The 7 lags in the time domain, and what auto makes of them with the
+  // fastest backend
+  DoaLagCorrelator correlator;
+  RunCase("lag correlation",
+          periods,
+          [&](const TestPeriod &period) {
+            return correlator.Estimate(period.audio, FrameTag());
+          },
+          &reference);
+
+  DoaEstimator auto_estimator(FastestFftBackend());
+  auto_estimator.SetMethod(DOA_METHOD_AUTO);
+  DoaMethod method =
+      auto_estimator.ResolvedMethod(periods[0].audio.data(), frames);
+  std::cout << "Auto method with FFT " << FftBackendName(FastestFftBackend())
+            << ": " << DoaMethodName(method) << std::endl;
+
+  RunAsync(periods);
+
+  // Short periods, averaged
+  RunAveraging(frames / AVERAGE_RUN, count, snr_db,
+               sizeof(snr_db) / sizeof(snr_db[0]));
+
+  return status;
+}
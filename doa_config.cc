@@ -0,0 +1,165 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_config.cc
+** The settings of the DoA estimator in a file
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Shortest window, the lags need a few bins at least
+static const int MIN_FRAMES = 16;
+
+DoaConfig DefaultDoaConfig() {
+  DoaConfig config;
+  config.frames = 4096;
+  config.hop = 4096;
+  config.band_low_hz = 0.0;
+  config.band_high_hz = 0.0;
+  config.fusion = DOA_FUSION_WHOLE_LAGS;
+  config.fixed_point = false;
+  config.fft_backend = FFT_BACKEND_KISS;
+  config.method = DOA_METHOD_GCC_PHAT;
+  return config;
+}
+
+// Takes value for key, false if the key is unknown or the value is wrong
+static bool ParseKey(const std::string &key, const std::string &value,
+                     DoaConfig *config) {
+  char *end;
+  if (key == "frames" || key == "hop") {
+    long frames = strtol(value.c_str(), &end, 10);
+    if (*end || frames < 1 || frames > (1 << 20)) return false;
+    (key == "frames" ? config->frames : config->hop) = frames;
+    return true;
+  }
+  if (key == "band_low_hz" || key == "band_high_hz") {
+    double hz = strtod(value.c_str(), &end);
+    if (*end || hz < 0.0) return false;
+    (key == "band_low_hz" ? config->band_low_hz : config->band_high_hz) = hz;
+    return true;
+  }
+  if (key == "fusion") return ParseDoaFusion(value.c_str(), &config->fusion);
+  if (key == "precision") {
+    if (value != "double" && value != "fixed") return false;
+    config->fixed_point = value == "fixed";
+    return true;
+  }
+  if (key == "fft") {
+    if (ParseFftBackend(value.c_str(), &config->fft_backend)) return true;
+
+    // Tuned on another machine, most likely
+    for (int i = 0; i < FFT_BACKEND_COUNT; i++) {
+      if (value == FftBackendName((FftBackend)i)) {
+        config->fft_backend = FastestFftBackend();
+        std::cout << "FFT " << value << " is not available, using "
+                  << FftBackendName(config->fft_backend) << std::endl;
+        return true;
+      }
+    }
+    return false;
+  }
+  if (key == "method") return ParseDoaMethod(value.c_str(), &config->method);
+  return false;
+}
+
+bool LoadDoaConfig(const char *path, DoaConfig *config) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cout << "Failed to open " << path << " (" << strerror(errno) << ")"
+              << std::endl;
+    return false;
+  }
+
+  std::string line;
+  for (int number = 1; std::getline(file, line); number++) {
+    size_t comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+    size_t equals = line.find('=');
+    std::istringstream key_stream(line.substr(0, equals));
+    std::string key, value, rest;
+    if (!(key_stream >> key)) continue;
+    if (equals != std::string::npos) {
+      std::istringstream value_stream(line.substr(equals + 1));
+      value_stream >> value >> rest;
+    }
+    if (value.empty() || !rest.empty() || !ParseKey(key, value, config)) {
+      std::cout << "Failed to load " << path << " (line " << number
+                << " is not a setting)" << std::endl;
+      return false;
+    }
+  }
+
+  if (config->frames < MIN_FRAMES || config->frames % 2 ||
+      config->hop > config->frames || config->frames % config->hop) {
+    std::cout << "Failed to load " << path << " (frames have to be even and "
+              << "at least " << MIN_FRAMES << ", and a multiple of hop)"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool SaveDoaConfig(const char *path, const DoaConfig &config,
+                   const std::string &comment) {
+  std::ofstream file(path, std::ios::trunc);
+  std::istringstream lines(comment);
+  std::string line;
+  while (std::getline(lines, line)) file << "# " << line << std::endl;
+  file << "frames = " << config.frames << std::endl
+       << "hop = " << config.hop << std::endl
+       << "band_low_hz = " << config.band_low_hz << std::endl
+       << "band_high_hz = " << config.band_high_hz << std::endl
+       << "fusion = " << DoaFusionName(config.fusion) << std::endl
+       << "precision = " << (config.fixed_point ? "fixed" : "double")
+       << std::endl
+       << "fft = " << FftBackendName(config.fft_backend) << std::endl
+       << "method = " << DoaMethodName(config.method) << std::endl;
+  if (!file) {
+    std::cout << "Failed to write " << path << " (" << strerror(errno) << ")"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::string DoaConfigSummary(const DoaConfig &config) {
+  std::ostringstream summary;
+  summary << config.frames << "/" << config.hop << " ";
+  if (config.band_low_hz > 0.0 || config.band_high_hz > 0.0)
+    summary << config.band_low_hz << "-" << config.band_high_hz << "Hz ";
+  else
+    summary << "all-bins ";
+  summary << DoaFusionName(config.fusion) << " ";
+  if (config.fixed_point)
+    summary << "fixed";
+  else if (config.method == DOA_METHOD_GCC_PHAT)
+    summary << "gcc-phat/" << FftBackendName(config.fft_backend);
+  else
+    summary << DoaMethodName(config.method);
+  return summary.str();
+}
+
+void ApplyDoaConfig(const DoaConfig &config, DoaEstimator *estimator) {
+  estimator->SetFftBackend(config.fft_backend);
+  estimator->SetMethod(config.method);
+  estimator->SetFusion(config.fusion);
+  estimator->SetBand(config.band_low_hz, config.band_high_hz);
+}
+
+void ApplyDoaConfig(const DoaConfig &config, DoaFixedEstimator *estimator) {
+  estimator->SetFusion(config.fusion);
+  estimator->SetBand(config.band_low_hz, config.band_high_hz);
+}
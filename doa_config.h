@@ -0,0 +1,67 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_config.h
+** The settings of the DoA estimator that trade accuracy for CPU, in a file
+** doa_autotune_benchmark writes and doa_detection_sample --config loads at
+** startup. One "key = value" per line, # starts a comment, keys that are
+** left out keep their value:
+**
+**   frames = 1024           window of an estimate
+**   hop = 512               frames from one estimate to the next (only
+**                           --array, otherwise it is the window)
+**   band_low_hz = 300       bins below count for nothing, 0 for all
+**   band_high_hz = 3400     bins above count for nothing, 0 for all
+**   fusion = interpolated   whole or interpolated (DoaFusion)
+**   precision = double      double or fixed (DoaFixedEstimator)
+**   fft = avx2              as --fft takes it
+**   method = gcc-phat       as --method takes it
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_CONFIG_H
+#define DOA_CONFIG_H
+
+#include <string>
+
+#include "doa_detection.h"
+#include "doa_detection_fixed.h"
+#include "fft_backend.h"
+
+struct DoaConfig {
+  int frames;
+  int hop;
+  double band_low_hz;
+  double band_high_hz;
+  DoaFusion fusion;
+  bool fixed_point;
+  FftBackend fft_backend;
+  DoaMethod method;
+};
+
+// What doa_detection_sample does without options: 4096 frames without
+// overlap, the whole band, whole lags, double, kiss_fft and gcc-phat
+DoaConfig DefaultDoaConfig();
+
+// Reads the keys of path into config. False (and config partly read) if
+// the file does not open or has a line we do not understand. An FFT this
+// machine does not have becomes the fastest one it has
+bool LoadDoaConfig(const char *path, DoaConfig *config);
+
+// Writes all keys, after comment (one "# " line per line of it)
+bool SaveDoaConfig(const char *path, const DoaConfig &config,
+                   const std::string &comment);
+
+// The keys on one line, e.g. for a table of configurations
+std::string DoaConfigSummary(const DoaConfig &config);
+
+// Sets the estimator up as the configuration says. The window and the hop
+// are for whoever reads the periods
+void ApplyDoaConfig(const DoaConfig &config, DoaEstimator *estimator);
+void ApplyDoaConfig(const DoaConfig &config, DoaFixedEstimator *estimator);
+
+#endif  // DOA_CONFIG_H
@@ -0,0 +1,245 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_correlation.cc
+** Time-domain variant of the DoaEstimator for short periods
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_correlation.h"
+
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// Stage timing
+#include "pipeline_stats.h"
+
+// Added to the zero lag of the autocorrelation, so the filter never whitens
+// away more than 40dB (and silence gives no division by zero)
+static const double LPC_NOISE_FLOOR = 1e-4;
+
+namespace {
+
+#if defined(__SSE2__)
+struct LagVector {
+  typedef __m128 Type;
+  static const int WIDTH = 4;
+  static Type Load(const float *p) { return _mm_loadu_ps(p); }
+  static void Store(float *p, Type a) { _mm_storeu_ps(p, a); }
+  static Type Set(float a) { return _mm_set1_ps(a); }
+  static Type MulAdd(Type a, Type b, Type c) {
+    return _mm_add_ps(a, _mm_mul_ps(b, c));
+  }
+  static float Sum(Type a) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, a);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+};
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+struct LagVector {
+  typedef float32x4_t Type;
+  static const int WIDTH = 4;
+  static Type Load(const float *p) { return vld1q_f32(p); }
+  static void Store(float *p, Type a) { vst1q_f32(p, a); }
+  static Type Set(float a) { return vdupq_n_f32(a); }
+  static Type MulAdd(Type a, Type b, Type c) { return vmlaq_f32(a, b, c); }
+  static float Sum(Type a) {
+    float32x2_t half = vadd_f32(vget_low_f32(a), vget_high_f32(a));
+    return vget_lane_f32(vpadd_f32(half, half), 0);
+  }
+};
+#else
+struct LagVector {
+  typedef float Type;
+  static const int WIDTH = 1;
+  static Type Load(const float *p) { return *p; }
+  static void Store(float *p, Type a) { *p = a; }
+  static Type Set(float a) { return a; }
+  static Type MulAdd(Type a, Type b, Type c) { return a + b * c; }
+  static float Sum(Type a) { return a; }
+};
+#endif
+
+}  // namespace
+
+// residual[n] = sum of filter[k] * samples[n - k], samples has LPC_ORDER
+// zeros (or the samples before) in front of it
+static void WhitenChannel(const float filter[LPC_ORDER + 1],
+                          const float *samples, int frames, float *residual) {
+  typedef LagVector V;
+  V::Type taps[LPC_ORDER + 1];
+  for (int k = 0; k <= LPC_ORDER; k++) taps[k] = V::Set(filter[k]);
+
+  int n = 0;
+  for (; n + V::WIDTH <= frames; n += V::WIDTH) {
+    V::Type sum = V::Set(0.0f);
+    for (int k = 0; k <= LPC_ORDER; k++)
+      sum = V::MulAdd(sum, taps[k], V::Load(samples + n - k));
+    V::Store(residual + n, sum);
+  }
+  for (; n < frames; n++) {
+    float sum = 0.0f;
+    for (int k = 0; k <= LPC_ORDER; k++) sum += filter[k] * samples[n - k];
+    residual[n] = sum;
+  }
+}
+
+// sig[n + lag] * ref[n] summed over count samples for the 7 lags, with one
+// load of ref for all of them, and the energies of both over the samples
+static void LagDots(const float *sig, const float *ref, int count,
+                    float dots[DOA_LAG_COUNT], float *sig_energy,
+                    float *ref_energy) {
+  typedef LagVector V;
+  V::Type sums[DOA_LAG_COUNT], sig_sum = V::Set(0.0f), ref_sum = V::Set(0.0f);
+  for (int i = 0; i < DOA_LAG_COUNT; i++) sums[i] = V::Set(0.0f);
+
+  int n = 0;
+  for (; n + V::WIDTH <= count; n += V::WIDTH) {
+    V::Type r = V::Load(ref + n);
+    for (int i = 0; i < DOA_LAG_COUNT; i++)
+      sums[i] = V::MulAdd(sums[i], V::Load(sig + n + i - DOA_MAX_LAG), r);
+    V::Type s = V::Load(sig + n);
+    sig_sum = V::MulAdd(sig_sum, s, s);
+    ref_sum = V::MulAdd(ref_sum, r, r);
+  }
+
+  for (int i = 0; i < DOA_LAG_COUNT; i++) dots[i] = V::Sum(sums[i]);
+  *sig_energy = V::Sum(sig_sum);
+  *ref_energy = V::Sum(ref_sum);
+  for (; n < count; n++) {
+    for (int i = 0; i < DOA_LAG_COUNT; i++)
+      dots[i] += sig[n + i - DOA_MAX_LAG] * ref[n];
+    *sig_energy += sig[n] * sig[n];
+    *ref_energy += ref[n] * ref[n];
+  }
+}
+
+DoaLagCorrelator::DoaLagCorrelator()
+    : frames_(0),
+      periods_since_update_(0),
+      fusion_(DOA_FUSION_WHOLE_LAGS) {
+  filter_[0] = 1.0f;
+  for (int k = 1; k <= LPC_ORDER; k++) filter_[k] = 0.0f;
+}
+
+// Levinson-Durbin on the autocorrelation of all channels together. The
+// filter stays as it is if the channels are silent
+void DoaLagCorrelator::UpdateFilter() {
+  double autocorrelation[LPC_ORDER + 1] = {0.0};
+  for (int channel = 0; channel < DOA_CHANNELS; channel++) {
+    const float *samples = &samples_[channel * (LPC_ORDER + frames_)];
+    for (int k = 0; k <= LPC_ORDER; k++) {
+      double sum = 0.0;
+      for (int n = LPC_ORDER + k; n < LPC_ORDER + frames_; n++)
+        sum += (double)samples[n] * samples[n - k];
+      autocorrelation[k] += sum;
+    }
+  }
+  if (autocorrelation[0] <= 0.0) return;
+  autocorrelation[0] *= 1.0 + LPC_NOISE_FLOOR;
+
+  double a[LPC_ORDER + 1] = {1.0}, previous[LPC_ORDER + 1];
+  double error = autocorrelation[0];
+  for (int i = 1; i <= LPC_ORDER; i++) {
+    double sum = autocorrelation[i];
+    for (int j = 1; j < i; j++) sum += a[j] * autocorrelation[i - j];
+    double reflection = -sum / error;
+
+    for (int j = 0; j < i; j++) previous[j] = a[j];
+    for (int j = 1; j < i; j++) a[j] += reflection * previous[i - j];
+    a[i] = reflection;
+    error *= 1.0 - reflection * reflection;
+  }
+
+  for (int k = 0; k <= LPC_ORDER; k++) filter_[k] = (float)a[k];
+}
+
+// Normalized correlation of the whitened pair at the lags -3 to 3. Only
+// samples with all 7 lags inside the period count
+void DoaLagCorrelator::Correlate(int channel, int ref_channel,
+                                 double cc_result[DOA_LAG_COUNT]) const {
+  int count = frames_ - 2 * DOA_MAX_LAG;
+  if (count <= 0) {
+    for (int i = 0; i < DOA_LAG_COUNT; i++) cc_result[i] = 0.0;
+    return;
+  }
+
+  float dots[DOA_LAG_COUNT], sig_energy, ref_energy;
+  LagDots(&residuals_[channel * frames_ + DOA_MAX_LAG],
+          &residuals_[ref_channel * frames_ + DOA_MAX_LAG], count, dots,
+          &sig_energy, &ref_energy);
+
+  double energy = std::sqrt((double)sig_energy * ref_energy);
+  for (int i = 0; i < DOA_LAG_COUNT; i++)
+    cc_result[i] = energy > 0.0 ? std::fabs(dots[i]) / energy : 0.0;
+}
+
+DoaResult DoaLagCorrelator::Estimate(const int16_t *interleaved, int frames,
+                                     const FrameTag &tag) {
+  DoaResult result;
+  result.tag = tag;
+  result.output_ns = 0;
+  result.compute_start_ns = PipelineClockNs();
+
+  StageLapTimer stage_timer;
+  if (frames != frames_) {
+    frames_ = frames;
+    samples_.assign(DOA_CHANNELS * (LPC_ORDER + frames), 0.0f);
+    residuals_.resize(DOA_CHANNELS * frames);
+    periods_since_update_ = 0;
+  }
+
+  // Create the channels for each mic behind their LPC_ORDER zeros, scaled
+  // to -1 to 1
+  for (int channel = 0; channel < DOA_CHANNELS; channel++) {
+    float *samples = &samples_[channel * (LPC_ORDER + frames) + LPC_ORDER];
+    for (int i = channel, j = 0; j < frames; i += DOA_CHANNELS, j++)
+      samples[j] = interleaved[i] * (1.0f / 32768.0f);
+  }
+  stage_timer.Lap(STAGE_DEINTERLEAVE);
+  CountPerfFrame();
+
+  // Whiten, with a new filter every LPC_UPDATE_PERIODS periods
+  if (periods_since_update_ == 0) UpdateFilter();
+  if (++periods_since_update_ == LPC_UPDATE_PERIODS) periods_since_update_ = 0;
+  for (int channel = 0; channel < DOA_CHANNELS; channel++)
+    WhitenChannel(filter_,
+                  &samples_[channel * (LPC_ORDER + frames) + LPC_ORDER],
+                  frames, &residuals_[channel * frames]);
+  stage_timer.Lap(STAGE_PHAT);
+
+  // The 7 lags of the two channel combinations
+  double cc1[DOA_LAG_COUNT], cc2[DOA_LAG_COUNT];
+  Correlate(0, 2, cc1);
+  Correlate(1, 3, cc2);
+  stage_timer.Lap(STAGE_INVERSE_FFT);
+
+  // The delays at the maximum of both
+  result.direction =
+      FuseDirection(PairDelay(cc1, fusion_), PairDelay(cc2, fusion_));
+
+  // Same confidence as the GCC-PHAT, 1 for a perfect match on both pairs
+  FindPeaks(cc1, cc2, &result);
+  result.confidence = result.peak_count ? result.peaks[0].strength : 0.0;
+  stage_timer.Lap(STAGE_PEAK_SEARCH);
+
+  result.compute_done_ns = PipelineClockNs();
+  return result;
+}
+
+DoaResult DoaLagCorrelator::Estimate(
+    const std::vector<int16_t> &audio_buffer_4_channels, const FrameTag &tag) {
+  return Estimate(audio_buffer_4_channels.data(),
+                  audio_buffer_4_channels.size() / DOA_CHANNELS, tag);
+}
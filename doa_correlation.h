@@ -0,0 +1,65 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_correlation.h
+** Time-domain variant of the DoaEstimator for short periods. Only the lags
+** -3 to 3 are possible on the 4mic_hat, so instead of two forward and an
+** inverse FFT per pair it computes those 7 lags directly, as SIMD dot
+** products over the period. A low-order LPC filter whitens the channels
+** first, which does for the time domain what PHAT does for GCC; it is
+** estimated from all channels together (so it shifts none of them against
+** the others) and only every LPC_UPDATE_PERIODS periods.
+**
+** DoaEstimator picks it on its own where it is faster, see
+** DoaEstimator::SetMethod.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_CORRELATION_H
+#define DOA_CORRELATION_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "doa_detection.h"
+
+// Order of the whitening filter, and how many periods it is kept
+static const int LPC_ORDER = 8;
+static const int LPC_UPDATE_PERIODS = 8;
+
+class DoaLagCorrelator {
+ public:
+  DoaLagCorrelator();
+
+  // How the pairs become a direction, see DoaEstimator::SetFusion
+  void SetFusion(DoaFusion fusion) { fusion_ = fusion; }
+
+  // Estimates the direction of an interleaved 4-channel period
+  DoaResult Estimate(const int16_t *interleaved, int frames,
+                     const FrameTag &tag);
+  DoaResult Estimate(const std::vector<int16_t> &audio_buffer_4_channels,
+                     const FrameTag &tag);
+
+ private:
+  void UpdateFilter();
+  void Correlate(int channel, int ref_channel,
+                 double cc_result[DOA_LAG_COUNT]) const;
+
+ private:
+  int frames_;
+  int periods_since_update_;
+  DoaFusion fusion_;
+
+  // 1, a_1 .. a_LPC_ORDER
+  float filter_[LPC_ORDER + 1];
+
+  // DOA_CHANNELS blocks of frames samples, and of their residuals
+  std::vector<float> samples_;
+  std::vector<float> residuals_;
+};
+
+#endif  // DOA_CORRELATION_H
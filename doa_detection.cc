@@ -11,133 +11,446 @@
 **
 ** Author: Oliver Pahl
 ** -------------------------------------------------------------------------*/
+#include "doa_detection.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
 #include <complex>
 #include <vector>
 
-// Simple rfft
-#include "contrib/kiss_fft/kiss_fftr.h"
+#include "doa_correlation.h"
 
-// The defines we need
-static const double SOUND_SPEED = 340.0;
-static const double MIC_DISTANCE_4 = 0.081;
-static const double MAX_TDOA_4 = MIC_DISTANCE_4 / SOUND_SPEED;
-static const double PI = 3.14159265358979323846;
+// Stage timing
+#include "pipeline_stats.h"
 
-// Direct port of the doa_respeaker_4mic_arry.py with
-// hardcoded values for unchanging parts
-double GccPhat(double sig[], double refsig[], int len) {
-  // Prepare the cfg for fftr
-  kiss_fftr_cfg rfft_cfg = kiss_fftr_alloc(len, 0, 0, 0);
+// How often auto runs each method on the first period of a length, the
+// fastest run counts
+static const int AUTO_TIMING_RUNS = 3;
 
-  // Get space for the results of the transformation
-  kiss_fft_cpx sig_out[len / 2 + 1];
-  kiss_fft_cpx refsig_out[len / 2 + 1];
+static const char *const METHOD_NAMES[] = {"gcc-phat", "lags", "auto"};
 
-  // Do the transformation
-  kiss_fftr(rfft_cfg, sig, sig_out);
-  kiss_fftr(rfft_cfg, refsig, refsig_out);
-
-  // Cross-Correlation table
-  kiss_fft_cpx cc[len / 2 + 1];
-
-  // Compute values for the Cross-Correlation table
-  std::complex<double> r[len];
-  std::complex<double> tmp;
-  for (int i = 0; i < len; i++) {
-    reinterpret_cast<double *>(r)[2 * i] =
-        (sig_out[i].r * refsig_out[i].r - sig_out[i].i * -refsig_out[i].i);
-    reinterpret_cast<double *>(r)[2 * i + 1] =
-        (sig_out[i].r * -refsig_out[i].i + sig_out[i].i * refsig_out[i].r);
-    tmp = r[i] / std::abs(r[i]);
-    cc[i].r = tmp.real();
-    cc[i].i = tmp.imag();
+const char *DoaMethodName(DoaMethod method) {
+  if (method < DOA_METHOD_GCC_PHAT || method > DOA_METHOD_AUTO)
+    return "unknown";
+  return METHOD_NAMES[method];
+}
+
+bool ParseDoaMethod(const char *name, DoaMethod *method) {
+  for (int i = DOA_METHOD_GCC_PHAT; i <= DOA_METHOD_AUTO; i++) {
+    if (strcmp(name, METHOD_NAMES[i]) == 0) {
+      *method = (DoaMethod)i;
+      return true;
+    }
   }
+  return false;
+}
 
-  // Clear the config
-  free(rfft_cfg);
+DoaEstimator::DoaEstimator(FftBackend fft_backend)
+    : frames_(0),
+      fft_backend_(fft_backend),
+      fft_(nullptr),
+      paired_transform_(false),
+      method_(DOA_METHOD_GCC_PHAT),
+      fusion_(DOA_FUSION_WHOLE_LAGS),
+      correlator_(nullptr),
+      resolved_frames_(0),
+      resolved_method_(DOA_METHOD_GCC_PHAT),
+      batch_frames_(0),
+      batch_count_(0),
+      batch_faster_(false),
+      forgetting_(0.0),
+      band_low_hz_(0.0),
+      band_high_hz_(0.0) {}
 
-  // Prepare a config for ifttr
-  kiss_fftr_cfg irfft_cfg = kiss_fftr_alloc(len, 1, 0, 0);
+DoaEstimator::~DoaEstimator() {
+  delete fft_;
+  delete correlator_;
+}
 
-  // Compute irfft
-  double cc_irfft_res[len];
-  kiss_fftri(irfft_cfg, cc, cc_irfft_res);
-
-  // Clear the config
-  free(irfft_cfg);
-
-  // Build the Cross-Correlation result array
-  double cc_result[7];
-  cc_result[0] = std::abs(cc_irfft_res[len - 3]);
-  cc_result[1] = std::abs(cc_irfft_res[len - 2]);
-  cc_result[2] = std::abs(cc_irfft_res[len - 1]);
-  cc_result[3] = std::abs(cc_irfft_res[0]);
-  cc_result[4] = std::abs(cc_irfft_res[1]);
-  cc_result[5] = std::abs(cc_irfft_res[2]);
-  cc_result[6] = std::abs(cc_irfft_res[3]);
-
-  // Find the maxximum in the result array and
-  // note its position in the array
-  int pos = -1;
-  double curr = cc_result[0];
-  for (int i = 1; i < 7; i++) {
-    if (curr < cc_result[i]) {
-      curr = cc_result[i];
-      pos = i;
-    }
+void DoaEstimator::SetMethod(DoaMethod method) {
+  method_ = method;
+
+  // Auto decides again
+  resolved_frames_ = 0;
+}
+
+void DoaEstimator::SetFusion(DoaFusion fusion) {
+  fusion_ = fusion;
+  if (correlator_) correlator_->SetFusion(fusion);
+}
+
+void DoaEstimator::SetBand(double low_hz, double high_hz) {
+  band_low_hz_ = low_hz;
+  band_high_hz_ = high_hz;
+}
+
+DoaMethod DoaEstimator::ResolvedMethod(const int16_t *interleaved,
+                                       int frames) {
+  if (method_ != DOA_METHOD_AUTO) return method_;
+  if (frames == resolved_frames_) return resolved_method_;
+
+  if (!correlator_) CreateCorrelator();
+  uint64_t gcc_phat_ns = UINT64_MAX, lags_ns = UINT64_MAX;
+  for (int run = 0; run < AUTO_TIMING_RUNS; run++) {
+    uint64_t start_ns = PipelineClockNs();
+    EstimateGccPhat(interleaved, frames, FrameTag());
+    uint64_t middle_ns = PipelineClockNs();
+    correlator_->Estimate(interleaved, frames, FrameTag());
+    uint64_t end_ns = PipelineClockNs();
+    if (middle_ns - start_ns < gcc_phat_ns) gcc_phat_ns = middle_ns - start_ns;
+    if (end_ns - middle_ns < lags_ns) lags_ns = end_ns - middle_ns;
   }
 
-  // compute tau and return it
-  return (pos - 3) / 16000.0;
+  resolved_frames_ = frames;
+  resolved_method_ = lags_ns < gcc_phat_ns ? DOA_METHOD_LAG_CORRELATION
+                                           : DOA_METHOD_GCC_PHAT;
+  return resolved_method_;
 }
 
-// Compute the modulo, but wrap-around at 360 degree
-double FmodWrap(double x, double y) {
-  if (x < 0) x += 360;
+void DoaEstimator::CreateCorrelator() {
+  correlator_ = new DoaLagCorrelator();
+  correlator_->SetFusion(fusion_);
+}
 
-  return std::fmod(x, y);
+void DoaEstimator::SetForgetting(double forgetting) {
+  forgetting_ = forgetting;
+  ResetAverage();
 }
 
-// Get the direction as a value between 1 and 360 degree
-double GetDirection(std::vector<int16_t> &audio_buffer_4_channels) {
-  // Get the item count
-  int buffer_items_count = audio_buffer_4_channels.size();
+void DoaEstimator::ResetAverage() {
+  averaged_cross_.assign(averaged_cross_.size(), kiss_fft_cpx());
+}
 
-  // Get the buffer size per channel (we are using 4 from the 4mics_hat)
-  int channel_buffer_size = (buffer_items_count - buffer_items_count % 4) / 4;
+void DoaEstimator::SetFftBackend(FftBackend fft_backend) {
+  if (fft_backend == fft_backend_) return;
+  fft_backend_ = fft_backend;
+
+  // The next period plans again
+  frames_ = 0;
+}
+
+// Sets up the plans and buffers, only when the period length changes
+void DoaEstimator::Prepare(int frames) {
+  if (frames == frames_) return;
+
+  delete fft_;
+  fft_ = CreateRealFft(fft_backend_, frames);
+
+  frames_ = frames;
+  samples_.resize(DOA_CHANNELS * frames);
+  spectra_.resize(DOA_CHANNELS * Bins());
+  cross_spectrum_.resize(Bins());
+  period_cross_.resize(2 * Bins());
+  averaged_cross_.assign(2 * Bins(), kiss_fft_cpx());
+  cross_correlation_.resize(frames);
+}
+
+void DoaEstimator::Analyze(const int16_t *interleaved, int frames) {
+  StageLapTimer stage_timer;
+  Prepare(frames);
 
   // Create the channels for each mic and fill them with data
-  double channel_1[channel_buffer_size], channel_2[channel_buffer_size],
-      channel_3[channel_buffer_size], channel_4[channel_buffer_size];
-  for (int i = 0, j = 0; j < channel_buffer_size; i += 4, j++) {
-    channel_1[j] = audio_buffer_4_channels[i];
-    channel_2[j] = audio_buffer_4_channels[i + 1];
-    channel_3[j] = audio_buffer_4_channels[i + 2];
-    channel_4[j] = audio_buffer_4_channels[i + 3];
+  double *channel_1 = &samples_[0], *channel_2 = &samples_[frames],
+         *channel_3 = &samples_[2 * frames], *channel_4 = &samples_[3 * frames];
+  for (int i = 0, j = 0; j < frames; i += 4, j++) {
+    channel_1[j] = interleaved[i];
+    channel_2[j] = interleaved[i + 1];
+    channel_3[j] = interleaved[i + 2];
+    channel_4[j] = interleaved[i + 3];
   }
+  stage_timer.Lap(STAGE_DEINTERLEAVE);
+  CountPerfFrame();
 
-  // Get tau and theta for the two channel combinations
-  double tau1 = GccPhat(channel_1, channel_3, channel_buffer_size);
-  double theta1 = asin(tau1 / MAX_TDOA_4) * 180.0 / PI;
+  // Do the transformation
+  if (paired_transform_) {
+    for (int channel = 0; channel < 2; channel++)
+      fft_->ForwardPair(&samples_[channel * frames],
+                        &samples_[(channel + 2) * frames],
+                        &spectra_[channel * Bins()],
+                        &spectra_[(channel + 2) * Bins()]);
+  } else {
+    fft_->ForwardBatch(DOA_CHANNELS, samples_.data(), spectra_.data());
+  }
+  stage_timer.Lap(STAGE_FFT);
 
-  double tau2 = GccPhat(channel_2, channel_4, channel_buffer_size);
-  double theta2 = asin(tau2 / MAX_TDOA_4) * 180.0 / PI;
+  if (forgetting_ > 0.0) Accumulate();
+}
 
-  // Use the results for best effort computation of the DoA
-  double best_guess = 0.0;
-  if (std::abs(theta1) < std::abs(theta2)) {
-    if (theta2 > 0)
-      best_guess = FmodWrap((theta1 + 360.0), 360.0);
-    else
-      best_guess = (180.0 - theta1);
+void DoaEstimator::AnalyzeBatch(int count, DoaEstimator *const *estimators,
+                                const int16_t *const *interleaved,
+                                int frames) {
+  DoaEstimator *first = estimators[0];
+  if (frames != first->batch_frames_ || count != first->batch_count_) {
+    // The timing runs must not go into the averages
+    std::vector<double> forgetting(count);
+    for (int i = 0; i < count; i++) {
+      forgetting[i] = estimators[i]->forgetting_;
+      estimators[i]->forgetting_ = 0.0;
+    }
+    uint64_t alone_ns = UINT64_MAX, together_ns = UINT64_MAX;
+    for (int run = 0; run < AUTO_TIMING_RUNS; run++) {
+      uint64_t start_ns = PipelineClockNs();
+      for (int i = 0; i < count; i++)
+        estimators[i]->Analyze(interleaved[i], frames);
+      uint64_t middle_ns = PipelineClockNs();
+      AnalyzeTogether(count, estimators, interleaved, frames);
+      uint64_t end_ns = PipelineClockNs();
+      if (middle_ns - start_ns < alone_ns) alone_ns = middle_ns - start_ns;
+      if (end_ns - middle_ns < together_ns) together_ns = end_ns - middle_ns;
+    }
+    for (int i = 0; i < count; i++)
+      estimators[i]->forgetting_ = forgetting[i];
+
+    first->batch_frames_ = frames;
+    first->batch_count_ = count;
+    first->batch_faster_ = together_ns < alone_ns;
+  }
+
+  if (first->batch_faster_) {
+    AnalyzeTogether(count, estimators, interleaved, frames);
   } else {
-    if (theta1 < 0)
-      best_guess = FmodWrap((theta2 + 360.0), 360.0);
-    else
-      best_guess = (180.0 - theta2);
-    best_guess = FmodWrap((best_guess + 270.0), 360.0);
+    for (int i = 0; i < count; i++)
+      estimators[i]->Analyze(interleaved[i], frames);
   }
-  best_guess = FmodWrap((-best_guess + 120.0), 360.0);
+}
+
+void DoaEstimator::AnalyzeTogether(int count,
+                                   DoaEstimator *const *estimators,
+                                   const int16_t *const *interleaved,
+                                   int frames) {
+  DoaEstimator *first = estimators[0];
+  first->Prepare(frames);
+  int periods_per_batch = first->fft_->BatchChannels() / DOA_CHANNELS;
+  int bins = frames / 2 + 1;
+
+  for (int i = 0; i < count;) {
+    // The periods that share the next transform
+    int batch = 0;
+    while (i + batch < count && batch < periods_per_batch &&
+           estimators[i + batch]->fft_backend_ == first->fft_backend_ &&
+           !estimators[i + batch]->paired_transform_)
+      batch++;
+    if (batch < 2) {
+      estimators[i]->Analyze(interleaved[i], frames);
+      i++;
+      continue;
+    }
+
+    StageLapTimer stage_timer;
+    first->batch_samples_.resize(batch * DOA_CHANNELS * frames);
+    first->batch_spectra_.resize(batch * DOA_CHANNELS * bins);
+    for (int b = 0; b < batch; b++) {
+      estimators[i + b]->Prepare(frames);
+      const int16_t *period = interleaved[i + b];
+      double *channel_1 = &first->batch_samples_[b * DOA_CHANNELS * frames];
+      double *channel_2 = channel_1 + frames, *channel_3 = channel_2 + frames,
+             *channel_4 = channel_3 + frames;
+      for (int k = 0, j = 0; j < frames; k += 4, j++) {
+        channel_1[j] = period[k];
+        channel_2[j] = period[k + 1];
+        channel_3[j] = period[k + 2];
+        channel_4[j] = period[k + 3];
+      }
+      CountPerfFrame();
+    }
+    stage_timer.Lap(STAGE_DEINTERLEAVE);
+
+    first->fft_->ForwardBatch(batch * DOA_CHANNELS,
+                              first->batch_samples_.data(),
+                              first->batch_spectra_.data());
+    stage_timer.Lap(STAGE_FFT);
+
+    // Every estimator gets its period back, as if it had analyzed it
+    for (int b = 0; b < batch; b++) {
+      DoaEstimator *estimator = estimators[i + b];
+      memcpy(estimator->samples_.data(),
+             &first->batch_samples_[b * DOA_CHANNELS * frames],
+             DOA_CHANNELS * frames * sizeof(double));
+      memcpy(estimator->spectra_.data(),
+             &first->batch_spectra_[b * DOA_CHANNELS * bins],
+             DOA_CHANNELS * bins * sizeof(kiss_fft_cpx));
+    }
+    stage_timer.Lap(STAGE_DEINTERLEAVE);
+
+    for (int b = 0; b < batch; b++)
+      if (estimators[i + b]->forgetting_ > 0.0) estimators[i + b]->Accumulate();
+    i += batch;
+  }
+}
+
+const double *DoaEstimator::Samples(int channel) const {
+  return &samples_[channel * frames_];
+}
+
+const kiss_fft_cpx *DoaEstimator::Spectrum(int channel) const {
+  return &spectra_[channel * Bins()];
+}
+
+void DoaEstimator::Inverse(const kiss_fft_cpx *spectrum,
+                           double *samples) const {
+  fft_->Inverse(spectrum, samples);
+}
+
+// sig * conj(refsig) of the last period
+void DoaEstimator::CrossSpectrum(int channel, int ref_channel,
+                                 kiss_fft_cpx *cross) const {
+  const kiss_fft_cpx *sig_out = Spectrum(channel);
+  const kiss_fft_cpx *refsig_out = Spectrum(ref_channel);
+  for (int i = 0; i < Bins(); i++) {
+    cross[i].r =
+        sig_out[i].r * refsig_out[i].r + sig_out[i].i * refsig_out[i].i;
+    cross[i].i =
+        sig_out[i].i * refsig_out[i].r - sig_out[i].r * refsig_out[i].i;
+  }
+}
+
+// Adds the cross-spectra of the last period to the averages of the pairs
+void DoaEstimator::Accumulate() {
+  StageLapTimer stage_timer;
+  double weight = 1.0 - forgetting_;
+  kiss_fft_cpx *cross = cross_spectrum_.data();
+  for (int pair = 0; pair < 2; pair++) {
+    kiss_fft_cpx *average = &averaged_cross_[pair * Bins()];
+    CrossSpectrum(pair, pair + 2, cross);
+    for (int i = 0; i < Bins(); i++) {
+      average[i].r += weight * (cross[i].r - average[i].r);
+      average[i].i += weight * (cross[i].i - average[i].i);
+    }
+  }
+  stage_timer.Lap(STAGE_PHAT);
+}
+
+// Direct port of the doa_respeaker_4mic_arry.py with
+// hardcoded values for unchanging parts. Fills cc_result with the
+// normalized cross-correlation of the 7 possible lags (-3 to 3) of a
+// cross-spectrum
+double DoaEstimator::GccPhat(const kiss_fft_cpx *cross,
+                             double cc_result[DOA_LAG_COUNT]) {
+  StageLapTimer stage_timer;
+  kiss_fft_cpx *cc = cross_spectrum_.data();
+
+  // The bins of the band, all of them by default
+  int low_bin = 0, high_bin = Bins() - 1;
+  if (band_low_hz_ > 0.0)
+    low_bin = std::min(high_bin, (int)std::ceil(band_low_hz_ * frames_ /
+                                                16000.0));
+  if (band_high_hz_ > 0.0)
+    high_bin = std::max(low_bin, (int)std::floor(band_high_hz_ * frames_ /
+                                                 16000.0));
+  high_bin = std::min(high_bin, Bins() - 1);
+
+  // Compute values for the Cross-Correlation table, with the magnitude
+  // removed, and nothing outside of the band
+  for (int i = 0; i < low_bin; i++) cc[i] = kiss_fft_cpx();
+  for (int i = low_bin; i <= high_bin; i++) {
+    std::complex<double> r(cross[i].r, cross[i].i);
+    double magnitude = std::abs(r);
+    std::complex<double> tmp = magnitude > 0.0 ? r / magnitude : 0.0;
+    cc[i].r = tmp.real();
+    cc[i].i = tmp.imag();
+  }
+  for (int i = high_bin + 1; i < Bins(); i++) cc[i] = kiss_fft_cpx();
+  stage_timer.Lap(STAGE_PHAT);
+
+  // Compute irfft
+  double *cc_irfft_res = cross_correlation_.data();
+  Inverse(cc, cc_irfft_res);
+  stage_timer.Lap(STAGE_INVERSE_FFT);
+
+  // Build the Cross-Correlation result array. The inverse is scaled, so a
+  // perfect match is 1, of the band too: the bins between DC and Nyquist
+  // stand for their mirror image as well
+  int len = frames_;
+  double scale = 1.0;
+  if (low_bin > 0 || high_bin < Bins() - 1) {
+    int weight = 2 * (high_bin - low_bin + 1);
+    if (low_bin == 0) weight--;
+    if (high_bin == Bins() - 1) weight--;
+    scale = (double)len / weight;
+  }
+  for (int i = 0; i < DOA_LAG_COUNT; i++) {
+    int lag = i - DOA_MAX_LAG;
+    cc_result[i] = std::abs(cc_irfft_res[lag < 0 ? len + lag : lag]) * scale;
+  }
+
+  // compute tau at the maximum and return it
+  double tau = PairDelay(cc_result, fusion_);
+  stage_timer.Lap(STAGE_PEAK_SEARCH);
+  return tau;
+}
+
+DoaResult DoaEstimator::Estimate(const FrameTag &tag) {
+  DoaResult result;
+  result.tag = tag;
+  result.output_ns = 0;
+  result.compute_start_ns = PipelineClockNs();
+
+  // The cross-spectra of the two channel combinations, averaged or of
+  // the last period
+  const kiss_fft_cpx *cross1 = &averaged_cross_[0];
+  const kiss_fft_cpx *cross2 = &averaged_cross_[Bins()];
+  if (forgetting_ <= 0.0) {
+    StageLapTimer stage_timer;
+    CrossSpectrum(0, 2, &period_cross_[0]);
+    CrossSpectrum(1, 3, &period_cross_[Bins()]);
+    stage_timer.Lap(STAGE_PHAT);
+    cross1 = &period_cross_[0];
+    cross2 = &period_cross_[Bins()];
+  }
+
+  // Get tau for the two channel combinations
+  double cc1[DOA_LAG_COUNT], cc2[DOA_LAG_COUNT];
+  double tau1 = GccPhat(cross1, cc1);
+  double tau2 = GccPhat(cross2, cc2);
+  result.direction = FuseDirection(tau1, tau2);
+
+  // The strongest combination is the direction we return, its strength
+  // (1 for a perfect match on both pairs) is our confidence
+  FindPeaks(cc1, cc2, &result);
+  result.confidence = result.peak_count ? result.peaks[0].strength : 0.0;
+
+  result.compute_done_ns = PipelineClockNs();
+  return result;
+}
+
+DoaResult DoaEstimator::EstimateGccPhat(const int16_t *interleaved,
+                                        int frames, const FrameTag &tag) {
+  uint64_t start_ns = PipelineClockNs();
+  Analyze(interleaved, frames);
+
+  DoaResult result = Estimate(tag);
+  result.compute_start_ns = start_ns;
+  return result;
+}
+
+DoaResult DoaEstimator::Estimate(
+    const std::vector<int16_t> &audio_buffer_4_channels, const FrameTag &tag) {
+  // Get the buffer size per channel (we are using 4 from the 4mics_hat)
+  return Estimate(audio_buffer_4_channels.data(),
+                  audio_buffer_4_channels.size() / DOA_CHANNELS, tag);
+}
+
+DoaResult DoaEstimator::Estimate(const int16_t *interleaved, int frames,
+                                 const FrameTag &tag) {
+  // The averages are of the spectra, they need the GCC-PHAT
+  if (forgetting_ <= 0.0 &&
+      ResolvedMethod(interleaved, frames) == DOA_METHOD_LAG_CORRELATION) {
+    if (!correlator_) CreateCorrelator();
+    return correlator_->Estimate(interleaved, frames, tag);
+  }
+  return EstimateGccPhat(interleaved, frames, tag);
+}
+
+// Get the direction as a value between 1 and 360 degree
+double GetDirection(std::vector<int16_t> &audio_buffer_4_channels) {
+  return GetDirection(audio_buffer_4_channels, FrameTag()).direction;
+}
 
-  return best_guess;
+DoaResult GetDirection(std::vector<int16_t> &audio_buffer_4_channels,
+                       const FrameTag &tag) {
+  // One estimator per thread keeps the plans between calls
+  static thread_local DoaEstimator estimator;
+  return estimator.Estimate(audio_buffer_4_channels, tag);
 }
@@ -11,6 +11,242 @@
 **
 ** Author: Oliver Pahl
 ** -------------------------------------------------------------------------*/
+#ifndef DOA_DETECTION_H
+#define DOA_DETECTION_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "contrib/kiss_fft/kiss_fftr.h"
+#include "fft_backend.h"
+#include "frame_timing.h"
+
+// The 4mic_hat
+static const int DOA_CHANNELS = 4;
+
+// Its mics sit on a circle with 81mm diagonals, at these angles in the
+// directions the estimators report
+static const double DOA_MIC_RADIUS = 0.081 / 2;
+static const double DOA_MIC_ANGLE[DOA_CHANNELS] = {210.0, 300.0, 30.0, 120.0};
+static const double DOA_SOUND_SPEED = 340.0;
+
+// Only lags of -3 to 3 samples are possible with 81mm between the mics at
+// 16kHz
+static const int DOA_MAX_LAG = 3;
+static const int DOA_LAG_COUNT = 2 * DOA_MAX_LAG + 1;
+
+// How many candidate directions a result keeps
+static const int DOA_MAX_PEAKS = 4;
+
+// A candidate direction and its correlation strength (0 to 1)
+struct DoaPeak {
+  double direction;
+  double strength;
+};
+
+// A direction together with the period it was computed from
+struct DoaResult {
+  double direction;
+  FrameTag tag;
+
+  // Strength of the best candidate, and the best candidates in descending
+  // order (the first one is the direction)
+  double confidence;
+  int peak_count;
+  DoaPeak peaks[DOA_MAX_PEAKS];
+
+  // When the DoA started and finished, and when the result was shown (set
+  // by whoever shows it, 0 until then)
+  uint64_t compute_start_ns;
+  uint64_t compute_done_ns;
+  uint64_t output_ns;
+
+  // How old the audio was when the result was shown (or computed)
+  uint64_t LatencyNs() const {
+    return (output_ns ? output_ns : compute_done_ns) - tag.capture_ns;
+  }
+};
+
+// Combines the delays (in seconds) of the mic pairs 1/3 and 2/4 to a
+// direction between 0 and 360 degree
+double FuseDirection(double tau1, double tau2);
+
+// How the two pairs become a direction: from the lag of the strongest
+// correlation of each, or from that lag moved by a parabola through it and
+// its neighbours. Whole lags only give 12 directions (30 degree apart at
+// best), interpolated ones anything in between, for a few flops more
+enum DoaFusion { DOA_FUSION_WHOLE_LAGS, DOA_FUSION_INTERPOLATED };
+
+// Short name of a fusion, as ParseDoaFusion takes it
+const char *DoaFusionName(DoaFusion fusion);
+
+// Fusion by name, false if unknown
+bool ParseDoaFusion(const char *name, DoaFusion *fusion);
+
+// The delay of a pair in seconds from its correlations at the lags -3 to 3
+double PairDelay(const double cc[DOA_LAG_COUNT], DoaFusion fusion);
+
+// Ranks all lag combinations of the two pairs by the product of their
+// correlations at the lags -3 to 3, fills the peaks of result
+void FindPeaks(const double cc1[DOA_LAG_COUNT],
+               const double cc2[DOA_LAG_COUNT], DoaResult *result);
+
+// How a period becomes a direction: GCC-PHAT over the whole spectrum, or
+// the 7 lags in the time domain after LPC whitening (DoaLagCorrelator).
+// Auto times both on the first period of a length and keeps the faster
+enum DoaMethod {
+  DOA_METHOD_GCC_PHAT,
+  DOA_METHOD_LAG_CORRELATION,
+  DOA_METHOD_AUTO
+};
+
+// Short name of a method, as ParseDoaMethod takes it
+const char *DoaMethodName(DoaMethod method);
+
+// Method by name, false if unknown
+bool ParseDoaMethod(const char *name, DoaMethod *method);
+
+class DoaLagCorrelator;
+
+// Keeps the FFT plans between periods and the spectra of the last one, so
+// others (like the beamformer) can reuse them instead of transforming the
+// audio again
+class DoaEstimator {
+ public:
+  explicit DoaEstimator(FftBackend fft_backend = FFT_BACKEND_KISS);
+  ~DoaEstimator();
+
+  // The FFT the next periods are transformed with
+  FftBackend GetFftBackend() const { return fft_backend_; }
+  void SetFftBackend(FftBackend fft_backend);
+
+  // Transforms the mic pairs 1/3 and 2/4 together (RealFft::ForwardPair)
+  // instead of every channel alone. Off by default, on x86 it was no
+  // faster than four kiss_fftr calls (see doa_benchmark)
+  bool PairedTransform() const { return paired_transform_; }
+  void SetPairedTransform(bool paired) { paired_transform_ = paired; }
+
+  // Averages the cross-spectra of the mic pairs over the periods given to
+  // Analyze, with one multiply-add per bin: each period weighs 1 -
+  // forgetting and fades by forgetting per period after it. Estimate then
+  // works on the averages. 0 (the default) estimates every period alone
+  double Forgetting() const { return forgetting_; }
+  void SetForgetting(double forgetting);
+
+  // Starts the averages over, e.g. when a new hotword was detected
+  void ResetAverage();
+
+  // The method Estimate of a whole period uses (GCC-PHAT by default).
+  // Averaging and the spectra for the beamformer need the GCC-PHAT, so
+  // Analyze and Estimate of its spectra always use that
+  DoaMethod Method() const { return method_; }
+  void SetMethod(DoaMethod method);
+
+  // How the pairs become a direction (whole lags by default)
+  DoaFusion Fusion() const { return fusion_; }
+  void SetFusion(DoaFusion fusion);
+
+  // Only the bins from low_hz to high_hz count for the GCC-PHAT, e.g. to
+  // leave out hum and the band above speech. 0 leaves a side open, which
+  // is the default for both. The time-domain method sees the whole band
+  double BandLowHz() const { return band_low_hz_; }
+  double BandHighHz() const { return band_high_hz_; }
+  void SetBand(double low_hz, double high_hz);
+
+  // What the method comes down to for periods of frames samples. Auto
+  // times both on the first call for a length
+  DoaMethod ResolvedMethod(const int16_t *interleaved, int frames);
+
+  // Splits an interleaved 4-channel period and transforms the channels
+  void Analyze(const int16_t *interleaved, int frames);
+
+  // Analyze of count periods of the same length, one per estimator, e.g.
+  // of several mic arrays. The channels of as many periods as fill
+  // RealFft::BatchChannels of the first estimator go through one
+  // ForwardBatch; periods of estimators with another backend, or when a
+  // batch would only hold one period, are analyzed alone. Like auto, the
+  // first call for a length and count times batches against one period
+  // after the other, and the faster is kept
+  static void AnalyzeBatch(int count, DoaEstimator *const *estimators,
+                           const int16_t *const *interleaved, int frames);
+
+  // Estimates the direction from the spectra of the last Analyze
+  DoaResult Estimate(const FrameTag &tag);
+
+  // Both of the above, or the time-domain correlation if the method says so
+  DoaResult Estimate(const int16_t *interleaved, int frames,
+                     const FrameTag &tag);
+  DoaResult Estimate(const std::vector<int16_t> &audio_buffer_4_channels,
+                     const FrameTag &tag);
+
+  // The last period, per channel, in the time and frequency domain
+  int Frames() const { return frames_; }
+  int Bins() const { return frames_ / 2 + 1; }
+  const double *Samples(int channel) const;
+  const kiss_fft_cpx *Spectrum(int channel) const;
+
+  // Inverse transform of Bins() bins into Frames() samples, scaled so it
+  // gives back the samples of a spectrum
+  void Inverse(const kiss_fft_cpx *spectrum, double *samples) const;
+
+ private:
+  void Prepare(int frames);
+  void CreateCorrelator();
+  static void AnalyzeTogether(int count, DoaEstimator *const *estimators,
+                              const int16_t *const *interleaved, int frames);
+  void CrossSpectrum(int channel, int ref_channel, kiss_fft_cpx *cross) const;
+  void Accumulate();
+  double GccPhat(const kiss_fft_cpx *cross, double cc_result[DOA_LAG_COUNT]);
+  DoaResult EstimateGccPhat(const int16_t *interleaved, int frames,
+                            const FrameTag &tag);
+
+ private:
+  int frames_;
+  FftBackend fft_backend_;
+  RealFft *fft_;
+  bool paired_transform_;
+
+  // The time-domain method, created on first use, and the length auto
+  // last decided for
+  DoaMethod method_;
+  DoaFusion fusion_;
+  DoaLagCorrelator *correlator_;
+  int resolved_frames_;
+  DoaMethod resolved_method_;
+
+  // DOA_CHANNELS blocks of Frames() samples and of Bins() bins
+  std::vector<double> samples_;
+  std::vector<kiss_fft_cpx> spectra_;
+
+  // The channels of the periods of AnalyzeBatch, the first estimator
+  // transforms them for all, and what its timing decided for which length
+  // and count
+  std::vector<double> batch_samples_;
+  std::vector<kiss_fft_cpx> batch_spectra_;
+  int batch_frames_;
+  int batch_count_;
+  bool batch_faster_;
+
+  // The cross-spectra of the pairs 1/3 and 2/4, of the last period and
+  // averaged
+  double forgetting_;
+  std::vector<kiss_fft_cpx> period_cross_;
+  std::vector<kiss_fft_cpx> averaged_cross_;
+
+  // The band of the GCC-PHAT
+  double band_low_hz_;
+  double band_high_hz_;
+
+  // Scratch for GccPhat
+  std::vector<kiss_fft_cpx> cross_spectrum_;
+  std::vector<double> cross_correlation_;
+};
 
 // Get the direction as a value between 1 and 360 degree
 double GetDirection(std::vector<int16_t> &audio_buffer_4_channels);
+
+// Same, but keeps the tag of the period and the compute times
+DoaResult GetDirection(std::vector<int16_t> &audio_buffer_4_channels,
+                       const FrameTag &tag);
+
+#endif  // DOA_DETECTION_H
@@ -0,0 +1,251 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_detection_fixed.cc
+** Fixed-point variant of the DoaEstimator for boards without a fast FPU
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_detection_fixed.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Stage timing
+#include "pipeline_stats.h"
+
+static const double PI = 3.14159265358979323846;
+
+// The samples are shifted up so the loudest one of a channel stays below
+// this many bits, which leaves the cross-spectrum room in 64 bits
+static const int SAMPLE_BITS = 30;
+
+// 1 / sqrt(x) in Q14 for x = 64/256 to 256/256 in steps of 1/256
+static const int RSQRT_STEPS = 192;
+
+struct RsqrtTable {
+  int32_t value[RSQRT_STEPS + 1];
+
+  RsqrtTable() {
+    for (int i = 0; i <= RSQRT_STEPS; i++)
+      value[i] = (int32_t)std::floor(
+          0.5 + 16384.0 / std::sqrt((i + 64) / 256.0));
+  }
+};
+
+static const RsqrtTable &GetRsqrtTable() {
+  static const RsqrtTable table;
+  return table;
+}
+
+// (r, i) scaled to length 1 in Q14, (0, 0) stays
+static void UnitVector(int64_t r, int64_t i, int16_t *unit_r,
+                       int16_t *unit_i) {
+  uint64_t largest = r < 0 ? -r : r;
+  uint64_t other = i < 0 ? -i : i;
+  if (other > largest) largest = other;
+  if (largest == 0) {
+    *unit_r = 0;
+    *unit_i = 0;
+    return;
+  }
+
+  // Down (or up) to 15 bits, then the squared length is 28 to 31 bits
+  int shift = 64 - __builtin_clzll(largest) - 15;
+  int32_t a = (int32_t)(shift > 0 ? r >> shift : r << -shift);
+  int32_t b = (int32_t)(shift > 0 ? i >> shift : i << -shift);
+  uint32_t power = (uint32_t)(a * a) + (uint32_t)(b * b);
+
+  // An even shift brings it to 30 to 32 bits, the top 8 bits index the
+  // table and the next 8 interpolate
+  int half = power < (1u << 30) ? 1 : 0;
+  power <<= 2 * half;
+  const int32_t *table = GetRsqrtTable().value + (power >> 24) - 64;
+  int32_t fraction = (power >> 16) & 0xff;
+  int32_t rsqrt = table[0] + (((table[1] - table[0]) * fraction) >> 8);
+
+  *unit_r = (int16_t)((a * rsqrt) >> (16 - half));
+  *unit_i = (int16_t)((b * rsqrt) >> (16 - half));
+}
+
+DoaFixedEstimator::DoaFixedEstimator()
+    : frames_(0),
+      fusion_(DOA_FUSION_WHOLE_LAGS),
+      band_low_hz_(0.0),
+      band_high_hz_(0.0),
+      low_bin_(0),
+      high_bin_(0),
+      band_weight_(0),
+      forward_cfg_(nullptr) {}
+
+DoaFixedEstimator::~DoaFixedEstimator() { kiss_fftr_fixed_free(forward_cfg_); }
+
+void DoaFixedEstimator::SetBand(double low_hz, double high_hz) {
+  band_low_hz_ = low_hz;
+  band_high_hz_ = high_hz;
+
+  // The next period works the bins out again
+  frames_ = 0;
+}
+
+// Sets up the plan and tables, only when the period length changes
+void DoaFixedEstimator::Prepare(int frames) {
+  if (frames == frames_) return;
+
+  kiss_fftr_fixed_free(forward_cfg_);
+  forward_cfg_ = kiss_fftr_fixed_alloc(frames, 0, 0, 0);
+
+  frames_ = frames;
+  int bins = frames / 2 + 1;
+  samples_.resize(DOA_CHANNELS * frames);
+  spectra_.resize(DOA_CHANNELS * bins);
+  cross_r_.resize(bins);
+  cross_i_.resize(bins);
+  cos_.resize(frames);
+  sin_.resize(frames);
+  for (int m = 0; m < frames; m++) {
+    double phase = 2 * PI * m / frames;
+    cos_[m] = (int16_t)std::floor(0.5 + 32767.0 * std::cos(phase));
+    sin_[m] = (int16_t)std::floor(0.5 + 32767.0 * std::sin(phase));
+  }
+
+  // The band, as in DoaEstimator::GccPhat. The bins between DC and
+  // Nyquist count twice
+  low_bin_ = 0;
+  high_bin_ = bins - 1;
+  if (band_low_hz_ > 0.0)
+    low_bin_ = std::min(high_bin_,
+                        (int)std::ceil(band_low_hz_ * frames / 16000.0));
+  if (band_high_hz_ > 0.0)
+    high_bin_ = std::max(low_bin_,
+                         (int)std::floor(band_high_hz_ * frames / 16000.0));
+  high_bin_ = std::min(high_bin_, bins - 1);
+  band_weight_ = 2 * (high_bin_ - low_bin_ + 1);
+  if (low_bin_ == 0) band_weight_--;
+  if (high_bin_ == bins - 1) band_weight_--;
+}
+
+// GCC-PHAT of one mic pair. Fills cc_result with the correlation of the 7
+// lags, where band_weight_ * 2^29 is a perfect match
+void DoaFixedEstimator::GccPhat(int channel, int ref_channel,
+                                int64_t cc_result[DOA_LAG_COUNT]) {
+  StageLapTimer stage_timer;
+  int bins = frames_ / 2 + 1;
+  const kiss_fft_fixed_cpx *sig_out = &spectra_[channel * bins];
+  const kiss_fft_fixed_cpx *refsig_out = &spectra_[ref_channel * bins];
+
+  // sig * conj(refsig) with the magnitude removed, in the band
+  for (int k = low_bin_; k <= high_bin_; k++) {
+    int64_t r = (int64_t)sig_out[k].r * refsig_out[k].r +
+                (int64_t)sig_out[k].i * refsig_out[k].i;
+    int64_t i = (int64_t)sig_out[k].i * refsig_out[k].r -
+                (int64_t)sig_out[k].r * refsig_out[k].i;
+    UnitVector(r, i, &cross_r_[k], &cross_i_[k]);
+  }
+  stage_timer.Lap(STAGE_PHAT);
+
+  // We only need 7 lags of the inverse transform, so they are dot products
+  // with the cos and sin table. The bins between DC and Nyquist stand for
+  // their mirror image as well
+  int64_t real[DOA_MAX_LAG + 1], imag[DOA_MAX_LAG + 1];
+  int32_t dc = low_bin_ == 0 ? cross_r_[0] : 0;
+  int32_t nyquist = high_bin_ == bins - 1 ? cross_r_[bins - 1] : 0;
+  for (int lag = 0; lag <= DOA_MAX_LAG; lag++) {
+    real[lag] = (int64_t)(dc + (lag & 1 ? -nyquist : nyquist)) * 32767;
+    imag[lag] = 0;
+  }
+
+  // The table index of the bin before the first one of the band
+  int first = std::max(low_bin_, 1), last = std::min(high_bin_, bins - 2);
+  int index[DOA_MAX_LAG + 1];
+  for (int lag = 0; lag <= DOA_MAX_LAG; lag++)
+    index[lag] = (int)((int64_t)lag * (first - 1) % frames_);
+  for (int k = first; k <= last; k++) {
+    int32_t r = 2 * cross_r_[k];
+    int32_t i = 2 * cross_i_[k];
+    real[0] += r * 32767;
+    for (int lag = 1; lag <= DOA_MAX_LAG; lag++) {
+      index[lag] += lag;
+      if (index[lag] >= frames_) index[lag] -= frames_;
+      real[lag] += r * cos_[index[lag]];
+      imag[lag] += i * sin_[index[lag]];
+    }
+  }
+  for (int i = 0; i < DOA_LAG_COUNT; i++) {
+    int lag = i - DOA_MAX_LAG;
+    int64_t cc = lag < 0 ? real[-lag] + imag[-lag] : real[lag] - imag[lag];
+    cc_result[i] = cc < 0 ? -cc : cc;
+  }
+  stage_timer.Lap(STAGE_INVERSE_FFT);
+}
+
+DoaResult DoaFixedEstimator::Estimate(const int16_t *interleaved, int frames,
+                                      const FrameTag &tag) {
+  DoaResult result;
+  result.tag = tag;
+  result.output_ns = 0;
+  result.compute_start_ns = PipelineClockNs();
+
+  StageLapTimer stage_timer;
+  Prepare(frames);
+
+  // Create the channels for each mic, shifted up as far as the loudest
+  // sample of the channel allows
+  int32_t loudest[DOA_CHANNELS] = {0};
+  for (int channel = 0; channel < DOA_CHANNELS; channel++) {
+    int32_t *samples = &samples_[channel * frames];
+    for (int i = channel, j = 0; j < frames; i += DOA_CHANNELS, j++) {
+      int32_t sample = interleaved[i];
+      samples[j] = sample;
+      if (sample < 0) sample = -sample;
+      if (sample > loudest[channel]) loudest[channel] = sample;
+    }
+  }
+  for (int channel = 0; channel < DOA_CHANNELS; channel++) {
+    if (loudest[channel] == 0) continue;
+    int shift = SAMPLE_BITS - (32 - __builtin_clz(loudest[channel]));
+    int32_t *samples = &samples_[channel * frames];
+    for (int j = 0; j < frames; j++) samples[j] <<= shift;
+  }
+  stage_timer.Lap(STAGE_DEINTERLEAVE);
+  CountPerfFrame();
+
+  // Do the transformation
+  int bins = frames / 2 + 1;
+  for (int channel = 0; channel < DOA_CHANNELS; channel++)
+    kiss_fftr_fixed(forward_cfg_, &samples_[channel * frames],
+                    &spectra_[channel * bins]);
+  stage_timer.Lap(STAGE_FFT);
+
+  // Get the lags for the two channel combinations
+  int64_t cc1[DOA_LAG_COUNT], cc2[DOA_LAG_COUNT];
+  GccPhat(0, 2, cc1);
+  GccPhat(1, 3, cc2);
+
+  // Only the delays and the ranking of the candidates leave the integers
+  StageLapTimer peak_timer;
+  double scale = 1.0 / ((double)band_weight_ * (1 << 29));
+  double strength1[DOA_LAG_COUNT], strength2[DOA_LAG_COUNT];
+  for (int i = 0; i < DOA_LAG_COUNT; i++) {
+    strength1[i] = cc1[i] * scale;
+    strength2[i] = cc2[i] * scale;
+  }
+  result.direction = FuseDirection(PairDelay(strength1, fusion_),
+                                   PairDelay(strength2, fusion_));
+  peak_timer.Lap(STAGE_PEAK_SEARCH);
+  FindPeaks(strength1, strength2, &result);
+  result.confidence = result.peak_count ? result.peaks[0].strength : 0.0;
+
+  result.compute_done_ns = PipelineClockNs();
+  return result;
+}
+
+DoaResult DoaFixedEstimator::Estimate(
+    const std::vector<int16_t> &audio_buffer_4_channels, const FrameTag &tag) {
+  return Estimate(audio_buffer_4_channels.data(),
+                  audio_buffer_4_channels.size() / DOA_CHANNELS, tag);
+}
@@ -0,0 +1,74 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_detection_fixed.h
+** Fixed-point variant of the DoaEstimator for boards without a fast FPU
+** (Pi Zero). It works on the S16 capture data with the 32 bit fixed-point
+** build of kiss_fftr, normalizes the cross-spectrum through a reciprocal
+** square root table and computes the 7 lags with integer dot products.
+** Only the final directions are converted to double.
+**
+** On the synthetic periods of doa_benchmark it picks the same lags as the
+** double estimator, see the README for the numbers.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_DETECTION_FIXED_H
+#define DOA_DETECTION_FIXED_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "contrib/kiss_fft/kiss_fftr_fixed.h"
+#include "doa_detection.h"
+
+class DoaFixedEstimator {
+ public:
+  DoaFixedEstimator();
+  ~DoaFixedEstimator();
+
+  // As DoaEstimator::SetFusion and SetBand. Bins outside of the band are
+  // skipped, so a narrow band is cheaper here
+  void SetFusion(DoaFusion fusion) { fusion_ = fusion; }
+  void SetBand(double low_hz, double high_hz);
+
+  // Estimates the direction of an interleaved 4-channel period
+  DoaResult Estimate(const int16_t *interleaved, int frames,
+                     const FrameTag &tag);
+  DoaResult Estimate(const std::vector<int16_t> &audio_buffer_4_channels,
+                     const FrameTag &tag);
+
+ private:
+  void Prepare(int frames);
+  void GccPhat(int channel, int ref_channel, int64_t cc_result[DOA_LAG_COUNT]);
+
+ private:
+  int frames_;
+  DoaFusion fusion_;
+  double band_low_hz_;
+  double band_high_hz_;
+
+  // The bins of the band, and the weight of a perfect match in them
+  int low_bin_;
+  int high_bin_;
+  int band_weight_;
+  kiss_fftr_fixed_cfg forward_cfg_;
+
+  // One channel of samples, DOA_CHANNELS blocks of Bins() bins
+  std::vector<int32_t> samples_;
+  std::vector<kiss_fft_fixed_cpx> spectra_;
+
+  // The PHAT-weighted cross-spectrum as Q14 unit vectors
+  std::vector<int16_t> cross_r_;
+  std::vector<int16_t> cross_i_;
+
+  // cos and sin of 2 pi m / frames in Q15, for the lags
+  std::vector<int16_t> cos_;
+  std::vector<int16_t> sin_;
+};
+
+#endif  // DOA_DETECTION_FIXED_H
@@ -11,13 +11,30 @@
 **
 ** Author: Oliver Pahl
 ** -------------------------------------------------------------------------*/
+#include <getopt.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
-// snowboy
-#include "contrib/snowboy/include/snowboy-detect.h"
+// Hotword detectors, snowboy models and tone stubs
+#include "hotword_detector.h"
+#include "hotword_runner.h"
+#include "snowboy_hotword_detector.h"
 
 // LED controller
 #include "contrib/led_controller/led_controller.h"
@@ -26,29 +43,63 @@
 #include <alsa/asoundlib.h>
 
 // DoA detection
+#include "audio_bus.h"
+#include "beamformer.h"
+#include "capture_log.h"
+#include "device_cache.h"
+#include "doa_arrays.h"
+#include "doa_async.h"
+#include "doa_config.h"
 #include "doa_detection.h"
+#include "doa_detection_fixed.h"
+#include "doa_history.h"
+#include "doa_publisher.h"
+#include "event_loop.h"
+#include "frame_timing.h"
+#include "rt_profile.h"
 
-// This returns a default string currently, because the
-// seeed ALSA driver has an issue where it does not report
-// the name of the PCM device
-const char *Get4MicHatPcmDevice() {
+// Stage timing, dumped on SIGUSR1, and tracing
+#include "pipeline_stats.h"
+#include "trace_events.h"
+
+// Periods (about 4 s) the capture records before the hotword detector is
+// ready, older ones are dropped
+static const size_t PREROLL_PERIODS = 16;
+
+// Hotword periods the async estimator queues before its overflow policy
+// kicks in
+static const int ASYNC_QUEUE_PERIODS = 4;
+
+// The hotword model without --model or --stub-hotword
+static const char *const DEFAULT_HOTWORD_MODEL =
+    "contrib/snowboy/resources/models/jarvis.umdl:0.8,0.80";
+
+// --device value that looks for the 4mic_hat instead of naming a device
+static const char *const DISCOVER_DEVICE = "discover";
+
+// How often the event loop paints the LEDs at most (30 per second)
+static const uint64_t LED_FRAME_NS = 1000000000ull / 30;
+
+// Finds the capture PCM of the 4mic_hat, "default" if there is none. Due
+// to a bug
+// (https://forum.seeedstudio.com/viewtopic.php?f=87&t=32458&sid=555a99ad0a9374ef0332af489a5eb9db)
+// in the driver, the PCM device reports no name, so we address it by the
+// id of its card and the device number instead
+std::string Discover4MicHatPcmDevice() {
   register int error;
   int card_num = -1;
   char card_id_string[64];
-  int pcm_device_id = -1;
+  std::string pcm_device_name = "default";
 
   // ALSA parameters
-  snd_pcm_t *pcm_handle;
   snd_pcm_info_t *pcm_info;
   snd_pcm_info_alloca(&pcm_info);
   snd_ctl_t *card_handle;
   snd_ctl_card_info_t *card_info;
   snd_ctl_card_info_alloca(&card_info);
 
-  // The PCM device name we want to get
-  const char *pcm_device_name;
-
-  while (snd_card_next(&card_num) == 0 && card_num >= 0) {
+  while (pcm_device_name == "default" && snd_card_next(&card_num) == 0 &&
+         card_num >= 0) {
     // Get the card id
     sprintf(card_id_string, "hw:%d", card_num);
     if ((error = snd_ctl_open(&card_handle, card_id_string, 0)) < 0) {
@@ -57,25 +108,27 @@ const char *Get4MicHatPcmDevice() {
       continue;
     }
 
-    // Get the Soundcard Info
-    if ((error = snd_ctl_card_info(card_handle, card_info)) < 0) {
+    // Get the Soundcard Info, the seeed voicecards have ids like
+    // seeed4micvoicec
+    if ((error = snd_ctl_card_info(card_handle, card_info)) < 0 ||
+        strncmp(snd_ctl_card_info_get_id(card_info), "seeed4mic", 9) != 0) {
       snd_ctl_close(card_handle);
       continue;
     }
 
-    // Iterate over the PCM devices
+    // The first PCM device we can record from
+    int pcm_device_id = -1;
     while (snd_ctl_pcm_next_device(card_handle, &pcm_device_id) == 0 &&
            pcm_device_id >= 0) {
-      // Get device info
       snd_pcm_info_set_device(pcm_info, pcm_device_id);
       snd_pcm_info_set_subdevice(pcm_info, 0);
       snd_pcm_info_set_stream(pcm_info, SND_PCM_STREAM_CAPTURE);
+      if (snd_ctl_pcm_info(card_handle, pcm_info) < 0) continue;
 
-      // If we cannot use it for recording, discard
-      if (snd_ctl_pcm_info(card_handle, pcm_info) < 0)
-        continue;
-      else
-        pcm_device_name = snd_pcm_info_get_name(pcm_info);
+      pcm_device_name = std::string("plughw:CARD=") +
+                        snd_ctl_card_info_get_id(card_info) +
+                        ",DEV=" + std::to_string(pcm_device_id);
+      break;
     }
 
     // Close the card's control interface after we're done with it
@@ -84,14 +137,20 @@ const char *Get4MicHatPcmDevice() {
 
   // Free the memory we used
   snd_config_update_free_global();
+  return pcm_device_name;
+}
 
-  // Due to a bug
-  // (https://forum.seeedstudio.com/viewtopic.php?f=87&t=32458&sid=555a99ad0a9374ef0332af489a5eb9db)
-  // in the driver, there is no pcm device name to get, which leads to the
-  // problem, that we cannot open the device by name. For the time being, we use
-  // the default capture device, but this may not be sufficent in the future.
-  // return pcm_device_name;
-  return "default";
+// The capture device of the last start if the cards are still the same,
+// otherwise it is discovered (which opens every card) and cached
+std::string Get4MicHatPcmDevice(bool *cached) {
+  uint64_t identity = SoundCardIdentity();
+  std::string pcm_device_name;
+  *cached = LoadCachedDevice(identity, &pcm_device_name);
+  if (*cached) return pcm_device_name;
+
+  pcm_device_name = Discover4MicHatPcmDevice();
+  StoreCachedDevice(identity, pcm_device_name);
+  return pcm_device_name;
 }
 
 snd_pcm_t *InitializeAlsaDevice(const char *pcm_device_name) {
@@ -155,6 +214,20 @@ snd_pcm_t *InitializeAlsaDevice(const char *pcm_device_name) {
 
   snd_pcm_hw_params_free(hw_params);
 
+  // Ask for monotonic hardware timestamps, so we know when each period was
+  // recorded. Not every driver has them, so this is not fatal
+  snd_pcm_sw_params_t *sw_params;
+  snd_pcm_sw_params_alloca(&sw_params);
+  if ((err = snd_pcm_sw_params_current(capture_handle, sw_params)) < 0 ||
+      (err = snd_pcm_sw_params_set_tstamp_mode(capture_handle, sw_params,
+                                               SND_PCM_TSTAMP_ENABLE)) < 0 ||
+      (err = snd_pcm_sw_params_set_tstamp_type(
+           capture_handle, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC)) < 0 ||
+      (err = snd_pcm_sw_params(capture_handle, sw_params)) < 0) {
+    std::cerr << "cannot enable hardware timestamps (" << snd_strerror(err)
+              << ")" << std::endl;
+  }
+
   if ((err = snd_pcm_prepare(capture_handle)) < 0) {
     std::cerr << "cannot prepare audio interface for use (" << snd_strerror(err)
               << ")" << std::endl;
@@ -164,89 +237,984 @@ snd_pcm_t *InitializeAlsaDevice(const char *pcm_device_name) {
   return capture_handle;
 }
 
-// Interruption Signal Handler, so we clean up after Ctrl+C
-void IntSignalHandler(int sig) {
-  LedController *led_controller = &LedController::GetInstance();
-  led_controller->PowerDown();
-  exit(0);
+// Tags the period we just read with its hardware timestamp
+void TagCapturedPeriod(snd_pcm_t *capture_handle, uint64_t frame_index,
+                       int frames, FrameTag *tag) {
+  snd_pcm_status_t *status;
+  snd_pcm_status_alloca(&status);
+
+  uint64_t hw_timestamp_ns = 0;
+  int64_t delay_frames = 0;
+  if (snd_pcm_status(capture_handle, status) == 0) {
+    snd_htimestamp_t htstamp;
+    snd_pcm_status_get_htstamp(status, &htstamp);
+    hw_timestamp_ns =
+        (uint64_t)htstamp.tv_sec * 1000000000ull + htstamp.tv_nsec;
+    delay_frames = snd_pcm_status_get_delay(status);
+  }
+
+  MakeFrameTag(frame_index, frames, 16000, hw_timestamp_ns, delay_frames, tag);
+}
+
+// Reads a whole period. A short read is continued; after an overrun or a
+// suspend the device is recovered and the period starts over, since the
+// audio has a gap. Only errors snd_pcm_recover cannot handle end the
+// capture
+bool ReadPeriod(snd_pcm_t *capture_handle, int16_t *buffer, int frames,
+                uint64_t *recoveries) {
+  int done = 0;
+  while (done < frames) {
+    snd_pcm_sframes_t read = snd_pcm_readi(
+        capture_handle, buffer + done * DOA_CHANNELS, frames - done);
+    if (read >= 0) {
+      done += read;
+      continue;
+    }
+
+    int err = snd_pcm_recover(capture_handle, read, 1);
+    if (err < 0) {
+      fprintf(stderr, "read from audio interface failed (%s)\n",
+              snd_strerror(err));
+      return false;
+    }
+    (*recoveries)++;
+    done = 0;
+  }
+  return true;
+}
+
+// Records periods on a thread of its own while the rest of the pipeline
+// starts up, so the audio of that time is there once the hotword detector
+// is. The oldest periods go when the ring is full
+class PrerollCapture {
+ public:
+  PrerollCapture()
+      : stop_(false),
+        done_(false),
+        first_frame_ns_(0),
+        captured_frames_(0),
+        dropped_(0) {}
+  ~PrerollCapture() {
+    Stop();
+    if (thread_.joinable()) thread_.join();
+  }
+
+  // Reads periods of frames from handle, with the profile if there is one
+  void Start(snd_pcm_t *handle, int frames, size_t periods,
+             const RtProfile *profile, uint64_t *recoveries) {
+    thread_ = std::thread([=] {
+      SetTraceThreadName("pre-roll");
+      if (profile) ApplyRtProfile("pre-roll", *profile);
+      Run(handle, frames, periods, recoveries);
+    });
+  }
+
+  // The thread stops after the period it is reading
+  void Stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+
+  // The oldest recorded period, waits for one while the thread runs. False
+  // once it stopped and everything was taken
+  bool Next(std::vector<int16_t> *audio, FrameTag *tag) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queued_.wait(lock, [this] { return !ring_.empty() || done_; });
+    if (ring_.empty()) {
+      lock.unlock();
+      if (thread_.joinable()) thread_.join();
+      return false;
+    }
+    audio->swap(ring_.front().audio);
+    *tag = ring_.front().tag;
+    ring_.pop_front();
+    return true;
+  }
+
+  // When the first period was complete, 0 if none was
+  uint64_t FirstFrameNs() const { return first_frame_ns_; }
+
+  // Only valid once Next returned false
+  uint64_t CapturedFrames() const { return captured_frames_; }
+  size_t Dropped() const { return dropped_; }
+
+ private:
+  struct Period {
+    std::vector<int16_t> audio;
+    FrameTag tag;
+  };
+
+  void Run(snd_pcm_t *handle, int frames, size_t periods,
+           uint64_t *recoveries) {
+    std::vector<int16_t> buffer(frames * DOA_CHANNELS);
+    uint64_t captured_frames = 0;
+    bool running = true;
+    while (running && ReadPeriod(handle, buffer.data(), frames, recoveries)) {
+      if (!first_frame_ns_) first_frame_ns_ = PipelineClockNs();
+      Period period;
+      TagCapturedPeriod(handle, captured_frames, frames, &period.tag);
+      captured_frames += frames;
+      period.audio = buffer;
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (ring_.size() == periods) {
+        ring_.pop_front();
+        dropped_++;
+      }
+      ring_.push_back(std::move(period));
+      captured_frames_ = captured_frames;
+      running = !stop_;
+      queued_.notify_one();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    queued_.notify_one();
+  }
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::deque<Period> ring_;
+  bool stop_;
+  bool done_;
+  std::atomic<uint64_t> first_frame_ns_;
+  uint64_t captured_frames_;
+  size_t dropped_;
+};
+
+// A capture device as one of the sources of MultiArrayDoa
+class AlsaArraySource : public DoaArraySource {
+ public:
+  explicit AlsaArraySource(snd_pcm_t *handle)
+      : handle_(handle), frame_index_(0), recoveries_(0) {}
+  ~AlsaArraySource() { snd_pcm_close(handle_); }
+
+  bool Read(int16_t *interleaved, int frames, FrameTag *tag) override {
+    if (!ReadPeriod(handle_, interleaved, frames, &recoveries_)) return false;
+    TagCapturedPeriod(handle_, frame_index_, frames, tag);
+    frame_index_ += frames;
+    return true;
+  }
+
+ private:
+  snd_pcm_t *handle_;
+  uint64_t frame_index_;
+  uint64_t recoveries_;
+};
+
+// Estimates the direction of every --array in one process until Ctrl+C,
+// or until the files and simulations are done. Hotword, LEDs and the
+// outputs are for a single array, the directions are only printed
+int RunArrays(const std::vector<const char *> &specs, bool batching,
+              const DoaConfig &config, bool paired_fft, double forgetting,
+              const RtProfile *capture_profile, const RtProfile *doa_profile,
+              int signal_fd) {
+  MultiArrayDoa arrays;
+  for (const char *spec : specs) {
+    DoaArraySource *source = CreateArraySource(spec, true);
+    if (!source) {
+      snd_pcm_t *handle = InitializeAlsaDevice(spec);
+      if (!handle) return 1;
+      source = new AlsaArraySource(handle);
+    }
+    int array = arrays.AddArray(source, config.frames);
+    arrays.SetHop(array, config.hop);
+    DoaEstimator &estimator = arrays.Estimator(array);
+    ApplyDoaConfig(config, &estimator);
+    estimator.SetPairedTransform(paired_fft);
+    estimator.SetForgetting(forgetting);
+
+    // Every array on the next of the cores of the profiles
+    if (capture_profile)
+      arrays.SetCaptureRtProfile(array,
+                                 NthCpuRtProfile(*capture_profile, array));
+    if (doa_profile)
+      arrays.SetWorkerRtProfile(array, NthCpuRtProfile(*doa_profile, array));
+    std::cout << "Array " << array << ": " << spec << std::endl;
+  }
+  arrays.SetBatching(batching);
+
+  std::mutex output_mutex;
+  LatencyReport latency_report;
+  arrays.Start([&](const DoaResult &result) {
+    uint64_t output_ns = PipelineClockNs();
+    std::lock_guard<std::mutex> lock(output_mutex);
+    latency_report.Add(result.tag, result.compute_start_ns, output_ns);
+    std::cout << "array " << result.tag.array
+              << " direction estimate is: " << result.direction
+              << " (confidence " << result.confidence << ")" << std::endl;
+  });
+
+  struct pollfd shutdown = {signal_fd, POLLIN, 0};
+  while (!arrays.Finished()) {
+    if (poll(&shutdown, 1, 100) > 0 && ReadSignalFd(signal_fd)) break;
+  }
+  arrays.Stop();
+
+  std::cout << arrays.WorkerCount() << " estimator threads" << std::endl;
+  for (int array = 0; array < arrays.ArrayCount(); array++)
+    std::cout << "Array " << array << ": " << arrays.Estimated(array)
+              << " periods estimated, " << arrays.Dropped(array)
+              << " dropped" << std::endl;
+  latency_report.Print(std::cout);
+  return 0;
+}
+
+// Prints the command line options
+void PrintUsage(const char *program) {
+  std::cerr << "Usage: " << program << " [options]" << std::endl
+            << "  --trace=FILE  write a Chrome trace-event JSON of all stages"
+            << std::endl
+            << "  --perf        count cycles, instructions, cache and branch "
+               "misses per stage"
+            << std::endl
+            << "  --publish[=NAME]  share the estimates in shared memory "
+               "(default /doa_results)"
+            << std::endl
+            << "  --publish-socket=PATH  also stream them on a Unix socket"
+            << std::endl
+            << "  --audio-bus[=NAME]  share the captured audio in shared "
+               "memory (default /doa_audio)"
+            << std::endl
+            << "  --model=FILE[:SENSITIVITY]  snowboy hotword model, give it "
+               "for each, they run in parallel (default jarvis.umdl)"
+            << std::endl
+            << "  --stub-hotword=HZ[:HOTWORD]  detect a tone of HZ as hotword, "
+               "for testing without snowboy"
+            << std::endl
+            << "  --rt-hotword=SPEC  real-time profile of the hotword threads, "
+               "the n-th of them on the n-th of its cores"
+            << std::endl
+            << "  --beamform    feed the hotword detector the audio steered at "
+               "the last direction"
+            << std::endl
+            << "  --beam-bus[=NAME]  share the steered audio in shared memory "
+               "(default /doa_beam)"
+            << std::endl
+            << "  --fixed-point  estimate the direction with integer math only"
+            << std::endl
+            << "  --fft=NAME    FFT of the estimator: kiss (default), radix4, "
+               "sse2, avx2, neon or auto"
+            << std::endl
+            << "  --paired-fft  transform the mic pairs 1/3 and 2/4 as one "
+               "complex FFT each (no faster on x86, see doa_benchmark)"
+            << std::endl
+            << "  --average=FORGETTING  average the cross-spectra over the "
+               "periods (0 to 1), start over on every hotword"
+            << std::endl
+            << "  --method=NAME  gcc-phat (default), lags (time-domain "
+               "correlation, less accurate) or auto (the faster for the "
+               "period)"
+            << std::endl
+            << "  --config=FILE  period, band, fusion, precision, FFT and "
+               "method from FILE (see doa_autotune_benchmark), options after "
+               "it override them. The hop is for --array only"
+            << std::endl
+            << "  --async[=POLICY]  estimate on a thread of its own; when "
+               "its queue is full block (default), drop-oldest or coalesce"
+            << std::endl
+            << "  --rt-capture=SPEC  real-time profile of the capture thread, "
+               "POLICY[:PRIORITY][@CPU,...], e.g. fifo:80@2"
+            << std::endl
+            << "  --rt-doa=SPEC  same for the estimator thread of --async"
+            << std::endl
+            << "  --mlock       lock all memory and prefault the buffers"
+            << std::endl
+            << "  --event-loop  run capture, hotwords, LEDs and shutdown in "
+               "one epoll loop, for single-core boards"
+            << std::endl
+            << "  --record=FILE  log the audio, hotwords and directions to "
+               "FILE (see capture_log_sample)"
+            << std::endl
+            << "  --compress    code the --record audio losslessly, about half "
+               "the size"
+            << std::endl
+            << "  --history=FILE  keep the estimates of days in FILE (see "
+               "doa_history_sample)"
+            << std::endl
+            << "  --device=NAME  capture from NAME instead of default, "
+               "discover finds the 4mic_hat (and caches it)"
+            << std::endl
+            << "  --array=SOURCE  estimate several arrays at once, give it "
+               "for each: an ALSA device, synthetic:DEGREE[:SNR] or "
+               "file:WAV"
+            << std::endl
+            << "  --batch-arrays  one estimator thread for all --array, "
+               "which transforms them together"
+            << std::endl;
 }
 
 // Test with a file as input
-int main() {
-  // Install the signal handler
-  signal(SIGINT, IntSignalHandler);
+int main(int argc, char **argv) {
+  // Startup times count from here
+  uint64_t main_start_ns = PipelineClockNs();
 
-  // Get the LED Controller and power it up
-  LedController *led_control = &LedController::GetInstance();
-  led_control->PowerUp(12);
+  // Parse the options
+  const char *trace_filename = nullptr;
+  bool perf_counters = false;
+  const char *publish_name = nullptr;
+  const char *publish_socket = nullptr;
+  const char *audio_bus_name = nullptr;
+  bool beamform = false;
+  const char *beam_bus_name = nullptr;
+  bool fixed_point = false;
+  FftBackend fft_backend = FFT_BACKEND_KISS;
+  bool paired_fft = false;
+  double forgetting = 0.0;
+  DoaMethod method = DOA_METHOD_GCC_PHAT;
+  DoaConfig doa_config = DefaultDoaConfig();
+  bool async = false;
+  DoaOverflowPolicy overflow_policy = DOA_OVERFLOW_BLOCK;
+  bool realtime = false;
+  bool event_loop = false;
+  bool lock_memory = false;
+  const char *pcm_device_option = "default";
+  const char *record_filename = nullptr;
+  bool compress_record = false;
+  const char *history_filename = nullptr;
+  std::vector<const char *> array_specs;
+  bool batch_arrays = false;
+  RtProfile capture_profile = DefaultRtProfile();
+  RtProfile doa_profile = DefaultRtProfile();
+  RtProfile hotword_profile = DefaultRtProfile();
+  std::vector<const char *> model_specs;
+  std::vector<std::unique_ptr<HotwordDetector>> stub_detectors;
+  static const struct option long_options[] = {
+      {"trace", required_argument, nullptr, 't'},
+      {"perf", no_argument, nullptr, 'p'},
+      {"publish", optional_argument, nullptr, 'P'},
+      {"publish-socket", required_argument, nullptr, 'S'},
+      {"audio-bus", optional_argument, nullptr, 'B'},
+      {"model", required_argument, nullptr, 'W'},
+      {"stub-hotword", required_argument, nullptr, 'U'},
+      {"rt-hotword", required_argument, nullptr, 'K'},
+      {"beamform", no_argument, nullptr, 'b'},
+      {"beam-bus", optional_argument, nullptr, 'M'},
+      {"fixed-point", no_argument, nullptr, 'F'},
+      {"fft", required_argument, nullptr, 'f'},
+      {"paired-fft", no_argument, nullptr, 'T'},
+      {"average", required_argument, nullptr, 'A'},
+      {"method", required_argument, nullptr, 'm'},
+      {"config", required_argument, nullptr, 'C'},
+      {"async", optional_argument, nullptr, 'a'},
+      {"rt-capture", required_argument, nullptr, 'c'},
+      {"rt-doa", required_argument, nullptr, 'd'},
+      {"mlock", no_argument, nullptr, 'L'},
+      {"event-loop", no_argument, nullptr, 'E'},
+      {"device", required_argument, nullptr, 'D'},
+      {"record", required_argument, nullptr, 'R'},
+      {"compress", no_argument, nullptr, 'z'},
+      {"history", required_argument, nullptr, 'H'},
+      {"array", required_argument, nullptr, 'X'},
+      {"batch-arrays", no_argument, nullptr, 'G'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}};
+  int option;
+  while ((option = getopt_long(argc, argv, "h", long_options, nullptr)) !=
+         -1) {
+    switch (option) {
+      case 't':
+        trace_filename = optarg;
+        break;
+      case 'p':
+        perf_counters = true;
+        break;
+      case 'P':
+        publish_name = optarg ? optarg : DOA_SHM_DEFAULT_NAME;
+        break;
+      case 'S':
+        publish_socket = optarg;
+        if (!publish_name) publish_name = DOA_SHM_DEFAULT_NAME;
+        break;
+      case 'B':
+        audio_bus_name = optarg ? optarg : AUDIO_BUS_DEFAULT_NAME;
+        break;
+      case 'W':
+        if (!*optarg || *optarg == ':') {
+          std::cerr << "Malformed hotword model " << optarg << std::endl;
+          return 1;
+        }
+        model_specs.push_back(optarg);
+        break;
+      case 'U':
+        stub_detectors.emplace_back(ParseStubHotwordDetector(optarg));
+        if (!stub_detectors.back()) {
+          std::cerr << "Malformed stub hotword " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      case 'b':
+        beamform = true;
+        break;
+      case 'M':
+        beam_bus_name = optarg ? optarg : "/doa_beam";
+        beamform = true;
+        break;
+      case 'F':
+        fixed_point = true;
+        break;
+      case 'f':
+        if (!ParseFftBackend(optarg, &fft_backend)) {
+          std::cerr << "FFT " << optarg << " is not available" << std::endl;
+          return 1;
+        }
+        break;
+      case 'T':
+        paired_fft = true;
+        break;
+      case 'A':
+        forgetting = atof(optarg);
+        if (forgetting < 0.0 || forgetting >= 1.0) {
+          std::cerr << "The forgetting factor must be from 0 to below 1"
+                    << std::endl;
+          return 1;
+        }
+        break;
+      case 'm':
+        if (!ParseDoaMethod(optarg, &method)) {
+          std::cerr << "Unknown method " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      case 'C':
+        // The options before it are overridden, with what is in the file
+        doa_config.fixed_point = fixed_point;
+        doa_config.fft_backend = fft_backend;
+        doa_config.method = method;
+        if (!LoadDoaConfig(optarg, &doa_config)) return 1;
+        fixed_point = doa_config.fixed_point;
+        fft_backend = doa_config.fft_backend;
+        method = doa_config.method;
+        break;
+      case 'a':
+        async = true;
+        if (optarg && !ParseDoaOverflowPolicy(optarg, &overflow_policy)) {
+          std::cerr << "Unknown overflow policy " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      case 'c':
+      case 'd':
+      case 'K':
+        if (!ParseRtProfile(optarg, option == 'c'   ? &capture_profile
+                                    : option == 'd' ? &doa_profile
+                                                    : &hotword_profile)) {
+          std::cerr << "Malformed real-time profile " << optarg << std::endl;
+          return 1;
+        }
+        realtime = true;
+        break;
+      case 'L':
+        lock_memory = true;
+        realtime = true;
+        break;
+      case 'E':
+        event_loop = true;
+        break;
+      case 'D':
+        pcm_device_option = optarg;
+        break;
+      case 'R':
+        record_filename = optarg;
+        break;
+      case 'z':
+        compress_record = true;
+        break;
+      case 'H':
+        history_filename = optarg;
+        break;
+      case 'X':
+        array_specs.push_back(optarg);
+        break;
+      case 'G':
+        batch_arrays = true;
+        break;
+      default:
+        PrintUsage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+
+  // And the options after it override the file
+  doa_config.fixed_point = fixed_point;
+  doa_config.fft_backend = fft_backend;
+  doa_config.method = method;
+
+  // A single array estimates every period as it is captured, only the
+  // arrays read overlapping windows
+  if (array_specs.empty() && doa_config.hop != doa_config.frames) {
+    std::cerr << "The hop of " << doa_config.hop
+              << " frames is for --array only, estimating every "
+              << doa_config.frames << " frames" << std::endl;
+    doa_config.hop = doa_config.frames;
+  }
+
+  // The async estimator has its own DoaEstimator, it cannot share the
+  // spectra of every period
+  if (async && (beamform || forgetting > 0.0 || fixed_point)) {
+    std::cerr << "--async works without --beamform, --average and "
+                 "--fixed-point only"
+              << std::endl;
+    return 1;
+  }
+  if (async && event_loop) {
+    std::cerr << "--event-loop runs everything on one thread, it cannot be "
+                 "combined with --async"
+              << std::endl;
+    return 1;
+  }
+
+  // Ctrl+C and SIGTERM arrive on a signalfd, which the capture loop reads,
+  // so we clean up outside of a signal handler. Blocked before any thread
+  // starts, so none of them gets the signals
+  static const int SHUTDOWN_SIGNALS[] = {SIGINT, SIGTERM};
+  int signal_fd = CreateSignalFd(SHUTDOWN_SIGNALS, 2);
+  DumpPipelineStatsOnSignal();
+
+  // Lock what is mapped now and everything mapped later, the rings then
+  // get their pages when they are created
+  if (lock_memory) LockAllMemory();
+
+  // Start recording the trace
+  SetTraceThreadName("capture");
+  if (trace_filename) StartTracing(trace_filename);
+
+  // Profile with the hardware counters, if we get them
+  if (perf_counters) EnablePerfCounters();
+
+  // Several arrays take their own path
+  if (!array_specs.empty()) {
+    int status = RunArrays(array_specs, batch_arrays, doa_config, paired_fft,
+                           forgetting, realtime ? &capture_profile : nullptr,
+                           realtime ? &doa_profile : nullptr, signal_fd);
+    close(signal_fd);
+    StopTracing();
+    if (PerfCountersEnabled()) DumpPerfCounters(std::cout);
+    return status;
+  }
+
+  // Share the estimates with other processes
+  DoaPublisher publisher;
+  if (publish_name && publisher.Open(publish_name) && publish_socket)
+    publisher.ServeSocket(publish_socket);
+
+  // And keep them, across restarts
+  DoaHistory history;
+  if (history_filename) history.Open(history_filename);
 
-  const char *pcm_device = Get4MicHatPcmDevice();
-  snd_pcm_t *capture_handle = InitializeAlsaDevice(pcm_device);
+  // Capture comes first: the device is the cached one while the cards stay
+  // the same, and the pre-roll thread records while the LEDs, the hotword
+  // model and the estimator plans get ready, all at the same time
+  uint64_t discovery_start_ns = PipelineClockNs();
+  bool device_cached = false;
+  bool discover = strcmp(pcm_device_option, DISCOVER_DEVICE) == 0;
+  std::string pcm_device =
+      discover ? Get4MicHatPcmDevice(&device_cached) : pcm_device_option;
+  uint64_t discovery_done_ns = PipelineClockNs();
+  snd_pcm_t *capture_handle = InitializeAlsaDevice(pcm_device.c_str());
+
+  // The cached device is gone (the card was renamed or its PCM changed
+  // without the card list changing), so look again
+  if (!capture_handle && device_cached) {
+    std::cout << "Cached device " << pcm_device << " failed, discovering"
+              << std::endl;
+    pcm_device = Discover4MicHatPcmDevice();
+    StoreCachedDevice(SoundCardIdentity(), pcm_device);
+    device_cached = false;
+    capture_handle = InitializeAlsaDevice(pcm_device.c_str());
+    discovery_done_ns = PipelineClockNs();
+  }
+  LedController *led_control = &LedController::GetInstance();
 
   if (capture_handle) {
-    // Make snowboy ready using jarvis as hotword
-    std::string resource_filename = "contrib/snowboy/resources/common.res";
-    std::string model_filename = "contrib/snowboy/resources/models/jarvis.umdl";
-    std::string sensitivity_str = "0.8,0.80";
-    float audio_gain = 1;
-    bool apply_frontend = true;
-
-    // Initializes Snowboy detector.
-    snowboy::SnowboyDetect detector(resource_filename, model_filename);
-    detector.SetSensitivity(sensitivity_str);
-    detector.SetAudioGain(audio_gain);
-    detector.ApplyFrontend(apply_frontend);
-
-    int size_of_sample = 4096;
+    int size_of_sample = doa_config.frames;
     std::vector<int16_t> buffer(size_of_sample * 4 * sizeof(short) /
                                 sizeof(int16_t));
-    bool capture_running = true;
-    while (capture_running) {
-      int err;
-      if ((err = snd_pcm_readi(capture_handle, (char *)buffer.data(),
-                               size_of_sample)) != size_of_sample) {
-        fprintf(stderr, "read from audio interface failed (%s)\n",
-                snd_strerror(err));
-        capture_running = false;
-        continue;
+    uint64_t period_ns = size_of_sample * 1000000000ull / 16000;
+    uint64_t recoveries = 0;
+    uint64_t parallel_start_ns = PipelineClockNs();
+    PrerollCapture preroll;
+    preroll.Start(capture_handle, size_of_sample, PREROLL_PERIODS,
+                  realtime ? &capture_profile : nullptr, &recoveries);
+
+    // Get the LED Controller and power it up
+    std::future<uint64_t> leds_ready = std::async(std::launch::async, [&] {
+      led_control->PowerUp(12);
+      return PipelineClockNs();
+    });
+
+    // Make the hotword detectors ready, jarvis if none is given. Each
+    // runs on a thread of its own, so another model costs a core rather
+    // than latency
+    HotwordRunner hotwords;
+    std::future<uint64_t> model_ready = std::async(std::launch::async, [&] {
+      if (model_specs.empty() && stub_detectors.empty())
+        model_specs.push_back(DEFAULT_HOTWORD_MODEL);
+      for (const char *model_spec : model_specs)
+        hotwords.AddDetector(ParseSnowboyHotwordDetector(model_spec));
+      for (std::unique_ptr<HotwordDetector> &stub : stub_detectors)
+        hotwords.AddDetector(stub.release());
+      return PipelineClockNs();
+    });
+
+    // Share the audio with other consumers, 16 periods (about 4 s) of it
+    AudioBusWriter audio_bus;
+    if (audio_bus_name)
+      audio_bus.Create(audio_bus_name, 4, 16000, 16 * size_of_sample);
+
+    // Record everything for later, the log writes on a thread of its own
+    CaptureLogWriter capture_log;
+    if (record_filename)
+      capture_log.Open(record_filename, 4, 16000, compress_record);
+
+    // The estimator keeps the spectra of the period, the beamformer steers
+    // them at the last direction we found
+    DoaEstimator estimator;
+    ApplyDoaConfig(doa_config, &estimator);
+    estimator.SetPairedTransform(paired_fft);
+    estimator.SetForgetting(forgetting);
+    AsyncDoaEstimator async_estimator;
+    if (async) {
+      DoaEstimator &worker_estimator = async_estimator.Estimator();
+      ApplyDoaConfig(doa_config, &worker_estimator);
+      worker_estimator.SetPairedTransform(paired_fft);
+      if (realtime) async_estimator.SetRtProfile(doa_profile);
+      async_estimator.Start(ASYNC_QUEUE_PERIODS, overflow_policy);
+    }
+    DelayAndSumBeamformer beamformer;
+    DoaFixedEstimator fixed_estimator;
+    ApplyDoaConfig(doa_config, &fixed_estimator);
+    bool have_direction = false;
+    double last_direction = 0.0;
+    AudioBusWriter beam_bus;
+    if (beam_bus_name)
+      beam_bus.Create(beam_bus_name, 1, 16000, 16 * size_of_sample);
+    uint64_t frame_index = 0;
+    uint64_t captured_frames = 0;
+    LatencyReport latency_report;
+
+    // Estimate a silent period once, so the plans, tables and buffers are
+    // there (and auto picked its method) before the first hotword. Nothing
+    // else touches the estimators until this is done
+    std::future<uint64_t> plans_ready = std::async(std::launch::async, [&] {
+      std::vector<int16_t> silence(buffer.size());
+      if (async) {
+        async_estimator.Estimator().Estimate(silence, FrameTag());
+      } else if (fixed_point) {
+        fixed_estimator.Estimate(silence, FrameTag());
       } else {
-        // Create the channels for each mic and fill them with data
-        std::vector<int16_t> channel_1(buffer.size() / 4);
-        for (int i = 0, j = 0; j < buffer.size() / 4; i += 4, j++) {
-          channel_1[j] = buffer[i];
+        estimator.Estimate(silence, FrameTag());
+        estimator.ResetAverage();
+      }
+      return PipelineClockNs();
+    });
+    uint64_t leds_ready_ns = leds_ready.get();
+    uint64_t model_ready_ns = model_ready.get();
+    uint64_t plans_ready_ns = plans_ready.get();
+    uint64_t ready_ns =
+        std::max(std::max(leds_ready_ns, model_ready_ns), plans_ready_ns);
+
+    // The hotword threads get the profile as well, one core each. The
+    // event loop runs the detectors itself, it has no threads to hand to
+    if (event_loop) {
+      hotwords.StartInline(size_of_sample);
+    } else {
+      if (realtime)
+        for (int d = 0; d < hotwords.DetectorCount(); d++)
+          hotwords.SetRtProfile(d, NthCpuRtProfile(hotword_profile, d));
+      hotwords.Start(size_of_sample);
+    }
+    std::vector<HotwordDetection> detections;
+
+    // The capture thread (and the threads it starts from now on) get their
+    // profile last, the helper threads started above keep the normal
+    // scheduling
+    if (realtime) ApplyRtProfile("capture", capture_profile);
+
+    // Shows a direction on the LEDs. The event loop only marks it and
+    // paints it with the next LED frame
+    bool led_pending = false, led_timer_armed = false;
+    double led_direction = 0.0;
+    int led_timer = event_loop ? CreateTimerFd() : -1;
+    auto show_leds = [&](double direction) {
+      if (!event_loop) {
+        ScopedStageTimer led_timer(STAGE_LED_TRANSMIT);
+        led_control->ShowDirection(direction);
+        return;
+      }
+      led_direction = direction;
+      led_pending = true;
+      if (!led_timer_armed)
+        led_timer_armed = ArmTimerFd(led_timer, 1, LED_FRAME_NS);
+    };
+
+    // Remembers when the period we just read was recorded
+    auto tag_period = [&]() {
+      FrameTag tag;
+      TagCapturedPeriod(capture_handle, captured_frames, size_of_sample,
+                        &tag);
+      captured_frames += size_of_sample;
+      return tag;
+    };
+
+    // Where the next period is read to: straight into the audio bus if
+    // we share it, the period buffer otherwise. Until the period is
+    // committed this gives the same place every time
+    auto capture_target = [&]() {
+      int16_t *target = audio_bus.AcquireWrite(size_of_sample);
+      return target ? target : buffer.data();
+    };
+
+    // Everything we do with a period, once it is read completely. The bus
+    // keeps a period for 16 more, so we can still use it after the commit
+    auto process_period = [&](const int16_t *audio, const FrameTag &tag,
+                              StageLapTimer &stage_timer,
+                              uint64_t read_done_ns) {
+      if (audio == buffer.data())
+        audio_bus.Write(audio, size_of_sample);
+      else
+        audio_bus.CommitWrite(size_of_sample);
+      if (record_filename)
+        capture_log.WriteAudio(audio, size_of_sample, tag);
+
+      // The first mic goes straight to where the hotword detectors read
+      int16_t *hotword_input = hotwords.NextPeriod();
+      for (int i = 0, j = 0; j < size_of_sample; i += 4, j++) {
+        hotword_input[j] = audio[i];
+      }
+      stage_timer.Lap(STAGE_DEINTERLEAVE);
+
+      // Once we know where the talker is, listen in that direction
+      // Averaging and beamforming need the spectra of every period
+      bool analyzed = beamform || forgetting > 0.0;
+      if (analyzed) {
+        estimator.Analyze(audio, size_of_sample);
+        if (have_direction) {
+          beamformer.Process(estimator, last_direction, hotword_input);
+          beam_bus.Write(hotword_input, size_of_sample);
         }
-        int result = detector.RunDetection(channel_1.data(), channel_1.size());
-        if (result > 0) {
-          double best_guess = GetDirection(buffer);
+        stage_timer.Restart();
+      }
 
-          // If we have an LED controller, Paint the pixels accordingly
-          int best_guess_pixel = (int)(best_guess / 30.0);
-          led_control->Clear();
+      // The detectors run in parallel, we wait for the slowest. One that
+      // takes longer than half a period reports with a later period. In
+      // the event loop they ran in Commit already
+      hotwords.Commit(tag);
+      if (!event_loop) hotwords.WaitIdle(period_ns / 2);
+      stage_timer.Lap(STAGE_HOTWORD);
+      detections.clear();
+      hotwords.TakeDetections(&detections);
+      for (const HotwordDetection &detection : detections) {
+        std::cout << "Hotword " << detection.hotword << " detected";
+        if (hotwords.DetectorCount() > 1)
+          std::cout << " by " << hotwords.Detector(detection.detector).Name();
+        std::cout << "!" << std::endl;
+        if (record_filename)
+          capture_log.WriteHotword(detection.tag, detection.hotword);
+      }
 
-          // Set all Pixel to green
-          for (int i = 0; i < 12; i++) {
-            led_control->SetPixelColor(i, 0, 24, 0, 1);
-          }
+      // One direction, from this period, however many detectors fired
+      if (!detections.empty()) {
+        // Shows a direction, on the estimator thread with --async
+        auto show = [&](DoaResult doa) {
+          double best_guess = doa.direction;
 
-          // Set the Pixel before and after the computed one to a lower
-          // brightness
-          led_control->SetPixelColor(
-              best_guess_pixel == 0 ? 11 : (best_guess_pixel - 1) % 12, 0, 0,
-              48, 1);
-          led_control->SetPixelColor(best_guess_pixel, 0, 0, 48, 31);
-          led_control->SetPixelColor((best_guess_pixel + 1) % 12, 0, 0, 48, 1);
-          led_control->Show();
+          // If we have an LED controller, Paint the pixels accordingly
+          show_leds(best_guess);
+          doa.output_ns = PipelineClockNs();
+          latency_report.Add(doa.tag, doa.compute_start_ns, doa.output_ns);
+          publisher.Publish(doa);
+          if (record_filename) capture_log.WriteDoa(doa);
+          if (history_filename) history.Append(doa);
 
-          std::cout << "Hotword " << result << " detected!" << std::endl;
           std::cout << "direction estimate is: " << best_guess << std::endl;
+          std::cout << "audio-to-output latency: " << doa.LatencyNs() / 1e6
+                    << " ms" << std::endl;
+        };
+
+        if (async) {
+          // The period is read into again, the estimator gets a copy
+          async_estimator.Submit(
+              std::make_shared<const std::vector<int16_t>>(
+                  audio, audio + size_of_sample * DOA_CHANNELS),
+              tag, show);
+        } else {
+          // The spectra of this period (and the averages) are there
+          // already if we analyze every period
+          DoaResult doa =
+              fixed_point
+                  ? fixed_estimator.Estimate(audio, size_of_sample, tag)
+              : analyzed ? estimator.Estimate(tag)
+                         : estimator.Estimate(audio, size_of_sample, tag);
+          estimator.ResetAverage();
+          have_direction = true;
+          last_direction = doa.direction;
+          show(doa);
+        }
+      }
+
+      // Mark the frames where we took longer than the audio we got, the
+      // next read will then return late data
+      if (TracingEnabled() && PipelineClockNs() - read_done_ns > period_ns)
+        RecordTraceInstant("overrun", PipelineClockNs());
+    };
+
+    // Hand over: the pre-roll thread stops after the period it is reading,
+    // we work off what it recorded until then and read on ourselves
+    preroll.Stop();
+    FrameTag preroll_tag;
+    while (preroll.Next(&buffer, &preroll_tag)) {
+      SetTraceFrame(frame_index++);
+      ScopedTraceSpan frame_span("frame");
+      StageLapTimer stage_timer;
+      process_period(buffer.data(), preroll_tag, stage_timer,
+                     PipelineClockNs());
+    }
+    captured_frames = preroll.CapturedFrames();
+
+    // How long it took until we heard something, and until we listened
+    std::cout << "Startup: capture from " << pcm_device << " ("
+              << (!discover       ? "given"
+                  : device_cached   ? "cached"
+                                    : "discovered")
+              << " in " << (discovery_done_ns - discovery_start_ns) / 1e6
+              << " ms), ";
+    if (preroll.FirstFrameNs())
+      std::cout << "first frame captured after "
+                << (preroll.FirstFrameNs() - main_start_ns) / 1e6 << " ms";
+    else
+      std::cout << "no frame captured";
+    std::cout << ", ready after " << (ready_ns - main_start_ns) / 1e6
+              << " ms (LEDs " << (leds_ready_ns - parallel_start_ns) / 1e6
+              << " ms, hotword model "
+              << (model_ready_ns - parallel_start_ns) / 1e6
+              << " ms, estimator plans "
+              << (plans_ready_ns - parallel_start_ns) / 1e6 << " ms), "
+              << captured_frames / size_of_sample << " periods pre-rolled, "
+              << preroll.Dropped() << " dropped" << std::endl;
+
+    if (!event_loop) {
+      // Read period after period, a signal ends it after the period
+      bool capture_running = true;
+      while (capture_running) {
+        // Every read is one frame in the trace
+        SetTraceFrame(frame_index++);
+        ScopedTraceSpan frame_span("frame");
+
+        StageLapTimer stage_timer;
+        int16_t *period = capture_target();
+        bool have_period =
+            ReadPeriod(capture_handle, period, size_of_sample, &recoveries);
+        stage_timer.Lap(STAGE_CAPTURE_WAIT);
+        if (!have_period) {
+          capture_running = false;
+          continue;
+        }
+        process_period(period, tag_period(), stage_timer, PipelineClockNs());
+        if (ReadSignalFd(signal_fd)) capture_running = false;
+      }
+    } else {
+      EventLoop loop;
+      loop.Open();
+
+      // Shutdown
+      loop.Add(signal_fd, EPOLLIN, [&](uint32_t) {
+        if (ReadSignalFd(signal_fd)) loop.Stop();
+      });
+
+      // One LED frame per tick while there is something to show, the
+      // timer stops when there is not
+      loop.Add(led_timer, EPOLLIN, [&](uint32_t) {
+        if (!ReadTimerFd(led_timer)) return;
+        if (led_pending) {
+          ScopedStageTimer led_timer(STAGE_LED_TRANSMIT);
+          led_control->ShowDirection(led_direction);
+          led_pending = false;
+        } else {
+          ArmTimerFd(led_timer, 0, 0);
+          led_timer_armed = false;
         }
+      });
+
+      // The capture, read without blocking into the period buffer. Every
+      // wakeup reads what is there and processes at most one period
+      snd_pcm_nonblock(capture_handle, 1);
+      int descriptor_count = snd_pcm_poll_descriptors_count(capture_handle);
+      std::vector<struct pollfd> descriptors(descriptor_count);
+      snd_pcm_poll_descriptors(capture_handle, descriptors.data(),
+                               descriptor_count);
+      int filled = 0;
+      StageLapTimer stage_timer;
+      for (int d = 0; d < descriptor_count; d++) {
+        auto read_capture = [&, d](uint32_t events) {
+          // ALSA translates the events of its descriptors
+          for (struct pollfd &descriptor : descriptors) descriptor.revents = 0;
+          descriptors[d].revents = events;
+          unsigned short revents = 0;
+          snd_pcm_poll_descriptors_revents(capture_handle, descriptors.data(),
+                                           descriptor_count, &revents);
+          if (!(revents & (POLLIN | POLLERR))) return;
+
+          int16_t *period = capture_target();
+          snd_pcm_sframes_t frames_read =
+              snd_pcm_readi(capture_handle, period + filled * DOA_CHANNELS,
+                            size_of_sample - filled);
+          if (frames_read == -EAGAIN) return;
+          if (frames_read < 0) {
+            int err = snd_pcm_recover(capture_handle, frames_read, 1);
+            if (err < 0) {
+              fprintf(stderr, "read from audio interface failed (%s)\n",
+                      snd_strerror(err));
+              loop.Stop();
+              return;
+            }
+            recoveries++;
+            filled = 0;
+            snd_pcm_start(capture_handle);
+            return;
+          }
+          filled += frames_read;
+          if (filled < size_of_sample) return;
+          filled = 0;
+
+          // Every period is one frame in the trace
+          SetTraceFrame(frame_index++);
+          ScopedTraceSpan frame_span("frame");
+          stage_timer.Lap(STAGE_CAPTURE_WAIT);
+          process_period(period, tag_period(), stage_timer,
+                         PipelineClockNs());
+          stage_timer.Restart();
+        };
+        loop.Add(descriptors[d].fd, descriptors[d].events, read_capture);
       }
+
+      snd_pcm_start(capture_handle);
+      loop.Run();
+      if (led_timer >= 0) close(led_timer);
     }
 
-    // Close the soundcard handle
+    // Close the soundcard handle, show what is still queued
     snd_pcm_close(capture_handle);
+    std::cout << recoveries << " capture overruns recovered" << std::endl;
+    hotwords.Stop();
+    uint64_t skipped = 0;
+    for (int d = 0; d < hotwords.DetectorCount(); d++)
+      skipped += hotwords.Skipped(d);
+    std::cout << hotwords.Dropped() << " periods dropped and " << skipped
+              << " skipped by the hotword detectors" << std::endl;
+    async_estimator.Stop();
+    if (async)
+      std::cout << async_estimator.Dropped()
+                << " hotwords dropped by the async estimator" << std::endl;
+    latency_report.Print(std::cout);
+    capture_log.Close();
 
     // Power Down the LED ring
     led_control->PowerDown();
   }
+
+  close(signal_fd);
+  StopTracing();
+  if (PerfCountersEnabled()) DumpPerfCounters(std::cout);
 }
@@ -0,0 +1,131 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_direction.cc
+** Turns the delays between the mic pairs of the 4mic_hat into directions,
+** shared by the double and the fixed-point estimator
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_detection.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+// The defines we need
+static const double MAX_TDOA_4 = 2 * DOA_MIC_RADIUS / DOA_SOUND_SPEED;
+static const double PI = 3.14159265358979323846;
+
+static const char *const FUSION_NAMES[] = {"whole", "interpolated"};
+
+const char *DoaFusionName(DoaFusion fusion) {
+  if (fusion < DOA_FUSION_WHOLE_LAGS || fusion > DOA_FUSION_INTERPOLATED)
+    return "unknown";
+  return FUSION_NAMES[fusion];
+}
+
+bool ParseDoaFusion(const char *name, DoaFusion *fusion) {
+  for (int i = DOA_FUSION_WHOLE_LAGS; i <= DOA_FUSION_INTERPOLATED; i++) {
+    if (strcmp(name, FUSION_NAMES[i]) == 0) {
+      *fusion = (DoaFusion)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// The lag of the strongest correlation (the first of equal ones), moved
+// to the vertex of the parabola through it and its neighbours if it has
+// both and is a true maximum
+double PairDelay(const double cc[DOA_LAG_COUNT], DoaFusion fusion) {
+  int pos = 0;
+  for (int i = 1; i < DOA_LAG_COUNT; i++)
+    if (cc[pos] < cc[i]) pos = i;
+
+  double lag = pos - DOA_MAX_LAG;
+  if (fusion == DOA_FUSION_INTERPOLATED && pos > 0 &&
+      pos < DOA_LAG_COUNT - 1) {
+    double curvature = cc[pos - 1] - 2.0 * cc[pos] + cc[pos + 1];
+    if (curvature < 0.0) {
+      double offset = 0.5 * (cc[pos - 1] - cc[pos + 1]) / curvature;
+      lag += std::max(-0.5, std::min(0.5, offset));
+    }
+  }
+  return lag / 16000.0;
+}
+
+// Compute the modulo, but wrap-around at 360 degree
+double FmodWrap(double x, double y) {
+  if (x < 0) x += 360;
+
+  return std::fmod(x, y);
+}
+
+// Combines the delays of the two mic pairs to a direction between 0 and
+// 360 degree
+double FuseDirection(double tau1, double tau2) {
+  double theta1 = asin(tau1 / MAX_TDOA_4) * 180.0 / PI;
+  double theta2 = asin(tau2 / MAX_TDOA_4) * 180.0 / PI;
+
+  // Use the results for best effort computation of the DoA
+  double best_guess = 0.0;
+  if (std::abs(theta1) < std::abs(theta2)) {
+    if (theta2 > 0)
+      best_guess = FmodWrap((theta1 + 360.0), 360.0);
+    else
+      best_guess = (180.0 - theta1);
+  } else {
+    if (theta1 < 0)
+      best_guess = FmodWrap((theta2 + 360.0), 360.0);
+    else
+      best_guess = (180.0 - theta2);
+    best_guess = FmodWrap((best_guess + 270.0), 360.0);
+  }
+  best_guess = FmodWrap((-best_guess + 120.0), 360.0);
+
+  return best_guess;
+}
+
+// Ranks all lag combinations of the two pairs by the product of their
+// correlations and keeps the best distinct directions
+void FindPeaks(const double cc1[DOA_LAG_COUNT],
+                      const double cc2[DOA_LAG_COUNT], DoaResult *result) {
+  result->peak_count = 0;
+  for (int i = 0; i < DOA_LAG_COUNT; i++) {
+    for (int j = 0; j < DOA_LAG_COUNT; j++) {
+      DoaPeak peak;
+      peak.strength = cc1[i] * cc2[j];
+      peak.direction = FuseDirection((i - DOA_MAX_LAG) / 16000.0,
+                                     (j - DOA_MAX_LAG) / 16000.0);
+
+      // Keep the stronger one if two combinations give the same direction
+      int k = 0;
+      while (k < result->peak_count &&
+             std::abs(result->peaks[k].direction - peak.direction) > 0.5)
+        k++;
+      if (k < result->peak_count) {
+        if (result->peaks[k].strength >= peak.strength) continue;
+        for (; k + 1 < result->peak_count; k++)
+          result->peaks[k] = result->peaks[k + 1];
+        result->peak_count--;
+      }
+
+      // Insertion into the sorted list
+      int pos = result->peak_count;
+      while (pos > 0 && result->peaks[pos - 1].strength < peak.strength) {
+        if (pos < DOA_MAX_PEAKS) result->peaks[pos] = result->peaks[pos - 1];
+        pos--;
+      }
+      if (pos < DOA_MAX_PEAKS) {
+        result->peaks[pos] = peak;
+        if (result->peak_count < DOA_MAX_PEAKS) result->peak_count++;
+      }
+    }
+  }
+}
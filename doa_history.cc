@@ -0,0 +1,362 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_history.cc
+** The ring file of past estimates
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_history.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+
+// How often a reader retries a slot that is being written. A writer that
+// died in the middle leaves it odd, and the reader gives up
+static const int READ_RETRIES = 1000;
+
+static size_t DoaHistorySize(uint32_t capacity, uint32_t minute_capacity) {
+  return sizeof(DoaHistoryHeader) +
+         minute_capacity * sizeof(DoaHistoryMinuteSlot) +
+         capacity * sizeof(DoaHistorySlot);
+}
+
+static uint64_t ClockNs(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+DoaHistory::DoaHistory()
+    : header_(nullptr),
+      minutes_(nullptr),
+      slots_(nullptr),
+      size_(0),
+      writable_(false) {}
+
+DoaHistory::~DoaHistory() { Close(); }
+
+bool DoaHistory::Open(const char *path, uint32_t capacity,
+                      uint32_t minute_capacity) {
+  return Map(path, true, capacity, minute_capacity);
+}
+
+bool DoaHistory::OpenReadOnly(const char *path) {
+  return Map(path, false, 0, 0);
+}
+
+bool DoaHistory::Map(const char *path, bool writable, uint32_t capacity,
+                     uint32_t minute_capacity) {
+  if (header_) {
+    std::cout << "History already open." << std::endl;
+    return false;
+  }
+
+  int fd = writable ? open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)
+                    : open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::cout << "Failed to open history " << path << " (" << strerror(errno)
+              << ")" << std::endl;
+    return false;
+  }
+
+  // Continue a file of the same layout, start over otherwise. The header
+  // starts with magic, version, capacity and minute_capacity
+  struct stat status;
+  uint32_t existing[4] = {0, 0, 0, 0};
+  bool valid = fstat(fd, &status) == 0 &&
+               (size_t)status.st_size >= sizeof(DoaHistoryHeader) &&
+               pread(fd, existing, sizeof(existing), 0) ==
+                   (ssize_t)sizeof(existing) &&
+               existing[0] == DOA_HISTORY_MAGIC &&
+               existing[1] == DOA_HISTORY_VERSION && existing[2] > 0 &&
+               (size_t)status.st_size ==
+                   DoaHistorySize(existing[2], existing[3]);
+  if (!writable) {
+    if (!valid) {
+      std::cout << "History " << path << " has an unknown format"
+                << std::endl;
+      close(fd);
+      return false;
+    }
+    capacity = existing[2];
+    minute_capacity = existing[3];
+  } else if (valid &&
+             (existing[2] != capacity || existing[3] != minute_capacity)) {
+    std::cout << "History " << path << " has another size, starting over"
+              << std::endl;
+    valid = false;
+  }
+
+  size_t size = DoaHistorySize(capacity, minute_capacity);
+  if (writable && !valid &&
+      (ftruncate(fd, 0) < 0 || ftruncate(fd, size) < 0)) {
+    std::cout << "Failed to size history " << path << " (" << strerror(errno)
+              << ")" << std::endl;
+    close(fd);
+    return false;
+  }
+
+  void *memory =
+      mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+           MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    std::cout << "Failed to map history " << path << " (" << strerror(errno)
+              << ")" << std::endl;
+    return false;
+  }
+
+  header_ = static_cast<DoaHistoryHeader *>(memory);
+  minutes_ = reinterpret_cast<DoaHistoryMinuteSlot *>(header_ + 1);
+  slots_ = reinterpret_cast<DoaHistorySlot *>(minutes_ + minute_capacity);
+  size_ = size;
+  writable_ = writable;
+
+  // A new file is all zeros, which is an empty ring but for the header
+  if (writable && !valid) {
+    header_->version = DOA_HISTORY_VERSION;
+    header_->capacity = capacity;
+    header_->minute_capacity = minute_capacity;
+    header_->write_count.store(0, std::memory_order_relaxed);
+    header_->last_time_ns = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = DOA_HISTORY_MAGIC;
+  } else if (writable) {
+    // A writer killed in the middle of Append left its slots odd, which
+    // would lock out the readers and flip our parity. Append only ever
+    // holds the slot of write_count and the minute of last_time_ns (it is
+    // set first), so those are all that need a look. The record it was
+    // writing is torn, it counts as overwritten
+    uint64_t sequence = header_->write_count.load(std::memory_order_relaxed);
+    DoaHistorySlot &slot = slots_[sequence % capacity];
+    uint32_t lock = slot.seqlock.load(std::memory_order_relaxed);
+    if (lock & 1) {
+      slot.record.sequence = UINT64_MAX;
+      slot.seqlock.store(lock + 1, std::memory_order_release);
+    }
+    DoaHistoryMinuteSlot &minute_slot =
+        minutes_[header_->last_time_ns / DOA_HISTORY_MINUTE_NS %
+                 minute_capacity];
+    lock = minute_slot.seqlock.load(std::memory_order_relaxed);
+    if (lock & 1)
+      minute_slot.seqlock.store(lock + 1, std::memory_order_release);
+  }
+  return true;
+}
+
+void DoaHistory::Close() {
+  if (!header_) return;
+  munmap(header_, size_);
+  header_ = nullptr;
+  minutes_ = nullptr;
+  slots_ = nullptr;
+  size_ = 0;
+}
+
+void DoaHistory::Append(const DoaResult &result) {
+  // The audio is older than now by as much as the monotonic clock says
+  uint64_t monotonic_ns = ClockNs(CLOCK_MONOTONIC);
+  uint64_t capture_ns = result.tag.capture_ns;
+  uint64_t age_ns = capture_ns && capture_ns < monotonic_ns
+                        ? monotonic_ns - capture_ns
+                        : 0;
+  Append(result, ClockNs(CLOCK_REALTIME) - age_ns);
+}
+
+void DoaHistory::Append(const DoaResult &result, uint64_t time_ns) {
+  if (!header_ || !writable_) return;
+
+  // The ring stays sorted even if the wall clock steps back
+  if (time_ns < header_->last_time_ns) time_ns = header_->last_time_ns;
+  header_->last_time_ns = time_ns;
+
+  uint64_t sequence = header_->write_count.load(std::memory_order_relaxed);
+  DoaHistorySlot &slot = slots_[sequence % header_->capacity];
+
+  // Odd while we write
+  uint32_t lock = slot.seqlock.load(std::memory_order_relaxed);
+  slot.seqlock.store(lock + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  DoaHistoryRecord &record = slot.record;
+  record.sequence = sequence;
+  record.time_ns = time_ns;
+  record.direction = result.direction;
+  record.confidence = result.confidence;
+  record.peak_count = result.peak_count < DOA_HISTORY_MAX_PEAKS
+                          ? result.peak_count
+                          : DOA_HISTORY_MAX_PEAKS;
+  for (uint32_t i = 0; i < record.peak_count; i++) {
+    record.peak_direction[i] = result.peaks[i].direction;
+    record.peak_strength[i] = result.peaks[i].strength;
+  }
+  slot.seqlock.store(lock + 2, std::memory_order_release);
+
+  // Count it in its minute, which starts over if it held an older one
+  uint64_t minute = time_ns / DOA_HISTORY_MINUTE_NS;
+  DoaHistoryMinuteSlot &minute_slot =
+      minutes_[minute % header_->minute_capacity];
+  lock = minute_slot.seqlock.load(std::memory_order_relaxed);
+  minute_slot.seqlock.store(lock + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  DoaHistoryMinute &summary = minute_slot.minute;
+  if (summary.minute != minute || summary.count == 0) {
+    memset(&summary, 0, sizeof(summary));
+    summary.minute = minute;
+    summary.first_sequence = sequence;
+  }
+  summary.count++;
+  summary.confidence_sum += result.confidence;
+  int bin = (int)(result.direction * DOA_HISTORY_BINS / 360.0);
+  if (bin < 0) bin = 0;
+  if (bin >= DOA_HISTORY_BINS) bin = DOA_HISTORY_BINS - 1;
+  summary.histogram[bin]++;
+  minute_slot.seqlock.store(lock + 2, std::memory_order_release);
+
+  header_->write_count.store(sequence + 1, std::memory_order_release);
+}
+
+uint64_t DoaHistory::WriteCount() const {
+  return header_ ? header_->write_count.load(std::memory_order_acquire) : 0;
+}
+
+uint64_t DoaHistory::Available() const {
+  uint64_t count = WriteCount();
+  return header_ && count > header_->capacity ? header_->capacity : count;
+}
+
+bool DoaHistory::ReadSlot(uint64_t sequence, DoaHistoryRecord *record) const {
+  const DoaHistorySlot &slot = slots_[sequence % header_->capacity];
+
+  for (int retry = 0; retry < READ_RETRIES; retry++) {
+    uint32_t before = slot.seqlock.load(std::memory_order_acquire);
+    if (before & 1) continue;  // Being written right now
+
+    memcpy(record, &slot.record, sizeof(DoaHistoryRecord));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seqlock.load(std::memory_order_relaxed) != before) continue;
+
+    // A newer record means the slot was reused
+    return record->sequence == sequence;
+  }
+  return false;
+}
+
+bool DoaHistory::ReadMinute(uint64_t minute,
+                            DoaHistoryMinute *summary) const {
+  const DoaHistoryMinuteSlot &slot =
+      minutes_[minute % header_->minute_capacity];
+
+  for (int retry = 0; retry < READ_RETRIES; retry++) {
+    uint32_t before = slot.seqlock.load(std::memory_order_acquire);
+    if (before & 1) continue;
+
+    memcpy(summary, &slot.minute, sizeof(DoaHistoryMinute));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seqlock.load(std::memory_order_relaxed) != before) continue;
+
+    // An older or newer minute in the same slot does not count
+    return summary->minute == minute && summary->count > 0;
+  }
+  return false;
+}
+
+// Binary search over the sequences [low, high), which are in time order.
+// Overwritten ones count as older than everything
+uint64_t DoaHistory::FirstAtOrAfter(uint64_t time_ns, uint64_t low,
+                                    uint64_t high) const {
+  DoaHistoryRecord record;
+  while (low < high) {
+    uint64_t middle = low + (high - low) / 2;
+    if (!ReadSlot(middle, &record) || record.time_ns < time_ns)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+size_t DoaHistory::Query(uint64_t from_ns, uint64_t to_ns,
+                         std::vector<DoaHistoryRecord> *records) const {
+  if (!header_ || from_ns >= to_ns) return 0;
+
+  uint64_t write_count = header_->write_count.load(std::memory_order_acquire);
+  uint64_t oldest =
+      write_count > header_->capacity ? write_count - header_->capacity : 0;
+
+  // The minute of from_ns, if we have it, holds the first record, or the
+  // one after its records is
+  uint64_t low = oldest, high = write_count;
+  DoaHistoryMinute summary;
+  if (ReadMinute(from_ns / DOA_HISTORY_MINUTE_NS, &summary) &&
+      summary.first_sequence >= oldest &&
+      summary.first_sequence + summary.count <= write_count) {
+    low = summary.first_sequence;
+    high = summary.first_sequence + summary.count;
+  }
+
+  size_t added = 0;
+  DoaHistoryRecord record;
+  for (uint64_t sequence = FirstAtOrAfter(from_ns, low, high);
+       sequence < write_count; sequence++) {
+    if (!ReadSlot(sequence, &record)) continue;
+    if (record.time_ns >= to_ns) break;
+    records->push_back(record);
+    added++;
+  }
+  return added;
+}
+
+size_t DoaHistory::Aggregate(uint64_t from_ns, uint64_t to_ns,
+                             int minutes_per_bucket,
+                             std::vector<DoaHistoryMinute> *buckets) const {
+  if (!header_ || from_ns >= to_ns || minutes_per_bucket < 1) return 0;
+
+  // Only the minutes the ring can still have
+  uint64_t first = from_ns / DOA_HISTORY_MINUTE_NS;
+  uint64_t last = (to_ns - 1) / DOA_HISTORY_MINUTE_NS;
+  uint64_t newest = header_->last_time_ns / DOA_HISTORY_MINUTE_NS;
+  if (newest >= header_->minute_capacity &&
+      first < newest - header_->minute_capacity + 1)
+    first = newest - header_->minute_capacity + 1;
+  if (last > newest) last = newest;
+
+  size_t added = 0;
+  DoaHistoryMinute bucket, summary;
+  memset(&bucket, 0, sizeof(bucket));
+  for (uint64_t minute = first; minute <= last; minute++) {
+    uint64_t start = minute - minute % minutes_per_bucket;
+    if (bucket.count && bucket.minute != start) {
+      buckets->push_back(bucket);
+      added++;
+      memset(&bucket, 0, sizeof(bucket));
+    }
+    if (!ReadMinute(minute, &summary)) continue;
+
+    if (!bucket.count) {
+      bucket.minute = start;
+      bucket.first_sequence = summary.first_sequence;
+    }
+    bucket.count += summary.count;
+    bucket.confidence_sum += summary.confidence_sum;
+    for (int bin = 0; bin < DOA_HISTORY_BINS; bin++)
+      bucket.histogram[bin] += summary.histogram[bin];
+  }
+  if (bucket.count) {
+    buckets->push_back(bucket);
+    added++;
+  }
+  return added;
+}
@@ -0,0 +1,148 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_history.h
+** Keeps the estimates of days in a memory-mapped ring file, to see later
+** where the talkers were. The file holds fixed-size records in the order
+** they were written (and so in time order), plus one summary per minute: how
+** many estimates, their confidence and a histogram of their directions.
+**
+** The minute summaries are the coarse index of the ring. They answer
+** aggregate questions (where were the talkers, per minute, hour or day)
+** without touching the records. A range query goes from the summary
+** of its first minute straight to the records of that minute, or does a
+** binary search over the whole ring if that minute is gone, so both are
+** O(log n) at most. Every slot has its own seqlock (as in
+** doa_shm_format.h), so another process may query the file while the
+** sample writes it.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_HISTORY_H
+#define DOA_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include "doa_detection.h"
+
+static const uint32_t DOA_HISTORY_MAGIC = 0x48414f44;  // "DOAH"
+static const uint32_t DOA_HISTORY_VERSION = 1;
+static const int DOA_HISTORY_MAX_PEAKS = 4;
+
+// 10 degree per bin
+static const int DOA_HISTORY_BINS = 36;
+
+// A week of minutes, and four estimates a second for three days
+static const uint32_t DOA_HISTORY_DEFAULT_MINUTES = 7 * 24 * 60;
+static const uint32_t DOA_HISTORY_DEFAULT_RECORDS = 1 << 20;
+
+static const uint64_t DOA_HISTORY_MINUTE_NS = 60000000000ull;
+
+struct DoaHistoryRecord {
+  // Number of the estimate since the file was created
+  uint64_t sequence;
+
+  // CLOCK_REALTIME when the audio was recorded, never decreasing
+  uint64_t time_ns;
+
+  float direction;
+  float confidence;
+  uint32_t peak_count;
+  float peak_direction[DOA_HISTORY_MAX_PEAKS];
+  float peak_strength[DOA_HISTORY_MAX_PEAKS];
+};
+
+struct DoaHistoryMinute {
+  // Minutes since the epoch (the first of them, for aggregates)
+  uint64_t minute;
+
+  // The estimates of the minute are the sequences [first_sequence,
+  // first_sequence + count)
+  uint64_t first_sequence;
+  uint32_t count;
+  float confidence_sum;
+  uint32_t histogram[DOA_HISTORY_BINS];
+};
+
+struct DoaHistorySlot {
+  std::atomic<uint32_t> seqlock;
+  uint32_t padding;
+  DoaHistoryRecord record;
+};
+
+struct DoaHistoryMinuteSlot {
+  std::atomic<uint32_t> seqlock;
+  uint32_t padding;
+  DoaHistoryMinute minute;
+};
+
+// Followed by the minute slots, then the record slots
+struct DoaHistoryHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity;
+  uint32_t minute_capacity;
+
+  // Number of records written so far, the newest is write_count - 1
+  std::atomic<uint64_t> write_count;
+  uint64_t last_time_ns;
+};
+
+class DoaHistory {
+ public:
+  DoaHistory();
+  ~DoaHistory();
+
+  // Creates the file, or continues the one that is there if it has the
+  // same size
+  bool Open(const char *path, uint32_t capacity = DOA_HISTORY_DEFAULT_RECORDS,
+            uint32_t minute_capacity = DOA_HISTORY_DEFAULT_MINUTES);
+
+  // For queries only, next to a writer
+  bool OpenReadOnly(const char *path);
+  void Close();
+
+  // Stores an estimate at the wall-clock time its audio was recorded. Only
+  // one thread may append
+  void Append(const DoaResult &result);
+  void Append(const DoaResult &result, uint64_t time_ns);
+
+  // The records with from_ns <= time_ns < to_ns, oldest first. Returns how
+  // many were added to records
+  size_t Query(uint64_t from_ns, uint64_t to_ns,
+               std::vector<DoaHistoryRecord> *records) const;
+
+  // The minute summaries of the range, merged into buckets of
+  // minutes_per_bucket minutes (60 for hours, ...). Buckets without
+  // estimates are left out
+  size_t Aggregate(uint64_t from_ns, uint64_t to_ns, int minutes_per_bucket,
+                   std::vector<DoaHistoryMinute> *buckets) const;
+
+  // Records written in total, and still in the ring
+  uint64_t WriteCount() const;
+  uint64_t Available() const;
+
+ private:
+  bool Map(const char *path, bool writable, uint32_t capacity,
+           uint32_t minute_capacity);
+  bool ReadSlot(uint64_t sequence, DoaHistoryRecord *record) const;
+  bool ReadMinute(uint64_t minute, DoaHistoryMinute *summary) const;
+  uint64_t FirstAtOrAfter(uint64_t time_ns, uint64_t low,
+                          uint64_t high) const;
+
+ private:
+  DoaHistoryHeader *header_;
+  DoaHistoryMinuteSlot *minutes_;
+  DoaHistorySlot *slots_;
+  size_t size_;
+  bool writable_;
+};
+
+#endif  // DOA_HISTORY_H
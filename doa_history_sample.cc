@@ -0,0 +1,84 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_history_sample.cc
+** Shows where the talkers were, from the history file the
+** doa_detection_sample keeps (run that one with --history=FILE): one line
+** per bucket of time with the number of estimates, their mean confidence
+** and a histogram of the directions in 10 degree bins.
+**
+** Usage: doa_history_sample <file> [hours back (24)] [minutes per line (60)]
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include <time.h>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "doa_history.h"
+
+// A character per bin, darker for more estimates
+void PrintHistogram(const DoaHistoryMinute &bucket) {
+  static const char SHADES[] = " .:-=+*#%@";
+  uint32_t most = 1;
+  for (int bin = 0; bin < DOA_HISTORY_BINS; bin++)
+    if (bucket.histogram[bin] > most) most = bucket.histogram[bin];
+  std::cout << "|";
+  for (int bin = 0; bin < DOA_HISTORY_BINS; bin++) {
+    int shade = bucket.histogram[bin] ? 1 + bucket.histogram[bin] * 8 / most
+                                      : 0;
+    std::cout << SHADES[shade];
+  }
+  std::cout << "|";
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <file> [hours] [minutes per line]"
+              << std::endl;
+    return 1;
+  }
+
+  DoaHistory history;
+  if (!history.OpenReadOnly(argv[1])) return 1;
+  double hours = argc > 2 ? atof(argv[2]) : 24.0;
+  int minutes_per_bucket = argc > 3 ? atoi(argv[3]) : 60;
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  uint64_t to_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+  uint64_t span_ns = hours * 3600e9;
+  uint64_t from_ns = to_ns > span_ns ? to_ns - span_ns : 0;
+
+  std::cout << history.Available() << " of " << history.WriteCount()
+            << " estimates still stored" << std::endl;
+  std::cout << "time, estimates, mean confidence, directions 0 to 360 degree"
+            << std::endl;
+
+  std::vector<DoaHistoryMinute> buckets;
+  history.Aggregate(from_ns, to_ns, minutes_per_bucket, &buckets);
+  for (const DoaHistoryMinute &bucket : buckets) {
+    time_t start = bucket.minute * 60;
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&start));
+    std::cout << when << "\t" << bucket.count << "\t"
+              << bucket.confidence_sum / bucket.count << "\t";
+    PrintHistogram(bucket);
+    std::cout << std::endl;
+  }
+
+  // The last minute in full
+  std::vector<DoaHistoryRecord> records;
+  history.Query(to_ns - 60000000000ull, to_ns, &records);
+  std::cout << records.size() << " estimates in the last minute";
+  if (!records.empty())
+    std::cout << ", the newest " << records.back().direction
+              << " degree with confidence " << records.back().confidence;
+  std::cout << std::endl;
+  return 0;
+}
@@ -0,0 +1,233 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_publisher.cc
+** Publishes every DoA estimate into a seqlock-protected shared-memory ring
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_publisher.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "doa_subscriber.h"
+#include "pipeline_stats.h"
+
+DoaPublisher::DoaPublisher()
+    : header_(nullptr), size_(0), listen_fd_(-1), stop_socket_(false) {}
+
+DoaPublisher::~DoaPublisher() { Close(); }
+
+bool DoaPublisher::Open(const char *name, uint32_t capacity, mode_t mode) {
+  if (header_) {
+    std::cout << "Publisher already open." << std::endl;
+    return false;
+  }
+
+  // Readers only need to read and sleep, but they bump the waiter count.
+  // A segment that is there already gets the mode as well
+  int fd = shm_open(name, O_RDWR | O_CREAT, mode);
+  if (fd < 0) {
+    std::cout << "Failed to create shared memory " << name << " ("
+              << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+  fchmod(fd, mode);
+
+  size_t size = DoaShmSize(capacity);
+  if (ftruncate(fd, size) < 0) {
+    std::cout << "Failed to size shared memory " << name << " ("
+              << strerror(errno) << ")" << std::endl;
+    close(fd);
+    return false;
+  }
+
+  // Populated right away, so the writer never faults on a fresh page
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    std::cout << "Failed to map shared memory " << name << " ("
+              << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+
+  // Start over. Readers of an older ring see the generation change and
+  // start over with us
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  header_ = static_cast<DoaShmHeader *>(memory);
+  header_->magic = 0;
+  std::atomic_thread_fence(std::memory_order_release);
+  memset(memory, 0, size);
+  header_->version = DOA_SHM_VERSION;
+  header_->capacity = capacity;
+  header_->record_size = sizeof(DoaShmRecord);
+  header_->write_count.store(0, std::memory_order_relaxed);
+  header_->futex_word.store(0, std::memory_order_relaxed);
+  header_->waiters.store(0, std::memory_order_relaxed);
+  header_->generation = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = DOA_SHM_MAGIC;
+
+  // Pay the page faults now instead of on the first publishes
+  mlock(memory, size);
+
+  name_ = name;
+  size_ = size;
+  return true;
+}
+
+void DoaPublisher::Publish(const DoaResult &result) {
+  if (!header_) return;
+
+  uint64_t sequence = header_->write_count.load(std::memory_order_relaxed);
+  DoaShmSlot &slot = DoaShmSlots(header_)[sequence % header_->capacity];
+
+  // Odd while we write
+  uint32_t lock = slot.seqlock.load(std::memory_order_relaxed);
+  slot.seqlock.store(lock + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  DoaShmRecord &record = slot.record;
+  record.sequence = sequence;
+  record.capture_ns = result.tag.capture_ns;
+  record.publish_ns = PipelineClockNs();
+  record.frame_index = result.tag.frame_index;
+  record.direction = result.direction;
+  record.confidence = result.confidence;
+  record.peak_count = result.peak_count < DOA_SHM_MAX_PEAKS
+                          ? result.peak_count
+                          : DOA_SHM_MAX_PEAKS;
+  for (uint32_t i = 0; i < record.peak_count; i++) {
+    record.peak_direction[i] = result.peaks[i].direction;
+    record.peak_strength[i] = result.peaks[i].strength;
+  }
+
+  // Even again, then tell everybody
+  slot.seqlock.store(lock + 2, std::memory_order_release);
+  header_->write_count.store(sequence + 1, std::memory_order_release);
+  header_->futex_word.fetch_add(1, std::memory_order_seq_cst);
+
+  // Only wake if somebody sleeps, the seq_cst pair with the waiters makes
+  // sure we never miss one that is about to
+  if (header_->waiters.load(std::memory_order_seq_cst) > 0)
+    syscall(SYS_futex, &header_->futex_word, FUTEX_WAKE, INT_MAX, nullptr,
+            nullptr, 0);
+}
+
+bool DoaPublisher::ServeSocket(const char *path) {
+  if (!header_) {
+    std::cout << "Open the publisher before serving a socket." << std::endl;
+    return false;
+  }
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    std::cout << "Socket path too long: " << path << std::endl;
+    return false;
+  }
+  strcpy(address.sun_path, path);
+
+  listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    std::cout << "Failed to create socket (" << strerror(errno) << ")"
+              << std::endl;
+    return false;
+  }
+
+  unlink(path);
+  if (bind(listen_fd_, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(listen_fd_, 8) < 0) {
+    std::cout << "Failed to listen on " << path << " (" << strerror(errno)
+              << ")" << std::endl;
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+
+  socket_path_ = path;
+  stop_socket_ = false;
+  socket_thread_ = std::thread(&DoaPublisher::SocketThread, this);
+  return true;
+}
+
+void DoaPublisher::SocketThread() {
+  DoaSubscriber subscriber;
+  if (!subscriber.Open(name_.c_str())) return;
+
+  std::vector<int> clients;
+  DoaShmRecord records[16];
+  while (!stop_socket_) {
+    // Take new clients
+    struct pollfd listen_poll = {listen_fd_, POLLIN, 0};
+    while (poll(&listen_poll, 1, 0) > 0) {
+      int client = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client < 0) break;
+      clients.push_back(client);
+    }
+
+    // Forward what is new, a client that cannot keep up misses records
+    // rather than stalling the others
+    if (!subscriber.Wait(50)) continue;
+    int count;
+    while ((count = subscriber.Poll(records, 16)) > 0) {
+      for (size_t c = 0; c < clients.size();) {
+        bool alive = true;
+        for (int i = 0; i < count && alive; i++) {
+          if (send(clients[c], &records[i], sizeof(DoaShmRecord),
+                   MSG_DONTWAIT | MSG_NOSIGNAL) < 0 &&
+              errno != EAGAIN && errno != EWOULDBLOCK)
+            alive = false;
+        }
+
+        if (alive) {
+          c++;
+        } else {
+          close(clients[c]);
+          clients.erase(clients.begin() + c);
+        }
+      }
+    }
+  }
+
+  for (int client : clients) close(client);
+}
+
+void DoaPublisher::Close() {
+  if (socket_thread_.joinable()) {
+    stop_socket_ = true;
+    socket_thread_.join();
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+    unlink(socket_path_.c_str());
+  }
+
+  if (header_) {
+    munmap(header_, size_);
+    header_ = nullptr;
+    size_ = 0;
+  }
+}
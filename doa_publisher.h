@@ -0,0 +1,63 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_publisher.h
+** Publishes every DoA estimate into a seqlock-protected shared-memory ring
+** (see doa_shm_format.h), so other local processes (camera pan, UI) can
+** follow the direction. Subscribers that prefer a stream can connect to
+** an optional Unix socket instead.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_PUBLISHER_H
+#define DOA_PUBLISHER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "doa_detection.h"
+#include "doa_shm_format.h"
+
+class DoaPublisher {
+ public:
+  DoaPublisher();
+  ~DoaPublisher();
+
+  // Creates (or takes over) the shared-memory ring, readable and writable
+  // for mode (see DOA_SHM_DEFAULT_MODE)
+  bool Open(const char *name = DOA_SHM_DEFAULT_NAME, uint32_t capacity = 256,
+            mode_t mode = DOA_SHM_DEFAULT_MODE);
+
+  // Also serves the records on a SOCK_SEQPACKET Unix socket, one
+  // DoaShmRecord per packet. The socket is fed by a thread that reads the
+  // ring like any other subscriber, so Publish stays syscall-free
+  bool ServeSocket(const char *path);
+
+  // Stops the socket thread and unmaps the ring. The segment stays, so
+  // the subscribers follow the next Open on it
+  void Close();
+
+  // Writes one estimate into the ring. Only one thread may publish
+  void Publish(const DoaResult &result);
+
+ private:
+  void SocketThread();
+
+ private:
+  std::string name_;
+  DoaShmHeader *header_;
+  size_t size_;
+
+  // Unix socket fallback
+  std::string socket_path_;
+  int listen_fd_;
+  std::atomic<bool> stop_socket_;
+  std::thread socket_thread_;
+};
+
+#endif  // DOA_PUBLISHER_H
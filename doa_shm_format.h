@@ -0,0 +1,102 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_shm_format.h
+** Layout of the shared-memory ring the DoaPublisher writes the estimates
+** to, shared by the publisher and the DoaSubscriber client library.
+**
+** Every slot is protected by its own seqlock: the writer makes the slot's
+** sequence odd, writes the record and makes it even again. A reader copies
+** the record and only uses it if the sequence was the same even number
+** before and after. The futex word is bumped on every publish, readers can
+** sleep on it with FUTEX_WAIT; the writer only calls FUTEX_WAKE when a
+** reader says it is sleeping, so publishing needs no syscall.
+**
+** The publisher leaves the segment in place when it closes. One that
+** restarts on it starts over with a new generation, readers then start
+** over at its first record. A segment that was removed and created anew
+** under the name is noticed by waiting readers within DOA_SHM_CHECK_MS, and
+** they move over to it. A publisher that died while writing leaves its
+** slot odd, readers give up on it after DOA_SHM_READ_RETRIES tries.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_SHM_FORMAT_H
+#define DOA_SHM_FORMAT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+
+static const uint32_t DOA_SHM_MAGIC = 0x444f4121;  // "DOA!"
+static const uint32_t DOA_SHM_VERSION = 2;
+static const char *const DOA_SHM_DEFAULT_NAME = "/doa_results";
+static const int DOA_SHM_MAX_PEAKS = 4;
+static const int DOA_SHM_READ_RETRIES = 1000;
+static const int DOA_SHM_CHECK_MS = 1000;
+
+// Readers bump the waiter count, so they need write access: the owner and
+// its group
+static const mode_t DOA_SHM_DEFAULT_MODE = 0660;
+
+// One estimate as other processes see it
+struct DoaShmRecord {
+  // Number of the estimate since the publisher started, starting at 0
+  uint64_t sequence;
+
+  // CLOCK_MONOTONIC time the audio was recorded and the result published
+  uint64_t capture_ns;
+  uint64_t publish_ns;
+
+  // Absolute index of the first audio frame the estimate was made from
+  uint64_t frame_index;
+
+  // Direction in degree (0 to 360) and its confidence (0 to 1)
+  double direction;
+  float confidence;
+
+  // The best candidate directions, strongest first
+  uint32_t peak_count;
+  float peak_direction[DOA_SHM_MAX_PEAKS];
+  float peak_strength[DOA_SHM_MAX_PEAKS];
+};
+
+struct DoaShmSlot {
+  std::atomic<uint32_t> seqlock;
+  uint32_t padding;
+  DoaShmRecord record;
+};
+
+struct DoaShmHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity;  // Number of slots
+  uint32_t record_size;
+
+  // Number of records published so far, the newest is write_count - 1
+  std::atomic<uint64_t> write_count;
+
+  // Bumped on every publish, the readers wait on it
+  std::atomic<uint32_t> futex_word;
+
+  // Readers currently sleeping in FUTEX_WAIT
+  std::atomic<uint32_t> waiters;
+
+  // CLOCK_REALTIME the publisher opened the ring, new on every restart
+  uint64_t generation;
+};
+
+// Size of the mapping for a ring with the given number of slots
+inline size_t DoaShmSize(uint32_t capacity) {
+  return sizeof(DoaShmHeader) + capacity * sizeof(DoaShmSlot);
+}
+
+inline DoaShmSlot *DoaShmSlots(DoaShmHeader *header) {
+  return reinterpret_cast<DoaShmSlot *>(header + 1);
+}
+
+#endif  // DOA_SHM_FORMAT_H
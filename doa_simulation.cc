@@ -0,0 +1,114 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_simulation.cc
+** Simulated 4mic_hat audio
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_simulation.h"
+
+#include <cmath>
+#include <cstdlib>
+
+#include "doa_detection.h"
+
+static const double PI = 3.14159265358979323846;
+
+double DoaAngleError(double a, double b) {
+  double error = std::fmod(std::abs(a - b), 360.0);
+  return error > 180.0 ? 360.0 - error : error;
+}
+
+DoaSimulator::DoaSimulator(int frames)
+    : frames_(frames),
+      forward_cfg_(kiss_fftr_alloc(frames, 0, 0, 0)),
+      inverse_cfg_(kiss_fftr_alloc(frames, 1, 0, 0)),
+      spectrum_(frames / 2 + 1),
+      channel_(frames),
+      channels_(DOA_CHANNELS, std::vector<double>(frames)) {}
+
+DoaSimulator::~DoaSimulator() {
+  free(forward_cfg_);
+  free(inverse_cfg_);
+}
+
+void DoaSimulator::MakeSource(double low_hz, double high_hz,
+                              const std::vector<double> *envelope,
+                              std::mt19937 *random,
+                              std::vector<kiss_fft_cpx> *source) {
+  std::normal_distribution<double> gauss(0.0, 1.0);
+  int bins = frames_ / 2 + 1;
+  source->resize(bins);
+  if (envelope) {
+    for (int n = 0; n < frames_; n++)
+      channel_[n] = gauss(*random) * (*envelope)[n];
+    kiss_fftr(forward_cfg_, channel_.data(), source->data());
+  }
+  for (int k = 0; k < bins; k++) {
+    double frequency = k * DOA_SIMULATION_RATE / frames_;
+    if (frequency <= low_hz || frequency >= high_hz) {
+      (*source)[k].r = (*source)[k].i = 0.0;
+    } else if (!envelope) {
+      // White, so it may as well be drawn as a spectrum
+      (*source)[k].r = gauss(*random);
+      (*source)[k].i = gauss(*random);
+    }
+  }
+}
+
+void DoaSimulator::AddSource(const std::vector<kiss_fft_cpx> &source,
+                             double direction, double rms,
+                             std::vector<std::vector<double>> *channels) {
+  int bins = frames_ / 2 + 1;
+  for (int c = 0; c < DOA_CHANNELS; c++) {
+    // The mic closer to the source hears it earlier
+    double delay = -DOA_MIC_RADIUS / DOA_SOUND_SPEED * DOA_SIMULATION_RATE *
+                   std::cos((direction - DOA_MIC_ANGLE[c]) * PI / 180.0);
+    for (int k = 0; k < bins; k++) {
+      double phase = -2.0 * PI * k * delay / frames_;
+      spectrum_[k].r = source[k].r * std::cos(phase) -
+                       source[k].i * std::sin(phase);
+      spectrum_[k].i = source[k].r * std::sin(phase) +
+                       source[k].i * std::cos(phase);
+    }
+    kiss_fftri(inverse_cfg_, spectrum_.data(), channel_.data());
+
+    double power = 0.0;
+    for (int n = 0; n < frames_; n++) power += channel_[n] * channel_[n];
+    double gain = power > 0.0 ? rms / std::sqrt(power / frames_) : 0.0;
+    for (int n = 0; n < frames_; n++) (*channels)[c][n] += channel_[n] * gain;
+  }
+}
+
+void DoaSimulator::Quantize(const std::vector<std::vector<double>> &channels,
+                            double noise_rms, std::mt19937 *random,
+                            std::vector<int16_t> *interleaved) {
+  std::normal_distribution<double> gauss(0.0, 1.0);
+  interleaved->resize(frames_ * DOA_CHANNELS);
+  for (int c = 0; c < DOA_CHANNELS; c++) {
+    for (int n = 0; n < frames_; n++) {
+      double sample = channels[c][n] + gauss(*random) * noise_rms;
+      if (sample > 32767.0) sample = 32767.0;
+      if (sample < -32768.0) sample = -32768.0;
+      (*interleaved)[n * DOA_CHANNELS + c] = (int16_t)std::lround(sample);
+    }
+  }
+}
+
+void DoaSimulator::MakePeriod(double direction, double snr_db,
+                              std::mt19937 *random,
+                              std::vector<int16_t> *interleaved) {
+  double signal_rms = 3000.0;
+  std::vector<kiss_fft_cpx> source;
+  MakeSource(100.0, 7000.0, nullptr, random, &source);
+  for (std::vector<double> &channel : channels_)
+    channel.assign(frames_, 0.0);
+  AddSource(source, direction, signal_rms, &channels_);
+  Quantize(channels_, signal_rms * std::pow(10.0, -snr_db / 20.0), random,
+           interleaved);
+}
@@ -0,0 +1,69 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_simulation.h
+** Simulated 4mic_hat audio for the benchmarks and SyntheticArraySource:
+** noise sources arriving as plane waves, each mic hearing them delayed by
+** the array geometry. The delays are applied in the frequency domain, so
+** they need not be whole samples.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_SIMULATION_H
+#define DOA_SIMULATION_H
+
+#include <stdint.h>
+#include <random>
+#include <vector>
+
+#include "contrib/kiss_fft/kiss_fftr.h"
+
+static const double DOA_SIMULATION_RATE = 16000.0;
+
+// Distance of two directions in degree
+double DoaAngleError(double a, double b);
+
+class DoaSimulator {
+ public:
+  // For blocks of frames samples (an even number)
+  explicit DoaSimulator(int frames);
+  ~DoaSimulator();
+
+  int Frames() const { return frames_; }
+
+  // The spectrum of noise between low_hz and high_hz. With an envelope
+  // the noise is shaped in time by it (frames values) first
+  void MakeSource(double low_hz, double high_hz,
+                  const std::vector<double> *envelope, std::mt19937 *random,
+                  std::vector<kiss_fft_cpx> *source);
+
+  // Adds source to the channels (DOA_CHANNELS of frames samples) as it
+  // arrives from direction, at rms on every mic
+  void AddSource(const std::vector<kiss_fft_cpx> &source, double direction,
+                 double rms, std::vector<std::vector<double>> *channels);
+
+  // Adds noise of noise_rms to every mic and rounds the channels to
+  // interleaved 16 bit
+  void Quantize(const std::vector<std::vector<double>> &channels,
+                double noise_rms, std::mt19937 *random,
+                std::vector<int16_t> *interleaved);
+
+  // A period of speech-band noise (100 to 7000 Hz) from direction, at
+  // snr_db over the noise of the mics
+  void MakePeriod(double direction, double snr_db, std::mt19937 *random,
+                  std::vector<int16_t> *interleaved);
+
+ private:
+  int frames_;
+  kiss_fftr_cfg forward_cfg_;
+  kiss_fftr_cfg inverse_cfg_;
+  std::vector<kiss_fft_cpx> spectrum_;
+  std::vector<double> channel_;
+  std::vector<std::vector<double>> channels_;
+};
+
+#endif  // DOA_SIMULATION_H
@@ -0,0 +1,293 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_subscriber.cc
+** Client library for the DoA estimates the DoaPublisher shares
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "doa_subscriber.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+
+DoaSubscriber::DoaSubscriber()
+    : header_(nullptr),
+      size_(0),
+      device_(0),
+      inode_(0),
+      generation_(0),
+      next_sequence_(0),
+      checked_ms_(0) {}
+
+DoaSubscriber::~DoaSubscriber() { Close(); }
+
+bool DoaSubscriber::Open(const char *name) {
+  if (header_) {
+    std::cout << "Subscriber already open." << std::endl;
+    return false;
+  }
+
+  name_ = name;
+  if (!Map(false)) return false;
+  next_sequence_ = header_->write_count.load(std::memory_order_acquire);
+  return true;
+}
+
+bool DoaSubscriber::Map(bool quiet) {
+  const char *name = name_.c_str();
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0) {
+    if (!quiet)
+      std::cout << "Failed to open shared memory " << name << " ("
+                << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+
+  // Map the header first to learn the size
+  struct stat info;
+  if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(DoaShmHeader)) {
+    if (!quiet)
+      std::cout << "Shared memory " << name << " is not a DoA ring"
+                << std::endl;
+    close(fd);
+    return false;
+  }
+
+  void *memory = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    if (!quiet)
+      std::cout << "Failed to map shared memory " << name << " ("
+                << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+
+  DoaShmHeader *header = static_cast<DoaShmHeader *>(memory);
+  if (header->magic != DOA_SHM_MAGIC || header->version != DOA_SHM_VERSION ||
+      header->record_size != sizeof(DoaShmRecord) ||
+      DoaShmSize(header->capacity) > (size_t)info.st_size) {
+    if (!quiet)
+      std::cout << "Shared memory " << name
+                << " has an unknown layout or is not initialized yet"
+                << std::endl;
+    munmap(memory, info.st_size);
+    return false;
+  }
+
+  Close();
+  header_ = header;
+  size_ = info.st_size;
+  device_ = info.st_dev;
+  inode_ = info.st_ino;
+  generation_ = header_->generation;
+  return true;
+}
+
+void DoaSubscriber::Close() {
+  if (header_) {
+    munmap(header_, size_);
+    header_ = nullptr;
+    size_ = 0;
+  }
+}
+
+bool DoaSubscriber::FollowRestart() {
+  // A larger ring than we mapped, on the same segment
+  bool remap = header_->magic == DOA_SHM_MAGIC &&
+               DoaShmSize(header_->capacity) > size_;
+
+  // Or a new segment, the old one was removed
+  struct stat info;
+  int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+  if (fd >= 0) {
+    if (fstat(fd, &info) == 0 &&
+        (info.st_dev != device_ || info.st_ino != inode_))
+      remap = true;
+    close(fd);
+  }
+
+  // Everything in it is new to us
+  if (!remap || !Map(true)) return false;
+  next_sequence_ = 0;
+  return true;
+}
+
+bool DoaSubscriber::CheckGeneration() {
+  // Zero while a publisher starts over
+  if (header_->magic != DOA_SHM_MAGIC) return false;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (header_->generation == generation_) return true;
+  if (DoaShmSize(header_->capacity) > size_) return false;
+
+  generation_ = header_->generation;
+  next_sequence_ = 0;
+  return true;
+}
+
+bool DoaSubscriber::ReadSlot(uint64_t sequence, DoaShmRecord *record) {
+  DoaShmSlot &slot = DoaShmSlots(header_)[sequence % header_->capacity];
+
+  for (int retry = 0; retry < DOA_SHM_READ_RETRIES; retry++) {
+    uint32_t before = slot.seqlock.load(std::memory_order_acquire);
+    if (before & 1) continue;  // Being written right now
+
+    memcpy(record, &slot.record, sizeof(DoaShmRecord));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seqlock.load(std::memory_order_relaxed) != before) continue;
+
+    // A newer record means the slot was reused
+    return record->sequence == sequence;
+  }
+  return false;
+}
+
+bool DoaSubscriber::Latest(DoaShmRecord *record) {
+  if (!header_ || !CheckGeneration()) return false;
+
+  for (int retry = 0; retry < DOA_SHM_READ_RETRIES; retry++) {
+    uint64_t count = header_->write_count.load(std::memory_order_acquire);
+    if (count == 0) return false;
+    if (ReadSlot(count - 1, record)) return true;
+  }
+  return false;
+}
+
+int DoaSubscriber::Poll(DoaShmRecord *records, int max_records,
+                        uint64_t *lost) {
+  if (!header_ || !CheckGeneration()) return 0;
+
+  int count = 0;
+  while (count < max_records) {
+    uint64_t write_count =
+        header_->write_count.load(std::memory_order_acquire);
+    if (next_sequence_ >= write_count) break;
+
+    // Skip what the publisher already overwrote
+    uint64_t oldest = write_count > header_->capacity
+                          ? write_count - header_->capacity
+                          : 0;
+    if (next_sequence_ < oldest) {
+      if (lost) *lost += oldest - next_sequence_;
+      next_sequence_ = oldest;
+    }
+
+    // Otherwise it was overwritten while we read, or the publisher died
+    // writing it
+    if (ReadSlot(next_sequence_, &records[count])) {
+      count++;
+    } else if (lost) {
+      (*lost)++;
+    }
+    next_sequence_++;
+  }
+
+  return count;
+}
+
+static uint64_t MonotonicMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+bool DoaSubscriber::Wait(int timeout_ms) {
+  if (!header_) return false;
+
+  // In slices, so a ring that was replaced under us is noticed
+  uint64_t start_ms = MonotonicMs();
+  for (;;) {
+    // A ring we cannot read (it grew) is followed right away
+    bool readable = CheckGeneration();
+    uint64_t now_ms = MonotonicMs();
+    if (!readable || now_ms - checked_ms_ >= (uint64_t)DOA_SHM_CHECK_MS) {
+      checked_ms_ = now_ms;
+      if (FollowRestart()) {
+        readable = true;
+        if (header_->write_count.load(std::memory_order_acquire) > 0)
+          return true;
+      }
+    }
+    int slice_ms = DOA_SHM_CHECK_MS - (int)(now_ms - checked_ms_);
+    if (timeout_ms >= 0 && timeout_ms - (int)(now_ms - start_ms) < slice_ms)
+      slice_ms = timeout_ms - (int)(now_ms - start_ms);
+
+    // Announce that we sleep before looking, the publisher checks the
+    // waiters after bumping the futex word
+    header_->waiters.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t word = header_->futex_word.load(std::memory_order_seq_cst);
+    bool ready = readable && header_->write_count.load(
+                                 std::memory_order_acquire) > next_sequence_;
+    if (!ready && slice_ms > 0) {
+      struct timespec timeout;
+      timeout.tv_sec = slice_ms / 1000;
+      timeout.tv_nsec = (slice_ms % 1000) * 1000000L;
+      syscall(SYS_futex, &header_->futex_word, FUTEX_WAIT, word, &timeout,
+              nullptr, 0);
+      ready = readable && header_->write_count.load(
+                              std::memory_order_acquire) > next_sequence_;
+    }
+    header_->waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+    if (ready) return true;
+    if (timeout_ms >= 0 && MonotonicMs() - start_ms >= (uint64_t)timeout_ms)
+      return false;
+  }
+}
+
+DoaSocketSubscriber::DoaSocketSubscriber() : fd_(-1) {}
+
+DoaSocketSubscriber::~DoaSocketSubscriber() { Close(); }
+
+bool DoaSocketSubscriber::Connect(const char *path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    std::cout << "Socket path too long: " << path << std::endl;
+    return false;
+  }
+  strcpy(address.sun_path, path);
+
+  fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 ||
+      connect(fd_, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    std::cout << "Failed to connect to " << path << " (" << strerror(errno)
+              << ")" << std::endl;
+    Close();
+    return false;
+  }
+
+  return true;
+}
+
+void DoaSocketSubscriber::Close() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool DoaSocketSubscriber::Receive(DoaShmRecord *record) {
+  for (;;) {
+    ssize_t received = recv(fd_, record, sizeof(DoaShmRecord), 0);
+    if (received == (ssize_t)sizeof(DoaShmRecord)) return true;
+    if (received < 0 && errno == EINTR) continue;
+    return false;
+  }
+}
@@ -0,0 +1,97 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_subscriber.h
+** Client library for the DoA estimates the DoaPublisher shares. Link this
+** and doa_subscriber.cc into the process that wants the direction, it does
+** not need anything else from this project.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef DOA_SUBSCRIBER_H
+#define DOA_SUBSCRIBER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+
+#include "doa_shm_format.h"
+
+// Reads the shared-memory ring directly, no syscalls unless it waits
+class DoaSubscriber {
+ public:
+  DoaSubscriber();
+  ~DoaSubscriber();
+
+  // Maps the ring read-only-ish (the waiter count is written). New
+  // subscribers start after the newest record, and at the first record of
+  // a publisher that restarted. Wait maps the ring again if the publisher
+  // restarted with a larger one, or on a new segment under the name
+  bool Open(const char *name = DOA_SHM_DEFAULT_NAME);
+  void Close();
+
+  // Copies the newest record, false if nothing was published yet
+  bool Latest(DoaShmRecord *record);
+
+  // Copies the records published since the last call, at most max_records.
+  // If the publisher lapped us, the lost records are added to lost and
+  // we continue with the oldest one still in the ring. So are records the
+  // publisher died writing
+  int Poll(DoaShmRecord *records, int max_records, uint64_t *lost = nullptr);
+
+  // Sleeps until something new is published or the timeout (in ms, -1 is
+  // forever) passed. Returns whether there is something new. It looks for
+  // a new ring every DOA_SHM_CHECK_MS while nothing comes
+  bool Wait(int timeout_ms);
+
+ private:
+  // Maps the ring of name_, quietly if it is a remap
+  bool Map(bool quiet);
+
+  // Maps the ring again if it no longer fits or the name is another
+  // segment now, true if it did
+  bool FollowRestart();
+
+  bool ReadSlot(uint64_t sequence, DoaShmRecord *record);
+
+  // Whether the ring can be read, starts over after a restart
+  bool CheckGeneration();
+
+ private:
+  std::string name_;
+  DoaShmHeader *header_;
+  size_t size_;
+  dev_t device_;
+  ino_t inode_;
+  uint64_t generation_;
+  uint64_t next_sequence_;
+
+  // CLOCK_MONOTONIC ms Wait last looked for a new ring
+  uint64_t checked_ms_;
+};
+
+// Receives the records from the publisher's Unix socket
+class DoaSocketSubscriber {
+ public:
+  DoaSocketSubscriber();
+  ~DoaSocketSubscriber();
+
+  bool Connect(const char *path);
+  void Close();
+
+  // Blocks until the next record arrives, false if the publisher is gone
+  bool Receive(DoaShmRecord *record);
+
+  // For poll/epoll
+  int FileDescriptor() const { return fd_; }
+
+ private:
+  int fd_;
+};
+
+#endif  // DOA_SUBSCRIBER_H
@@ -0,0 +1,131 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** doa_subscriber_sample.cc
+** A sample showing how another process follows the direction estimates the
+** doa_detection_sample publishes (run that one with --publish).
+**
+** --simulate needs no sample: it publishes into a ring of its own and
+** checks that a subscriber follows the publisher when it closes and opens
+** again, when it comes back with a larger ring, and when the ring is
+** removed and created anew. The exit code is 1 if a record is missing.
+**
+** Usage: doa_subscriber_sample [shm name]
+**        doa_subscriber_sample --socket <path>
+**        doa_subscriber_sample --simulate
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include <sys/mman.h>
+#include <cstring>
+#include <iostream>
+
+#include "doa_publisher.h"
+#include "doa_subscriber.h"
+
+static const char *const SIMULATED_RING = "/doa_subscriber_sample";
+static const int SIMULATED_RECORDS = 5;
+
+void PrintRecord(const DoaShmRecord &record) {
+  std::cout << "#" << record.sequence << " direction " << record.direction
+            << " confidence " << record.confidence << " candidates";
+  for (uint32_t i = 0; i < record.peak_count; i++)
+    std::cout << " " << record.peak_direction[i] << "("
+              << record.peak_strength[i] << ")";
+  std::cout << " latency "
+            << (record.publish_ns - record.capture_ns) / 1e6 << " ms"
+            << std::endl;
+}
+
+// Publishes records_count records, and whether the subscriber gets all of
+// them after waiting
+static bool PublishAndRead(DoaPublisher *publisher, DoaSubscriber *subscriber,
+                           int records_count, const char *what) {
+  DoaResult result;
+  memset(&result, 0, sizeof(result));
+  for (int i = 0; i < records_count; i++) {
+    result.direction = i * 10.0;
+    publisher->Publish(result);
+  }
+
+  DoaShmRecord records[16];
+  int count = 0;
+  if (subscriber->Wait(3 * DOA_SHM_CHECK_MS))
+    count = subscriber->Poll(records, 16);
+  bool right = count == records_count && records[0].sequence == 0;
+  std::cout << what << ": " << count << " of " << records_count
+            << " records" << (right ? "" : " (WRONG)") << std::endl;
+  return right;
+}
+
+static int Simulate() {
+  DoaPublisher publisher;
+  DoaSubscriber subscriber;
+  if (!publisher.Open(SIMULATED_RING, 16) ||
+      !subscriber.Open(SIMULATED_RING))
+    return 1;
+  bool right = PublishAndRead(&publisher, &subscriber, SIMULATED_RECORDS,
+                              "First publisher");
+
+  publisher.Close();
+  publisher.Open(SIMULATED_RING, 16);
+  right &= PublishAndRead(&publisher, &subscriber, SIMULATED_RECORDS,
+                         "Clean restart");
+
+  publisher.Close();
+  publisher.Open(SIMULATED_RING, 64);
+  right &= PublishAndRead(&publisher, &subscriber, 2 * SIMULATED_RECORDS,
+                         "Larger ring");
+
+  publisher.Close();
+  shm_unlink(SIMULATED_RING);
+  publisher.Open(SIMULATED_RING, 16);
+  right &= PublishAndRead(&publisher, &subscriber, SIMULATED_RECORDS,
+                         "New segment");
+
+  publisher.Close();
+  shm_unlink(SIMULATED_RING);
+  std::cout << (right ? "Restarts are followed" : "FAILED") << std::endl;
+  return right ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--simulate") == 0) return Simulate();
+
+  // Streaming over the Unix socket
+  if (argc > 2 && strcmp(argv[1], "--socket") == 0) {
+    DoaSocketSubscriber subscriber;
+    if (!subscriber.Connect(argv[2])) return 1;
+
+    DoaShmRecord record;
+    while (subscriber.Receive(&record)) PrintRecord(record);
+    return 0;
+  }
+
+  // Reading the shared memory directly
+  DoaSubscriber subscriber;
+  if (!subscriber.Open(argc > 1 ? argv[1] : DOA_SHM_DEFAULT_NAME)) return 1;
+
+  DoaShmRecord latest;
+  if (subscriber.Latest(&latest)) {
+    std::cout << "Latest: ";
+    PrintRecord(latest);
+  }
+
+  DoaShmRecord records[16];
+  uint64_t lost = 0;
+  for (;;) {
+    subscriber.Wait(-1);
+
+    int count = subscriber.Poll(records, 16, &lost);
+    for (int i = 0; i < count; i++) PrintRecord(records[i]);
+    if (lost) {
+      std::cout << "Missed " << lost << " records" << std::endl;
+      lost = 0;
+    }
+  }
+}
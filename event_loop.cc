@@ -0,0 +1,125 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** event_loop.cc
+** A single-threaded epoll loop
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "event_loop.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <iostream>
+
+EventLoop::EventLoop() : epoll_fd_(-1), running_(false) {}
+
+EventLoop::~EventLoop() { Close(); }
+
+bool EventLoop::Open() {
+  if (epoll_fd_ >= 0) {
+    std::cout << "Event loop already open." << std::endl;
+    return false;
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    std::cout << "Failed to create the event loop (" << strerror(errno)
+              << ")" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void EventLoop::Close() {
+  if (epoll_fd_ < 0) return;
+  close(epoll_fd_);
+  epoll_fd_ = -1;
+  handlers_.clear();
+}
+
+bool EventLoop::Add(int fd, uint32_t events, Handler handler) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    std::cout << "Failed to watch descriptor " << fd << " ("
+              << strerror(errno) << ")" << std::endl;
+    return false;
+  }
+
+  if ((size_t)fd >= handlers_.size()) handlers_.resize(fd + 1);
+  handlers_[fd] = handler;
+  return true;
+}
+
+void EventLoop::Remove(int fd) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  if ((size_t)fd < handlers_.size()) handlers_[fd] = Handler();
+}
+
+void EventLoop::Run() {
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+  running_ = true;
+  while (running_) {
+    int count = epoll_wait(epoll_fd_, events, EVENT_LOOP_MAX_EVENTS, -1);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      std::cout << "Event loop failed (" << strerror(errno) << ")"
+                << std::endl;
+      return;
+    }
+
+    // A handler may remove a later descriptor, or stop the loop
+    for (int i = 0; i < count && running_; i++) {
+      int fd = events[i].data.fd;
+      if ((size_t)fd < handlers_.size() && handlers_[fd])
+        handlers_[fd](events[i].events);
+    }
+  }
+}
+
+int CreateTimerFd() {
+  return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+bool ArmTimerFd(int fd, uint64_t first_ns, uint64_t period_ns) {
+  struct itimerspec spec;
+  spec.it_value.tv_sec = first_ns / 1000000000ull;
+  spec.it_value.tv_nsec = first_ns % 1000000000ull;
+  spec.it_interval.tv_sec = period_ns / 1000000000ull;
+  spec.it_interval.tv_nsec = period_ns % 1000000000ull;
+  return timerfd_settime(fd, 0, &spec, nullptr) == 0;
+}
+
+uint64_t ReadTimerFd(int fd) {
+  uint64_t expirations;
+  if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    return 0;
+  return expirations;
+}
+
+int CreateSignalFd(const int *signals, int count) {
+  sigset_t set;
+  sigemptyset(&set);
+  for (int i = 0; i < count; i++) sigaddset(&set, signals[i]);
+  if (pthread_sigmask(SIG_BLOCK, &set, nullptr) != 0) return -1;
+  return signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+int ReadSignalFd(int fd) {
+  struct signalfd_siginfo info;
+  if (read(fd, &info, sizeof(info)) != sizeof(info)) return 0;
+  return info.ssi_signo;
+}
@@ -0,0 +1,73 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** event_loop.h
+** A single-threaded epoll loop for boards where handing work between
+** threads costs more than it saves (one core). Everything the pipeline
+** waits for is a descriptor: the ALSA capture (snd_pcm_poll_descriptors),
+** a timerfd for the LED frames and a signalfd for shutdown. Handlers run
+** one after the other on the loop thread and must not block.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+// Descriptors one wakeup handles at most, the rest wait for the next
+static const int EVENT_LOOP_MAX_EVENTS = 8;
+
+class EventLoop {
+ public:
+  // Gets the epoll events (EPOLLIN, ...) of the descriptor
+  typedef std::function<void(uint32_t events)> Handler;
+
+  EventLoop();
+  ~EventLoop();
+
+  bool Open();
+  void Close();
+
+  // Calls handler whenever fd has one of events (level-triggered). The
+  // descriptor stays owned by the caller
+  bool Add(int fd, uint32_t events, Handler handler);
+  void Remove(int fd);
+
+  // Dispatches until a handler calls Stop
+  void Run();
+  void Stop() { running_ = false; }
+
+ private:
+  int epoll_fd_;
+  bool running_;
+
+  // Indexed by descriptor
+  std::vector<Handler> handlers_;
+};
+
+// A CLOCK_MONOTONIC timerfd, nonblocking. -1 on failure
+int CreateTimerFd();
+
+// Fires first after first_ns, then every period_ns (0 for once). A first_ns
+// of 0 disarms the timer
+bool ArmTimerFd(int fd, uint64_t first_ns, uint64_t period_ns);
+
+// How often the timer fired since the last call, 0 if it did not
+uint64_t ReadTimerFd(int fd);
+
+// Blocks the signals in the calling thread (so do it before any other
+// thread starts, they inherit the mask) and returns a nonblocking
+// signalfd that reads them instead. -1 on failure
+int CreateSignalFd(const int *signals, int count);
+
+// The next pending signal of a signalfd, 0 if there is none
+int ReadSignalFd(int fd);
+
+#endif  // EVENT_LOOP_H
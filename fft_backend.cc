@@ -0,0 +1,169 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** fft_backend.cc
+** The real FFT under the DoA estimator, kiss_fft or the radix-4 one
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "fft_backend.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "fft_radix4.h"
+
+namespace {
+
+class KissRealFft : public RealFft {
+ public:
+  explicit KissRealFft(int length)
+      : RealFft(FFT_BACKEND_KISS, length),
+        forward_cfg_(kiss_fftr_alloc(length, 0, 0, 0)),
+        inverse_cfg_(kiss_fftr_alloc(length, 1, 0, 0)),
+        pair_cfg_(nullptr) {}
+
+  ~KissRealFft() override {
+    free(forward_cfg_);
+    free(inverse_cfg_);
+    free(pair_cfg_);
+  }
+
+  void Forward(const double *samples, kiss_fft_cpx *spectrum) override {
+    kiss_fftr(forward_cfg_, samples, spectrum);
+  }
+
+  // Our kiss_fftri is scaled already
+  void Inverse(const kiss_fft_cpx *spectrum, double *samples) override {
+    kiss_fftri(inverse_cfg_, spectrum, samples);
+  }
+
+  void ForwardPair(const double *samples_a, const double *samples_b,
+                   kiss_fft_cpx *spectrum_a,
+                   kiss_fft_cpx *spectrum_b) override;
+
+ private:
+  kiss_fftr_cfg forward_cfg_;
+  kiss_fftr_cfg inverse_cfg_;
+
+  // The complex transform of Length() points for ForwardPair, planned on
+  // its first use
+  kiss_fft_cfg pair_cfg_;
+  std::vector<kiss_fft_cpx> pair_in_;
+  std::vector<kiss_fft_cpx> pair_out_;
+};
+
+void KissRealFft::ForwardPair(const double *samples_a,
+                              const double *samples_b,
+                              kiss_fft_cpx *spectrum_a,
+                              kiss_fft_cpx *spectrum_b) {
+  int length = Length();
+  if (!pair_cfg_) {
+    pair_cfg_ = kiss_fft_alloc(length, 0, 0, 0);
+    pair_in_.resize(length);
+    pair_out_.resize(length);
+  }
+
+  // a + j b
+  kiss_fft_cpx *in = pair_in_.data(), *out = pair_out_.data();
+  for (int n = 0; n < length; n++) {
+    in[n].r = samples_a[n];
+    in[n].i = samples_b[n];
+  }
+  kiss_fft(pair_cfg_, in, out);
+
+  // A is the conjugate symmetric part, j B the other one:
+  // A[k] = (Z[k] + conj(Z[N - k])) / 2, B[k] = (Z[k] - conj(Z[N - k])) / 2j
+  for (int k = 0; k <= length / 2; k++) {
+    const kiss_fft_cpx &zk = out[k];
+    const kiss_fft_cpx &znk = out[k ? length - k : 0];
+    spectrum_a[k].r = 0.5 * (zk.r + znk.r);
+    spectrum_a[k].i = 0.5 * (zk.i - znk.i);
+    spectrum_b[k].r = 0.5 * (zk.i + znk.i);
+    spectrum_b[k].i = 0.5 * (znk.r - zk.r);
+  }
+}
+
+}  // namespace
+
+void RealFft::ForwardPair(const double *samples_a, const double *samples_b,
+                          kiss_fft_cpx *spectrum_a,
+                          kiss_fft_cpx *spectrum_b) {
+  Forward(samples_a, spectrum_a);
+  Forward(samples_b, spectrum_b);
+}
+
+void RealFft::ForwardBatch(int channels, const double *samples,
+                           kiss_fft_cpx *spectra) {
+  int bins = length_ / 2 + 1;
+  for (int c = 0; c < channels; c++)
+    Forward(samples + c * length_, spectra + c * bins);
+}
+
+static const char *const BACKEND_NAMES[FFT_BACKEND_COUNT] = {
+    "kiss", "radix4", "sse2", "avx2", "neon"};
+
+const Radix4Kernels *Radix4BackendKernels(FftBackend backend) {
+  switch (backend) {
+    case FFT_BACKEND_RADIX4:
+      return Radix4ScalarKernels();
+    case FFT_BACKEND_RADIX4_SSE2:
+      return Radix4Sse2Kernels();
+    case FFT_BACKEND_RADIX4_AVX2:
+#if defined(__x86_64__) || defined(__i386__)
+      if (!__builtin_cpu_supports("avx2")) return nullptr;
+#endif
+      return Radix4Avx2Kernels();
+    case FFT_BACKEND_RADIX4_NEON:
+      return Radix4NeonKernels();
+    default:
+      return nullptr;
+  }
+}
+
+const char *FftBackendName(FftBackend backend) {
+  if (backend < 0 || backend >= FFT_BACKEND_COUNT) return "unknown";
+  return BACKEND_NAMES[backend];
+}
+
+bool FftBackendAvailable(FftBackend backend) {
+  return backend == FFT_BACKEND_KISS ||
+         Radix4BackendKernels(backend) != nullptr;
+}
+
+FftBackend FastestFftBackend() {
+  static const FftBackend FASTEST_FIRST[] = {
+      FFT_BACKEND_RADIX4_AVX2, FFT_BACKEND_RADIX4_NEON,
+      FFT_BACKEND_RADIX4_SSE2};
+  for (FftBackend backend : FASTEST_FIRST)
+    if (FftBackendAvailable(backend)) return backend;
+
+  // Even the scalar radix-4 beats kiss_fft, it is in single precision
+  return FFT_BACKEND_RADIX4;
+}
+
+bool ParseFftBackend(const char *name, FftBackend *backend) {
+  if (strcmp(name, "auto") == 0) {
+    *backend = FastestFftBackend();
+    return true;
+  }
+  for (int i = 0; i < FFT_BACKEND_COUNT; i++) {
+    if (strcmp(name, BACKEND_NAMES[i]) == 0) {
+      *backend = (FftBackend)i;
+      return FftBackendAvailable(*backend);
+    }
+  }
+  return false;
+}
+
+RealFft *CreateRealFft(FftBackend backend, int length) {
+  const Radix4Kernels *kernels = Radix4BackendKernels(backend);
+  if (kernels && Radix4FftSupports(length))
+    return CreateRadix4Fft(backend, kernels, length);
+  return new KissRealFft(length);
+}
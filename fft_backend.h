@@ -0,0 +1,87 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** fft_backend.h
+** The real FFT under the DoA estimator. kiss_fft is the default; the
+** in-tree radix-4 transform (fft_radix4.cc) computes in single precision
+** with SSE2, AVX2 or NEON butterflies where the CPU has them. The backend
+** is picked at runtime, doa_benchmark compares them.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef FFT_BACKEND_H
+#define FFT_BACKEND_H
+
+#include "contrib/kiss_fft/kiss_fftr.h"
+
+enum FftBackend {
+  FFT_BACKEND_KISS,
+  FFT_BACKEND_RADIX4,
+  FFT_BACKEND_RADIX4_SSE2,
+  FFT_BACKEND_RADIX4_AVX2,
+  FFT_BACKEND_RADIX4_NEON,
+  FFT_BACKEND_COUNT
+};
+
+// Short name of a backend, as ParseFftBackend takes it
+const char *FftBackendName(FftBackend backend);
+
+// Whether this build runs the backend on this CPU
+bool FftBackendAvailable(FftBackend backend);
+
+// The fastest available backend
+FftBackend FastestFftBackend();
+
+// Backend by name, "auto" is the fastest. False if unknown or unavailable
+bool ParseFftBackend(const char *name, FftBackend *backend);
+
+// Real transform of one length. Forward gives Length() / 2 + 1 bins, like
+// kiss_fftr; Inverse is scaled, so it gives back the samples of a spectrum
+class RealFft {
+ public:
+  virtual ~RealFft() {}
+
+  int Length() const { return length_; }
+  FftBackend Backend() const { return backend_; }
+
+  virtual void Forward(const double *samples, kiss_fft_cpx *spectrum) = 0;
+  virtual void Inverse(const kiss_fft_cpx *spectrum, double *samples) = 0;
+
+  // Forward of two signals. kiss packs them as real and imaginary part
+  // into one complex transform and separates the spectra by their
+  // symmetry, the others transform them one after the other
+  virtual void ForwardPair(const double *samples_a, const double *samples_b,
+                           kiss_fft_cpx *spectrum_a,
+                           kiss_fft_cpx *spectrum_b);
+
+  // Forward of channels signals of Length() samples, one after the other
+  // in samples, into channels spectra of Length() / 2 + 1 bins. The
+  // radix-4 backends run all channels through every butterfly at once,
+  // one per vector lane, if the channel count fills their vectors; the
+  // others transform one channel after the other
+  virtual void ForwardBatch(int channels, const double *samples,
+                            kiss_fft_cpx *spectra);
+
+  // How many channels ForwardBatch runs through the butterflies at once at
+  // this length (1 if it transforms them one after the other). Callers
+  // with channels of several sources batch them in groups of this size
+  virtual int BatchChannels() const { return 1; }
+
+ protected:
+  RealFft(FftBackend backend, int length)
+      : backend_(backend), length_(length) {}
+
+ private:
+  FftBackend backend_;
+  int length_;
+};
+
+// A transform of length samples. Lengths the backend cannot do (the
+// radix-4 ones need a power of two of at least 32) get kiss instead
+RealFft *CreateRealFft(FftBackend backend, int length);
+
+#endif  // FFT_BACKEND_H
@@ -0,0 +1,422 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** fft_radix4.cc
+** Single-precision radix-4 real FFT with scalar, SSE2 and NEON butterflies
+** (the AVX2 ones are in fft_radix4_avx2.cc)
+**
+** A real transform of N samples is a complex one of N / 2 points on the
+** even samples as real and the odd ones as imaginary part, split up
+** afterwards like kiss_fftr does.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "fft_radix4.h"
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+static const double PI = 3.14159265358979323846;
+
+// Buffer of a batched transform, 32 KB (the L1 data cache of the Pi 3 and
+// 4 and most PCs)
+static const int BATCH_MAX_FLOATS = 8192;
+
+namespace {
+
+struct ScalarVector {
+  typedef float Type;
+  static const int WIDTH = 1;
+  static Type Load(const float *p) { return *p; }
+  static void Store(float *p, Type a) { *p = a; }
+  static Type Set(float a) { return a; }
+  static Type Add(Type a, Type b) { return a + b; }
+  static Type Sub(Type a, Type b) { return a - b; }
+  static Type Mul(Type a, Type b) { return a * b; }
+};
+
+#if defined(__SSE2__)
+struct Sse2Vector {
+  typedef __m128 Type;
+  static const int WIDTH = 4;
+  static Type Load(const float *p) { return _mm_loadu_ps(p); }
+  static void Store(float *p, Type a) { _mm_storeu_ps(p, a); }
+  static Type Set(float a) { return _mm_set1_ps(a); }
+  static Type Add(Type a, Type b) { return _mm_add_ps(a, b); }
+  static Type Sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+  static Type Mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+  static void Transpose(Type *a, Type *b, Type *c, Type *d) {
+    _MM_TRANSPOSE4_PS(*a, *b, *c, *d);
+  }
+};
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+struct NeonVector {
+  typedef float32x4_t Type;
+  static const int WIDTH = 4;
+  static Type Load(const float *p) { return vld1q_f32(p); }
+  static void Store(float *p, Type a) { vst1q_f32(p, a); }
+  static Type Set(float a) { return vdupq_n_f32(a); }
+  static Type Add(Type a, Type b) { return vaddq_f32(a, b); }
+  static Type Sub(Type a, Type b) { return vsubq_f32(a, b); }
+  static Type Mul(Type a, Type b) { return vmulq_f32(a, b); }
+  static void Transpose(Type *a, Type *b, Type *c, Type *d) {
+    // Pairs first, then the halves
+    float32x4x2_t ab = vtrnq_f32(*a, *b);
+    float32x4x2_t cd = vtrnq_f32(*c, *d);
+    *a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    *b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    *c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    *d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+  }
+};
+#endif
+
+}  // namespace
+
+const Radix4Kernels *Radix4ScalarKernels() {
+  static const Radix4Kernels kernels = {
+      ScalarVector::WIDTH, Radix4Stage<ScalarVector>, nullptr, nullptr,
+      Radix2LastStage<ScalarVector>,
+      RADIX4_FIXED_TRANSFORMS(ScalarVector, ScalarVector, 1), {}};
+  return &kernels;
+}
+
+const Radix4Kernels *Radix4Sse2Kernels() {
+#if defined(__SSE2__)
+  static const Radix4Kernels kernels = {
+      Sse2Vector::WIDTH, Radix4Stage<Sse2Vector>, nullptr,
+      Radix4FirstStage<Sse2Vector>, Radix2LastStage<Sse2Vector>,
+      RADIX4_FIXED_TRANSFORMS(Sse2Vector, Sse2Vector, 1),
+      RADIX4_FIXED_TRANSFORMS(Sse2Vector, Sse2Vector, 4)};
+  return &kernels;
+#else
+  return nullptr;
+#endif
+}
+
+const Radix4Kernels *Radix4NeonKernels() {
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  static const Radix4Kernels kernels = {
+      NeonVector::WIDTH, Radix4Stage<NeonVector>, nullptr,
+      Radix4FirstStage<NeonVector>, Radix2LastStage<NeonVector>,
+      RADIX4_FIXED_TRANSFORMS(NeonVector, NeonVector, 1),
+      RADIX4_FIXED_TRANSFORMS(NeonVector, NeonVector, 4)};
+  return &kernels;
+#else
+  return nullptr;
+#endif
+}
+
+namespace {
+
+// exp(-j pi (k / points + 1 / 2)) for k = 1 to points / 2, for splitting
+// up the real transform. Built at compile time for the fixed lengths
+template <int POINTS>
+struct SplitTwiddles {
+  float re[POINTS / 2];
+  float im[POINTS / 2];
+
+  constexpr SplitTwiddles() : re(), im() {
+    for (int k = 1; k <= POINTS / 2; k++) {
+      double phase = -RADIX4_PI * ((double)k / POINTS + 0.5);
+      re[k - 1] = (float)Radix4Cos(phase);
+      im[k - 1] = (float)Radix4Sin(phase);
+    }
+  }
+};
+
+template <int POINTS>
+const SplitTwiddles<POINTS> &FixedSplitTwiddles() {
+  static constexpr SplitTwiddles<POINTS> TWIDDLES;
+  return TWIDDLES;
+}
+
+class Radix4RealFft : public RealFft {
+ public:
+  Radix4RealFft(FftBackend backend, const Radix4Kernels *kernels, int length,
+                bool fixed);
+
+  void Forward(const double *samples, kiss_fft_cpx *spectrum) override;
+  void Inverse(const kiss_fft_cpx *spectrum, double *samples) override;
+  void ForwardBatch(int channels, const double *samples,
+                    kiss_fft_cpx *spectra) override;
+  int BatchChannels() const override;
+
+ private:
+  // One stage of the complex transform
+  struct Step {
+    int length;
+    int stride;
+    int twiddles;  // Offset into twiddles_
+  };
+
+  // Plans the stages, for lengths without a fixed transform or channel
+  // counts without one
+  void PlanStages();
+
+  // Complex transform of channels interleaved in the first re, im pair of
+  // buffer, returns the pair that holds the result
+  float *Transform(float *buffer, int channels);
+
+  // The bins of one channel of the complex result, which is every step-th
+  // point of z_re and z_im
+  void Split(const float *z_re, const float *z_im, int step,
+             kiss_fft_cpx *spectrum) const;
+
+  // Whether ForwardBatch runs channels at once
+  bool Batches(int channels) const;
+
+ private:
+  const Radix4Kernels *kernels_;
+  int points_;
+
+  // The whole transform on 1 and 4 channels if the length has a fixed one,
+  // otherwise the planned stages
+  float *(*fixed_transform_)(float *buffer);
+  float *(*fixed_transform4_)(float *buffer);
+  std::vector<Step> steps_;
+  bool radix2_;
+  std::vector<float> twiddles_;
+
+  // The split twiddles (see SplitTwiddles), planned ones in split_
+  const float *split_re_;
+  const float *split_im_;
+  std::vector<float> split_;
+
+  // Two buffers of re and im for the ping-pong of the stages, for one
+  // channel and for ForwardBatch
+  std::vector<float> buffer_;
+  std::vector<float> batch_buffer_;
+};
+
+Radix4RealFft::Radix4RealFft(FftBackend backend,
+                             const Radix4Kernels *kernels, int length,
+                             bool fixed)
+    : RealFft(backend, length),
+      kernels_(kernels),
+      points_(length / 2),
+      fixed_transform_(nullptr),
+      fixed_transform4_(nullptr),
+      radix2_(false),
+      split_re_(nullptr),
+      split_im_(nullptr) {
+  if (fixed) {
+    for (int i = 0; i < RADIX4_FIXED_COUNT; i++) {
+      if (length == RADIX4_FIXED_MIN_LENGTH << i) {
+        fixed_transform_ = kernels_->fixed_transform[i];
+        fixed_transform4_ = kernels_->fixed_transform4[i];
+      }
+    }
+  }
+
+  switch (fixed_transform_ ? points_ : 0) {
+#define FIXED_SPLIT(points)                      \
+  case points:                                   \
+    split_re_ = FixedSplitTwiddles<points>().re; \
+    split_im_ = FixedSplitTwiddles<points>().im; \
+    break;
+    FIXED_SPLIT(128)
+    FIXED_SPLIT(256)
+    FIXED_SPLIT(512)
+    FIXED_SPLIT(1024)
+    FIXED_SPLIT(2048)
+#undef FIXED_SPLIT
+    default:
+      fixed_transform_ = nullptr;
+      fixed_transform4_ = nullptr;
+      PlanStages();
+
+      split_.resize(points_);
+      for (int k = 1; k <= points_ / 2; k++) {
+        double phase = -PI * ((double)k / points_ + 0.5);
+        split_[k - 1] = (float)std::cos(phase);
+        split_[points_ / 2 + k - 1] = (float)std::sin(phase);
+      }
+      split_re_ = &split_[0];
+      split_im_ = &split_[points_ / 2];
+  }
+  buffer_.resize(4 * points_);
+}
+
+void Radix4RealFft::PlanStages() {
+  int size = points_, stride = 1;
+  for (; size >= 4; size /= 4, stride *= 4) {
+    Step step = {size, stride, (int)twiddles_.size()};
+    steps_.push_back(step);
+    int m = size / 4;
+    for (int k = 1; k <= 3; k++) {
+      for (int p = 0; p < m; p++)
+        twiddles_.push_back((float)std::cos(-2.0 * PI * k * p / size));
+      for (int p = 0; p < m; p++)
+        twiddles_.push_back((float)std::sin(-2.0 * PI * k * p / size));
+    }
+  }
+  radix2_ = size == 2;
+}
+
+float *Radix4RealFft::Transform(float *buffer, int channels) {
+  if (channels == 1 && fixed_transform_) return fixed_transform_(buffer);
+  if (channels == 4 && fixed_transform4_) return fixed_transform4_(buffer);
+  if (steps_.empty()) PlanStages();
+
+  // The interleaved channels just multiply every stride
+  const Radix4Kernels *scalar = Radix4ScalarKernels();
+  int size = points_ * channels;
+  float *x = buffer, *y = buffer + 2 * size;
+  for (const Step &step : steps_) {
+    const float *twiddles = &twiddles_[step.twiddles];
+    int stride = step.stride * channels;
+    if (stride % kernels_->width == 0) {
+      kernels_->stage(step.length, stride, x, x + size, y, y + size,
+                      twiddles);
+    } else if (kernels_->stage4 && stride % 4 == 0) {
+      kernels_->stage4(step.length, stride, x, x + size, y, y + size,
+                       twiddles);
+    } else if (kernels_->first_stage && stride == 1 &&
+               step.length % 16 == 0) {
+      kernels_->first_stage(step.length, x, x + size, y, y + size, twiddles);
+    } else {
+      scalar->stage(step.length, stride, x, x + size, y, y + size, twiddles);
+    }
+    std::swap(x, y);
+  }
+
+  if (radix2_) {
+    int stride = size / 2;
+    const Radix4Kernels *last =
+        stride % kernels_->width == 0 ? kernels_ : scalar;
+    last->last_stage(stride, x, x + size, y, y + size);
+    std::swap(x, y);
+  }
+  return x;
+}
+
+void Radix4RealFft::Split(const float *z_re, const float *z_im, int step,
+                          kiss_fft_cpx *spectrum) const {
+  spectrum[0].r = z_re[0] + z_im[0];
+  spectrum[0].i = 0.0;
+  spectrum[points_].r = z_re[0] - z_im[0];
+  spectrum[points_].i = 0.0;
+
+  // The bins k and points - k together, as kiss_fftr does
+  for (int k = 1; k <= points_ / 2; k++) {
+    float pk_r = z_re[k * step], pk_i = z_im[k * step];
+    float pnk_r = z_re[(points_ - k) * step];
+    float pnk_i = -z_im[(points_ - k) * step];
+    float f1_r = pk_r + pnk_r, f1_i = pk_i + pnk_i;
+    float f2_r = pk_r - pnk_r, f2_i = pk_i - pnk_i;
+    float w_r = split_re_[k - 1], w_i = split_im_[k - 1];
+    float tw_r = f2_r * w_r - f2_i * w_i, tw_i = f2_r * w_i + f2_i * w_r;
+    spectrum[k].r = 0.5f * (f1_r + tw_r);
+    spectrum[k].i = 0.5f * (f1_i + tw_i);
+    spectrum[points_ - k].r = 0.5f * (f1_r - tw_r);
+    spectrum[points_ - k].i = 0.5f * (tw_i - f1_i);
+  }
+}
+
+void Radix4RealFft::Forward(const double *samples, kiss_fft_cpx *spectrum) {
+  // Even samples as real, odd ones as imaginary part
+  float *re = &buffer_[0], *im = &buffer_[points_];
+  for (int k = 0; k < points_; k++) {
+    re[k] = (float)samples[2 * k];
+    im[k] = (float)samples[2 * k + 1];
+  }
+  float *z = Transform(&buffer_[0], 1);
+  Split(z, z + points_, 1, spectrum);
+}
+
+// All channels at once only if they fill whole vectors of 4 lanes (or of
+// the width, which is 8 for AVX2), and if their buffers stay in the L1
+// cache: beyond it the larger working set costs more than the batching
+// saves
+bool Radix4RealFft::Batches(int channels) const {
+  return kernels_->width > 1 &&
+         (channels == kernels_->width ||
+          (channels == 4 && kernels_->stage4)) &&
+         4 * points_ * channels <= BATCH_MAX_FLOATS;
+}
+
+int Radix4RealFft::BatchChannels() const {
+  if (Batches(kernels_->width)) return kernels_->width;
+  return Batches(4) ? 4 : 1;
+}
+
+void Radix4RealFft::ForwardBatch(int channels, const double *samples,
+                                 kiss_fft_cpx *spectra) {
+  if (!Batches(channels)) {
+    RealFft::ForwardBatch(channels, samples, spectra);
+    return;
+  }
+
+  // Even samples as real, odd ones as imaginary part, the channels
+  // interleaved
+  int size = points_ * channels;
+  batch_buffer_.resize(4 * size);
+  float *re = &batch_buffer_[0], *im = &batch_buffer_[size];
+  for (int c = 0; c < channels; c++) {
+    const double *channel = samples + c * Length();
+    for (int k = 0; k < points_; k++) {
+      re[k * channels + c] = (float)channel[2 * k];
+      im[k * channels + c] = (float)channel[2 * k + 1];
+    }
+  }
+  float *z = Transform(&batch_buffer_[0], channels);
+  for (int c = 0; c < channels; c++)
+    Split(z + c, z + size + c, channels, spectra + c * (points_ + 1));
+}
+
+void Radix4RealFft::Inverse(const kiss_fft_cpx *spectrum, double *samples) {
+  // The complex spectrum back from the real one, as kiss_fftri does. It
+  // goes in with real and imaginary part swapped, so the forward transform
+  // computes the inverse one
+  float *re = &buffer_[0], *im = &buffer_[points_];
+  im[0] = (float)(spectrum[0].r + spectrum[points_].r);
+  re[0] = (float)(spectrum[0].r - spectrum[points_].r);
+  for (int k = 1; k <= points_ / 2; k++) {
+    float fk_r = (float)spectrum[k].r, fk_i = (float)spectrum[k].i;
+    float fnk_r = (float)spectrum[points_ - k].r;
+    float fnk_i = -(float)spectrum[points_ - k].i;
+    float fe_r = fk_r + fnk_r, fe_i = fk_i + fnk_i;
+    float t_r = fk_r - fnk_r, t_i = fk_i - fnk_i;
+    float w_r = split_re_[k - 1], w_i = -split_im_[k - 1];
+    float fo_r = t_r * w_r - t_i * w_i, fo_i = t_r * w_i + t_i * w_r;
+    im[k] = fe_r + fo_r;
+    re[k] = fe_i + fo_i;
+    im[points_ - k] = fe_r - fo_r;
+    re[points_ - k] = fo_i - fe_i;
+  }
+  float *z = Transform(&buffer_[0], 1);
+  const float *z_re = z, *z_im = z + points_;
+
+  double scale = 1.0 / Length();
+  for (int k = 0; k < points_; k++) {
+    samples[2 * k] = z_im[k] * scale;
+    samples[2 * k + 1] = z_re[k] * scale;
+  }
+}
+
+}  // namespace
+
+bool Radix4FftSupports(int length) {
+  return length >= 32 && (length & (length - 1)) == 0;
+}
+
+RealFft *CreateRadix4Fft(FftBackend backend, const Radix4Kernels *kernels,
+                         int length, bool fixed) {
+  return new Radix4RealFft(backend, kernels, length, fixed);
+}
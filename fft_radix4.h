@@ -0,0 +1,361 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** fft_radix4.h
+** Butterflies of the single-precision radix-4 FFT (fft_radix4.cc), written
+** once against a small vector type and instantiated per instruction set.
+**
+** The complex transform is a Stockham radix-4 (with a final radix-2 if
+** needed) on separate real and imaginary arrays, so it sorts itself and
+** needs no bit reversal. Stages whose stride is a multiple of the vector
+** width run vectorized over the stride; the first stage (stride 1) runs 4
+** butterflies side by side and transposes its output.
+**
+** For the real lengths 256 to 4096 there are whole transforms with the
+** stage schedule fixed at compile time and constexpr twiddle tables, so
+** the loops have constant bounds and the small butterflies unroll.
+**
+** Several channels of the same length go through the same stages at once
+** if they are interleaved, re[k * channels + c]: that is just every
+** stride times channels. With 4 channels every stage runs on full 4-lane
+** vectors, without the transposes of the first stage.
+**
+** fft_radix4_avx2.cc is compiled for AVX2 as a whole. It defines
+** FFT_RADIX4_KERNELS_ONLY, so this header pulls in no library code there,
+** and the vector types of each file live in an anonymous namespace:
+** nothing built for AVX2 may be shared with code that runs on CPUs
+** without it.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef FFT_RADIX4_H
+#define FFT_RADIX4_H
+
+// Real lengths RADIX4_FIXED_MIN_LENGTH << i for i < RADIX4_FIXED_COUNT
+// have transforms fixed at compile time
+static const int RADIX4_FIXED_MIN_LENGTH = 256;
+static const int RADIX4_FIXED_COUNT = 5;
+
+// The butterflies for one instruction set
+struct Radix4Kernels {
+  // Lanes of stage and last_stage, the stride must be a multiple of it
+  int width;
+
+  // One radix-4 stage: sub-transforms of length points, stride of them
+  // interleaved
+  void (*stage)(int length, int stride, const float *x_re,
+                const float *x_im, float *y_re, float *y_im,
+                const float *twiddles);
+
+  // The same on 4 lanes for the strides too small for stage, nullptr if
+  // width is 4 or less
+  void (*stage4)(int length, int stride, const float *x_re,
+                 const float *x_im, float *y_re, float *y_im,
+                 const float *twiddles);
+
+  // The first stage (stride 1) on 4 lanes, nullptr if there are none.
+  // length / 4 must be a multiple of 4
+  void (*first_stage)(int length, const float *x_re, const float *x_im,
+                      float *y_re, float *y_im, const float *twiddles);
+
+  // The radix-2 stage lengths of 2 * 4^k end with
+  void (*last_stage)(int stride, const float *x_re, const float *x_im,
+                     float *y_re, float *y_im);
+
+  // Complex transforms of RADIX4_FIXED_MIN_LENGTH / 2 << i points on the
+  // buffer x_re, x_im, y_re, y_im. They start on x and return the re, im
+  // pair that holds the result
+  float *(*fixed_transform[RADIX4_FIXED_COUNT])(float *buffer);
+
+  // The same on 4 interleaved channels, nullptr if width is 1
+  float *(*fixed_transform4[RADIX4_FIXED_COUNT])(float *buffer);
+};
+
+// nullptr if this build does not have the instruction set
+const Radix4Kernels *Radix4ScalarKernels();
+const Radix4Kernels *Radix4Sse2Kernels();
+const Radix4Kernels *Radix4Avx2Kernels();
+const Radix4Kernels *Radix4NeonKernels();
+
+#ifndef FFT_RADIX4_KERNELS_ONLY
+#include "fft_backend.h"
+
+// The butterflies of a radix-4 backend, nullptr for kiss or if this build
+// or CPU lacks them
+const Radix4Kernels *Radix4BackendKernels(FftBackend backend);
+
+// Powers of two of at least 32
+bool Radix4FftSupports(int length);
+
+// The real transform on the given butterflies. The fixed lengths use
+// their fixed transform unless fixed is false
+RealFft *CreateRadix4Fft(FftBackend backend, const Radix4Kernels *kernels,
+                         int length, bool fixed = true);
+#endif
+
+// The stages are inlined into the fixed transforms, where their lengths
+// and strides are constants
+#define RADIX4_INLINE inline __attribute__((always_inline))
+
+// The twiddles of a stage are exp(-2 pi j k p / length) for k = 1, 2, 3
+// and p < length / 4, as 6 arrays: real and imaginary part for each k
+template <class V>
+RADIX4_INLINE void Radix4Stage(int length, int stride, const float *x_re,
+                               const float *x_im, float *y_re, float *y_im,
+                               const float *twiddles) {
+  typedef typename V::Type T;
+  int m = length / 4;
+  const float *w1_re = twiddles, *w1_im = twiddles + m;
+  const float *w2_re = twiddles + 2 * m, *w2_im = twiddles + 3 * m;
+  const float *w3_re = twiddles + 4 * m, *w3_im = twiddles + 5 * m;
+  int quarter = stride * m;
+
+  for (int p = 0; p < m; p++) {
+    T w1r = V::Set(w1_re[p]), w1i = V::Set(w1_im[p]);
+    T w2r = V::Set(w2_re[p]), w2i = V::Set(w2_im[p]);
+    T w3r = V::Set(w3_re[p]), w3i = V::Set(w3_im[p]);
+    const float *a_re = x_re + stride * p, *a_im = x_im + stride * p;
+    float *b_re = y_re + stride * 4 * p, *b_im = y_im + stride * 4 * p;
+
+    for (int q = 0; q < stride; q += V::WIDTH) {
+      T ar = V::Load(a_re + q), ai = V::Load(a_im + q);
+      T br = V::Load(a_re + quarter + q), bi = V::Load(a_im + quarter + q);
+      T cr = V::Load(a_re + 2 * quarter + q);
+      T ci = V::Load(a_im + 2 * quarter + q);
+      T dr = V::Load(a_re + 3 * quarter + q);
+      T di = V::Load(a_im + 3 * quarter + q);
+
+      T apc_r = V::Add(ar, cr), apc_i = V::Add(ai, ci);
+      T amc_r = V::Sub(ar, cr), amc_i = V::Sub(ai, ci);
+      T bpd_r = V::Add(br, dr), bpd_i = V::Add(bi, di);
+      T bmd_r = V::Sub(br, dr), bmd_i = V::Sub(bi, di);
+
+      // a - j b - c + j d, a - b + c - d and a + j b - c - j d
+      T t1r = V::Add(amc_r, bmd_i), t1i = V::Sub(amc_i, bmd_r);
+      T t2r = V::Sub(apc_r, bpd_r), t2i = V::Sub(apc_i, bpd_i);
+      T t3r = V::Sub(amc_r, bmd_i), t3i = V::Add(amc_i, bmd_r);
+
+      V::Store(b_re + q, V::Add(apc_r, bpd_r));
+      V::Store(b_im + q, V::Add(apc_i, bpd_i));
+      V::Store(b_re + stride + q, V::Sub(V::Mul(t1r, w1r), V::Mul(t1i, w1i)));
+      V::Store(b_im + stride + q, V::Add(V::Mul(t1r, w1i), V::Mul(t1i, w1r)));
+      V::Store(b_re + 2 * stride + q,
+               V::Sub(V::Mul(t2r, w2r), V::Mul(t2i, w2i)));
+      V::Store(b_im + 2 * stride + q,
+               V::Add(V::Mul(t2r, w2i), V::Mul(t2i, w2r)));
+      V::Store(b_re + 3 * stride + q,
+               V::Sub(V::Mul(t3r, w3r), V::Mul(t3i, w3i)));
+      V::Store(b_im + 3 * stride + q,
+               V::Add(V::Mul(t3r, w3i), V::Mul(t3i, w3r)));
+    }
+  }
+}
+
+template <class V4>
+RADIX4_INLINE void Radix4FirstStage(int length, const float *x_re,
+                                    const float *x_im, float *y_re,
+                                    float *y_im, const float *twiddles) {
+  typedef typename V4::Type T;
+  int m = length / 4;
+  const float *w1_re = twiddles, *w1_im = twiddles + m;
+  const float *w2_re = twiddles + 2 * m, *w2_im = twiddles + 3 * m;
+  const float *w3_re = twiddles + 4 * m, *w3_im = twiddles + 5 * m;
+
+  for (int p = 0; p < m; p += 4) {
+    T ar = V4::Load(x_re + p), ai = V4::Load(x_im + p);
+    T br = V4::Load(x_re + m + p), bi = V4::Load(x_im + m + p);
+    T cr = V4::Load(x_re + 2 * m + p), ci = V4::Load(x_im + 2 * m + p);
+    T dr = V4::Load(x_re + 3 * m + p), di = V4::Load(x_im + 3 * m + p);
+
+    T apc_r = V4::Add(ar, cr), apc_i = V4::Add(ai, ci);
+    T amc_r = V4::Sub(ar, cr), amc_i = V4::Sub(ai, ci);
+    T bpd_r = V4::Add(br, dr), bpd_i = V4::Add(bi, di);
+    T bmd_r = V4::Sub(br, dr), bmd_i = V4::Sub(bi, di);
+
+    T t1r = V4::Add(amc_r, bmd_i), t1i = V4::Sub(amc_i, bmd_r);
+    T t2r = V4::Sub(apc_r, bpd_r), t2i = V4::Sub(apc_i, bpd_i);
+    T t3r = V4::Sub(amc_r, bmd_i), t3i = V4::Add(amc_i, bmd_r);
+
+    T w1r = V4::Load(w1_re + p), w1i = V4::Load(w1_im + p);
+    T w2r = V4::Load(w2_re + p), w2i = V4::Load(w2_im + p);
+    T w3r = V4::Load(w3_re + p), w3i = V4::Load(w3_im + p);
+
+    T y0r = V4::Add(apc_r, bpd_r), y0i = V4::Add(apc_i, bpd_i);
+    T y1r = V4::Sub(V4::Mul(t1r, w1r), V4::Mul(t1i, w1i));
+    T y1i = V4::Add(V4::Mul(t1r, w1i), V4::Mul(t1i, w1r));
+    T y2r = V4::Sub(V4::Mul(t2r, w2r), V4::Mul(t2i, w2i));
+    T y2i = V4::Add(V4::Mul(t2r, w2i), V4::Mul(t2i, w2r));
+    T y3r = V4::Sub(V4::Mul(t3r, w3r), V4::Mul(t3i, w3i));
+    T y3i = V4::Add(V4::Mul(t3r, w3i), V4::Mul(t3i, w3r));
+
+    // Lane l of yk belongs to y[4 (p + l) + k]
+    V4::Transpose(&y0r, &y1r, &y2r, &y3r);
+    V4::Transpose(&y0i, &y1i, &y2i, &y3i);
+    V4::Store(y_re + 4 * p, y0r);
+    V4::Store(y_re + 4 * p + 4, y1r);
+    V4::Store(y_re + 4 * p + 8, y2r);
+    V4::Store(y_re + 4 * p + 12, y3r);
+    V4::Store(y_im + 4 * p, y0i);
+    V4::Store(y_im + 4 * p + 4, y1i);
+    V4::Store(y_im + 4 * p + 8, y2i);
+    V4::Store(y_im + 4 * p + 12, y3i);
+  }
+}
+
+template <class V>
+RADIX4_INLINE void Radix2LastStage(int stride, const float *x_re,
+                                   const float *x_im, float *y_re,
+                                   float *y_im) {
+  typedef typename V::Type T;
+  for (int q = 0; q < stride; q += V::WIDTH) {
+    T ar = V::Load(x_re + q), ai = V::Load(x_im + q);
+    T br = V::Load(x_re + stride + q), bi = V::Load(x_im + stride + q);
+    V::Store(y_re + q, V::Add(ar, br));
+    V::Store(y_im + q, V::Add(ai, bi));
+    V::Store(y_re + stride + q, V::Sub(ar, br));
+    V::Store(y_im + stride + q, V::Sub(ai, bi));
+  }
+}
+
+static constexpr double RADIX4_PI = 3.14159265358979323846;
+
+// sin and cos for the tables at compile time, C++14 has no constexpr ones.
+// Taylor series after bringing x into -pi to pi
+static constexpr double Radix4Sin(double x) {
+  while (x > RADIX4_PI) x -= 2 * RADIX4_PI;
+  while (x < -RADIX4_PI) x += 2 * RADIX4_PI;
+  double term = x, sum = x;
+  for (int n = 1; n < 16; n++) {
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+static constexpr double Radix4Cos(double x) {
+  while (x > RADIX4_PI) x -= 2 * RADIX4_PI;
+  while (x < -RADIX4_PI) x += 2 * RADIX4_PI;
+  double term = 1.0, sum = 1.0;
+  for (int n = 1; n < 16; n++) {
+    term *= -x * x / ((2 * n - 1) * (2 * n));
+    sum += term;
+  }
+  return sum;
+}
+
+// 6 twiddles per butterfly of a stage
+static constexpr int Radix4TwiddleCount(int points) {
+  int count = 0;
+  for (int size = points; size >= 4; size /= 4) count += 6 * (size / 4);
+  return count;
+}
+
+// The twiddles of all stages of a transform of points, one after the other
+template <int POINTS>
+struct Radix4Twiddles {
+  float value[Radix4TwiddleCount(POINTS)];
+
+  constexpr Radix4Twiddles() : value() {
+    int offset = 0;
+    for (int size = POINTS; size >= 4; size /= 4) {
+      for (int k = 1; k <= 3; k++) {
+        for (int p = 0; p < size / 4; p++)
+          value[offset++] = (float)Radix4Cos(-2 * RADIX4_PI * k * p / size);
+        for (int p = 0; p < size / 4; p++)
+          value[offset++] = (float)Radix4Sin(-2 * RADIX4_PI * k * p / size);
+      }
+    }
+  }
+};
+
+// How a fixed stage runs: 0 vectorized over the stride, 1 the same on 4
+// lanes, 2 as first stage
+template <int KIND>
+struct Radix4FixedStage;
+
+template <>
+struct Radix4FixedStage<0> {
+  template <class V, class V4, int LENGTH, int STRIDE>
+  static RADIX4_INLINE void Run(const float *x_re, const float *x_im,
+                                float *y_re, float *y_im,
+                                const float *twiddles) {
+    Radix4Stage<V>(LENGTH, STRIDE, x_re, x_im, y_re, y_im, twiddles);
+  }
+};
+
+template <>
+struct Radix4FixedStage<1> {
+  template <class V, class V4, int LENGTH, int STRIDE>
+  static RADIX4_INLINE void Run(const float *x_re, const float *x_im,
+                                float *y_re, float *y_im,
+                                const float *twiddles) {
+    Radix4Stage<V4>(LENGTH, STRIDE, x_re, x_im, y_re, y_im, twiddles);
+  }
+};
+
+template <>
+struct Radix4FixedStage<2> {
+  template <class V, class V4, int LENGTH, int STRIDE>
+  static RADIX4_INLINE void Run(const float *x_re, const float *x_im,
+                                float *y_re, float *y_im,
+                                const float *twiddles) {
+    Radix4FirstStage<V4>(LENGTH, x_re, x_im, y_re, y_im, twiddles);
+  }
+};
+
+// The stages from LENGTH on, ping-ponging between x and y. The re and im
+// arrays have SIZE floats
+template <class V, class V4, int SIZE, int LENGTH, int STRIDE>
+struct Radix4Schedule {
+  static const int KIND =
+      STRIDE % V::WIDTH == 0 ? 0 : STRIDE % 4 == 0 ? 1 : 2;
+
+  static RADIX4_INLINE float *Run(float *x, float *y,
+                                  const float *twiddles) {
+    Radix4FixedStage<KIND>::template Run<V, V4, LENGTH, STRIDE>(
+        x, x + SIZE, y, y + SIZE, twiddles);
+    return Radix4Schedule<V, V4, SIZE, LENGTH / 4, STRIDE * 4>::Run(
+        y, x, twiddles + 6 * (LENGTH / 4));
+  }
+};
+
+template <class V, class V4, int SIZE, int STRIDE>
+struct Radix4Schedule<V, V4, SIZE, 2, STRIDE> {
+  static_assert(STRIDE % V::WIDTH == 0, "radix-2 stage too narrow");
+
+  static RADIX4_INLINE float *Run(float *x, float *y, const float *) {
+    Radix2LastStage<V>(STRIDE, x, x + SIZE, y, y + SIZE);
+    return y;
+  }
+};
+
+template <class V, class V4, int SIZE, int STRIDE>
+struct Radix4Schedule<V, V4, SIZE, 1, STRIDE> {
+  static RADIX4_INLINE float *Run(float *x, float *, const float *) {
+    return x;
+  }
+};
+
+// A whole complex transform of POINTS on CHANNELS, see Radix4Kernels
+template <class V, class V4, int POINTS, int CHANNELS>
+float *Radix4FixedTransform(float *buffer) {
+  static constexpr Radix4Twiddles<POINTS> TWIDDLES;
+  return Radix4Schedule<V, V4, POINTS * CHANNELS, POINTS, CHANNELS>::Run(
+      buffer, buffer + 2 * POINTS * CHANNELS, TWIDDLES.value);
+}
+
+// The initializer of Radix4Kernels::fixed_transform and fixed_transform4
+#define RADIX4_FIXED_TRANSFORMS(V, V4, CHANNELS)      \
+  {                                                   \
+    Radix4FixedTransform<V, V4, 128, CHANNELS>,       \
+        Radix4FixedTransform<V, V4, 256, CHANNELS>,   \
+        Radix4FixedTransform<V, V4, 512, CHANNELS>,   \
+        Radix4FixedTransform<V, V4, 1024, CHANNELS>,  \
+        Radix4FixedTransform<V, V4, 2048, CHANNELS>   \
+  }
+
+#endif  // FFT_RADIX4_H
@@ -0,0 +1,69 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** fft_radix4_avx2.cc
+** The AVX2 butterflies of the radix-4 FFT. The whole file is built for
+** AVX2, whether the CPU has it is checked at runtime (fft_backend.cc)
+** before any of this runs.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+// Before the butterflies, so their instances are built for AVX2 too
+#if defined(__x86_64__) || defined(__i386__)
+#pragma GCC target("avx2")
+#endif
+
+#define FFT_RADIX4_KERNELS_ONLY
+#include "fft_radix4.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+namespace {
+
+struct AvxVector {
+  typedef __m256 Type;
+  static const int WIDTH = 8;
+  static Type Load(const float *p) { return _mm256_loadu_ps(p); }
+  static void Store(float *p, Type a) { _mm256_storeu_ps(p, a); }
+  static Type Set(float a) { return _mm256_set1_ps(a); }
+  static Type Add(Type a, Type b) { return _mm256_add_ps(a, b); }
+  static Type Sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+  static Type Mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+};
+
+// The 4-lane stages, with the VEX encoding of this file
+struct AvxVector4 {
+  typedef __m128 Type;
+  static const int WIDTH = 4;
+  static Type Load(const float *p) { return _mm_loadu_ps(p); }
+  static void Store(float *p, Type a) { _mm_storeu_ps(p, a); }
+  static Type Set(float a) { return _mm_set1_ps(a); }
+  static Type Add(Type a, Type b) { return _mm_add_ps(a, b); }
+  static Type Sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+  static Type Mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+  static void Transpose(Type *a, Type *b, Type *c, Type *d) {
+    _MM_TRANSPOSE4_PS(*a, *b, *c, *d);
+  }
+};
+
+}  // namespace
+
+const Radix4Kernels *Radix4Avx2Kernels() {
+  static const Radix4Kernels kernels = {
+      AvxVector::WIDTH, Radix4Stage<AvxVector>, Radix4Stage<AvxVector4>,
+      Radix4FirstStage<AvxVector4>, Radix2LastStage<AvxVector>,
+      RADIX4_FIXED_TRANSFORMS(AvxVector, AvxVector4, 1),
+      RADIX4_FIXED_TRANSFORMS(AvxVector, AvxVector4, 4)};
+  return &kernels;
+}
+
+#else
+
+const Radix4Kernels *Radix4Avx2Kernels() { return nullptr; }
+
+#endif
@@ -0,0 +1,77 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** frame_timing.cc
+** Capture timestamps of the periods and the latency budget report
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "frame_timing.h"
+
+#include <iomanip>
+
+#include "pipeline_stats.h"
+
+void MakeFrameTag(uint64_t frame_index, int frames, int sample_rate,
+                  uint64_t hw_timestamp_ns, int64_t delay_frames,
+                  FrameTag *tag) {
+  tag->frame_index = frame_index;
+  tag->read_ns = PipelineClockNs();
+  tag->array = 0;
+
+  // The hardware timestamp is taken at the last pointer update, delay
+  // frames were captured since the last one we read
+  uint64_t now_ns = hw_timestamp_ns ? hw_timestamp_ns : tag->read_ns;
+  if (delay_frames < 0) delay_frames = 0;
+  tag->complete_ns =
+      now_ns - (uint64_t)delay_frames * 1000000000ull / sample_rate;
+  tag->capture_ns =
+      tag->complete_ns - (uint64_t)frames * 1000000000ull / sample_rate;
+}
+
+LatencyReport::LatencyReport() : count_(0) {
+  for (int i = 0; i < PART_COUNT; i++) {
+    sum_ns_[i] = 0;
+    max_ns_[i] = 0;
+  }
+}
+
+void LatencyReport::Add(const FrameTag &tag, uint64_t compute_start_ns,
+                        uint64_t output_ns) {
+  uint64_t parts[PART_COUNT];
+  parts[BUFFERING] = tag.complete_ns - tag.capture_ns;
+  parts[QUEUEING] = compute_start_ns - tag.complete_ns;
+  parts[COMPUTE] = output_ns - compute_start_ns;
+  parts[TOTAL] = output_ns - tag.capture_ns;
+
+  for (int i = 0; i < PART_COUNT; i++) {
+    sum_ns_[i] += parts[i];
+    if (parts[i] > max_ns_[i]) max_ns_[i] = parts[i];
+  }
+  count_++;
+}
+
+void LatencyReport::Print(std::ostream &out) const {
+  static const char *names[PART_COUNT] = {"buffering", "queueing", "compute",
+                                          "total"};
+
+  out << "Audio-to-output latency over " << count_ << " results" << std::endl;
+  if (count_ == 0) return;
+
+  out << std::left << std::setw(12) << "part" << std::right << std::setw(12)
+      << "mean_ms" << std::setw(12) << "max_ms" << std::setw(10) << "share"
+      << std::endl;
+  out << std::fixed << std::setprecision(2);
+  for (int i = 0; i < PART_COUNT; i++) {
+    out << std::left << std::setw(12) << names[i] << std::right
+        << std::setw(12) << sum_ns_[i] / 1e6 / count_ << std::setw(12)
+        << max_ns_[i] / 1e6 << std::setw(9)
+        << (sum_ns_[TOTAL] ? 100.0 * sum_ns_[i] / sum_ns_[TOTAL] : 0.0) << "%"
+        << std::endl;
+  }
+  out << std::defaultfloat;
+}
@@ -0,0 +1,72 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** frame_timing.h
+** Tags every captured period with the time its audio was recorded, so each
+** DoA result can tell how old its audio is once it is shown, and a report
+** can split that latency into buffering, queueing and compute.
+**
+** All times are CLOCK_MONOTONIC nanoseconds (see PipelineClockNs).
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef FRAME_TIMING_H
+#define FRAME_TIMING_H
+
+#include <stdint.h>
+#include <ostream>
+
+// Travels with a captured period through hotword, DoA and LED
+struct FrameTag {
+  // Index of the first frame of the period since capture started
+  uint64_t frame_index;
+
+  // When the first and the last sample of the period were recorded, taken
+  // from the ALSA hardware timestamp
+  uint64_t capture_ns;
+  uint64_t complete_ns;
+
+  // When the read returned the period to us
+  uint64_t read_ns;
+
+  // Which mic array the period is from, 0 if there is only one (see
+  // doa_arrays.h)
+  uint32_t array;
+};
+
+// Fills the tag for a period of the given length that was read just now.
+// hw_timestamp_ns is the ALSA htstamp and delay_frames the frames captured
+// after the last one we read, both from one snd_pcm_status. If there is no
+// hardware timestamp (0), the read time is used instead
+void MakeFrameTag(uint64_t frame_index, int frames, int sample_rate,
+                  uint64_t hw_timestamp_ns, int64_t delay_frames,
+                  FrameTag *tag);
+
+// Collects the latency of many results and breaks it down
+class LatencyReport {
+ public:
+  LatencyReport();
+
+  // Adds one result. compute_start_ns is when the DoA started to work on
+  // it, output_ns when it was shown
+  void Add(const FrameTag &tag, uint64_t compute_start_ns,
+           uint64_t output_ns);
+
+  // Writes mean and max of buffering (recording the period), queueing
+  // (ALSA buffer and everything before the DoA), compute (DoA and output)
+  // and the total audio-to-output latency
+  void Print(std::ostream &out) const;
+
+ private:
+  enum { BUFFERING, QUEUEING, COMPUTE, TOTAL, PART_COUNT };
+
+  uint64_t count_;
+  uint64_t sum_ns_[PART_COUNT];
+  uint64_t max_ns_[PART_COUNT];
+};
+
+#endif  // FRAME_TIMING_H
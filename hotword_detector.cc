@@ -0,0 +1,111 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** hotword_detector.cc
+** The stub hotword detector
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "hotword_detector.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+static const double PI = 3.14159265358979323846;
+static const int SAMPLE_RATE = 16000;
+
+// 20 ms blocks, 50 Hz wide bins
+static const int STUB_BLOCK = 320;
+
+// Share of a block's energy that has to be in the tone, low enough for
+// two tones at once
+static const double TONE_SHARE = 0.3;
+
+// Spins for us microseconds of thread CPU time
+static void Busy(double us) {
+  if (us <= 0.0) return;
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  double end = now.tv_sec * 1e6 + now.tv_nsec / 1e3 + us;
+  do {
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  } while (now.tv_sec * 1e6 + now.tv_nsec / 1e3 < end);
+}
+
+StubHotwordDetector::StubHotwordDetector(double frequency_hz, int hotword,
+                                         double min_ms,
+                                         double busy_us_per_second)
+    : frequency_hz_(frequency_hz),
+      hotword_(hotword),
+      min_blocks_(std::max(1, (int)(min_ms * SAMPLE_RATE / 1000.0 /
+                                    STUB_BLOCK))),
+      busy_us_per_second_(busy_us_per_second),
+      coefficient_(2.0 * std::cos(2.0 * PI * frequency_hz / SAMPLE_RATE)) {
+  Reset();
+}
+
+std::string StubHotwordDetector::Name() const {
+  std::ostringstream name;
+  name << "stub " << frequency_hz_ << " Hz";
+  return name.str();
+}
+
+void StubHotwordDetector::Reset() {
+  s1_ = 0.0;
+  s2_ = 0.0;
+  energy_ = 0.0;
+  filled_ = 0;
+  tone_blocks_ = 0;
+  reported_ = false;
+}
+
+int StubHotwordDetector::Detect(const int16_t *samples, int count) {
+  Busy(busy_us_per_second_ * count / SAMPLE_RATE);
+
+  int result = 0;
+  for (int n = 0; n < count; n++) {
+    double sample = samples[n];
+    double s0 = sample + coefficient_ * s1_ - s2_;
+    s2_ = s1_;
+    s1_ = s0;
+    energy_ += sample * sample;
+    if (++filled_ < STUB_BLOCK) continue;
+
+    // A sine of amplitude A gives A^2 N^2 / 4 here, and A^2 N / 2 energy
+    double tone = s1_ * s1_ + s2_ * s2_ - coefficient_ * s1_ * s2_;
+    bool has_tone = energy_ > 0.0 && 2.0 * tone / (STUB_BLOCK * energy_) >
+                                         TONE_SHARE;
+    tone_blocks_ = has_tone ? tone_blocks_ + 1 : 0;
+    if (!has_tone) reported_ = false;
+    if (tone_blocks_ >= min_blocks_ && !reported_) {
+      reported_ = true;
+      result = hotword_;
+    }
+    s1_ = 0.0;
+    s2_ = 0.0;
+    energy_ = 0.0;
+    filled_ = 0;
+  }
+  return result;
+}
+
+StubHotwordDetector *ParseStubHotwordDetector(const char *spec) {
+  char *next;
+  double frequency_hz = strtod(spec, &next);
+  if (next == spec || frequency_hz <= 0.0 || frequency_hz >= SAMPLE_RATE / 2)
+    return nullptr;
+  int hotword = 1;
+  if (*next == ':') {
+    hotword = strtol(next + 1, &next, 10);
+    if (hotword < 1) return nullptr;
+  }
+  if (*next) return nullptr;
+  return new StubHotwordDetector(frequency_hz, hotword);
+}
@@ -0,0 +1,72 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** hotword_detector.h
+** What the sample needs of a hotword detector: mono 16 kHz 16-bit audio
+** in, the index of a hotword out. snowboy is one implementation
+** (snowboy_hotword_detector.h, ARM only, like the bundled library); the
+** stub here detects tones instead of words, so everything around the
+** detectors runs and can be tested on any machine.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef HOTWORD_DETECTOR_H
+#define HOTWORD_DETECTOR_H
+
+#include <stdint.h>
+#include <string>
+
+class HotwordDetector {
+ public:
+  virtual ~HotwordDetector() {}
+
+  // For the logs, e.g. the model file
+  virtual std::string Name() const = 0;
+
+  // Runs the detection over the next count samples. Like snowboy: the
+  // index (from 1) of the hotword that ended in them, 0 for none, -1 on an
+  // error and -2 for silence
+  virtual int Detect(const int16_t *samples, int count) = 0;
+
+  // Forgets the audio so far, e.g. after a gap in the capture
+  virtual void Reset() {}
+};
+
+// Detects a sine of frequency_hz that lasts at least min_ms as hotword,
+// once per tone. busy_us_per_second spins that long per second of audio,
+// to stand in for the CPU of a real model
+class StubHotwordDetector : public HotwordDetector {
+ public:
+  StubHotwordDetector(double frequency_hz, int hotword = 1,
+                      double min_ms = 200.0, double busy_us_per_second = 0.0);
+
+  std::string Name() const override;
+  int Detect(const int16_t *samples, int count) override;
+  void Reset() override;
+
+ private:
+  double frequency_hz_;
+  int hotword_;
+  int min_blocks_;
+  double busy_us_per_second_;
+
+  // Goertzel over blocks of STUB_BLOCK samples, carried across calls
+  double coefficient_;
+  double s1_;
+  double s2_;
+  double energy_;
+  int filled_;
+
+  // Blocks in a row with the tone, and whether it was reported
+  int tone_blocks_;
+  bool reported_;
+};
+
+// Parses HZ[:HOTWORD] into a stub, nullptr if malformed
+StubHotwordDetector *ParseStubHotwordDetector(const char *spec);
+
+#endif  // HOTWORD_DETECTOR_H
@@ -0,0 +1,277 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** hotword_runner.cc
+** Runs several hotword detectors in parallel
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "hotword_runner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include "pipeline_stats.h"
+#include "trace_events.h"
+
+HotwordRunner::HotwordRunner()
+    : frames_(0),
+      next_in_ring_(false),
+      inline_(false),
+      written_(0),
+      dropped_(0),
+      stop_(false) {}
+
+HotwordRunner::~HotwordRunner() {
+  Stop();
+  for (Worker *worker : workers_) {
+    delete worker->detector;
+    delete worker;
+  }
+}
+
+int HotwordRunner::AddDetector(HotwordDetector *detector) {
+  Worker *worker = new Worker();
+  worker->id = workers_.size();
+  worker->name = "hotword " + std::to_string(worker->id);
+  worker->detector = detector;
+  worker->has_rt_profile = false;
+  worker->next = 0;
+  worker->reading = false;
+  worker->reading_period = 0;
+  worker->skipped = 0;
+  worker->gap = false;
+  workers_.push_back(worker);
+  return worker->id;
+}
+
+void HotwordRunner::SetRtProfile(int detector, const RtProfile &profile) {
+  workers_[detector]->rt_profile = profile;
+  workers_[detector]->has_rt_profile = true;
+}
+
+bool HotwordRunner::Start(int frames, size_t ring_periods) {
+  if (frames_) {
+    std::cout << "Hotword runner already started." << std::endl;
+    return false;
+  }
+  if (workers_.empty()) {
+    std::cout << "Failed to start the hotword runner (no detectors)"
+              << std::endl;
+    return false;
+  }
+
+  frames_ = frames;
+  ring_.assign(ring_periods < 2 ? 2 : ring_periods,
+               std::vector<int16_t>(frames));
+  tags_.resize(ring_.size());
+  overflow_.resize(frames);
+  stop_ = false;
+  for (Worker *worker : workers_)
+    worker->thread = std::thread(&HotwordRunner::Work, this, worker);
+  return true;
+}
+
+bool HotwordRunner::StartInline(int frames) {
+  if (frames_) {
+    std::cout << "Hotword runner already started." << std::endl;
+    return false;
+  }
+  if (workers_.empty()) {
+    std::cout << "Failed to start the hotword runner (no detectors)"
+              << std::endl;
+    return false;
+  }
+
+  // Nobody reads while we write, one slot is enough
+  frames_ = frames;
+  ring_.assign(1, std::vector<int16_t>(frames));
+  tags_.resize(1);
+  inline_ = true;
+  return true;
+}
+
+void HotwordRunner::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  committed_.notify_all();
+  for (Worker *worker : workers_)
+    if (worker->thread.joinable()) worker->thread.join();
+}
+
+int16_t *HotwordRunner::NextPeriod() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  next_in_ring_ = true;
+  if (inline_) return ring_[0].data();
+  if (written_ < ring_.size()) return ring_[written_ % ring_.size()].data();
+
+  // The slot still holds this period, nobody may be reading it. Whoever
+  // has not got to it yet skips ahead
+  uint64_t reused = written_ - ring_.size();
+  for (Worker *worker : workers_) {
+    if (worker->reading && worker->reading_period == reused) {
+      next_in_ring_ = false;
+      return overflow_.data();
+    }
+  }
+  for (Worker *worker : workers_) {
+    if (worker->next <= reused) {
+      worker->skipped += reused + 1 - worker->next;
+      worker->next = reused + 1;
+      worker->gap = true;
+    }
+  }
+  return ring_[written_ % ring_.size()].data();
+}
+
+void HotwordRunner::Commit(const FrameTag &tag) {
+  if (inline_) {
+    DetectInline(tag);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!next_in_ring_) {
+      dropped_++;
+      return;
+    }
+    tags_[written_ % ring_.size()] = tag;
+    written_++;
+    next_in_ring_ = false;
+  }
+  committed_.notify_all();
+}
+
+void HotwordRunner::DetectInline(const FrameTag &tag) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t period = written_++;
+  next_in_ring_ = false;
+  for (Worker *worker : workers_) {
+    int hotword;
+    {
+      ScopedTraceSpan span("hotword");
+      hotword = worker->detector->Detect(ring_[0].data(), frames_);
+    }
+    worker->next = period + 1;
+
+    // The detectors run in order, so the detections come in order too
+    if (hotword > 0) {
+      HotwordDetection detection;
+      detection.detector = worker->id;
+      detection.hotword = hotword;
+      detection.tag = tag;
+      detection.detected_ns = PipelineClockNs();
+      pending_.push_back(std::make_pair(period, detection));
+    }
+  }
+}
+
+// The first period not every detector is done with
+uint64_t HotwordRunner::DoneLocked() const {
+  uint64_t done = written_;
+  for (const Worker *worker : workers_) done = std::min(done, worker->next);
+  return done;
+}
+
+bool HotwordRunner::WaitIdle(uint64_t timeout_ns) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return done_.wait_for(lock, std::chrono::nanoseconds(timeout_ns),
+                        [this] { return DoneLocked() >= written_; });
+}
+
+size_t HotwordRunner::TakeDetections(
+    std::vector<HotwordDetection> *detections) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  uint64_t done = DoneLocked();
+  size_t count = 0;
+  while (count < pending_.size() && pending_[count].first < done) {
+    detections->push_back(pending_[count].second);
+    count++;
+  }
+  pending_.erase(pending_.begin(), pending_.begin() + count);
+  return count;
+}
+
+uint64_t HotwordRunner::Committed() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return written_;
+}
+
+uint64_t HotwordRunner::Dropped() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+uint64_t HotwordRunner::Skipped(int detector) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return workers_[detector]->skipped;
+}
+
+void HotwordRunner::Work(Worker *worker) {
+  SetTraceThreadName(worker->name.c_str());
+  if (worker->has_rt_profile)
+    ApplyRtProfile(worker->name.c_str(), worker->rt_profile);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    committed_.wait(lock,
+                    [&] { return stop_ || worker->next < written_; });
+    if (worker->next >= written_) break;
+
+    // Half a ring behind, skip to the newest period. Reading one close to
+    // being overwritten would hold up the capture thread instead
+    if (written_ - worker->next > ring_.size() / 2) {
+      worker->skipped += written_ - 1 - worker->next;
+      worker->next = written_ - 1;
+      worker->gap = true;
+    }
+
+    // Read the period in place, the capture thread leaves its slot alone
+    // while we are at it
+    uint64_t period = worker->next;
+    const int16_t *samples = ring_[period % ring_.size()].data();
+    FrameTag tag = tags_[period % ring_.size()];
+    bool gap = worker->gap;
+    worker->gap = false;
+    worker->reading = true;
+    worker->reading_period = period;
+    lock.unlock();
+
+    // The detector must not take the skipped periods for part of a word
+    if (gap) worker->detector->Reset();
+    int hotword;
+    {
+      ScopedTraceSpan span("hotword");
+      hotword = worker->detector->Detect(samples, frames_);
+    }
+    uint64_t detected_ns = PipelineClockNs();
+
+    lock.lock();
+    worker->reading = false;
+    worker->next = period + 1;
+    if (hotword > 0) {
+      HotwordDetection detection;
+      detection.detector = worker->id;
+      detection.hotword = hotword;
+      detection.tag = tag;
+      detection.detected_ns = detected_ns;
+
+      // In the order of the periods, then of the detectors
+      auto position = pending_.begin();
+      while (position != pending_.end() &&
+             (position->first < period ||
+              (position->first == period &&
+               position->second.detector < worker->id)))
+        ++position;
+      pending_.insert(position, std::make_pair(period, detection));
+    }
+    done_.notify_all();
+  }
+}
@@ -0,0 +1,148 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** hotword_runner.h
+** Runs several hotword detectors (models, or instances of one) in
+** parallel, each on a thread of its own that can be pinned to a core, so
+** another wake word costs a core instead of latency in the audio loop.
+**
+** The capture thread writes the mono hotword audio of each period
+** straight into a ring (NextPeriod, Commit), and every detector reads the
+** periods in place from there, so there is no copy per detector. The
+** capture thread never waits: a detector that falls half a ring behind
+** skips to the newest period, and if it still reads the slot the next
+** period needs (one period took it longer than the ring), that period is
+** dropped for all of them.
+**
+** The detections come out in the order of their periods (then of the
+** detectors), no matter which detector finished first: a detection is only
+** handed out once every detector is past its period.
+**
+** StartInline runs the detectors one after the other on the thread that
+** commits instead, for single-core boards and the event loop, where the
+** handoffs to threads cost more than they save.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef HOTWORD_RUNNER_H
+#define HOTWORD_RUNNER_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "frame_timing.h"
+#include "hotword_detector.h"
+#include "rt_profile.h"
+
+// Periods the ring holds by default, about 4 s at 4096 frames
+static const size_t HOTWORD_RING_PERIODS = 16;
+
+struct HotwordDetection {
+  // ID of the detector (see AddDetector) and what its Detect returned
+  int detector;
+  int hotword;
+
+  // The period the hotword ended in, and when the detector returned
+  FrameTag tag;
+  uint64_t detected_ns;
+};
+
+class HotwordRunner {
+ public:
+  HotwordRunner();
+  ~HotwordRunner();
+
+  // Adds a detector, which the runner then owns. Returns its ID, the
+  // number of detectors added before it
+  int AddDetector(HotwordDetector *detector);
+  int DetectorCount() const { return workers_.size(); }
+  HotwordDetector &Detector(int id) { return *workers_[id]->detector; }
+
+  // Real-time profile of the thread of a detector, before Start
+  void SetRtProfile(int detector, const RtProfile &profile);
+
+  // Starts a thread per detector, for periods of frames samples
+  bool Start(int frames, size_t ring_periods = HOTWORD_RING_PERIODS);
+
+  // Starts without threads: Commit runs every detector over the period
+  // before it returns. Real-time profiles are ignored
+  bool StartInline(int frames);
+
+  // Runs the detectors over what was committed, then stops them
+  void Stop();
+
+  // Where the capture thread writes the next period, frames samples. Then
+  // Commit hands it to the detectors. Only one thread may write
+  int16_t *NextPeriod();
+  void Commit(const FrameTag &tag);
+
+  // Waits until every detector is done with every committed period, or
+  // until timeout_ns passed. False on the timeout
+  bool WaitIdle(uint64_t timeout_ns);
+
+  // Appends the detections of the periods every detector is done with, in
+  // the order of their periods. Returns how many
+  size_t TakeDetections(std::vector<HotwordDetection> *detections);
+
+  // Periods committed, dropped because a detector still read their slot,
+  // and skipped by a detector that fell behind
+  uint64_t Committed() const;
+  uint64_t Dropped() const;
+  uint64_t Skipped(int detector) const;
+
+ private:
+  struct Worker {
+    int id;
+    std::string name;
+    HotwordDetector *detector;
+    bool has_rt_profile;
+    RtProfile rt_profile;
+
+    // The next period it runs over, and the one it reads right now
+    uint64_t next;
+    bool reading;
+    uint64_t reading_period;
+    uint64_t skipped;
+
+    // Whether it skipped periods since it last ran, then it is reset first
+    bool gap;
+    std::thread thread;
+  };
+
+  void Work(Worker *worker);
+  void DetectInline(const FrameTag &tag);
+  uint64_t DoneLocked() const;
+
+ private:
+  std::vector<Worker *> workers_;
+  int frames_;
+
+  // The ring and the tags of its periods. Period p is in slot p % size,
+  // the periods [written_ - size, written_) are there
+  std::vector<std::vector<int16_t>> ring_;
+  std::vector<FrameTag> tags_;
+  std::vector<int16_t> overflow_;
+  bool next_in_ring_;
+  bool inline_;
+  uint64_t written_;
+  uint64_t dropped_;
+  bool stop_;
+
+  // Detections by period, not yet handed out
+  std::vector<std::pair<uint64_t, HotwordDetection>> pending_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable committed_;
+  std::condition_variable done_;
+};
+
+#endif  // HOTWORD_RUNNER_H
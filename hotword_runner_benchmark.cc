@@ -0,0 +1,247 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** hotword_runner_benchmark.cc
+** Feeds a stream of noise with tone bursts to several stub hotword
+** detectors (one tone each, with the CPU of a model spun per second of
+** audio), once one detector after the other on the loop's thread (the
+** runner's inline mode, as in the event loop), and once through the HotwordRunner with a thread per
+** detector. Prints how long the loop waits for the detectors per period,
+** and checks that every burst is detected once, by its detector, in the
+** right period and in the order of the periods. A last run at four times
+** real time, with a small ring, no waiting and one detector slower than
+** real time, checks that the slow one skips periods without holding the
+** loop up, and that what is detected is still in order.
+**
+** The exit code is 1 if a detection is missing, extra, misplaced or out of
+** order.
+**
+** Usage: hotword_runner_benchmark [detectors (4)]
+**                                 [CPU ms per second of audio each (50)]
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "hotword_runner.h"
+#include "pipeline_stats.h"
+
+static const double PI = 3.14159265358979323846;
+static const int SAMPLE_RATE = 16000;
+static const int PERIOD_FRAMES = 1024;
+static const double SECONDS = 12.0;
+
+// A burst every BURST_EVERY seconds, BURST_MS long, at the tone of the
+// detectors in turn; every fourth one goes to two detectors at once
+static const double BURST_EVERY = 0.5;
+static const double BURST_MS = 300.0;
+static const double TONE_MIN_MS = 200.0;
+static const double FIRST_TONE_HZ = 500.0;
+static const double TONE_STEP_HZ = 300.0;
+
+// The stub decides per 20 ms block, and a block half in the tone counts,
+// so up to two blocks before or after the tone was long enough
+static const int DETECT_SLACK = 640;
+
+// CPU ms per second of audio of the slow detector of the last run
+static const double SLOW_BUSY_MS = 400.0;
+
+struct Burst {
+  int detector;
+  uint64_t start;
+};
+
+static double ToneHz(int detector) {
+  return FIRST_TONE_HZ + detector * TONE_STEP_HZ;
+}
+
+// Noise with the bursts added, and which detector should find each
+static void MakeStream(int detectors, std::vector<int16_t> *stream,
+                       std::vector<Burst> *bursts) {
+  std::mt19937 random(3);
+  std::normal_distribution<double> gauss(0.0, 300.0);
+  stream->resize(SECONDS * SAMPLE_RATE);
+  std::vector<double> audio(stream->size());
+  for (double &sample : audio) sample = gauss(random);
+
+  int burst_length = BURST_MS * SAMPLE_RATE / 1000;
+  for (int b = 0;; b++) {
+    uint64_t start = (b + 0.5) * BURST_EVERY * SAMPLE_RATE;
+    if (start + burst_length > audio.size()) break;
+    std::vector<int> targets = {b % detectors};
+    if (b % 4 == 3 && detectors > 1) targets.push_back((b + 1) % detectors);
+    for (int detector : targets) {
+      bursts->push_back({detector, start});
+      for (int n = 0; n < burst_length; n++)
+        audio[start + n] +=
+            3000.0 * std::sin(2.0 * PI * ToneHz(detector) * n / SAMPLE_RATE);
+    }
+  }
+  for (size_t n = 0; n < audio.size(); n++)
+    (*stream)[n] = (int16_t)std::max(-32768.0, std::min(32767.0, audio[n]));
+}
+
+// Whether the detections are the bursts, in the order of their periods and
+// detectors. With exact every burst has to be there, about when its tone
+// was long enough. Otherwise a detector skipped periods and was reset, and
+// a detection only has to be within a burst of its tone
+static bool Check(const std::vector<HotwordDetection> &detections,
+                  const std::vector<Burst> &bursts, bool exact) {
+  bool right = true;
+  std::vector<bool> found(bursts.size(), false);
+  uint64_t last_frame = 0;
+  int last_detector = -1;
+  for (const HotwordDetection &detection : detections) {
+    uint64_t frame = detection.tag.frame_index;
+    right &= frame > last_frame ||
+             (frame == last_frame && detection.detector > last_detector);
+    last_frame = frame;
+    last_detector = detection.detector;
+
+    int match = -1;
+    for (size_t b = 0; b < bursts.size(); b++) {
+      uint64_t enough = bursts[b].start + TONE_MIN_MS * SAMPLE_RATE / 1000;
+      uint64_t first = exact ? enough - DETECT_SLACK : bursts[b].start;
+      uint64_t last = exact ? enough + DETECT_SLACK
+                            : bursts[b].start +
+                                  BURST_MS * SAMPLE_RATE / 1000 +
+                                  DETECT_SLACK;
+      if (bursts[b].detector == detection.detector && !found[b] &&
+          frame <= last && frame + PERIOD_FRAMES > first)
+        match = b;
+    }
+    if (match < 0) {
+      right = false;
+      continue;
+    }
+    found[match] = true;
+  }
+  if (exact)
+    for (bool burst_found : found) right &= burst_found;
+  return right;
+}
+
+// One detector after the other on this thread, as the sample used to and
+// as the runner does inline for the event loop
+static bool RunInline(int detectors, double busy_us,
+                      const std::vector<int16_t> &stream,
+                      const std::vector<Burst> &bursts) {
+  HotwordRunner runner;
+  for (int d = 0; d < detectors; d++)
+    runner.AddDetector(
+        new StubHotwordDetector(ToneHz(d), 1, TONE_MIN_MS, busy_us));
+  runner.StartInline(PERIOD_FRAMES);
+
+  std::vector<HotwordDetection> detections;
+  uint64_t wait_ns = 0, worst_ns = 0, periods = 0;
+  for (size_t frame = 0; frame + PERIOD_FRAMES <= stream.size();
+       frame += PERIOD_FRAMES, periods++) {
+    FrameTag tag;
+    MakeFrameTag(frame, PERIOD_FRAMES, SAMPLE_RATE, 0, 0, &tag);
+    uint64_t start_ns = PipelineClockNs();
+    int16_t *period = runner.NextPeriod();
+    std::copy(&stream[frame], &stream[frame + PERIOD_FRAMES], period);
+    runner.Commit(tag);
+    runner.TakeDetections(&detections);
+    uint64_t took_ns = PipelineClockNs() - start_ns;
+    wait_ns += took_ns;
+    worst_ns = std::max(worst_ns, took_ns);
+  }
+
+  bool right = Check(detections, bursts, true);
+  std::cout << "  one after the other: " << wait_ns / 1e3 / periods
+            << " us per period, worst " << worst_ns / 1e3 << " us, "
+            << detections.size() << " detections"
+            << (right ? "" : " (WRONG)") << std::endl;
+  return right;
+}
+
+// A thread per detector, with busy_us CPU each. With wait the loop waits
+// for them after every period (as the sample does), otherwise it only
+// paces the periods pace_ns apart
+static bool RunParallel(const std::vector<double> &busy_us, bool wait,
+                        uint64_t pace_ns, size_t ring_periods,
+                        const std::vector<int16_t> &stream,
+                        const std::vector<Burst> &bursts) {
+  int detectors = busy_us.size();
+  HotwordRunner runner;
+  for (int d = 0; d < detectors; d++)
+    runner.AddDetector(
+        new StubHotwordDetector(ToneHz(d), 1, TONE_MIN_MS, busy_us[d]));
+  runner.Start(PERIOD_FRAMES, ring_periods);
+
+  std::vector<HotwordDetection> detections;
+  uint64_t wait_ns = 0, worst_ns = 0, periods = 0;
+  uint64_t paced_ns = PipelineClockNs();
+  for (size_t frame = 0; frame + PERIOD_FRAMES <= stream.size();
+       frame += PERIOD_FRAMES, periods++) {
+    FrameTag tag;
+    MakeFrameTag(frame, PERIOD_FRAMES, SAMPLE_RATE, 0, 0, &tag);
+    uint64_t start_ns = PipelineClockNs();
+    int16_t *period = runner.NextPeriod();
+    std::copy(&stream[frame], &stream[frame + PERIOD_FRAMES], period);
+    runner.Commit(tag);
+    if (wait) runner.WaitIdle(1000000000ull);
+    runner.TakeDetections(&detections);
+    uint64_t took_ns = PipelineClockNs() - start_ns;
+    wait_ns += took_ns;
+    worst_ns = std::max(worst_ns, took_ns);
+
+    paced_ns += pace_ns;
+    if (pace_ns && paced_ns > PipelineClockNs())
+      std::this_thread::sleep_for(
+          std::chrono::nanoseconds(paced_ns - PipelineClockNs()));
+  }
+  runner.Stop();
+  runner.TakeDetections(&detections);
+
+  uint64_t skipped = 0;
+  for (int d = 0; d < detectors; d++) skipped += runner.Skipped(d);
+  bool lost = skipped > 0 || runner.Dropped() > 0;
+  bool right = Check(detections, bursts, !lost);
+  std::cout << "  " << detectors << " threads"
+            << (wait ? ", waiting" : ", not waiting") << ", ring of "
+            << ring_periods << ": " << wait_ns / 1e3 / periods
+            << " us per period, worst " << worst_ns / 1e3 << " us, "
+            << detections.size() << " detections, " << runner.Dropped()
+            << " periods dropped, " << skipped << " skipped"
+            << (right ? "" : " (WRONG)") << std::endl;
+  return right;
+}
+
+int main(int argc, char **argv) {
+  int detectors = argc > 1 ? std::max(1, atoi(argv[1])) : 4;
+  double busy_ms = argc > 2 ? atof(argv[2]) : 50.0;
+
+  std::vector<int16_t> stream;
+  std::vector<Burst> bursts;
+  MakeStream(detectors, &stream, &bursts);
+  std::cout << detectors << " stub detectors of " << busy_ms
+            << " ms CPU per second of audio, " << bursts.size()
+            << " bursts in " << SECONDS << " s, periods of " << PERIOD_FRAMES
+            << " frames, " << std::thread::hardware_concurrency() << " cores"
+            << std::endl;
+
+  std::vector<double> busy_us(detectors, busy_ms * 1000.0);
+  bool right = RunInline(detectors, busy_us[0], stream, bursts);
+  right &= RunParallel(busy_us, true, 0, HOTWORD_RING_PERIODS, stream,
+                       bursts);
+
+  // Four times real time, with a first detector that cannot keep up even
+  // at real time, so it has to skip
+  uint64_t period_ns = 1000000000ull * PERIOD_FRAMES / SAMPLE_RATE;
+  busy_us[0] = SLOW_BUSY_MS * 1000.0;
+  right &= RunParallel(busy_us, false, period_ns / 4, 8, stream, bursts);
+  return right ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** led_controller_benchmark.cc
+** Measures frames/sec and bytes/frame of the LedController using the memory
+** or file transport, so it runs on any Linux box without the 4mic_hat.
+**
+** Usage: led_controller_benchmark [memory | file <path>] [frames]
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// LED controller
+#include "contrib/led_controller/led_controller.h"
+
+static const int NUMBER_OF_LEDS = 12;
+
+// Runs one benchmark case and prints its throughput
+template <typename Step>
+void RunCase(const char *name, int frames, Step step,
+             MemoryLedTransport *memory_transport) {
+  uint64_t frames_before = 0, bytes_before = 0;
+  if (memory_transport) {
+    frames_before = memory_transport->FrameCount();
+    bytes_before = memory_transport->ByteCount();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) step(i);
+  auto end = std::chrono::steady_clock::now();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << name << ": " << frames / seconds << " frames/sec, "
+            << seconds * 1e9 / frames << " ns/frame";
+  if (memory_transport) {
+    uint64_t written = memory_transport->FrameCount() - frames_before;
+    uint64_t bytes = memory_transport->ByteCount() - bytes_before;
+    std::cout << ", " << (written ? bytes / written : 0) << " bytes/frame";
+  }
+  std::cout << std::endl;
+}
+
+int main(int argc, char **argv) {
+  MemoryLedTransport memory_transport;
+  FileLedTransport *file_transport = nullptr;
+  int frames = 1000000;
+
+  // Pick the transport
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "file") == 0) {
+    if (arg + 1 >= argc) {
+      std::cerr << "Usage: " << argv[0]
+                << " [memory | file <path>] [frames]" << std::endl;
+      return 1;
+    }
+    file_transport = new FileLedTransport(argv[arg + 1]);
+    arg += 2;
+  } else if (arg < argc && strcmp(argv[arg], "memory") == 0) {
+    arg++;
+  }
+  if (arg < argc) frames = atoi(argv[arg]);
+  if (frames <= 0) frames = 1;
+
+  LedController *led_control = &LedController::GetInstance();
+  if (file_transport)
+    led_control->SetTransport(file_transport);
+  else
+    led_control->SetTransport(&memory_transport);
+  if (!led_control->PowerUp(NUMBER_OF_LEDS)) return 1;
+
+  MemoryLedTransport *counted = file_transport ? nullptr : &memory_transport;
+  std::cout << "LEDs: " << NUMBER_OF_LEDS
+            << ", frame size: " << led_control->FrameSize() << " bytes"
+            << std::endl;
+
+  // Pure transfer cost of an unchanged frame
+  RunCase("Show", frames, [&](int) { led_control->Show(); }, counted);
+
+  // Frame encoding: every pixel set once per frame
+  RunCase("SetPixelColor x12 + Show", frames,
+          [&](int i) {
+            for (int p = 0; p < NUMBER_OF_LEDS; p++)
+              led_control->SetPixelColor(p, i & 0xff, p * 16, 0, i & 31);
+            led_control->Show();
+          },
+          counted);
+
+  // The direction animation the sample uses, sweeping the whole circle
+  RunCase("ShowDirection", frames,
+          [&](int i) { led_control->ShowDirection((i % 3600) / 10.0); },
+          counted);
+
+  led_control->PowerDown();
+  led_control->SetTransport(nullptr);
+  delete file_transport;
+
+  return 0;
+}
@@ -0,0 +1,247 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** perf_counters.cc
+** Hardware performance counters per pipeline stage using perf_event_open
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#include "pipeline_stats.h"
+
+#ifdef DOA_ENABLE_PERF_COUNTERS
+static const char *COUNTER_NAMES[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "cache-misses", "branch-misses"};
+#endif
+static const uint64_t COUNTER_CONFIGS[PERF_COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+std::atomic<bool> perf_counters_enabled(false);
+
+// Which counters the kernel gave us on the first try, so the report can
+// tell "not available" from "zero"
+static std::atomic<bool> counter_available[PERF_COUNTER_COUNT];
+static std::atomic<uint64_t> frames(0);
+
+// The counter group of one thread. The first counter that opens is the
+// group leader, so one read() returns all of them
+class ThreadPerfGroup {
+ public:
+  ThreadPerfGroup() : leader_(-1), opened_(0) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+      fds_[i] = -1;
+      slots_[i] = -1;
+    }
+  }
+
+  ~ThreadPerfGroup() {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+      if (fds_[i] >= 0) close(fds_[i]);
+  }
+
+  // Opens what we can, returns the errno of the first failure or 0
+  int Open() {
+    int first_error = 0;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = COUNTER_CONFIGS[i];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      // This thread only, on any CPU
+      fds_[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0);
+      if (fds_[i] < 0) {
+        if (!first_error) first_error = errno;
+        continue;
+      }
+
+      if (leader_ < 0) leader_ = fds_[i];
+      slots_[i] = opened_++;
+    }
+
+    return opened_ ? 0 : first_error;
+  }
+
+  bool Has(int counter) const { return slots_[counter] >= 0; }
+
+  void Read(PerfSample *sample) {
+    uint64_t buffer[1 + PERF_COUNTER_COUNT];
+    memset(sample, 0, sizeof(*sample));
+    if (leader_ < 0) return;
+    if (read(leader_, buffer, sizeof(buffer)) < (ssize_t)sizeof(uint64_t))
+      return;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+      if (slots_[i] >= 0 && (uint64_t)slots_[i] < buffer[0])
+        sample->values[i] = buffer[1 + slots_[i]];
+  }
+
+ private:
+  int fds_[PERF_COUNTER_COUNT];
+  int slots_[PERF_COUNTER_COUNT];
+  int leader_;
+  int opened_;
+};
+
+// What the stages of one thread used. Only the owning thread writes
+struct ThreadPerfTotals {
+  std::atomic<uint64_t> calls[STAGE_COUNT];
+  std::atomic<uint64_t> counts[STAGE_COUNT][PERF_COUNTER_COUNT];
+  ThreadPerfTotals *next;
+};
+
+static std::atomic<ThreadPerfTotals *> all_totals(nullptr);
+
+static ThreadPerfGroup &ThreadGroup() {
+  static thread_local ThreadPerfGroup group;
+  static thread_local bool opened = false;
+  if (!opened) {
+    group.Open();
+    opened = true;
+  }
+  return group;
+}
+
+static ThreadPerfTotals *RegisterThread() {
+  ThreadPerfTotals *totals = new ThreadPerfTotals();
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    totals->calls[stage].store(0, std::memory_order_relaxed);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+      totals->counts[stage][i].store(0, std::memory_order_relaxed);
+  }
+
+  ThreadPerfTotals *head = all_totals.load(std::memory_order_relaxed);
+  do {
+    totals->next = head;
+  } while (!all_totals.compare_exchange_weak(head, totals,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+  return totals;
+}
+
+static inline void Increment(std::atomic<uint64_t> &counter, uint64_t by) {
+  counter.store(counter.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+}
+
+bool EnablePerfCounters() {
+#ifndef DOA_ENABLE_PERF_COUNTERS
+  std::cout << "Perf counters are compiled out "
+               "(build with -DDOA_ENABLE_PERF_COUNTERS)"
+            << std::endl;
+  return false;
+#else
+  // Probe on this thread
+  ThreadPerfGroup probe;
+  int error = probe.Open();
+  bool any = false;
+  for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+    counter_available[i].store(probe.Has(i), std::memory_order_relaxed);
+    if (probe.Has(i))
+      any = true;
+    else
+      std::cout << "Perf counter " << COUNTER_NAMES[i] << " not available"
+                << std::endl;
+  }
+
+  if (!any) {
+    std::cout << "No perf counters available (" << strerror(error)
+              << "), check /proc/sys/kernel/perf_event_paranoid or the "
+                 "container's seccomp profile"
+              << std::endl;
+    return false;
+  }
+
+  perf_counters_enabled.store(true, std::memory_order_relaxed);
+  return true;
+#endif
+}
+
+void ReadPerfCounters(PerfSample *sample) { ThreadGroup().Read(sample); }
+
+void RecordPerfStage(int stage, const PerfSample &begin,
+                     const PerfSample &end) {
+  static thread_local ThreadPerfTotals *totals = RegisterThread();
+
+  Increment(totals->calls[stage], 1);
+  for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+    Increment(totals->counts[stage][i], end.values[i] - begin.values[i]);
+}
+
+void RecordPerfFrame() { frames.fetch_add(1, std::memory_order_relaxed); }
+
+void DumpPerfCounters(std::ostream &out) {
+  if (!PerfCountersEnabled()) {
+    out << "Perf counters are not enabled or not available" << std::endl;
+    return;
+  }
+
+  uint64_t frame_count = frames.load(std::memory_order_relaxed);
+  out << "Perf counters over " << frame_count << " DoA frames" << std::endl;
+  out << std::left << std::setw(14) << "stage" << std::right << std::setw(10)
+      << "calls" << std::setw(15) << "cycles/frame" << std::setw(15)
+      << "instr/frame" << std::setw(7) << "IPC" << std::setw(16)
+      << "cache_miss/fr" << std::setw(16) << "branch_miss/fr" << std::endl;
+
+  out << std::fixed;
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    uint64_t calls = 0;
+    uint64_t counts[PERF_COUNTER_COUNT] = {};
+    for (ThreadPerfTotals *totals = all_totals.load(std::memory_order_acquire);
+         totals; totals = totals->next) {
+      calls += totals->calls[stage].load(std::memory_order_relaxed);
+      for (int i = 0; i < PERF_COUNTER_COUNT; i++)
+        counts[i] += totals->counts[stage][i].load(std::memory_order_relaxed);
+    }
+    if (calls == 0) continue;
+
+    // Stages outside of the DoA (capture, hotword, LED) run once per
+    // captured frame, so normalize those by their own calls
+    double per = (stage >= STAGE_FFT && stage <= STAGE_PEAK_SEARCH &&
+                  frame_count > 0)
+                     ? (double)frame_count
+                     : (double)calls;
+
+    out << std::left << std::setw(14) << PipelineStageName((PipelineStage)stage)
+        << std::right << std::setw(10) << calls << std::setprecision(0);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+      if (i == PERF_CACHE_MISSES) {
+        // IPC goes in between the totals and the misses
+        out << std::setw(7) << std::setprecision(2);
+        if (counter_available[PERF_CYCLES] &&
+            counter_available[PERF_INSTRUCTIONS] && counts[PERF_CYCLES])
+          out << (double)counts[PERF_INSTRUCTIONS] / counts[PERF_CYCLES];
+        else
+          out << "n/a";
+        out << std::setprecision(0);
+      }
+
+      int width = i < PERF_CACHE_MISSES ? 15 : 16;
+      if (counter_available[i])
+        out << std::setw(width) << counts[i] / per;
+      else
+        out << std::setw(width) << "n/a";
+    }
+    out << std::endl;
+  }
+  out << std::defaultfloat;
+}
@@ -0,0 +1,73 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** perf_counters.h
+** Hardware performance counters (cycles, instructions, cache misses and
+** branch misses) per pipeline stage using perf_event_open, so we can tell
+** whether GccPhat is bound by compute or by memory.
+**
+** The stage timers only read the counters if DOA_ENABLE_PERF_COUNTERS is
+** defined and EnablePerfCounters succeeded. If the kernel does not give us
+** the counters (containers, perf_event_paranoid, no PMU) everything keeps
+** working and the report says so.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+
+// The counters we open, in this order
+enum PerfCounter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_COUNTER_COUNT
+};
+
+// One reading of the counters of the calling thread
+struct PerfSample {
+  uint64_t values[PERF_COUNTER_COUNT];
+};
+
+// Tries to open the counters on the calling thread and switches the
+// profiling on if at least one of them works. Other threads open theirs on
+// first use
+bool EnablePerfCounters();
+
+// Whether the stage timers read the counters
+extern std::atomic<bool> perf_counters_enabled;
+inline bool PerfCountersEnabled() {
+  return perf_counters_enabled.load(std::memory_order_relaxed);
+}
+
+// Reads the counters of the calling thread, missing ones read as 0
+void ReadPerfCounters(PerfSample *sample);
+
+// Charges the counts between the two samples to a PipelineStage
+void RecordPerfStage(int stage, const PerfSample &begin,
+                     const PerfSample &end);
+
+// Counts one processed DoA frame, the report is normalized to these
+void RecordPerfFrame();
+
+// Writes IPC and misses per frame for every stage
+void DumpPerfCounters(std::ostream &out);
+
+#ifdef DOA_ENABLE_PERF_COUNTERS
+inline void CountPerfFrame() {
+  if (PerfCountersEnabled()) RecordPerfFrame();
+}
+#else
+inline void CountPerfFrame() {}
+#endif
+
+#endif  // PERF_COUNTERS_H
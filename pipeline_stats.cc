@@ -0,0 +1,230 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** pipeline_stats.cc
+** Per-stage latency histograms for the capture -> hotword -> DoA -> LED
+** pipeline
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "pipeline_stats.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Log-linear buckets: values below 8ns get their own bucket, above that every
+// power of two is split into 8 linear sub-buckets (at most 12.5% error).
+// Everything from 2^40ns (~18 minutes) up goes into the last bucket
+static const int SUB_BUCKET_BITS = 3;
+static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+static const int MAX_EXPONENT = 40;
+static const int NUM_BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) *
+                               SUB_BUCKETS;
+
+static int BucketIndex(uint64_t value) {
+  if (value < (uint64_t)SUB_BUCKETS) return (int)value;
+
+  int exponent = 63 - __builtin_clzll(value);
+  if (exponent >= MAX_EXPONENT) return NUM_BUCKETS - 1;
+
+  int sub_bucket = (int)(value >> (exponent - SUB_BUCKET_BITS)) &
+                   (SUB_BUCKETS - 1);
+  return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+// Upper bound of the values that end up in the bucket
+static uint64_t BucketUpperBound(int index) {
+  if (index < SUB_BUCKETS) return index;
+
+  int exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+  uint64_t sub_bucket = index % SUB_BUCKETS;
+  uint64_t width = 1ull << (exponent - SUB_BUCKET_BITS);
+  return (1ull << exponent) + (sub_bucket + 1) * width - 1;
+}
+
+// The histograms of one thread. Only the owning thread writes, so a relaxed
+// load and store is enough and we never need a locked read-modify-write
+struct ThreadStageHistograms {
+  std::atomic<uint64_t> buckets[STAGE_COUNT][NUM_BUCKETS];
+  std::atomic<uint64_t> count[STAGE_COUNT];
+  std::atomic<uint64_t> sum_ns[STAGE_COUNT];
+  std::atomic<uint64_t> max_ns[STAGE_COUNT];
+  ThreadStageHistograms *next;
+};
+
+// All threads that ever recorded something. The blocks are never freed, so
+// the numbers of finished threads stay in the dumps
+static std::atomic<ThreadStageHistograms *> all_histograms(nullptr);
+
+static ThreadStageHistograms *RegisterThread() {
+  ThreadStageHistograms *histograms = new ThreadStageHistograms();
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    for (int i = 0; i < NUM_BUCKETS; i++)
+      histograms->buckets[stage][i].store(0, std::memory_order_relaxed);
+    histograms->count[stage].store(0, std::memory_order_relaxed);
+    histograms->sum_ns[stage].store(0, std::memory_order_relaxed);
+    histograms->max_ns[stage].store(0, std::memory_order_relaxed);
+  }
+
+  // Push it to the front of the list
+  ThreadStageHistograms *head = all_histograms.load(std::memory_order_relaxed);
+  do {
+    histograms->next = head;
+  } while (!all_histograms.compare_exchange_weak(head, histograms,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed));
+  return histograms;
+}
+
+static inline void Increment(std::atomic<uint64_t> &counter, uint64_t by) {
+  counter.store(counter.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+}
+
+const char *PipelineStageName(PipelineStage stage) {
+  switch (stage) {
+    case STAGE_CAPTURE_WAIT:
+      return "capture_wait";
+    case STAGE_DEINTERLEAVE:
+      return "deinterleave";
+    case STAGE_HOTWORD:
+      return "hotword";
+    case STAGE_FFT:
+      return "fft";
+    case STAGE_PHAT:
+      return "phat";
+    case STAGE_INVERSE_FFT:
+      return "inverse_fft";
+    case STAGE_PEAK_SEARCH:
+      return "peak_search";
+    case STAGE_BEAMFORM:
+      return "beamform";
+    case STAGE_LED_TRANSMIT:
+      return "led_transmit";
+    default:
+      return "unknown";
+  }
+}
+
+void RecordPipelineStage(PipelineStage stage, uint64_t duration_ns) {
+  static thread_local ThreadStageHistograms *histograms = RegisterThread();
+
+  Increment(histograms->buckets[stage][BucketIndex(duration_ns)], 1);
+  Increment(histograms->count[stage], 1);
+  Increment(histograms->sum_ns[stage], duration_ns);
+  if (duration_ns > histograms->max_ns[stage].load(std::memory_order_relaxed))
+    histograms->max_ns[stage].store(duration_ns, std::memory_order_relaxed);
+}
+
+PipelineStageSummary GetPipelineStageSummary(PipelineStage stage) {
+  PipelineStageSummary summary = {};
+  uint64_t buckets[NUM_BUCKETS] = {};
+  uint64_t sum_ns = 0;
+
+  // Merge all threads
+  for (ThreadStageHistograms *histograms =
+           all_histograms.load(std::memory_order_acquire);
+       histograms; histograms = histograms->next) {
+    for (int i = 0; i < NUM_BUCKETS; i++)
+      buckets[i] +=
+          histograms->buckets[stage][i].load(std::memory_order_relaxed);
+    sum_ns += histograms->sum_ns[stage].load(std::memory_order_relaxed);
+    uint64_t max_ns =
+        histograms->max_ns[stage].load(std::memory_order_relaxed);
+    if (max_ns > summary.max_ns) summary.max_ns = max_ns;
+  }
+
+  // Use the bucket counts rather than the counters, they are read at
+  // slightly different times while the pipeline is running
+  for (int i = 0; i < NUM_BUCKETS; i++) summary.count += buckets[i];
+  if (summary.count == 0) return summary;
+  summary.mean_ns = sum_ns / summary.count;
+
+  // Walk the buckets once for all percentiles
+  const double percentiles[4] = {0.5, 0.9, 0.99, 0.999};
+  uint64_t *results[4] = {&summary.p50_ns, &summary.p90_ns, &summary.p99_ns,
+                          &summary.p999_ns};
+  uint64_t seen = 0;
+  int next = 0;
+  for (int i = 0; i < NUM_BUCKETS && next < 4; i++) {
+    seen += buckets[i];
+    while (next < 4 && seen >= percentiles[next] * summary.count) {
+      uint64_t bound = BucketUpperBound(i);
+      *results[next++] = bound < summary.max_ns ? bound : summary.max_ns;
+    }
+  }
+
+  return summary;
+}
+
+void DumpPipelineStats(std::ostream &out) {
+#ifndef DOA_ENABLE_PIPELINE_STATS
+  out << "Pipeline stats are compiled out "
+         "(build with -DDOA_ENABLE_PIPELINE_STATS)"
+      << std::endl;
+#endif
+
+  out << std::left << std::setw(14) << "stage" << std::right << std::setw(10)
+      << "count" << std::setw(11) << "mean_us" << std::setw(11) << "p50_us"
+      << std::setw(11) << "p90_us" << std::setw(11) << "p99_us"
+      << std::setw(11) << "p99.9_us" << std::setw(11) << "max_us"
+      << std::endl;
+
+  out << std::fixed << std::setprecision(1);
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    PipelineStageSummary summary =
+        GetPipelineStageSummary((PipelineStage)stage);
+    out << std::left << std::setw(14) << PipelineStageName((PipelineStage)stage)
+        << std::right << std::setw(10) << summary.count << std::setw(11)
+        << summary.mean_ns / 1000.0 << std::setw(11) << summary.p50_ns / 1000.0
+        << std::setw(11) << summary.p90_ns / 1000.0 << std::setw(11)
+        << summary.p99_ns / 1000.0 << std::setw(11) << summary.p999_ns / 1000.0
+        << std::setw(11) << summary.max_ns / 1000.0 << std::endl;
+  }
+  out << std::defaultfloat;
+}
+
+// Waits for SIGUSR1 and dumps, the signal is blocked everywhere else
+static void *DumpOnSignalThread(void *arg) {
+  sigset_t *signals = (sigset_t *)arg;
+  int sig;
+  while (sigwait(signals, &sig) == 0) {
+    std::ostringstream dump;
+    DumpPipelineStats(dump);
+    if (PerfCountersEnabled()) DumpPerfCounters(dump);
+    std::string text = dump.str();
+    ssize_t ret = write(STDERR_FILENO, text.data(), text.size());
+    (void)ret;
+  }
+
+  return nullptr;
+}
+
+bool DumpPipelineStatsOnSignal() {
+  static sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  if (pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0) {
+    std::cerr << "Failed to block SIGUSR1 for the stats dump" << std::endl;
+    return false;
+  }
+
+  pthread_t thread;
+  if (pthread_create(&thread, nullptr, DumpOnSignalThread, &signals) != 0) {
+    std::cerr << "Failed to start the stats dump thread" << std::endl;
+    return false;
+  }
+  pthread_detach(thread);
+
+  return true;
+}
@@ -0,0 +1,178 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** pipeline_stats.h
+** Per-stage latency histograms for the capture -> hotword -> DoA -> LED
+** pipeline. Every thread records into its own fixed-bucket log-linear
+** histograms with relaxed atomics, a dump merges them.
+**
+** The timers only do something if DOA_ENABLE_PIPELINE_STATS,
+** DOA_ENABLE_TRACING or DOA_ENABLE_PERF_COUNTERS is defined, otherwise they
+** are empty inline classes and cost nothing. With tracing, every stage also
+** becomes a trace event, with perf counters it also gets the hardware counts.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <ostream>
+
+#include "perf_counters.h"
+#include "trace_events.h"
+
+// The stages we measure
+enum PipelineStage {
+  STAGE_CAPTURE_WAIT,
+  STAGE_DEINTERLEAVE,
+  STAGE_HOTWORD,
+  STAGE_FFT,
+  STAGE_PHAT,
+  STAGE_INVERSE_FFT,
+  STAGE_PEAK_SEARCH,
+  STAGE_BEAMFORM,
+  STAGE_LED_TRANSMIT,
+  STAGE_COUNT
+};
+
+// Short name of a stage, used in the dumps
+const char *PipelineStageName(PipelineStage stage);
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+inline uint64_t PipelineClockNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Aggregated numbers of one stage over all threads, times in nanoseconds
+struct PipelineStageSummary {
+  uint64_t count;
+  uint64_t mean_ns;
+  uint64_t p50_ns;
+  uint64_t p90_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+  uint64_t max_ns;
+};
+
+// Records one duration for the calling thread
+void RecordPipelineStage(PipelineStage stage, uint64_t duration_ns);
+
+// Merges the histograms of all threads for one stage
+PipelineStageSummary GetPipelineStageSummary(PipelineStage stage);
+
+// Writes a table with the percentiles of all stages
+void DumpPipelineStats(std::ostream &out);
+
+// Starts a thread that dumps the stats (and the perf counters, if enabled)
+// to stderr whenever the process gets SIGUSR1. Call it before any other
+// thread is started, so they all inherit the blocked signal and it never
+// interrupts a blocking read
+bool DumpPipelineStatsOnSignal();
+
+#if defined(DOA_ENABLE_PIPELINE_STATS) || defined(DOA_ENABLE_TRACING) || \
+    defined(DOA_ENABLE_PERF_COUNTERS)
+
+// Hands one finished stage to the histograms and the trace
+inline void StageDone(PipelineStage stage, uint64_t start_ns,
+                      uint64_t end_ns) {
+#ifdef DOA_ENABLE_PIPELINE_STATS
+  RecordPipelineStage(stage, end_ns - start_ns);
+#endif
+#ifdef DOA_ENABLE_TRACING
+  if (TracingEnabled())
+    RecordTraceSpan(PipelineStageName(stage), start_ns, end_ns);
+#endif
+}
+
+#ifdef DOA_ENABLE_PERF_COUNTERS
+// Reads the hardware counters at a stage boundary
+class StagePerfCounters {
+ public:
+  StagePerfCounters() {
+    if (PerfCountersEnabled()) ReadPerfCounters(&last_);
+  }
+  void Lap(PipelineStage stage) {
+    if (!PerfCountersEnabled()) return;
+    PerfSample now;
+    ReadPerfCounters(&now);
+    RecordPerfStage(stage, last_, now);
+    last_ = now;
+  }
+  void Restart() {
+    if (PerfCountersEnabled()) ReadPerfCounters(&last_);
+  }
+
+ private:
+  PerfSample last_;
+};
+#else
+class StagePerfCounters {
+ public:
+  void Lap(PipelineStage) {}
+  void Restart() {}
+};
+#endif
+
+// Measures from construction to destruction
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(PipelineStage stage)
+      : stage_(stage), start_ns_(PipelineClockNs()) {}
+  ~ScopedStageTimer() {
+    perf_.Lap(stage_);
+    StageDone(stage_, start_ns_, PipelineClockNs());
+  }
+
+ private:
+  PipelineStage stage_;
+  StagePerfCounters perf_;
+  uint64_t start_ns_;
+};
+
+// Measures back-to-back stages with one clock read per boundary, each Lap
+// charges the time since the previous one to the given stage
+class StageLapTimer {
+ public:
+  StageLapTimer() : last_ns_(PipelineClockNs()) {}
+  void Lap(PipelineStage stage) {
+    perf_.Lap(stage);
+    uint64_t now_ns = PipelineClockNs();
+    StageDone(stage, last_ns_, now_ns);
+    last_ns_ = now_ns;
+  }
+
+  // Starts the next lap now, after work that timed its own stages
+  void Restart() {
+    perf_.Restart();
+    last_ns_ = PipelineClockNs();
+  }
+
+ private:
+  StagePerfCounters perf_;
+  uint64_t last_ns_;
+};
+
+#else
+
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(PipelineStage) {}
+};
+
+class StageLapTimer {
+ public:
+  void Lap(PipelineStage) {}
+  void Restart() {}
+};
+
+#endif  // DOA_ENABLE_PIPELINE_STATS || ..._TRACING || ..._PERF_COUNTERS
+
+#endif  // PIPELINE_STATS_H
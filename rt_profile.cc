@@ -0,0 +1,209 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** rt_profile.cc
+** Real-time settings of the pipeline threads
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "rt_profile.h"
+
+#include <alloca.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+static const char *PolicyName(int policy) {
+  switch (policy) {
+    case SCHED_OTHER:
+      return "other";
+    case SCHED_FIFO:
+      return "fifo";
+    case SCHED_RR:
+      return "rr";
+    default:
+      return "unknown";
+  }
+}
+
+// "all" or the cores as a list
+static std::string CpuList(uint64_t cpus) {
+  if (cpus == 0) return "all";
+  std::ostringstream list;
+  for (int cpu = 0; cpu < 64; cpu++) {
+    if (!(cpus & (1ull << cpu))) continue;
+    if (list.tellp() > 0) list << ",";
+    list << cpu;
+  }
+  return list.str();
+}
+
+// A resource limit for the messages, "unlimited" or the number
+static std::string Limit(int resource) {
+  struct rlimit limit;
+  if (getrlimit(resource, &limit) != 0) return "unknown";
+  if (limit.rlim_cur == RLIM_INFINITY) return "unlimited";
+  return std::to_string((unsigned long long)limit.rlim_cur);
+}
+
+// Touches every page of size bytes of stack below the caller
+static void __attribute__((noinline)) PrefaultStack(size_t size) {
+  volatile char *stack = (volatile char *)alloca(size);
+  for (size_t i = 0; i < size; i += 4096) stack[i] = 0;
+}
+
+RtProfile DefaultRtProfile() {
+  RtProfile profile;
+  profile.policy = SCHED_OTHER;
+  profile.priority = 0;
+  profile.cpus = 0;
+  profile.prefault_stack_bytes = RT_PREFAULT_STACK_BYTES;
+  return profile;
+}
+
+bool ParseRtProfile(const char *spec, RtProfile *profile) {
+  *profile = DefaultRtProfile();
+
+  // The policy up to ':' or '@'
+  const char *end = spec + strcspn(spec, ":@");
+  std::string policy(spec, end);
+  if (policy == "other") {
+    profile->policy = SCHED_OTHER;
+  } else if (policy == "fifo") {
+    profile->policy = SCHED_FIFO;
+  } else if (policy == "rr") {
+    profile->policy = SCHED_RR;
+  } else {
+    return false;
+  }
+
+  // The priority, the real-time policies need one
+  char *next = (char *)end;
+  if (*next == ':') {
+    const char *digits = next + 1;
+    profile->priority = strtol(digits, &next, 10);
+    if (next == digits) return false;
+  } else if (profile->policy != SCHED_OTHER) {
+    profile->priority = 1;
+  }
+  int lowest = sched_get_priority_min(profile->policy);
+  int highest = sched_get_priority_max(profile->policy);
+  if (profile->priority < lowest || profile->priority > highest) return false;
+
+  // The cores
+  if (*next == '@') {
+    do {
+      const char *digits = next + 1;
+      long cpu = strtol(digits, &next, 10);
+      if (next == digits || cpu < 0 || cpu >= 64) return false;
+      profile->cpus |= 1ull << cpu;
+    } while (*next == ',');
+  }
+  return *next == '\0';
+}
+
+RtProfile NthCpuRtProfile(const RtProfile &profile, int n) {
+  RtProfile nth = profile;
+  int count = __builtin_popcountll(profile.cpus);
+  if (count == 0) return nth;
+
+  n %= count;
+  for (int cpu = 0; cpu < 64; cpu++) {
+    if (!(profile.cpus & (1ull << cpu))) continue;
+    if (n-- == 0) {
+      nth.cpus = 1ull << cpu;
+      break;
+    }
+  }
+  return nth;
+}
+
+void ApplyRtProfile(const char *thread_name, const RtProfile &profile) {
+  pthread_t self = pthread_self();
+  std::ostringstream failures;
+
+  // Pin first, so a real-time thread never spins on the wrong core
+  if (profile.cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < 64; cpu++)
+      if (profile.cpus & (1ull << cpu)) CPU_SET(cpu, &set);
+    int error = pthread_setaffinity_np(self, sizeof(set), &set);
+    if (error)
+      failures << ", affinity " << CpuList(profile.cpus) << ": "
+               << strerror(error);
+  }
+
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = profile.priority;
+  int error = pthread_setschedparam(self, profile.policy, &param);
+  if (error) {
+    failures << ", " << PolicyName(profile.policy) << " "
+             << profile.priority << ": " << strerror(error);
+    if (error == EPERM)
+      failures << " (needs CAP_SYS_NICE, RLIMIT_RTPRIO is "
+               << Limit(RLIMIT_RTPRIO) << ")";
+  }
+
+  if (profile.prefault_stack_bytes)
+    PrefaultStack(profile.prefault_stack_bytes);
+
+  // What we really got
+  int policy;
+  pthread_getschedparam(self, &policy, &param);
+  cpu_set_t set;
+  uint64_t cpus = 0;
+  if (pthread_getaffinity_np(self, sizeof(set), &set) == 0) {
+    int count = CPU_COUNT(&set);
+    for (int cpu = 0; cpu < 64; cpu++)
+      if (CPU_ISSET(cpu, &set)) cpus |= 1ull << cpu;
+    if (count == (int)sysconf(_SC_NPROCESSORS_ONLN)) cpus = 0;
+  }
+
+  std::cout << "RT profile " << thread_name << ": " << PolicyName(policy)
+            << " " << param.sched_priority << " on CPUs " << CpuList(cpus)
+            << ", " << profile.prefault_stack_bytes / 1024
+            << " KB stack prefaulted";
+  std::string failed = failures.str();
+  if (!failed.empty()) std::cout << "; failed" << failed;
+  std::cout << std::endl;
+}
+
+bool LockAllMemory() {
+  // With a memlock limit every mapping past it would fail (even the stack
+  // of a new thread), so then only what is mapped now gets locked
+  struct rlimit limit;
+  bool future = geteuid() == 0 ||
+                (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+                 limit.rlim_cur == RLIM_INFINITY);
+  if (mlockall(future ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT) != 0) {
+    int error = errno;
+    std::cout << "RT profile: memory not locked, mlockall: "
+              << strerror(error);
+    if (error == ENOMEM || error == EPERM)
+      std::cout << " (needs CAP_IPC_LOCK, RLIMIT_MEMLOCK is "
+                << Limit(RLIMIT_MEMLOCK) << " bytes)";
+    std::cout << std::endl;
+    return false;
+  }
+  std::cout << "RT profile: memory locked";
+  if (!future)
+    std::cout << ", but not what is mapped later (needs CAP_IPC_LOCK, "
+                 "RLIMIT_MEMLOCK is "
+              << Limit(RLIMIT_MEMLOCK) << " bytes)";
+  std::cout << std::endl;
+  return true;
+}
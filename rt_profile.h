@@ -0,0 +1,56 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** rt_profile.h
+** Real-time settings of the pipeline threads: scheduling policy and
+** priority, the cores a thread may run on and how much of its stack is
+** touched up front, plus locking all memory of the process. Without root
+** (CAP_SYS_NICE, CAP_IPC_LOCK or the rtprio and memlock limits) some of
+** it fails; every call prints what actually took effect, and why not.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef RT_PROFILE_H
+#define RT_PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Stack a thread touches when its profile is applied, so the pages are
+// there (and locked, after LockAllMemory) before the first period
+static const size_t RT_PREFAULT_STACK_BYTES = 256 * 1024;
+
+struct RtProfile {
+  // SCHED_OTHER, SCHED_FIFO or SCHED_RR, and 1 to 99 for the latter two
+  int policy;
+  int priority;
+
+  // One bit per core the thread may run on, 0 for all of them
+  uint64_t cpus;
+
+  size_t prefault_stack_bytes;
+};
+
+// SCHED_OTHER on all cores, with the stack prefaulted
+RtProfile DefaultRtProfile();
+
+// POLICY[:PRIORITY][@CPU[,CPU...]], e.g. "fifo:80@2" or "rr:50@2,3". The
+// policy is other, fifo or rr. False if the spec is malformed
+bool ParseRtProfile(const char *spec, RtProfile *profile);
+
+// The profile with only the n-th of its cores, counting round, e.g. for
+// the n-th of several threads of one kind. Unchanged without cores
+RtProfile NthCpuRtProfile(const RtProfile &profile, int n);
+
+// Applies the profile to the calling thread and prints what took effect
+void ApplyRtProfile(const char *thread_name, const RtProfile &profile);
+
+// mlockall of everything mapped now and later, prints whether it worked.
+// Without root and with a memlock limit only what is mapped now
+bool LockAllMemory();
+
+#endif  // RT_PROFILE_H
@@ -0,0 +1,45 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** snowboy_hotword_detector.cc
+** A snowboy model as HotwordDetector
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "snowboy_hotword_detector.h"
+
+#include "contrib/snowboy/include/snowboy-detect.h"
+
+SnowboyHotwordDetector::SnowboyHotwordDetector(const std::string &resource,
+                                               const std::string &model,
+                                               const std::string &sensitivity,
+                                               float audio_gain,
+                                               bool apply_frontend)
+    : model_(model), detector_(new snowboy::SnowboyDetect(resource, model)) {
+  if (!sensitivity.empty()) detector_->SetSensitivity(sensitivity);
+  detector_->SetAudioGain(audio_gain);
+  detector_->ApplyFrontend(apply_frontend);
+}
+
+SnowboyHotwordDetector::~SnowboyHotwordDetector() {}
+
+int SnowboyHotwordDetector::Detect(const int16_t *samples, int count) {
+  return detector_->RunDetection(samples, count);
+}
+
+void SnowboyHotwordDetector::Reset() { detector_->Reset(); }
+
+SnowboyHotwordDetector *ParseSnowboyHotwordDetector(const char *spec) {
+  std::string model = spec, sensitivity;
+  size_t colon = model.find(':');
+  if (colon != std::string::npos) {
+    sensitivity = model.substr(colon + 1);
+    model.erase(colon);
+  }
+  if (model.empty()) return nullptr;
+  return new SnowboyHotwordDetector(SNOWBOY_RESOURCE, model, sensitivity);
+}
@@ -0,0 +1,53 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** snowboy_hotword_detector.h
+** A snowboy model as HotwordDetector. Links against the bundled
+** libsnowboy-detect, which is built for ARM only
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef SNOWBOY_HOTWORD_DETECTOR_H
+#define SNOWBOY_HOTWORD_DETECTOR_H
+
+#include <memory>
+#include <string>
+
+#include "hotword_detector.h"
+
+namespace snowboy {
+class SnowboyDetect;
+}
+
+// The resource snowboy needs for every model
+static const char *const SNOWBOY_RESOURCE =
+    "contrib/snowboy/resources/common.res";
+
+class SnowboyHotwordDetector : public HotwordDetector {
+ public:
+  // model as snowboy takes it (several separated by commas), sensitivity
+  // one value per hotword in them, e.g. "0.8,0.80" for jarvis.umdl
+  SnowboyHotwordDetector(const std::string &resource,
+                         const std::string &model,
+                         const std::string &sensitivity,
+                         float audio_gain = 1.0f, bool apply_frontend = true);
+  ~SnowboyHotwordDetector();
+
+  std::string Name() const override { return model_; }
+  int Detect(const int16_t *samples, int count) override;
+  void Reset() override;
+
+ private:
+  std::string model_;
+  std::unique_ptr<snowboy::SnowboyDetect> detector_;
+};
+
+// MODEL[:SENSITIVITY] into a detector, one sensitivity per hotword of the
+// model (the defaults of the model if left out)
+SnowboyHotwordDetector *ParseSnowboyHotwordDetector(const char *spec);
+
+#endif  // SNOWBOY_HOTWORD_DETECTOR_H
@@ -0,0 +1,245 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** trace_events.cc
+** Per-thread trace rings and their Chrome trace-event JSON export
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#include "trace_events.h"
+
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "pipeline_stats.h"
+
+// Events per thread between two flushes. The flush thread runs every 50ms,
+// so this is plenty for a few hundred events per frame
+static const int RING_CAPACITY = 1 << 14;
+static const int FLUSH_INTERVAL_MS = 50;
+
+struct TraceEvent {
+  const char *name;
+  uint64_t begin_ns;
+  uint64_t end_ns;  // Equal to begin_ns for instant events
+  uint64_t frame_index;
+};
+
+// Single producer (the owning thread), single consumer (the flush thread)
+struct TraceRing {
+  TraceEvent events[RING_CAPACITY];
+  std::atomic<uint64_t> head;  // Written by the owner
+  std::atomic<uint64_t> tail;  // Written by the flush thread
+  std::atomic<uint64_t> dropped;
+  std::atomic<const char *> thread_name;
+  int thread_id;
+  TraceRing *next;
+};
+
+std::atomic<bool> tracing_enabled(false);
+
+static std::atomic<TraceRing *> all_rings(nullptr);
+static FILE *trace_file = nullptr;
+static bool first_event = true;
+static std::thread flush_thread;
+static std::mutex flush_mutex;
+static std::condition_variable flush_condition;
+static bool stop_flushing = false;
+
+// The frame the thread works on, and its name and ring. The ring is only
+// made when the thread records its first event, so threads that name
+// themselves while tracing is off cost nothing
+static thread_local uint64_t current_frame = 0;
+static thread_local const char *current_thread_name = nullptr;
+static thread_local TraceRing *thread_ring = nullptr;
+
+static TraceRing *RegisterThread() {
+  TraceRing *ring = new TraceRing();
+  ring->head.store(0, std::memory_order_relaxed);
+  ring->tail.store(0, std::memory_order_relaxed);
+  ring->dropped.store(0, std::memory_order_relaxed);
+  ring->thread_name.store(current_thread_name, std::memory_order_relaxed);
+  ring->thread_id = (int)syscall(SYS_gettid);
+
+  TraceRing *head = all_rings.load(std::memory_order_relaxed);
+  do {
+    ring->next = head;
+  } while (!all_rings.compare_exchange_weak(head, ring,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed));
+  return ring;
+}
+
+static TraceRing *ThreadRing() {
+  if (!thread_ring) thread_ring = RegisterThread();
+  return thread_ring;
+}
+
+static void Push(const char *name, uint64_t begin_ns, uint64_t end_ns) {
+  TraceRing *ring = ThreadRing();
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+  // Never overwrite what has not been flushed, count it instead
+  if (head - ring->tail.load(std::memory_order_acquire) >= RING_CAPACITY) {
+    ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+    return;
+  }
+
+  TraceEvent &event = ring->events[head % RING_CAPACITY];
+  event.name = name;
+  event.begin_ns = begin_ns;
+  event.end_ns = end_ns;
+  event.frame_index = current_frame;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void SetTraceThreadName(const char *name) {
+  current_thread_name = name;
+  if (thread_ring)
+    thread_ring->thread_name.store(name, std::memory_order_release);
+}
+
+void SetTraceFrame(uint64_t frame_index) { current_frame = frame_index; }
+
+void RecordTraceSpan(const char *name, uint64_t begin_ns, uint64_t end_ns) {
+  if (!TracingEnabled()) return;
+  Push(name, begin_ns, end_ns);
+}
+
+void RecordTraceInstant(const char *name, uint64_t time_ns) {
+  if (!TracingEnabled()) return;
+  Push(name, time_ns, time_ns);
+}
+
+#ifdef DOA_ENABLE_TRACING
+ScopedTraceSpan::ScopedTraceSpan(const char *name)
+    : name_(name), begin_ns_(PipelineClockNs()) {}
+
+ScopedTraceSpan::~ScopedTraceSpan() {
+  RecordTraceSpan(name_, begin_ns_, PipelineClockNs());
+}
+#endif
+
+#ifdef DOA_ENABLE_TRACING
+// Writes one event as JSON, spans become complete ("X") events
+static void WriteEvent(const TraceRing *ring, const TraceEvent &event) {
+  fprintf(trace_file, "%s\n", first_event ? "" : ",");
+  first_event = false;
+
+  if (event.end_ns == event.begin_ns) {
+    fprintf(trace_file,
+            "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+            "\"pid\":%d,\"tid\":%d,\"args\":{\"frame\":%llu}}",
+            event.name, event.begin_ns / 1000.0, (int)getpid(),
+            ring->thread_id, (unsigned long long)event.frame_index);
+  } else {
+    fprintf(trace_file,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%d,\"args\":{\"frame\":%llu}}",
+            event.name, event.begin_ns / 1000.0,
+            (event.end_ns - event.begin_ns) / 1000.0, (int)getpid(),
+            ring->thread_id, (unsigned long long)event.frame_index);
+  }
+}
+
+// Moves everything recorded so far into the file
+static void FlushRings() {
+  for (TraceRing *ring = all_rings.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++)
+      WriteEvent(ring, ring->events[tail % RING_CAPACITY]);
+    ring->tail.store(tail, std::memory_order_release);
+  }
+  fflush(trace_file);
+}
+
+static void FlushThread() {
+  std::unique_lock<std::mutex> lock(flush_mutex);
+  while (!stop_flushing) {
+    flush_condition.wait_for(lock,
+                             std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+    FlushRings();
+  }
+}
+#endif
+
+bool StartTracing(const char *path) {
+#ifndef DOA_ENABLE_TRACING
+  (void)path;
+  std::cout << "Tracing is compiled out (build with -DDOA_ENABLE_TRACING)"
+            << std::endl;
+  return false;
+#else
+  if (trace_file) {
+    std::cout << "Tracing already started." << std::endl;
+    return false;
+  }
+
+  trace_file = fopen(path, "w");
+  if (!trace_file) {
+    std::cout << "Failed to open trace file " << path << std::endl;
+    return false;
+  }
+
+  // Skip whatever was recorded by an earlier session
+  for (TraceRing *ring = all_rings.load(std::memory_order_acquire); ring;
+       ring = ring->next)
+    ring->tail.store(ring->head.load(std::memory_order_acquire),
+                     std::memory_order_release);
+
+  fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  first_event = true;
+  stop_flushing = false;
+  flush_thread = std::thread(FlushThread);
+  tracing_enabled.store(true, std::memory_order_relaxed);
+
+  return true;
+#endif
+}
+
+void StopTracing() {
+  if (!trace_file) return;
+
+  tracing_enabled.store(false, std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(flush_mutex);
+    stop_flushing = true;
+  }
+  flush_condition.notify_one();
+  flush_thread.join();
+
+  // Name the threads and report what did not fit
+  for (TraceRing *ring = all_rings.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    const char *name = ring->thread_name.load(std::memory_order_acquire);
+    if (name) {
+      fprintf(trace_file,
+              "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+              "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              first_event ? "" : ",", (int)getpid(), ring->thread_id, name);
+      first_event = false;
+    }
+
+    uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+      std::cerr << "Trace ring of thread " << ring->thread_id << " dropped "
+                << dropped << " events" << std::endl;
+  }
+
+  fprintf(trace_file, "\n]}\n");
+  fclose(trace_file);
+  trace_file = nullptr;
+}
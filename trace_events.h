@@ -0,0 +1,72 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose. You are free to modify it and use it in any way you want,
+** but you have to leave this header intact.
+**
+**
+** trace_events.h
+** Records the begin and end of every pipeline stage into a preallocated
+** ring per thread. A background thread drains the rings into a Chrome
+** trace-event JSON file, which chrome://tracing or ui.perfetto.dev can open.
+**
+** Recording only happens if DOA_ENABLE_TRACING is defined and StartTracing
+** was called.
+**
+** Author: Oliver Pahl
+** -------------------------------------------------------------------------*/
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Opens the JSON file and starts the flush thread
+bool StartTracing(const char *path);
+
+// Stops recording, flushes what is left and closes the file
+void StopTracing();
+
+// Whether events are recorded right now
+extern std::atomic<bool> tracing_enabled;
+inline bool TracingEnabled() {
+  return tracing_enabled.load(std::memory_order_relaxed);
+}
+
+// Names the calling thread in the trace
+void SetTraceThreadName(const char *name);
+
+// Records a span from begin_ns to end_ns (CLOCK_MONOTONIC) on the calling
+// thread. The name has to be a string literal or otherwise live forever,
+// only the pointer is stored
+void RecordTraceSpan(const char *name, uint64_t begin_ns, uint64_t end_ns);
+
+// Records a single point in time, e.g. an overrun
+void RecordTraceInstant(const char *name, uint64_t time_ns);
+
+// The frame the calling thread works on, it is attached to every event
+void SetTraceFrame(uint64_t frame_index);
+
+#ifdef DOA_ENABLE_TRACING
+
+// Records a span from construction to destruction, e.g. a whole frame
+class ScopedTraceSpan {
+ public:
+  explicit ScopedTraceSpan(const char *name);
+  ~ScopedTraceSpan();
+
+ private:
+  const char *name_;
+  uint64_t begin_ns_;
+};
+
+#else
+
+class ScopedTraceSpan {
+ public:
+  explicit ScopedTraceSpan(const char *) {}
+};
+
+#endif  // DOA_ENABLE_TRACING
+
+#endif  // TRACE_EVENTS_H